@@ -6,11 +6,11 @@
 #define ItsMaxKeyLength_ 50
 #define ItsMaxLevel_ 5
 
-static char keyLevel[ItsMaxLevel_][ItsMaxKeyLength_], requestKeyLevel[ItsMaxLevel_][ItsMaxKeyLength_],
+static __thread char keyLevel[ItsMaxLevel_][ItsMaxKeyLength_], requestKeyLevel[ItsMaxLevel_][ItsMaxKeyLength_],
     *jsonBodyBuf;
-static uint16_t jsonBodyPtr, jsonRecordStartPtr, jsonBodyLength;
-static uint8_t level, requestLevel, requestArrayIndex[ItsMaxLevel_], arrayIndex[ItsMaxLevel_];
-static bool keysFound, isRequestArray[ItsMaxLevel_], isArray[ItsMaxLevel_], arraySpecified;
+static __thread uint16_t jsonBodyPtr, jsonRecordStartPtr, jsonBodyLength;
+static __thread uint8_t level, requestLevel, requestArrayIndex[ItsMaxLevel_], arrayIndex[ItsMaxLevel_];
+static __thread bool keysFound, isRequestArray[ItsMaxLevel_], isArray[ItsMaxLevel_], arraySpecified;
 
 static bool isPrintable(unsigned char character)
 {
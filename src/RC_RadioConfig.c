@@ -301,6 +301,8 @@ void RC_HandleVersionIndication(SYSTEM_INDICATION_STRUCT_PTR p_val)
     p_version = (uint32_t*)&p_val->payload;
     printf("Nordic version = 0x%08X\n",*p_version);
     OS_ReleaseMsgMemBlock(p_val);
+    //the indication answers RC_RequestVersion, free its window slot
+    RFO_NotifySerialResponse(MSG_TYPE_SYSTEM_INDICATION, 0, SC_RSLT_SUCCESS);
 }
 
 /*****************************************************************************//**
@@ -613,7 +615,7 @@ if ( result == 0x20) {
             break;
     }
     if (expected_msg == true) {
-        RFO_NotifySerialResponse(result);
+        RFO_NotifySerialResponse(res_type, 0, result);
         (*pCurrentCfgRec->p_callback)((void *)p_ser_msg);
     }
     OS_ReleaseMsgMemBlock((void *)p_ser_msg);
@@ -44,6 +44,7 @@ pthread_t RfOutboundTaskId;
 pthread_t RNCRFNetworkConfigTaskId;
 pthread_t NBTBootloadTaskId;
 pthread_t IPCServerTaskId;
+pthread_t IPCReportTaskId;
 
 /* Local Constants and Definitions
 *******************************************************************************/
@@ -111,6 +112,7 @@ OS_TaskSleep(1000);
 printf("RC_ResetRadio\n");
     RC_ResetRadio();
     IPCServerTaskId = OS_TaskCreate(IPC_SERVER_TASK_NUM, 0);
+    IPCReportTaskId = OS_TaskCreate(IPC_REPORT_TASK_NUM, 0);
 
 }
 
@@ -157,10 +159,10 @@ void RNC_SendNordicConfigRequest(RNC_CONFIG_REC_PTR p_cfg_rec)
 * 11/25/2014    Created.
 * 11/19/2015	Modified by Henk
 *******************************************************************************/
-extern uint16_t SC_RedundantChecksum;
 void RNC_SendShadeRequest(SHADE_COMMAND_INSTRUCTION_PTR p_cfg_rec)
 {
-    SC_RedundantChecksum = 0xffff;
+    //SC_LoadNewCommand forgets recent indications once the rnc task
+    //takes the request, before anything goes out
     OS_MessageSend(RNC_ShadeConfigRequestMbox,p_cfg_rec);
 }
 
@@ -191,7 +193,7 @@ void RNC_SendNordicConfigConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg)
 *******************************************************************************/
 void RNC_SendShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg)
 {
-    uint8_t * p_rslt_code;
+    SC_CONF_RESULT_PTR p_rslt_code;
 
     p_rslt_code = SC_ProcessShadeConfirmation(p_ser_msg);
     OS_MessageSend(RNC_ShadeSerialConfirmationMbox,p_rslt_code);
@@ -213,21 +215,19 @@ void RNC_SendShadeIndication(PARSE_KEY_STRUCT_PTR p_ser_msg)
 }
 
 /*****************************************************************************//**
-* @brief Start up the RF tick timer and enable its event.
+* @brief Start up the RF tick timer and enable its event.  The timer fires once,
+*   restarting it replaces the previous expiry.
 *
-* @param none.
+* @param msec.  Time until the tick, the end of the earliest pacing hold.
 * @return none.
 * @author Neal Shurmantine
 * @since 11/25/2014
 * @version Initial revision.
 *******************************************************************************/
-void RNC_StartTickTimer(void)
+void RNC_StartTickTimer(uint32_t msec)
 {
-    if ((RNC_ExpectedEvents & RNC_RF_TICK_EVENT) == 0)
-    {
-        OS_TimerSetCyclicInterval(RNC_RFTickTimer,SC_WAIT_RF_TICK);
-        RNC_ExpectedEvents |= RNC_RF_TICK_EVENT;
-    }
+    OS_TimerSetCyclicInterval(RNC_RFTickTimer,msec);
+    RNC_ExpectedEvents |= RNC_RF_TICK_EVENT;
 }
 
 /*****************************************************************************//**
@@ -242,24 +242,31 @@ void RNC_StartTickTimer(void)
 void RNC_StopTickTimer(void)
 {
     OS_TimerStop(RNC_RFTickTimer);
+    OS_EventClear(RNC_EventHandle,RNC_RF_TICK_EVENT);
     RNC_ExpectedEvents &= ~RNC_RF_TICK_EVENT;
 }
 
 /*****************************************************************************//**
-* @brief
+* @brief Called by rfo_outbound when a message was never confirmed by the Nordic.
+*   For shade messages a timeout result is queued as if it had come from the
+*   Nordic so the shade config list can release the record.
 *
-* @param none.
-* @return
+* @param type.  Destination of the message that timed out.
+* @param conf_type.  Confirmation type that was expected.
+* @param handle.  Tx handle of the message, shade data only.
+* @return none.
 * @author Neal Shurmantine
 * @version
 * 11/25/2014    Created.
 *******************************************************************************/
-void RNC_NotifySerialTimeout(DESTINATION_DEVICE_TYPE type)
+void RNC_NotifySerialTimeout(DESTINATION_DEVICE_TYPE type, uint8_t conf_type, uint8_t handle)
 {
     if (type == DESTINATION_SHADE) {
-        uint8_t * p_status =
-                (uint8_t *)OS_GetMsgMemBlock(sizeof(uint8_t));
-        *p_status = SC_RSLT_TIMEOUT;
+        SC_CONF_RESULT_PTR p_status =
+                (SC_CONF_RESULT_PTR)OS_GetMsgMemBlock(sizeof(SC_CONF_RESULT));
+        p_status->status = SC_RSLT_TIMEOUT;
+        p_status->conf_type = conf_type;
+        p_status->handle = handle;
         OS_MessageSend(RNC_ShadeSerialConfirmationMbox,p_status);
     }
 //FIX ME
@@ -323,15 +330,13 @@ void *rnc_rf_network_config_task(void * temp)
     RNC_SystemIndicationMbox = OS_MboxCreate(RNC_EventHandle,RNC_SYSTEM_INDICATION_EVENT);
     RNC_RFTickTimer = OS_TimerCreate(RNC_EventHandle, RNC_RF_TICK_EVENT);
 
-    OS_TimerSetCyclicInterval(RNC_RFTickTimer,RNC_TICK_INTERVAL);
-
+    //the tick timer is started by SC when a message begins its pacing hold
     RNC_ExpectedEvents = RNC_RADIO_CONFIG_REQ_EVENT
                         | RNC_SHADE_CONFIG_REQ_EVENT
                         | RNC_RADIO_SERIAL_CONF_EVENT
                         | RNC_SHADE_SERIAL_CONF_EVENT
                         | RNC_SHADE_INDICATION_EVENT
                         | RNC_SYSTEM_INDICATION_EVENT
-                        | RNC_RF_TICK_EVENT
                         | RNC_DISCOVERY_PROCESS_EVENT;
 printf("rnc_rf_network_config_task\n");
     while(1) {
@@ -368,7 +373,6 @@ printf("rnc_rf_network_config_task\n");
         if (event_active & RNC_RF_TICK_EVENT)
         {
             OS_EventClear(RNC_EventHandle,RNC_RF_TICK_EVENT);
-            OS_TimerSetCyclicInterval(RNC_RFTickTimer,RNC_TICK_INTERVAL);
             RNC_process_timeout();
 //printf("tick\n");
         }
@@ -442,7 +446,7 @@ static void RNC_process_radio_serial_confirmation(void)
 *******************************************************************************/
 static void RNC_process_shade_serial_confirmation(void)
 {
-    uint8_t * p_ser_stat = (uint8_t *)OS_MessageGet(RNC_ShadeSerialConfirmationMbox);
+    SC_CONF_RESULT_PTR p_ser_stat = (SC_CONF_RESULT_PTR)OS_MessageGet(RNC_ShadeSerialConfirmationMbox);
     SC_HandleShadeConfirmationResult(p_ser_stat);
 }
 
@@ -629,6 +633,35 @@ void RNC_AddTransportLayer(uint8_t * p_msg_send, uint8_t * p_msg_raw)
 //p_msg_send = {7E 14 0C 01 01 84 18 00 00 00 00 00 00 01 01 3F 5A 04 40 50 D5 5F 0D}
 //checksum = SUM{0C 01 ... D5 5F}
 }
+
+/*****************************************************************************//**
+* @brief Read back one byte of the raw message from a message built by
+*   RNC_AddTransportLayer, undoing any escape.
+*
+* @param p_msg_send.  Message with the transport layer added.
+* @param index.  Position of the byte in the raw message, 1 is the request type.
+*   The raw length byte (0) can't be recovered since escapes change it.
+* @return the byte, 0 if index is past the end of the message.
+*******************************************************************************/
+uint8_t RNC_GetTransportByte(uint8_t * p_msg_send, uint8_t index)
+{
+    uint8_t *p_source = &p_msg_send[2];
+    uint8_t *p_end = &p_msg_send[2 + p_msg_send[1]];
+    uint8_t raw_index = 1;
+    uint8_t val;
+
+    while (p_source < p_end) {
+        val = *p_source++;
+        if ((val == ESCAPE_TOKEN) && (p_source < p_end)) {
+            val = *p_source++ | 0x40;
+        }
+        if (raw_index == index) {
+            return val;
+        }
+        ++raw_index;
+    }
+    return 0;
+}
 //-----------------------------------------------------------------------------
 
 // marker 05/02/2016 - new
@@ -1,13 +1,24 @@
 /***************************************************************************//**
  * @file   SCH_ScheduleTask.c
  * @brief  This task allows events to be scheduled for execution. 
- * Scheduled events exist in a linked list.  The scheduler searches thru the 
- * linked list at 1 second increments and executes the entry's callback 
- * function when its time matches the current time. The entry is 
- * removed from the list.
+ * Scheduled events are kept in a binary min-heap ordered by the uptime
+ * (CLOCK_MONOTONIC) they are due at.  The task sleeps until the earliest
+ * one is due, executes the entry's callback function and removes it, so
+ * events that are not due cost nothing.  Daily events are due at a local
+ * time; their place in the heap is worked out again when the clock is set.
+ * Events other than scenes are also found by token in a handle table so
+ * they can be removed without a search.  A token is a slot number in the
+ * table plus the slot's generation, which changes each time the slot is
+ * freed, so a token kept after its event fired or was removed never finds
+ * whatever event has the slot now.  The slot is reserved when the token is
+ * handed out, before the request reaches this task, so a removal that
+ * overtakes its request still cancels the event.
  *
  * For scenes, the callback function executes the scene and reloads
- * itself in the scheduled events.
+ * itself in the scheduled events.  When the scene schedule or the day
+ * changes, the stored list is matched against the scene events already in
+ * the heap by id and a hash of the record, and only what differs is added,
+ * moved or removed.
  * 
  * This task also is responsible for setting the system time.
  *
@@ -24,7 +35,7 @@
 
 /* Includes
 *******************************************************************************/
-#define _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -40,6 +51,7 @@
 #include "LOG_DataLogger.h"
 #include "stub.h"
 #include "RMT_RemoteServers.h"
+#include "eph_ephemeris.h"
 
 #ifdef USE_ME
 #include <mutex.h>
@@ -70,7 +82,6 @@ extern uint16_t sunriseTimeInMinutes, sunsetTimeInMinutes;
 
 /* Local Constants and Definitions
 *******************************************************************************/
-#define SCH_TICK_EVENT                          BIT0
 #define SCH_NEW_SCHEDULE_EVENT                  BIT1
 #define SCH_MODIFY_SCHEDULED_SCENES_EVENT       BIT2
 #define SCH_TIME_CHANGE_EVENT                   BIT3
@@ -78,7 +89,6 @@ extern uint16_t sunriseTimeInMinutes, sunsetTimeInMinutes;
 
 #define SCH_DEBUG_REQ_DAILY_LIST                BIT5
 
-#define SCH_TICK_INTERVAL                       1000
 #define SCH_SIGNIFICANT_TIME_CHANGE  60
 #define SCH_NO_TIME                             0xffffffff
 #ifdef ENABLE_DEBUG
@@ -96,8 +106,9 @@ typedef struct SCH_EVENT_STRUCT_TAG
     int32_t count_down;
     DAY_STRUCT day;
     void(*p_callback)(uint16_t);
-    struct SCH_EVENT_STRUCT_TAG *p_next;
-    struct SCH_EVENT_STRUCT_TAG *p_previous;
+    uint64_t due_msec;          //uptime the event is due at, the heap key
+    uint16_t heap_index;        //position in SCH_Heap
+    uint32_t scene_hash;        //SCH_scene_hash of the record a scene came from
 } SCH_EVENT_STRUCT, *SCH_EVENT_STRUCT_PTR;
 
 typedef struct SCH_EVENT_REQUEST_TAG
@@ -111,6 +122,36 @@ typedef struct SCH_EVENT_REQUEST_TAG
 } SCH_EVENT_REQUEST, *SCH_EVENT_REQUEST_PTR;
 
 #define SCH_WATCHDOG_INTERVAL                       (20*SEC_IN_MS)
+//longest the task sleeps, so the watchdog is always fed in time
+#define SCH_MAX_WAIT_MSEC                           (SCH_WATCHDOG_INTERVAL / 2)
+#define SCH_HEAP_INITIAL_SIZE                       32
+//kept under the watchdog interval, the task retries if the flash is busy
+#define SCH_FLASH_LOCK_WAIT_MSEC                    (5*SEC_IN_MS)
+#define SCH_SCENE_RETRY_SECONDS                     60
+
+//token = (generation << SCH_HANDLE_SLOT_BITS) | slot, generation never 0
+//so no token is NULL_TOKEN
+#define SCH_HANDLE_SLOT_BITS                        8
+#define SCH_HANDLE_SLOTS                            (1 << SCH_HANDLE_SLOT_BITS)
+#define SCH_HANDLE_SLOT(token)                      ((token) & (SCH_HANDLE_SLOTS - 1))
+#define SCH_HANDLE_GENERATION(token)                ((token) >> SCH_HANDLE_SLOT_BITS)
+#define SCH_HANDLE_NONE                             0xffff
+
+typedef enum
+{
+    SCH_HANDLE_FREE,
+    SCH_HANDLE_RESERVED,        //token handed out, request not yet in the heap
+    SCH_HANDLE_LIVE,            //event is in the heap
+    SCH_HANDLE_CANCELLED        //removed while still reserved, drop the request
+} SCH_HANDLE_STATE;
+
+typedef struct SCH_HANDLE_TAG
+{
+    SCH_EVENT_STRUCT_PTR p_event;
+    uint16_t next_free;
+    uint8_t generation;
+    uint8_t state;
+} SCH_HANDLE;
 
 /* Local Function Declarations
 *******************************************************************************/
@@ -120,12 +161,25 @@ static void SCH_handle_new_schedule_request(void);
 static void SCH_new_time_set(time_t * p_new_time);
 static uint16_t SCH_send_new_schedule_event(SCH_EVENT_REQUEST_PTR p_req, 
                                     void(*p_callback)(uint16_t));
-static void SCH_monitor_schedule_list(void);
+static void SCH_run_due_events(void);
+static uint32_t SCH_msec_until_next_event(void);
+static uint64_t SCH_uptime_msec(void);
+static void SCH_set_due(SCH_EVENT_STRUCT_PTR p_rec, time_t now, uint64_t uptime);
+static void SCH_insert_event(SCH_EVENT_STRUCT_PTR p_rec);
+static void SCH_unlink_event(SCH_EVENT_STRUCT_PTR p_rec);
+static void SCH_heap_place(SCH_EVENT_STRUCT_PTR p_rec, uint16_t index);
+static void SCH_heap_sift_up(uint16_t index);
+static void SCH_heap_sift_down(uint16_t index);
+static void SCH_heap_rebuild(void);
 static void SCH_refresh_scene_events(void);
+static uint16_t SCH_collect_scene_events(SCH_EVENT_STRUCT_PTR ** p_list);
+static void SCH_add_scene_event(strScheduledEvent * p_sched, time_t when);
+static void SCH_move_event(SCH_EVENT_STRUCT_PTR p_rec, time_t when);
+static uint32_t SCH_scene_hash(strScheduledEvent * p_sched);
+static int SCH_compare_schedule_id(const void * p_a, const void * p_b);
+static int SCH_compare_event_id(const void * p_a, const void * p_b);
 static strScheduledEvent * SCH_find_scheduled_event_data(uint16_t event_id);
-static void SCH_remove_all_scene_events(void);
 static void SCH_remove_event(SCH_EVENT_STRUCT_PTR p_rec);
-static void SCH_add_record_to_list(SCH_EVENT_STRUCT_PTR p_event_rec);
 static bool SCH_compute_scene_event(strScheduledEvent *sched_event, time_t * p_when);
 static void SCH_execute_scene_now(uint16_t event_id);
 static bool SCH_is_happening_today(DAY_STRUCT_PTR p_day, time_t * p_when);
@@ -136,10 +190,13 @@ static bool SCH_is_event_enabled_today(strScheduledEvent *p_event);
 static void SCH_handle_midnight(uint16_t unused);
 static void SCH_schedule_midnight(void);
 static void SCH_remove_event_at_token(uint16_t token);
+static uint16_t SCH_handle_reserve(void);
+static bool SCH_handle_attach(SCH_EVENT_STRUCT_PTR p_rec);
+static void SCH_handle_free(uint16_t token);
 static void SCH_handle_remove_event_at_token(void);
 static void SCH_debug_handle_event_request(void);
 static void SCH_re_schedule_midnight(void);
-static void SCH_schedule_scene_refresh(bool remove, uint32_t countdown);
+static void SCH_schedule_scene_refresh(bool recompute, uint32_t countdown);
 static bool SCH_is_time_change_significant(void);
 static void SCH_commit_to_flash_if_necessary(void);
 
@@ -148,19 +205,34 @@ static void SCH_commit_to_flash_if_necessary(void);
 static uint16_t SCH_NewScheduleMbox;
 static uint16_t SCH_RemoveEventMbox;
 static uint32_t SCH_WaitTime;
-static uint16_t SCH_TickTimer;
 static uint16_t SCH_ExpectedEvents;
 static void *SCH_EventHandle;
 static uint16_t SCH_MidnightHandle;
 static uint16_t SCH_RefreshHandle=NULL_TOKEN;
-static uint16_t SCH_TokenCounter = 1;
-static SCH_EVENT_STRUCT_PTR p_HeadEvent;
-static SCH_EVENT_STRUCT_PTR p_TailEvent;
+/** Min-heap of pending events, earliest due_msec at index 0. */
+static SCH_EVENT_STRUCT_PTR * SCH_Heap;
+static uint16_t SCH_HeapCount;
+static uint16_t SCH_HeapSize;
+/** Events other than scenes, by token.  Tokens are reserved in the
+    caller's context so the table is under a mutex. */
+static SCH_HANDLE SCH_Handles[SCH_HANDLE_SLOTS];
+static uint16_t SCH_HandleFree = SCH_HANDLE_NONE;
+static bool SCH_HandlesReady = false;
+static pthread_mutex_t SCH_HandleMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t SCH_StaleTokenCount;
+static uint32_t SCH_CancelledCount;
 static bool sunrise_sunset_found;
 static int32_t SCH_TimeZoneOffset;
 static bool SCH_IsTimeSet;
+/** Stored scene schedule, sorted by uID, that the scene events came from. */
 static ALL_RAW_DB_STR_PTR SCH_pScheduleEventList = NULL;
-static uint32_t SCH_HTTPActiveCount = SCH_HTTP_ACTIVE_MAX_COUNT;
+/** The day or clock changed so every scene time must be worked out again,
+    not just those whose record changed. */
+static bool SCH_SceneRecomputeAll = true;
+static uint32_t SCH_SceneRefreshMsec;
+static uint32_t SCH_SceneRefreshMaxMsec;
+static bool SCH_HTTPSeen = false;
+static uint64_t SCH_HTTPActiveMsec;
 static bool SCH_AppTimeChange;
 static time_t SCH_OldTime;
 static time_t SCH_NewTime;
@@ -223,8 +295,7 @@ void SCH_ScheduleTaskTest(void)
 *******************************************************************************/
 void SCH_ScheduleTaskInit(void)
 {
-    p_HeadEvent = NULL;
-    p_TailEvent = NULL;
+    SCH_HeapCount = 0;
     SCH_ScheduleTaskId = OS_TaskCreate(SCH_SCHEDULE_TASK_NUM, 0);
     SCH_set_default_time();
     if (IO_IsSelfTestActive() == false) {
@@ -466,7 +537,8 @@ void SCH_new_time_set(time_t * p_new_time)
 * Note: This function runs in the context of the calling task.
 * @param sec Number of seconds from now before the callback function is executed.
 * @param p_callback is a pointer to a function that is called when event occurs.
-* @return uint16_t event_id that will be passed as a parameter to the callback function.
+* @return uint16_t event_id that will be passed as a parameter to the callback function,
+*   NULL_TOKEN if every handle is in use.
 * @author Neal Shurmantine
 * @version
 * 03/04/2015    Created.
@@ -487,7 +559,8 @@ uint16_t SCH_ScheduleEventPostSeconds(uint32_t sec, void(*p_callback)(uint16_t))
 * Note: This function runs in the context of the calling task.
 * @param p_day, pointer to a DAY_STRUCT (time of day for event to occur).
 * @param p_callback is a pointer to a function that is called when event occurs.
-* @return uint16_t event_id that will be passed as a parameter to the callback function.
+* @return uint16_t event_id that will be passed as a parameter to the callback function,
+*   NULL_TOKEN if every handle is in use.
 * @author Neal Shurmantine
 * @version
 * 03/04/2015    Created.
@@ -507,7 +580,8 @@ uint16_t SCH_ScheduleDaily(DAY_STRUCT_PTR p_day, void(*p_callback)(uint16_t))
 *
 * @param p_req, pointer to SCH_EVENT_REQUEST.
 * @param p_callback is a pointer to a function that is called when event occurs.
-* @return uint16_t event_id that will be passed as a parameter to the callback function.
+* @return uint16_t event_id that will be passed as a parameter to the callback function,
+*   NULL_TOKEN (and p_req is released) if every handle is in use.
 * @author Neal Shurmantine
 * @version
 * 06/04/2015    Created.
@@ -515,12 +589,12 @@ uint16_t SCH_ScheduleDaily(DAY_STRUCT_PTR p_day, void(*p_callback)(uint16_t))
 static uint16_t SCH_send_new_schedule_event(SCH_EVENT_REQUEST_PTR p_req, 
                                     void(*p_callback)(uint16_t))
 {
-    OS_SchedLock();
-    p_req->event_id = SCH_TokenCounter++;
-    if (SCH_TokenCounter == NULL_TOKEN) {
-        SCH_TokenCounter = 1;
+    p_req->event_id = SCH_handle_reserve();
+    if (p_req->event_id == NULL_TOKEN) {
+        printf("SCH: no free handle, event not scheduled\n");
+        OS_ReleaseMsgMemBlock((uint8_t *)p_req);
+        return NULL_TOKEN;
     }
-    OS_SchedUnlock();
     p_req->p_callback = p_callback;
     uint16_t id = p_req->event_id;
     OS_MessageSend(SCH_NewScheduleMbox,p_req);
@@ -559,7 +633,8 @@ void SCH_DebugRequestScheduleList(void)
 
 /*****************************************************************************//**
 * @brief This function is called to remove an event, identified by the token,
-*  for the scheduled events list.
+*  for the scheduled events list.  A token whose event already ran or was
+*  removed is ignored, as is NULL_TOKEN.
 *
 * Note: This function runs in the context of the calling task.
 * @param token.
@@ -570,6 +645,9 @@ void SCH_DebugRequestScheduleList(void)
 *******************************************************************************/
 void SCH_RemoveScheduledEvent(uint16_t token)
 {
+    if (token == NULL_TOKEN) {
+        return;
+    }
     uint16_t * p_event_token = (uint16_t*)OS_GetMsgMemBlock(sizeof(uint16_t));
     *p_event_token = token;
     OS_MessageSend(SCH_RemoveEventMbox,p_event_token);
@@ -645,16 +723,16 @@ bool SCH_IsHTTPActive(void)
 {
     bool rtn;
     OS_SchedLock();
-    if (SCH_HTTPActiveCount==SCH_HTTP_ACTIVE_MAX_COUNT) rtn = false;
-    else rtn = true;
+    if (SCH_HTTPSeen == false) rtn = false;
+    else rtn = ((SCH_uptime_msec() - SCH_HTTPActiveMsec) < (SCH_HTTP_ACTIVE_MAX_COUNT * SEC_IN_MS));
     OS_SchedUnlock();
     return rtn;
 }
 
 /*****************************************************************************//**
 * @brief This function is called each time there is a REST request from the
-*    app.  It resets a one second counter that is used to block out remote
-*    server requests and scene rescheduling.
+*    app.  It notes the time, which is used to block out remote server
+*    requests and scene rescheduling.
 *
 * Note: This function runs in the context of another task.
 * @param none.
@@ -666,7 +744,8 @@ bool SCH_IsHTTPActive(void)
 void SCH_ResetHTTPActiveCount(void)
 {
     OS_SchedLock();
-    SCH_HTTPActiveCount = 0;
+    SCH_HTTPActiveMsec = SCH_uptime_msec();
+    SCH_HTTPSeen = true;
     OS_SchedUnlock();
 }
 
@@ -705,18 +784,17 @@ void *SCH_schedule_task(void *Temp)
     uint16_t event_active;
     
     //the task will wake up on this timeout if no events have occurred.
-    SCH_WaitTime = WAIT_TIME_INFINITE;
+    SCH_WaitTime = SCH_MAX_WAIT_MSEC;
 
-    //create the event for this task plus mailboxes and timer
+    //create the event for this task plus mailboxes
     SCH_EventHandle = OS_EventCreate(0,false);
-    SCH_TickTimer = OS_TimerCreate(SCH_EventHandle, SCH_TICK_EVENT);
     SCH_NewScheduleMbox = OS_MboxCreate(SCH_EventHandle,SCH_NEW_SCHEDULE_EVENT); 
     SCH_RemoveEventMbox = OS_MboxCreate(SCH_EventHandle,SCH_REMOVE_SCHEDULED_EVENT); 
 
-    OS_TimerSetCyclicInterval(SCH_TickTimer,SCH_TICK_INTERVAL);
+    SCH_HeapSize = SCH_HEAP_INITIAL_SIZE;
+    SCH_Heap = (SCH_EVENT_STRUCT_PTR *)OS_GetMemBlock(SCH_HeapSize * sizeof(SCH_EVENT_STRUCT_PTR));
 
-    SCH_ExpectedEvents = SCH_TICK_EVENT
-                 | SCH_NEW_SCHEDULE_EVENT
+    SCH_ExpectedEvents = SCH_NEW_SCHEDULE_EVENT
                  | SCH_MODIFY_SCHEDULED_SCENES_EVENT
                  | SCH_TIME_CHANGE_EVENT
                  | SCH_REMOVE_SCHEDULED_EVENT
@@ -738,22 +816,16 @@ printf("SCH_schedule_task\n");
         }
         if (event_active & SCH_MODIFY_SCHEDULED_SCENES_EVENT) {
             OS_EventClear(SCH_EventHandle,SCH_MODIFY_SCHEDULED_SCENES_EVENT);
-            SCH_schedule_scene_refresh(true,SCH_HTTP_ACTIVE_MAX_COUNT);
+            SCH_schedule_scene_refresh(false,SCH_HTTP_ACTIVE_MAX_COUNT);
         }
         if (event_active & SCH_DEBUG_REQ_DAILY_LIST) {
             OS_EventClear(SCH_EventHandle, SCH_DEBUG_REQ_DAILY_LIST);
             SCH_debug_handle_event_request();
         }
-        if (event_active & SCH_TICK_EVENT)
-        {
-            OS_EventClear(SCH_EventHandle,SCH_TICK_EVENT);
-            if (SCH_HTTPActiveCount < SCH_HTTP_ACTIVE_MAX_COUNT) {
-                ++SCH_HTTPActiveCount;
-            }
-            SCH_monitor_schedule_list();
-            _watchdog_start(SCH_WATCHDOG_INTERVAL);
-            OS_TimerSetCyclicInterval(SCH_TickTimer,SCH_TICK_INTERVAL);
-        }
+        //woken by a request or a deadline, either way run what is due
+        SCH_run_due_events();
+        _watchdog_start(SCH_WATCHDOG_INTERVAL);
+        SCH_WaitTime = SCH_msec_until_next_event();
     }
 }
 
@@ -769,10 +841,14 @@ printf("SCH_schedule_task\n");
 *******************************************************************************/
 static void SCH_debug_handle_event_request(void)
 {
-    SCH_EVENT_STRUCT_PTR p_event_rec = p_HeadEvent;
+    SCH_EVENT_STRUCT_PTR p_event_rec;
+    uint64_t uptime = SCH_uptime_msec();
     struct tm date;
+    uint16_t n;
 
-    while(p_event_rec != NULL) {
+    //heap order, the first is the next due
+    for (n = 0; n < SCH_HeapCount; ++n) {
+        p_event_rec = SCH_Heap[n];
         if (p_event_rec->isDailyEvent == true) {
             localtime_r(&p_event_rec->time,&date);
             if (p_event_rec->isSceneEvent == true) {
@@ -784,10 +860,14 @@ static void SCH_debug_handle_event_request(void)
             printf("%02d:%02d:%02d\n",date.tm_hour,date.tm_min,date.tm_sec);
         }
         else {
-            printf("Count down %d sec\n",p_event_rec->count_down);
+            printf("Count down %d sec\n",
+                    (p_event_rec->due_msec > uptime) ? (int32_t)((p_event_rec->due_msec - uptime) / SEC_IN_MS) : 0);
         }
-        p_event_rec = p_event_rec->p_next;
     }
+    printf("Stale tokens %u, cancelled before scheduled %u\n",
+            (unsigned int)SCH_StaleTokenCount, (unsigned int)SCH_CancelledCount);
+    printf("Scene refresh last %u ms, max %u ms\n",
+            (unsigned int)SCH_SceneRefreshMsec, (unsigned int)SCH_SceneRefreshMaxMsec);
 }
 
 /*****************************************************************************//**
@@ -802,15 +882,113 @@ static void SCH_debug_handle_event_request(void)
 *******************************************************************************/
 static void SCH_remove_event_at_token(uint16_t token)
 {
-    SCH_EVENT_STRUCT_PTR p_event_rec = p_HeadEvent;
-    while(p_event_rec != NULL) {
-        if ((p_event_rec->isSceneEvent == false) &&
-                (p_event_rec->event_id == token) ) {
-            SCH_remove_event(p_event_rec);
-            break;
+    SCH_HANDLE * p_handle = &SCH_Handles[SCH_HANDLE_SLOT(token)];
+    SCH_EVENT_STRUCT_PTR p_event_rec = NULL;
+
+    if (token == NULL_TOKEN) {
+        return;
+    }
+    pthread_mutex_lock(&SCH_HandleMutex);
+    if (p_handle->generation != SCH_HANDLE_GENERATION(token)) {
+        //fired or removed already, the slot may belong to another event now
+        ++SCH_StaleTokenCount;
+    }
+    else if (p_handle->state == SCH_HANDLE_LIVE) {
+        p_event_rec = p_handle->p_event;
+    }
+    else if (p_handle->state == SCH_HANDLE_RESERVED) {
+        //the request is still in the mailbox, drop it when it arrives
+        p_handle->state = SCH_HANDLE_CANCELLED;
+        ++SCH_CancelledCount;
+    }
+    pthread_mutex_unlock(&SCH_HandleMutex);
+
+    if (p_event_rec != NULL) {
+        SCH_remove_event(p_event_rec);
+    }
+}
+
+/*****************************************************************************//**
+* @brief Reserve a handle for an event that is about to be scheduled.
+*
+* Note: This function may run in the context of another task.
+* @param none.
+* @return uint16_t. Token for the handle, NULL_TOKEN if all are in use.
+*******************************************************************************/
+static uint16_t SCH_handle_reserve(void)
+{
+    SCH_HANDLE * p_handle;
+    uint16_t token = NULL_TOKEN;
+    uint16_t slot;
+
+    pthread_mutex_lock(&SCH_HandleMutex);
+    if (SCH_HandlesReady == false) {
+        for (slot = 0; slot < SCH_HANDLE_SLOTS; ++slot) {
+            SCH_Handles[slot].generation = 1;
+            SCH_Handles[slot].state = SCH_HANDLE_FREE;
+            SCH_Handles[slot].next_free = (slot + 1 < SCH_HANDLE_SLOTS) ? slot + 1 : SCH_HANDLE_NONE;
         }
-        p_event_rec = p_event_rec->p_next;
+        SCH_HandleFree = 0;
+        SCH_HandlesReady = true;
+    }
+    slot = SCH_HandleFree;
+    if (slot != SCH_HANDLE_NONE) {
+        p_handle = &SCH_Handles[slot];
+        SCH_HandleFree = p_handle->next_free;
+        p_handle->state = SCH_HANDLE_RESERVED;
+        p_handle->p_event = NULL;
+        token = (uint16_t)((p_handle->generation << SCH_HANDLE_SLOT_BITS) | slot);
+    }
+    pthread_mutex_unlock(&SCH_HandleMutex);
+    return token;
+}
+
+/*****************************************************************************//**
+* @brief Point an event's reserved handle at the event.
+*
+* @param p_rec. Pointer to the event record, its event_id is the token.
+* @return bool. False if the event was removed before it got here, in which
+*   case the handle is freed and the event must be dropped.
+*******************************************************************************/
+static bool SCH_handle_attach(SCH_EVENT_STRUCT_PTR p_rec)
+{
+    SCH_HANDLE * p_handle = &SCH_Handles[SCH_HANDLE_SLOT(p_rec->event_id)];
+    bool attached = false;
+
+    pthread_mutex_lock(&SCH_HandleMutex);
+    if (p_handle->state == SCH_HANDLE_RESERVED) {
+        p_handle->state = SCH_HANDLE_LIVE;
+        p_handle->p_event = p_rec;
+        attached = true;
+    }
+    pthread_mutex_unlock(&SCH_HandleMutex);
+    if (attached == false) {
+        SCH_handle_free(p_rec->event_id);
+    }
+    return attached;
+}
+
+/*****************************************************************************//**
+* @brief Return a handle to the free list.  Its generation moves on so the
+*   old token no longer matches.
+*
+* @param token. Token of the handle.
+* @return nothing.
+*******************************************************************************/
+static void SCH_handle_free(uint16_t token)
+{
+    uint16_t slot = SCH_HANDLE_SLOT(token);
+    SCH_HANDLE * p_handle = &SCH_Handles[slot];
+
+    pthread_mutex_lock(&SCH_HandleMutex);
+    if (++p_handle->generation == 0) {
+        p_handle->generation = 1;
     }
+    p_handle->state = SCH_HANDLE_FREE;
+    p_handle->p_event = NULL;
+    p_handle->next_free = SCH_HandleFree;
+    SCH_HandleFree = slot;
+    pthread_mutex_unlock(&SCH_HandleMutex);
 }
 
 /*****************************************************************************//**
@@ -846,23 +1024,23 @@ static void SCH_re_schedule_midnight(void)
 
     //get memory for a new record (freed when alarm occurs)
     p_event_rec = (SCH_EVENT_STRUCT_PTR)OS_GetMemBlock(sizeof(SCH_EVENT_STRUCT));
-    SCH_add_record_to_list(p_event_rec);
 
     p_event_rec->p_callback = SCH_handle_midnight;
     p_event_rec->isSceneEvent = false;
     p_event_rec->isDailyEvent = true;
 
-    OS_SchedLock();
-    p_event_rec->event_id = SCH_TokenCounter++;
-    if (SCH_TokenCounter == NULL_TOKEN) {
-        SCH_TokenCounter = 1;
-    }
-    OS_SchedUnlock();
+    p_event_rec->event_id = SCH_handle_reserve();
     SCH_MidnightHandle = p_event_rec->event_id;
+    if (p_event_rec->event_id == NULL_TOKEN) {
+        printf("SCH: no free handle for midnight\n");
+        OS_ReleaseMemBlock((uint8_t *)p_event_rec);
+        return;
+    }
     p_event_rec->day.hour = 0;
     p_event_rec->day.minute = 0;
     p_event_rec->day.second = 0;
     SCH_is_happening_today(&p_event_rec->day, &p_event_rec->time);
+    SCH_insert_event(p_event_rec);
 }
 
 /*****************************************************************************//**
@@ -973,7 +1151,7 @@ void reset_task(uint32_t temp)
 static void SCH_handle_scene_refresh_expire(uint16_t unused)
 {
     SCH_RefreshHandle = NULL_TOKEN;
-    if (SCH_HTTPActiveCount < SCH_HTTP_ACTIVE_MAX_COUNT) {
+    if (SCH_IsHTTPActive() == true) {
         SCH_schedule_scene_refresh(false,10);
     }
     else {
@@ -983,19 +1161,21 @@ static void SCH_handle_scene_refresh_expire(uint16_t unused)
 
 /*****************************************************************************//**
 * @brief This task is used to schedule an event that will refresh the scheduled
-*      scenes.  
+*      scenes.  The scenes already scheduled stay in place until then.
 *
-* @param remove.  Boolean that, if true, removes all currently scheduled scenes.
+* @param recompute.  Boolean that, if true, has the refresh work out the time
+*      of every scene again, not only those whose record changed.
+* @param countdown.  Seconds until the refresh.
 * @return nothing.
 
 * @author Neal Shurmantine
 * @version
 * 08/06/2015    Created.
 *******************************************************************************/
-static void SCH_schedule_scene_refresh(bool remove, uint32_t countdown)
+static void SCH_schedule_scene_refresh(bool recompute, uint32_t countdown)
 {
-    if (remove == true) {
-        SCH_remove_all_scene_events();
+    if (recompute == true) {
+        SCH_SceneRecomputeAll = true;
     }
     if (SCH_RefreshHandle != NULL_TOKEN) {
         SCH_remove_event_at_token(SCH_RefreshHandle);
@@ -1021,6 +1201,8 @@ static void SCH_schedule_scene_refresh(bool remove, uint32_t countdown)
 static void SCH_handle_time_change(void)
 {
     static bool sunrise_sunset_prog = false;
+    //the year, or with a time server answer the location, may have changed
+    EPH_Invalidate();
     if ((SCH_is_time_change_significant() == true) || (sunrise_sunset_prog == false) ) {
         if (SCH_AppTimeChange == true) {
             SCH_schedule_scene_refresh(true,SCH_HTTP_ACTIVE_MAX_COUNT);
@@ -1039,15 +1221,22 @@ static void SCH_handle_time_change(void)
 //        AWS_BeginConnection();
         SCH_IsTimeSet = true;
     }
-    SCH_EVENT_STRUCT_PTR p_event_rec = p_HeadEvent;
-    while(p_event_rec != NULL) {
-        if (p_event_rec->isSceneEvent == false) {
-            if (p_event_rec->isDailyEvent == true) {
+    SCH_EVENT_STRUCT_PTR p_event_rec;
+    time_t now;
+    uint64_t uptime = SCH_uptime_msec();
+    uint16_t n;
+    OS_GetTimeLocal(&now);
+    //daily events are due at a local time, so their places in the heap change
+    for (n = 0; n < SCH_HeapCount; ++n) {
+        p_event_rec = SCH_Heap[n];
+        if (p_event_rec->isDailyEvent == true) {
+            if (p_event_rec->isSceneEvent == false) {
                 SCH_is_happening_today(&p_event_rec->day, &p_event_rec->time);
             }
+            SCH_set_due(p_event_rec, now, uptime);
         }
-        p_event_rec = p_event_rec->p_next;
     }
+    SCH_heap_rebuild();
     SCH_remove_event_at_token(SCH_MidnightHandle);
     SCH_re_schedule_midnight();
 }                 
@@ -1080,7 +1269,7 @@ static bool SCH_is_time_change_significant(void)
 }
 
 /*****************************************************************************//**
-* @brief Put new scheduled event in the linked list of scheduled events.
+* @brief Put new scheduled event in the heap of scheduled events.
 *
 * @param none. New event request is in the mailbox.
 * @return nothing.
@@ -1095,7 +1284,6 @@ static void SCH_handle_new_schedule_request(void)
 
     //get memory for a new record (freed when alarm occurs)
     p_event_rec = (SCH_EVENT_STRUCT_PTR)OS_GetMemBlock(sizeof(SCH_EVENT_STRUCT));
-    SCH_add_record_to_list(p_event_rec);
     p_event_rec->p_callback = p_req->p_callback;
     p_event_rec->isSceneEvent = p_req->isSceneEvent;
     p_event_rec->isDailyEvent = p_req->isDailyEvent;
@@ -1105,157 +1293,262 @@ static void SCH_handle_new_schedule_request(void)
         memcpy(&p_event_rec->day, &p_req->day,sizeof(DAY_STRUCT));
         SCH_is_happening_today(&p_req->day, &p_event_rec->time);
     }
+    SCH_insert_event(p_event_rec);
     OS_ReleaseMsgMemBlock((uint8_t *)p_req);
 }
 
 /*****************************************************************************//**
-* @brief Adds a new event record to the linked list by modifying the next 
-*   and previous pointers in its record and modifying those pointers
-*   in adjacent records as needed.
+* @brief Add an event record to the heap, and attach it to its handle unless
+*   it is a scene.  Its time, or count down, must be filled in.  An event
+*   whose token was removed while the request was on its way is released
+*   instead.
 *
-* @param p_event_rec. Pointer to new event record to be added.
+* @param p_rec. Pointer to new event record to be added.
 * @return nothing.
-* @author Neal Shurmantine
-* @version
-* 04/18/2015    Created.
 *******************************************************************************/
-static void SCH_add_record_to_list(SCH_EVENT_STRUCT_PTR p_event_rec)
+static void SCH_insert_event(SCH_EVENT_STRUCT_PTR p_rec)
 {
-    SCH_EVENT_STRUCT_PTR p_last_rec;
-    //if no records in the list
-    if (p_HeadEvent == NULL)
-    {
-        //create list with this record only
-        p_HeadEvent = p_event_rec;
-        p_TailEvent = p_event_rec;
-        p_event_rec->p_next = NULL;
-        p_event_rec->p_previous = NULL;
+    SCH_EVENT_STRUCT_PTR * p_grown;
+    time_t now;
+
+    if ((p_rec->isSceneEvent == false) && (SCH_handle_attach(p_rec) == false)) {
+        OS_ReleaseMemBlock((uint8_t *)p_rec);
+        return;
     }
-    else
-    {
-        //add this record to the end of the list
-        p_last_rec = p_TailEvent;
-        p_last_rec->p_next = p_event_rec;
-        p_event_rec->p_previous = p_last_rec;
-        p_TailEvent = p_event_rec;
-        p_event_rec->p_next = NULL;
-    }
-    p_event_rec->p_next = NULL;
+    if (SCH_HeapCount == SCH_HeapSize) {
+        p_grown = (SCH_EVENT_STRUCT_PTR *)OS_GetMemBlock(2 * SCH_HeapSize * sizeof(SCH_EVENT_STRUCT_PTR));
+        memcpy(p_grown, SCH_Heap, SCH_HeapSize * sizeof(SCH_EVENT_STRUCT_PTR));
+        OS_ReleaseMemBlock((void *)SCH_Heap);
+        SCH_Heap = p_grown;
+        SCH_HeapSize *= 2;
+    }
+    OS_GetTimeLocal(&now);
+    SCH_set_due(p_rec, now, SCH_uptime_msec());
+    SCH_heap_place(p_rec, SCH_HeapCount++);
+    SCH_heap_sift_up(p_rec->heap_index);
 }
 
 /*****************************************************************************//**
-* @brief Go through schedule list, looking for any expired alarms. If an alarm is
-*        expired then execute its callback function and remove from list.
+* @brief Work out the uptime an event is due at, from its local time if it is
+*   a daily event, otherwise from its count down.
+*
+* @param p_rec. Pointer to event record.
+* @param now. Local time.
+* @param uptime. SCH_uptime_msec at the same moment.
+* @return nothing.
+*******************************************************************************/
+static void SCH_set_due(SCH_EVENT_STRUCT_PTR p_rec, time_t now, uint64_t uptime)
+{
+    if (p_rec->isDailyEvent == true) {
+        p_rec->due_msec = uptime;
+        if (p_rec->time > now) {
+            p_rec->due_msec += (uint64_t)(p_rec->time - now) * SEC_IN_MS;
+        }
+    }
+    else {
+        p_rec->due_msec = uptime;
+        if (p_rec->count_down > 0) {
+            p_rec->due_msec += (uint64_t)p_rec->count_down * SEC_IN_MS;
+        }
+    }
+}
+
+/*****************************************************************************//**
+* @brief Execute the callback of each event that is due and remove it.
 *
 * @param none.
 * @return nothing.
-* @author Neal Shurmantine
-* @version
-* 03/04/2015    Created.
 *******************************************************************************/
-static void SCH_monitor_schedule_list(void)
+static void SCH_run_due_events(void)
 {
+    SCH_EVENT_STRUCT_PTR p_event_rec;
     time_t now;
-    SCH_EVENT_STRUCT_PTR p_event_rec = p_HeadEvent;
-    SCH_EVENT_STRUCT_PTR p_temp;
-    OS_GetTimeLocal(&now);
-    while(p_event_rec != NULL) {
-        p_temp = p_event_rec->p_next;
-        if (p_event_rec->isDailyEvent == false) {
-            if (--p_event_rec->count_down <= 0) {
-                (*p_event_rec->p_callback)(p_event_rec->event_id);
-                SCH_remove_event(p_event_rec);
+
+    while ((SCH_HeapCount != 0) && (SCH_Heap[0]->due_msec <= SCH_uptime_msec())) {
+        p_event_rec = SCH_Heap[0];
+        if (p_event_rec->isDailyEvent == true) {
+            OS_GetTimeLocal(&now);
+            if (now < p_event_rec->time) {
+                //uptime ran ahead of the clock, wait for the clock
+                SCH_set_due(p_event_rec, now, SCH_uptime_msec());
+                SCH_heap_sift_down(0);
+                continue;
             }
         }
-        else if (now >= p_event_rec->time) {
-            (*p_event_rec->p_callback)(p_event_rec->event_id);
-            SCH_remove_event(p_event_rec);
+        //out of the heap first, the callback may schedule or remove events
+        SCH_unlink_event(p_event_rec);
+        (*p_event_rec->p_callback)(p_event_rec->event_id);
+        OS_ReleaseMemBlock((uint8_t *)p_event_rec);
+    }
+}
+
+/*****************************************************************************//**
+* @brief Determine how long the task may sleep before the next event is due.
+*
+* @param none.
+* @return uint32_t. msec, at most SCH_MAX_WAIT_MSEC and never 0 (which would
+*   mean forever).
+*******************************************************************************/
+static uint32_t SCH_msec_until_next_event(void)
+{
+    uint64_t uptime = SCH_uptime_msec();
+    uint64_t wait = SCH_MAX_WAIT_MSEC;
+
+    if (SCH_HeapCount != 0) {
+        if (SCH_Heap[0]->due_msec <= uptime) {
+            wait = 1;
+        }
+        else if ((SCH_Heap[0]->due_msec - uptime) < wait) {
+            wait = SCH_Heap[0]->due_msec - uptime;
         }
-        p_event_rec = p_temp;
     }
+    return (uint32_t)wait;
 }
 
 /*****************************************************************************//**
-* @brief Remove a specific event from the linked list of events and release
-*   memory.
+* @brief Time since boot, unaffected by setting the clock.
+*
+* @param none.
+* @return uint64_t. msec.
+*******************************************************************************/
+static uint64_t SCH_uptime_msec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * SEC_IN_MS) + (now.tv_nsec / 1000000);
+}
+
+/*****************************************************************************//**
+* @brief Take an event out of the heap and free its handle without releasing
+*   it.
 *
 * @param p_rec.  Pointer to record to be removed.
 * @return nothing.
-* @author Neal Shurmantine
-* @version
-* 03/04/2015    Created.
 *******************************************************************************/
-static void SCH_remove_event(SCH_EVENT_STRUCT_PTR p_rec)
+static void SCH_unlink_event(SCH_EVENT_STRUCT_PTR p_rec)
 {
-    SCH_EVENT_STRUCT_PTR p_prev_list;
-    SCH_EVENT_STRUCT_PTR p_next_list;
+    uint16_t index = p_rec->heap_index;
+    SCH_EVENT_STRUCT_PTR p_last = SCH_Heap[--SCH_HeapCount];
+
+    //the last event fills the hole and moves whichever way it must
+    if (p_last != p_rec) {
+        SCH_heap_place(p_last, index);
+        SCH_heap_sift_up(index);
+        SCH_heap_sift_down(p_last->heap_index);
+    }
 
-    //remove from list of pending msgs
-    if ((p_HeadEvent != p_rec) && (p_TailEvent != p_rec))
-    {
-        p_prev_list = p_rec->p_previous;
-        p_next_list = p_rec->p_next;
-        p_prev_list->p_next = p_next_list;
-        p_next_list->p_previous = p_prev_list;
+    if (p_rec->isSceneEvent == false) {
+        SCH_handle_free(p_rec->event_id);
     }
-    else
-    {
-        if (p_HeadEvent == p_rec)
-        {
-            p_HeadEvent = p_rec->p_next;
-            p_next_list = p_rec->p_next;
-            if (p_next_list != NULL)
-            {
-                p_next_list->p_previous = NULL;
-            }
-        }
-        if (p_TailEvent == p_rec)
-        {
-            p_TailEvent = p_rec->p_previous;
-            p_prev_list = p_rec->p_previous;
-            if (p_prev_list != NULL)
-            {
-                p_prev_list->p_next = NULL;
-            }
+}
+
+/*****************************************************************************//**
+* @brief Put an event at a position in the heap.
+*
+* @param p_rec.  Pointer to event record.
+* @param index.  Position.
+* @return nothing.
+*******************************************************************************/
+static void SCH_heap_place(SCH_EVENT_STRUCT_PTR p_rec, uint16_t index)
+{
+    SCH_Heap[index] = p_rec;
+    p_rec->heap_index = index;
+}
+
+/*****************************************************************************//**
+* @brief Move an event towards the top of the heap until its parent is due
+*   no later than it.
+*
+* @param index.  Position of the event.
+* @return nothing.
+*******************************************************************************/
+static void SCH_heap_sift_up(uint16_t index)
+{
+    SCH_EVENT_STRUCT_PTR p_rec = SCH_Heap[index];
+    uint16_t parent;
+
+    while (index > 0) {
+        parent = (index - 1) / 2;
+        if (SCH_Heap[parent]->due_msec <= p_rec->due_msec) {
+            break;
         }
+        SCH_heap_place(SCH_Heap[parent], index);
+        index = parent;
     }
-    OS_ReleaseMemBlock((uint8_t *)p_rec);
+    SCH_heap_place(p_rec, index);
 }
 
 /*****************************************************************************//**
-* @brief Remove all scheduled scene events from the linked list of 
-*    events.  Memory is released also.
+* @brief Move an event towards the bottom of the heap until both children are
+*   due no earlier than it.
 *
-* @param event_id.  Scheduled scene event to be removed.
+* @param index.  Position of the event.
 * @return nothing.
-* @author Neal Shurmantine
-* @version
-* 04/18/2015    Created.
 *******************************************************************************/
-static void SCH_remove_all_scene_events(void)
+static void SCH_heap_sift_down(uint16_t index)
 {
-    SCH_EVENT_STRUCT_PTR p_next;
-    SCH_EVENT_STRUCT_PTR p_event_rec = p_HeadEvent;
-    while (p_event_rec != NULL) {
-        p_next = p_event_rec->p_next;
-        if (p_event_rec->isSceneEvent == true) {
-            SCH_remove_event(p_event_rec);
+    SCH_EVENT_STRUCT_PTR p_rec = SCH_Heap[index];
+    uint16_t child;
+
+    while (1) {
+        child = (2 * index) + 1;
+        if (child >= SCH_HeapCount) {
+            break;
         }
-        p_event_rec = p_next;
+        if (((child + 1) < SCH_HeapCount)
+                && (SCH_Heap[child + 1]->due_msec < SCH_Heap[child]->due_msec)) {
+            ++child;
+        }
+        if (p_rec->due_msec <= SCH_Heap[child]->due_msec) {
+            break;
+        }
+        SCH_heap_place(SCH_Heap[child], index);
+        index = child;
     }
-    if (SCH_pScheduleEventList != NULL) {
-        OS_ReleaseMemBlock((void *)SCH_pScheduleEventList);
-        SCH_pScheduleEventList = NULL;
+    SCH_heap_place(p_rec, index);
+}
+
+/*****************************************************************************//**
+* @brief Restore heap order after many keys have changed.
+*
+* @param none.
+* @return nothing.
+*******************************************************************************/
+static void SCH_heap_rebuild(void)
+{
+    uint16_t index = SCH_HeapCount / 2;
+
+    while (index > 0) {
+        SCH_heap_sift_down(--index);
     }
 }
 
 /*****************************************************************************//**
-* @brief Scheduled scene database has changed or time has changed.  Each 
-*     scheduled scene event is removed from the list.  The scheduled scene 
-*     event database is then checked, one entry at a time, and enabled events
-*   are added to the list of scheduled events.
+* @brief Remove a specific event from the heap of events and release
+*   memory.
+*
+* @param p_rec.  Pointer to record to be removed.
+* @return nothing.
+* @author Neal Shurmantine
+* @version
+* 03/04/2015    Created.
+*******************************************************************************/
+static void SCH_remove_event(SCH_EVENT_STRUCT_PTR p_rec)
+{
+    SCH_unlink_event(p_rec);
+    OS_ReleaseMemBlock((uint8_t *)p_rec);
+}
+
+/*****************************************************************************//**
+* @brief Scheduled scene database has changed or time has changed.  The
+*     stored list is read and sorted by id, then walked alongside the scene
+*     events in the heap, also sorted by id.  A scene whose record hash and
+*     time are unchanged is left alone; a changed one is moved in the heap,
+*     or removed if it no longer happens today; new ones are added and
+*     scenes missing from the list are removed.  Unless the day or clock
+*     changed, the time is only worked out for records whose hash differs.
 *
-* @param token.  If this is a callback from the scheduler then token will be non-zero.
+* @param none.
 * @return nothing.
 * @author Neal Shurmantine
 * @version
@@ -1263,40 +1556,223 @@ static void SCH_remove_all_scene_events(void)
 *******************************************************************************/
 static void SCH_refresh_scene_events(void)
 {
+    ALL_RAW_DB_STR_PTR p_new_list = NULL;
+    strScheduledEvent * p_sched = NULL;
+    SCH_EVENT_STRUCT_PTR * p_live = NULL;
     SCH_EVENT_STRUCT_PTR p_event_rec;
-    strScheduledEvent * p_single_schedule;
-    uint16_t index;
+    uint16_t live_count;
+    uint16_t sched_count = 0;
+    uint16_t s = 0;
+    uint16_t l = 0;
     time_t event_time;
-    uint16_t scene_count = 0;
-
-    while (_mutex_try_lock(&flashDeviceMutex) != MQX_EOK) {
-//        printf("Sched waiting for mutex\n");
-        OS_TaskSleep(100);
+    bool happens;
+    uint16_t added = 0;
+    uint16_t moved = 0;
+    uint16_t removed = 0;
+    uint16_t kept = 0;
+    uint64_t start = SCH_uptime_msec();
+    uint64_t locked;
+
+    if (_mutex_lock_timed(&flashDeviceMutex, SCH_FLASH_LOCK_WAIT_MSEC) != MQX_EOK) {
+        printf("Sched flash busy, scene refresh retried\n");
+        SCH_schedule_scene_refresh(false, 10);
+        return;
     }
+    locked = SCH_uptime_msec();
     if (isEnableScheduledEvents() == true) {
-        FF_ReadListOfScheduledEvents(&SCH_pScheduleEventList);
-        if (SCH_pScheduleEventList->count != 0) {
-            p_single_schedule = (strScheduledEvent*)SCH_pScheduleEventList->db_list;
-            for (index=0; index < SCH_pScheduleEventList->count; ++index) {
-                if (SCH_compute_scene_event(p_single_schedule, &event_time) == true) {
-                    ++scene_count;
-                    p_event_rec = (SCH_EVENT_STRUCT_PTR)OS_GetMemBlock(sizeof(SCH_EVENT_STRUCT));
-                    SCH_add_record_to_list(p_event_rec);
-                    memcpy(&p_event_rec->time, &event_time, sizeof(time_t));
-                    p_event_rec->event_id = p_single_schedule->uID;
-                    p_event_rec->p_callback = SCH_execute_scene_now;
-                    p_event_rec->isSceneEvent = true;
-                    p_event_rec->isDailyEvent = true;
-                }
-                ++p_single_schedule;
+        FF_ReadListOfScheduledEvents(&p_new_list);
+    }
+    _mutex_unlock(&flashDeviceMutex);
+
+    if ((p_new_list != NULL) && (p_new_list->count < 0)) {
+        //could not be read, keep what is scheduled rather than drop it all
+        OS_ReleaseMemBlock((void *)p_new_list);
+        printf("Sched scene list not read, retry in %d sec\n", SCH_SCENE_RETRY_SECONDS);
+        SCH_schedule_scene_refresh(false, SCH_SCENE_RETRY_SECONDS);
+        return;
+    }
+    if (p_new_list != NULL) {
+        sched_count = (uint16_t)p_new_list->count;
+        p_sched = (strScheduledEvent *)p_new_list->db_list;
+        qsort(p_sched, sched_count, sizeof(strScheduledEvent), SCH_compare_schedule_id);
+    }
+    live_count = SCH_collect_scene_events(&p_live);
+
+    while ((s < sched_count) || (l < live_count)) {
+        if ((l == live_count)
+                || ((s < sched_count) && (p_sched[s].uID < p_live[l]->event_id))) {
+            if (SCH_compute_scene_event(&p_sched[s], &event_time) == true) {
+                SCH_add_scene_event(&p_sched[s], event_time);
+                ++added;
             }
-            if (scene_count) {
-                printf("Added %d scenes to scheduler\n", scene_count);
+            ++s;
+        }
+        else if ((s == sched_count) || (p_live[l]->event_id < p_sched[s].uID)) {
+            SCH_remove_event(p_live[l]);
+            ++removed;
+            ++l;
+        }
+        else {
+            p_event_rec = p_live[l];
+            if ((SCH_SceneRecomputeAll == false)
+                    && (p_event_rec->scene_hash == SCH_scene_hash(&p_sched[s]))) {
+                ++kept;
             }
+            else {
+                happens = SCH_compute_scene_event(&p_sched[s], &event_time);
+                if (happens == false) {
+                    SCH_remove_event(p_event_rec);
+                    ++removed;
+                }
+                else if (event_time != p_event_rec->time) {
+                    SCH_move_event(p_event_rec, event_time);
+                    ++moved;
+                }
+                else {
+                    ++kept;
+                }
+                p_event_rec->scene_hash = SCH_scene_hash(&p_sched[s]);
+            }
+            ++s;
+            ++l;
         }
     }
+    if (p_live != NULL) {
+        OS_ReleaseMemBlock((void *)p_live);
+    }
 
-    _mutex_unlock(&flashDeviceMutex);
+    //scene callbacks look themselves up in the list, swap it only now
+    if (SCH_pScheduleEventList != NULL) {
+        OS_ReleaseMemBlock((void *)SCH_pScheduleEventList);
+    }
+    SCH_pScheduleEventList = p_new_list;
+    SCH_SceneRecomputeAll = false;
+
+    SCH_SceneRefreshMsec = (uint32_t)(SCH_uptime_msec() - start);
+    if (SCH_SceneRefreshMsec > SCH_SceneRefreshMaxMsec) {
+        SCH_SceneRefreshMaxMsec = SCH_SceneRefreshMsec;
+    }
+    if (added || moved || removed) {
+        printf("Scenes added %d moved %d removed %d kept %d, %u ms (%u ms for flash)\n",
+                added, moved, removed, kept,
+                (unsigned int)SCH_SceneRefreshMsec, (unsigned int)(locked - start));
+    }
+}
+
+/*****************************************************************************//**
+* @brief Make a list of the scene events in the heap, sorted by id.
+*
+* @param p_list.  Where to put the list, NULL if there are none.  The caller
+*     releases it.
+* @return uint16_t. Number of scene events.
+*******************************************************************************/
+static uint16_t SCH_collect_scene_events(SCH_EVENT_STRUCT_PTR ** p_list)
+{
+    uint16_t count = 0;
+    uint16_t n;
+
+    *p_list = NULL;
+    for (n = 0; n < SCH_HeapCount; ++n) {
+        if (SCH_Heap[n]->isSceneEvent == true) {
+            ++count;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    *p_list = (SCH_EVENT_STRUCT_PTR *)OS_GetMemBlock(count * sizeof(SCH_EVENT_STRUCT_PTR));
+    count = 0;
+    for (n = 0; n < SCH_HeapCount; ++n) {
+        if (SCH_Heap[n]->isSceneEvent == true) {
+            (*p_list)[count++] = SCH_Heap[n];
+        }
+    }
+    qsort(*p_list, count, sizeof(SCH_EVENT_STRUCT_PTR), SCH_compare_event_id);
+    return count;
+}
+
+/*****************************************************************************//**
+* @brief Add a scene event to the heap.
+*
+* @param p_sched.  Record from the scene schedule.
+* @param when.  Local time it is due.
+* @return nothing.
+*******************************************************************************/
+static void SCH_add_scene_event(strScheduledEvent * p_sched, time_t when)
+{
+    SCH_EVENT_STRUCT_PTR p_event_rec;
+
+    p_event_rec = (SCH_EVENT_STRUCT_PTR)OS_GetMemBlock(sizeof(SCH_EVENT_STRUCT));
+    p_event_rec->time = when;
+    p_event_rec->event_id = p_sched->uID;
+    p_event_rec->p_callback = SCH_execute_scene_now;
+    p_event_rec->isSceneEvent = true;
+    p_event_rec->isDailyEvent = true;
+    p_event_rec->scene_hash = SCH_scene_hash(p_sched);
+    SCH_insert_event(p_event_rec);
+}
+
+/*****************************************************************************//**
+* @brief Change the local time of a daily event and its place in the heap.
+*
+* @param p_rec.  Pointer to event record.
+* @param when.  New local time.
+* @return nothing.
+*******************************************************************************/
+static void SCH_move_event(SCH_EVENT_STRUCT_PTR p_rec, time_t when)
+{
+    time_t now;
+
+    OS_GetTimeLocal(&now);
+    p_rec->time = when;
+    SCH_set_due(p_rec, now, SCH_uptime_msec());
+    SCH_heap_sift_up(p_rec->heap_index);
+    SCH_heap_sift_down(p_rec->heap_index);
+}
+
+/*****************************************************************************//**
+* @brief Hash the fields of a scene schedule record (FNV-1a).
+*
+* @param p_sched.  Record from the scene schedule.
+* @return uint32_t. Hash.
+*******************************************************************************/
+static uint32_t SCH_scene_hash(strScheduledEvent * p_sched)
+{
+    uint8_t bytes[8];
+    uint32_t hash = 2166136261UL;
+    uint8_t n;
+
+    //field by field, the record has padding
+    bytes[0] = (uint8_t)p_sched->sceneOrMultiSceneID;
+    bytes[1] = (uint8_t)(p_sched->sceneOrMultiSceneID >> 8);
+    bytes[2] = p_sched->enabledFlags.byte;
+    bytes[3] = p_sched->typeFlags.byte;
+    bytes[4] = p_sched->hours;
+    bytes[5] = (uint8_t)p_sched->minutes;
+    bytes[6] = (uint8_t)((uint16_t)p_sched->minutes >> 8);
+    bytes[7] = 0;
+    for (n = 0; n < sizeof(bytes); ++n) {
+        hash ^= bytes[n];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/*****************************************************************************//**
+* @brief qsort and bsearch comparison of scene schedule records by uID.
+*******************************************************************************/
+static int SCH_compare_schedule_id(const void * p_a, const void * p_b)
+{
+    return (int)((const strScheduledEvent *)p_a)->uID - (int)((const strScheduledEvent *)p_b)->uID;
+}
+
+/*****************************************************************************//**
+* @brief qsort comparison of event record pointers by event_id.
+*******************************************************************************/
+static int SCH_compare_event_id(const void * p_a, const void * p_b)
+{
+    return (int)(*(const SCH_EVENT_STRUCT_PTR *)p_a)->event_id
+            - (int)(*(const SCH_EVENT_STRUCT_PTR *)p_b)->event_id;
 }
 
 /*****************************************************************************//**
@@ -1322,14 +1798,23 @@ static bool SCH_check_sunrise_sunset(bool is_sunrise,
     time_t now;
     OS_GetTimeLocal(&now);
     time_t event_time;
+    uint16_t sunrise_minutes = sunriseTimeInMinutes;
+    uint16_t sunset_minutes = sunsetTimeInMinutes;
+    //the table covers every day, the time server's times only the day
+    //they were sent; keep those if the table has no answer
+    if ((EPH_GetSunMinutes(now, currentTimeOffset, &sunrise_minutes, &sunset_minutes) == false)
+            && (sunrise_sunset_found == false)) {
+        //polar day or night, or no location, and no times from the server
+        return false;
+    }
     localtime_r(&now, &todays_date);
     if (is_sunrise == true) {
-        todays_date.tm_hour = sunriseTimeInMinutes / 60;
-        todays_date.tm_min = sunriseTimeInMinutes % 60;
+        todays_date.tm_hour = sunrise_minutes / 60;
+        todays_date.tm_min = sunrise_minutes % 60;
     }
     else {
-        todays_date.tm_hour = sunsetTimeInMinutes / 60;
-        todays_date.tm_min = sunsetTimeInMinutes % 60;
+        todays_date.tm_hour = sunset_minutes / 60;
+        todays_date.tm_min = sunset_minutes % 60;
     }
     todays_date.tm_sec = 0;
     event_time = mktime(&todays_date);
@@ -1433,7 +1918,7 @@ static bool SCH_compute_scene_event(strScheduledEvent *sched_event, time_t * p_w
                 day.second = 0;
                 event_found = SCH_is_happening_today(&day,p_when);
             }
-            else if (sunrise_sunset_found == true) {
+            else if ((sunrise_sunset_found == true) || (EPH_IsAvailable() == true)) {
                 event_found = SCH_check_sunrise_sunset(sched_event->typeFlags.flags.isSunrise, 
                                     sched_event->minutes,
                                         p_when);
@@ -1454,17 +1939,15 @@ static bool SCH_compute_scene_event(strScheduledEvent *sched_event, time_t * p_w
 *******************************************************************************/
 static strScheduledEvent * SCH_find_scheduled_event_data(uint16_t event_id)
 {
-    strScheduledEvent * p_check_event = NULL;
-    uint16_t n;
-    p_check_event = (strScheduledEvent *)&SCH_pScheduleEventList->db_list;
-    for (n=0; n < SCH_pScheduleEventList->count; ++n) {
-        if (event_id == p_check_event->uID) {
-            return p_check_event;
-        }
-        ++p_check_event;
-    }
+    strScheduledEvent key;
 
-    return NULL;
+    if (SCH_pScheduleEventList == NULL) {
+        return NULL;
+    }
+    key.uID = event_id;
+    //the list is kept sorted by SCH_refresh_scene_events
+    return (strScheduledEvent *)bsearch(&key, SCH_pScheduleEventList->db_list,
+            SCH_pScheduleEventList->count, sizeof(strScheduledEvent), SCH_compare_schedule_id);
 }
 
 /*****************************************************************************//**
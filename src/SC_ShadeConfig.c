@@ -30,6 +30,11 @@
 #include "rf_serial_api.h"
 #include "os.h"
 #include "rfo_outbound.h"
+#include "rfp_pacing.h"
+#include "rfd_dedup.h"
+#include "scd_discovery.h"
+#include "bsw_battery_sweep.h"
+#include "sst_shade_state.h"
 #include "stub.h"
 #include "SCH_ScheduleTask.h"
 #include "RMT_RemoteServers.h"
@@ -79,37 +84,48 @@ typedef struct SHADE_DATA_REQ_TAG
     P3_Address_Internal_Type adr;
     uint8_t tx_opt;
     void(*p_callback)(void*);
+    SC_PRIORITY_T priority;
     uint8_t len;
     uint8_t msg[MAX_CMD_PAYLOAD];
 } SHADE_DATA_REQ, *SHADE_DATA_REQ_PTR;
 
-#define BATTERY_CHECK_RETRY_MAX     7
-#define SECONDS_BETWEEN_BATTERY_CHECKS  4
+//waiting moves are found by address through a small hash table
+#define SC_COALESCE_BUCKETS     64      //power of two
+#define SC_COALESCE_SHIFT       58      //64 - log2(SC_COALESCE_BUCKETS)
+
+//a sweep cut short by a reboot is picked up this long after start up
+#define SC_BATTERY_RESUME_DELAY_SECONDS     60
 
 /* Local Function Declarations
 *******************************************************************************/
 static void sc_continue_discovery(void);
 static void SC_discovery_timeout(uint16_t unused);
-static void sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req);
-static void SC_build_config_record(SHADE_DATA_REQ_MSG_STRUCT_PTR p_pay_rec);
+static RNC_CONFIG_REC_PTR sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req);
+static RNC_CONFIG_REC_PTR SC_build_config_record(SHADE_DATA_REQ_MSG_STRUCT_PTR p_pay_rec,
+                            SC_PRIORITY_T priority);
 static void sc_group_assign_exec(P3_Address_Mode_Type adr_mode,
                              P3_Address_Internal_Type * address, uint8_t group_id, bool isAssigned);
 static void sc_issue_beacon_exec(void);
+static SC_PRIORITY_T sc_command_priority(SHADE_COMMAND_TYPE cmd_type);
+static bool sc_coalesce_key(uint8_t adr_mode, P3_Address_Internal_Type * address, uint64_t * p_key);
+static uint16_t sc_coalesce_bucket(uint64_t key, uint8_t adr_mode);
+static void sc_coalesce_add(RNC_CONFIG_REC_PTR p_cfg_rec, uint8_t kinds, uint64_t key);
+static void sc_coalesce_remove(RNC_CONFIG_REC_PTR p_cfg_rec);
 void sc_send_raw_payload(P3_Address_Mode_Type adr_mode,
                         P3_Address_Internal_Type * address,
                         uint8_t len, uint8_t * msg);
-static RNC_CONFIG_REC_PTR SC_create_blank_record(void);
+static RNC_CONFIG_REC_PTR SC_create_blank_record(SC_PRIORITY_T priority);
 static void SC_clear_item_in_list(RNC_CONFIG_REC_PTR p_active_msg);
+static void sc_start_pacing_timer(void);
 
 static void sc_shade_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response);
-static SC_SHADE_DISC_REC_PTR SC_create_discover_record(PARSE_KEY_STRUCT_PTR p_rf_response);
-static void SC_remove_discovered_shade_from_list(void);
+static void SC_record_discover_response(PARSE_KEY_STRUCT_PTR p_rf_response);
 
 static void sc_group_set_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response);
 static void sc_cancel_configurations(void);
 static void SC_discovery_callback(void *);
-static bool SC_is_redundant_discovery_response(uint16_t id);
-static void SC_batt_check_proc_continue(uint16_t token);
+static void SC_battery_sweep_done(BATT_CHECK_STRUCT_PTR p_data, uint16_t count);
+static void SC_resume_battery_check(uint16_t token);
 static void sc_parse_indication_payload(uint16_t id, uint8_t *p_payload);
 static void sc_parse_scene_controller_payload(uint16_t id, uint8_t *p_data);
 static void sc_indication_debug_metrics(uint16_t id, uint8_t* p_data);
@@ -129,28 +145,32 @@ static void print_serial_msg(char *title, uint8_t * msg_str);
 
 /* Local variables
 *******************************************************************************/
-static SC_SHADE_DISC_REC_PTR SC_DiscoverHead;
-static SC_SHADE_DISC_REC_PTR SC_DiscoverTail;
+/** Shades that answered the current discovery round. */
+static SCD_REGISTRY SC_Discovered;
 static bool SC_DiscoveryActive = false;
 static bool SC_CapturingShades;
 static uint16_t SC_DiscoverRetryCount;
 static RNC_CONFIG_REC_PTR SC_HeadAddress;
 static RNC_CONFIG_REC_PTR SC_TailAddress;
+/** Last record of each priority class in the list, NULL if the class is empty. */
+static RNC_CONFIG_REC_PTR SC_ClassTail[SC_PRIORITY_COUNT];
+/** Records of each priority class in the list, read by other tasks. */
+static uint16_t SC_ClassCount[SC_PRIORITY_COUNT];
+/** Waiting moves, chained through p_coalesce_next. */
+static RNC_CONFIG_REC_PTR SC_CoalesceTable[SC_COALESCE_BUCKETS];
+/** Moves dropped because a later one replaced them. */
+static uint32_t SC_CoalescedCount;
 static bool SC_JoinEnabled = false;
 static uint8_t SC_TxHandle = 0;
 static bool SC_AbsoluteDiscoveryActive =  false;
-static BATT_CHECK_STRUCT_PTR p_BattCheckData;
-static uint16_t MaxShades;
-static uint16_t ShadeIndex;
-static uint16_t BattCheckRetryCount;
 static SHADE_POSITION SC_Positions;
 static bool SC_FinalPacketData;
 static uint16_t SC_BatteryCheckToken = NULL_TOKEN;
-uint16_t SC_RedundantChecksum = 0xffff;
 static bool SC_SingleShadeBatteryCheck = false;
 uint16_t SC_LowBatteryCount;
 static bool SC_IsForceBatteryCheck = false;
 static bool SC_MaintainFlash;
+static bool SC_BatteryResumeChecked = false;
 uint16_t SC_NetworkJoinScheduleToken;
 eDiscoveryType SC_DiscoveryType;
 
@@ -301,7 +321,6 @@ void SC_SetSceneAtPosition( P3_Address_Mode_Type adr_mode,
     p_cmd->data.scene_data.posKind[1] = pos->posKind[1];
     p_cmd->data.scene_data.position[1] = pos->position[1];
     RNC_SendShadeRequest(p_cmd);
-	OS_TaskSleep(1000);
 }
 void SC_SetSceneToCurrent( P3_Address_Mode_Type adr_mode,
                             P3_Address_Internal_Type * address,
@@ -315,7 +334,6 @@ void SC_SetSceneToCurrent( P3_Address_Mode_Type adr_mode,
     p_cmd->data.scene_data.count = 1;
     p_cmd->data.scene_data.id_list[0] = scene_id;
     RNC_SendShadeRequest(p_cmd);
-	OS_TaskSleep(1000);
 }
 void SC_ExecuteSceneProc(uint8_t scene_count, uint8_t * scene_id, void(*p_callback)(void*))
 {
@@ -412,7 +430,6 @@ void SC_GroupAssign(P3_Address_Mode_Type adr_mode,
     p_cmd->data.group_data.id = group_id;
     p_cmd->data.group_data.is_assigned = isAssigned;
     RNC_SendShadeRequest(p_cmd);
-	OS_TaskSleep(1000);
 }
 void SC_ResetShade(P3_Address_Mode_Type adr_mode,
                         P3_Address_Internal_Type * address,
@@ -425,7 +442,6 @@ void SC_ResetShade(P3_Address_Mode_Type adr_mode,
     p_cmd->address.Unique_Id = address->Unique_Id;
     p_cmd->data.reset_data = cfg;
     RNC_SendShadeRequest(p_cmd);
-	OS_TaskSleep(1000);
 }
 void sc_send_raw_payload(P3_Address_Mode_Type adr_mode,
                         P3_Address_Internal_Type * address,
@@ -511,10 +527,14 @@ void SC_LoadNewCommand(SHADE_COMMAND_INSTRUCTION_PTR p_cmd)
     char n;
     int i;
     SHADE_DATA_REQ req;
+    RNC_CONFIG_REC_PTR p_cfg_rec;
+    uint8_t coalesce_kinds = 0;
+    uint64_t coalesce_key;
     req.p_callback = p_cmd->p_callback;
     req.adr_mode = p_cmd->adr_mode;
     req.adr.Unique_Id = p_cmd->address.Unique_Id;
-    SC_RedundantChecksum = 0xffff;
+    req.priority = sc_command_priority(p_cmd->cmd_type);
+    RFD_Flush();
 
     switch (p_cmd->cmd_type) {
 
@@ -565,6 +585,7 @@ void SC_LoadNewCommand(SHADE_COMMAND_INSTRUCTION_PTR p_cmd)
                 }
                 req.msg[(i * 5) + 5] = (uint8_t)(p_cmd->data.pos_data.position[i] & 0xff);
                 req.msg[(i * 5) + 6] = (uint8_t)((p_cmd->data.pos_data.position[i] & 0xff00)>>8);
+                coalesce_kinds |= (1 << p_cmd->data.pos_data.posKind[i]);
             }
 
             break;
@@ -580,6 +601,8 @@ void SC_LoadNewCommand(SHADE_COMMAND_INSTRUCTION_PTR p_cmd)
             else { //stop
                 req.msg[1] = 'S';
             }
+            //a move takes over every rail
+            coalesce_kinds = (1 << pkPrimaryRail) | (1 << pkSecondaryRail) | (1 << pkVaneTilt);
             break;
         case SC_REQUEST_BATTERY_LEVEL:
             req.len = 5;
@@ -750,24 +773,202 @@ void SC_LoadNewCommand(SHADE_COMMAND_INSTRUCTION_PTR p_cmd)
             shade_data_req = false;
             break;
     }
+    if ((coalesce_kinds != 0)
+            && (sc_coalesce_key(p_cmd->adr_mode, &p_cmd->address, &coalesce_key) == false)) {
+        coalesce_kinds = 0;
+    }
     OS_ReleaseMsgMemBlock((void *)p_cmd);
     if (shade_data_req == true) {
         req.tx_opt = TX_OPTION;
-        sc_build_shade_data_request(&req);
+        p_cfg_rec = sc_build_shade_data_request(&req);
+        if (coalesce_kinds != 0) {
+            sc_coalesce_add(p_cfg_rec, coalesce_kinds, coalesce_key);
+        }
     }
     SC_GetNextMessageToSend();
 }
 
+/*****************************************************************************//**
+* @brief Give the number of waiting moves dropped because a later move to the
+*   same shade replaced them.
+*
+* @param none.
+* @return the count.
+*******************************************************************************/
+uint32_t SC_GetCoalescedCount(void)
+{
+    return SC_CoalescedCount;
+}
+
+/*****************************************************************************//**
+* @brief Give the number of shade messages of a priority class waiting to go
+*   out or waiting on the shade.  May be called from any task.
+*
+* @param priority. The class.
+* @return the count.
+*******************************************************************************/
+uint16_t SC_GetQueuedCount(SC_PRIORITY_T priority)
+{
+    return __atomic_load_n(&SC_ClassCount[priority], __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************//**
+* @brief Give the priority class of a shade command.  Anything a user is waiting
+*   on goes first, then scenes, then housekeeping the user never sees.
+*
+* @param cmd_type.  The command.
+* @return the class.
+*******************************************************************************/
+static SC_PRIORITY_T sc_command_priority(SHADE_COMMAND_TYPE cmd_type)
+{
+    switch (cmd_type) {
+        case SC_SET_SHADE_POSITION:
+        case SC_MOVE_SHADE:
+        case SC_JOG_SHADE:
+        case SC_GET_SHADE_POSITION:
+        case SC_RAW_PAYLOAD:
+        case SC_SCENE_CTL_CLEARED_ACK:
+        case SC_SCENE_CTL_UPDATE_HEADER:
+        case SC_SCENE_CTL_UPDATE_PACKET:
+        case SC_SCENE_CTL_TRIGGER_ACK:
+            return SC_PRIORITY_INTERACTIVE;
+        case SC_ABSOLUTE_DISCOVER:
+        case SC_CONDITIONAL_DISCOVER:
+        case SC_SET_DISCOVERED_FLAG:
+        case SC_REQUEST_SHADE_STATUS:
+        case SC_REQUEST_BATTERY_LEVEL:
+        case SC_REQUEST_SHADE_TYPE:
+        case SC_REQUEST_RECEIVER_FW:
+        case SC_REQUEST_MOTOR_FW:
+        case SC_REQUEST_GROUP:
+        case SC_REQUEST_DEBUG_STATUS:
+        case SC_RESET_SHADE:
+        case SC_ISSUE_BEACON:
+            return SC_PRIORITY_MAINTENANCE;
+        default:
+            return SC_PRIORITY_SCENE;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Reduce a shade address to a key for finding waiting moves.
+*
+* @param adr_mode.  P3_Address_Mode_Type of the address.
+* @param address.  The address; only the part the mode uses is read.
+* @param p_key.  Where to put the key.
+* @return false if moves to this address are never coalesced.
+*******************************************************************************/
+static bool sc_coalesce_key(uint8_t adr_mode, P3_Address_Internal_Type * address, uint64_t * p_key)
+{
+    uint8_t i;
+
+    switch (adr_mode) {
+        case P3_Address_Mode_Device_Id:
+            *p_key = address->Device_Id;
+            return true;
+        case P3_Address_Mode_Unique_Id:
+            *p_key = address->Unique_Id;
+            return true;
+        case P3_Address_Mode_Group_Id:
+            //the group list ends at the first zero, ignore what follows
+            *p_key = 0;
+            for (i = 0; (i < MAX_GROUP_LIST_SIZE) && (address->Group_Id[i] != 0); ++i) {
+                *p_key |= (uint64_t)address->Group_Id[i] << (8 * i);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Give the bucket of the table of waiting moves for an address.
+*
+* @param key.  From sc_coalesce_key.
+* @param adr_mode.  P3_Address_Mode_Type of the address.
+* @return the bucket.
+*******************************************************************************/
+static uint16_t sc_coalesce_bucket(uint64_t key, uint8_t adr_mode)
+{
+    return (uint16_t)(((key ^ adr_mode) * 0x9E3779B97F4A7C15ULL) >> SC_COALESCE_SHIFT);
+}
+
+/*****************************************************************************//**
+* @brief Enter a new move in the table of waiting moves, first dropping any
+*   waiting move to the same address that it fully replaces.
+*
+* @param p_cfg_rec.  The new move, waiting to send.
+* @param kinds.  Bit per ePosKind the move sets.
+* @param key.  From sc_coalesce_key.
+* @return nothing.
+* @note A move with a callback is never dropped, something is waiting on it.
+*******************************************************************************/
+static void sc_coalesce_add(RNC_CONFIG_REC_PTR p_cfg_rec, uint8_t kinds, uint64_t key)
+{
+    RNC_CONFIG_REC_PTR * p_link;
+    RNC_CONFIG_REC_PTR p_old;
+    p_link = &SC_CoalesceTable[sc_coalesce_bucket(key, p_cfg_rec->dest_mode)];
+    while (*p_link != NULL)
+    {
+        p_old = *p_link;
+        if ((p_old->coalesce_key == key)
+                && (p_old->dest_mode == p_cfg_rec->dest_mode)
+                && ((p_old->coalesce_kinds & kinds) == p_old->coalesce_kinds)
+                && (p_old->p_callback == NULL))
+        {
+            //unlink here, SC_clear_item_in_list then finds it out of the table
+            *p_link = p_old->p_coalesce_next;
+            p_old->coalesce_kinds = 0;
+            SC_clear_item_in_list(p_old);
+            ++SC_CoalescedCount;
+        }
+        else {
+            p_link = &p_old->p_coalesce_next;
+        }
+    }
+    p_cfg_rec->coalesce_kinds = kinds;
+    p_cfg_rec->coalesce_key = key;
+    p_link = &SC_CoalesceTable[sc_coalesce_bucket(key, p_cfg_rec->dest_mode)];
+    p_cfg_rec->p_coalesce_next = *p_link;
+    *p_link = p_cfg_rec;
+}
+
+/*****************************************************************************//**
+* @brief Take a move out of the table of waiting moves, once it is on its way
+*   or gone.  Does nothing for other records.
+*
+* @param p_cfg_rec.  The record.
+* @return nothing.
+*******************************************************************************/
+static void sc_coalesce_remove(RNC_CONFIG_REC_PTR p_cfg_rec)
+{
+    RNC_CONFIG_REC_PTR * p_link;
+
+    if (p_cfg_rec->coalesce_kinds == 0) {
+        return;
+    }
+    p_link = &SC_CoalesceTable[sc_coalesce_bucket(p_cfg_rec->coalesce_key, p_cfg_rec->dest_mode)];
+    while (*p_link != NULL)
+    {
+        if (*p_link == p_cfg_rec) {
+            *p_link = p_cfg_rec->p_coalesce_next;
+            break;
+        }
+        p_link = &(*p_link)->p_coalesce_next;
+    }
+    p_cfg_rec->coalesce_kinds = 0;
+}
+
 /*****************************************************************************//**
 * @brief This function a shade data request message.
 *
 * @param p_req. A pointer to SHADE_DATA_REQ
-* @return nothing.
+* @return the new config record.
 * @author Neal Shurmantine
 * @version
 * 11/06/2014    Created.
 *******************************************************************************/
-static void sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req)
+static RNC_CONFIG_REC_PTR sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req)
 {
     int i;
     SHADE_DATA_REQ_MSG_STRUCT payload_rec;
@@ -786,7 +987,7 @@ static void sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req)
     payload_rec.hdr.tx_options = p_req->tx_opt;
     payload_rec.hdr.tx_handle = SC_TxHandle++;
 
-    SC_build_config_record(&payload_rec);
+    return SC_build_config_record(&payload_rec, p_req->priority);
 }
 
 /*****************************************************************************//**
@@ -794,17 +995,19 @@ static void sc_build_shade_data_request(SHADE_DATA_REQ_PTR p_req)
 *  that is read for transport.
 *
 * @param p_pay_rec. A pointer to SHADE_DATA_REQ_MSG_STRUCT_PTR
-* @return nothing.
+* @param priority. Class of the message in the list.
+* @return the new config record.
 * @author Neal Shurmantine
 * @version
 * 11/06/2014    Created.
 *******************************************************************************/
-static void SC_build_config_record(SHADE_DATA_REQ_MSG_STRUCT_PTR p_pay_rec)
+static RNC_CONFIG_REC_PTR SC_build_config_record(SHADE_DATA_REQ_MSG_STRUCT_PTR p_pay_rec,
+                            SC_PRIORITY_T priority)
 {
     RNC_CONFIG_REC_PTR p_cfg_rec;
 
     //create a blank RNC_CONFIG_REC for a shade configuration
-    p_cfg_rec = SC_create_blank_record();
+    p_cfg_rec = SC_create_blank_record(priority);
     p_cfg_rec->p_callback = p_pay_rec->p_callback;
     p_cfg_rec->dest_dev_type = DESTINATION_SHADE;
     p_cfg_rec->dest_mode = p_pay_rec->hdr.dest_mode;
@@ -815,6 +1018,7 @@ print_serial_msg("config record", &p_cfg_rec->ser_msg[0]);
 
     //indicate that this message is ready to be sent
     p_cfg_rec->state = WAITING_TO_SEND_STATE;
+    return p_cfg_rec;
 }
 
 /*****************************************************************************//**
@@ -844,7 +1048,7 @@ static void sc_group_assign_exec(P3_Address_Mode_Type adr_mode,
     p_payload_rec.tx_options = TX_OPTION | TX_OPTION_NO_NET_HEADER;
 
     //create a blank RNC_CONFIG_REC
-    p_cfg_rec = SC_create_blank_record();
+    p_cfg_rec = SC_create_blank_record(SC_PRIORITY_SCENE);
     p_cfg_rec->dest_dev_type = DESTINATION_SHADE;
     p_cfg_rec->dest_mode = p_payload_rec.dest_mode;
     p_cfg_rec->id.Unique_Id = p_payload_rec.dest_adr.Unique_Id;
@@ -875,7 +1079,7 @@ static void sc_issue_beacon_exec(void)
     p_payload_rec.tx_options = TX_OPTION | TX_OPTION_NO_NET_HEADER;
 
     //create a blank RNC_CONFIG_REC
-    p_cfg_rec = SC_create_blank_record();
+    p_cfg_rec = SC_create_blank_record(SC_PRIORITY_MAINTENANCE);
     p_cfg_rec->dest_dev_type = DESTINATION_SHADE;
     //the following two parameters are not used for beacon
     p_cfg_rec->dest_mode = (uint8_t)P3_Address_Mode_None;
@@ -913,18 +1117,20 @@ static void print_serial_msg(char *title, uint8_t * msg_str)
 /*****************************************************************************//**
 * @brief This function acquires a memory block to hold a structure of type<br/>
 *  RNC_CONFIG_REC.  This structure is part of a linked list and this function adds
-*  the new record to the list.
+*  the new record to the list.  The list is kept in priority order, the record<br/>
+*  goes after the last one of its class.
 *
-* @param nothing.
+* @param priority. Class of the new record.
 * @return a pointer to a new memory block containing a RNC_CONFIG_REC.
 * @author Neal Shurmantine
 * @version
 * 11/06/2014    Created.
 *******************************************************************************/
-static RNC_CONFIG_REC_PTR SC_create_blank_record(void)
+static RNC_CONFIG_REC_PTR SC_create_blank_record(SC_PRIORITY_T priority)
 {
     RNC_CONFIG_REC_PTR p_cfg_rec;
-    RNC_CONFIG_REC_PTR p_last_rec;
+    RNC_CONFIG_REC_PTR p_last_rec = NULL;
+    int16_t class;
 
     //get memory for a new record (freed in SC_clear_item_in_list)
 
@@ -932,25 +1138,43 @@ static RNC_CONFIG_REC_PTR SC_create_blank_record(void)
 
     p_cfg_rec->rf_retry_count = 0;
     p_cfg_rec->rf_retry_max = SC_MAX_MSG_TRIES;
+    p_cfg_rec->priority = priority;
+    p_cfg_rec->coalesce_kinds = 0;
+    p_cfg_rec->p_coalesce_next = NULL;
+
+    //find the last record of this or a more urgent class
+    for (class = priority; (class >= 0) && (p_last_rec == NULL); --class) {
+        p_last_rec = SC_ClassTail[class];
+    }
 
-    //if no records in the list
-    if (SC_HeadAddress == NULL)
+    if (p_last_rec == NULL)
     {
-        //create list with this record only
-        SC_HeadAddress = p_cfg_rec;
-        SC_TailAddress = p_cfg_rec;
+        //add this record to the start of the list
         p_cfg_rec->p_prev_rec = NULL;
-        p_cfg_rec->p_next_rec = NULL;
+        p_cfg_rec->p_next_rec = SC_HeadAddress;
+        if (SC_HeadAddress != NULL) {
+            SC_HeadAddress->p_prev_rec = p_cfg_rec;
+        }
+        else {
+            SC_TailAddress = p_cfg_rec;
+        }
+        SC_HeadAddress = p_cfg_rec;
     }
     else
     {
-        //add this record to the end of the list
-        p_last_rec = SC_TailAddress;
-        p_last_rec->p_next_rec = p_cfg_rec;
-        SC_TailAddress = p_cfg_rec;
+        //add this record after it
         p_cfg_rec->p_prev_rec = p_last_rec;
-        p_cfg_rec->p_next_rec = NULL;
+        p_cfg_rec->p_next_rec = p_last_rec->p_next_rec;
+        if (p_last_rec->p_next_rec != NULL) {
+            p_last_rec->p_next_rec->p_prev_rec = p_cfg_rec;
+        }
+        else {
+            SC_TailAddress = p_cfg_rec;
+        }
+        p_last_rec->p_next_rec = p_cfg_rec;
     }
+    SC_ClassTail[priority] = p_cfg_rec;
+    __atomic_add_fetch(&SC_ClassCount[priority], 1, __ATOMIC_RELAXED);
     return p_cfg_rec;
 }
 
@@ -967,39 +1191,38 @@ static RNC_CONFIG_REC_PTR SC_create_blank_record(void)
 void SC_GetNextMessageToSend(void)
 {
     RNC_CONFIG_REC_PTR p_cfg_rec;
-    RNC_CONFIG_REC_PTR p_next_send = NULL;
+    uint16_t in_flight = 0;
 
     //There are only three states that a message may be in:
     //  waiting to be sent, waiting for a confirmation from nordic
     //  or message just sent and waiting for a timeout before
-    //  clearing message and sending the next.
-    //Search through the list and make sure all are waiting to
-    //  be sent, if true, send the first one on list.
+    //  clearing message.
+    //Everything not waiting to be sent counts against the rfo_outbound
+    //  window; hand over waiting messages in list order, which is
+    //  priority order then oldest first, until it is full.
     p_cfg_rec = SC_HeadAddress;
     while (p_cfg_rec != NULL)
     {
-        if (p_cfg_rec->state == WAITING_TO_SEND_STATE)
-        {
-            if (p_next_send == NULL) {
-                //this is the first available message in the list
-                p_next_send = p_cfg_rec;
-            }
-            p_cfg_rec = p_cfg_rec->p_next_rec;
-        }
-        else
-        {
-            //This message was just sent, wait for confirmation
-            //or timeout before checking again
-            //escape while loop instead
-            p_next_send = NULL;
-            p_cfg_rec = NULL;
+        if (p_cfg_rec->state != WAITING_TO_SEND_STATE) {
+            ++in_flight;
         }
+        p_cfg_rec = p_cfg_rec->p_next_rec;
     }
-    if (p_next_send != NULL)
+
+    p_cfg_rec = SC_HeadAddress;
+    while ((p_cfg_rec != NULL) && (in_flight < RFO_WINDOW_DEPTH))
     {
-        p_next_send->state = WAITING_FOR_SER_ACK_STATE;
-        RFO_DeliverRequest(p_next_send);
-        LED_Flicker(true);
+        if (p_cfg_rec->state == WAITING_TO_SEND_STATE)
+        {
+            //on its way, too late to replace
+            sc_coalesce_remove(p_cfg_rec);
+            p_cfg_rec->state = WAITING_FOR_SER_ACK_STATE;
+            p_cfg_rec->sent_tick = OS_GetMsecTick();
+            RFO_DeliverRequest(p_cfg_rec);
+            LED_Flicker(true);
+            ++in_flight;
+        }
+        p_cfg_rec = p_cfg_rec->p_next_rec;
     }
 }
 
@@ -1019,6 +1242,20 @@ static void SC_clear_item_in_list(RNC_CONFIG_REC_PTR p_active_msg)
     RNC_CONFIG_REC_PTR p_prev_list;
     RNC_CONFIG_REC_PTR p_next_list;
 
+    sc_coalesce_remove(p_active_msg);
+    __atomic_sub_fetch(&SC_ClassCount[p_active_msg->priority], 1, __ATOMIC_RELAXED);
+    if (SC_ClassTail[p_active_msg->priority] == p_active_msg)
+    {
+        //the record before it is the new last of the class, if it is in the class
+        p_prev_list = p_active_msg->p_prev_rec;
+        if ((p_prev_list != NULL) && (p_prev_list->priority == p_active_msg->priority)) {
+            SC_ClassTail[p_active_msg->priority] = p_prev_list;
+        }
+        else {
+            SC_ClassTail[p_active_msg->priority] = NULL;
+        }
+    }
+
     //remove from list of pending msgs
     if ((SC_HeadAddress != p_active_msg) && (SC_TailAddress != p_active_msg))
     {
@@ -1076,6 +1313,9 @@ static void sc_cancel_configurations(void)
     }
     SC_HeadAddress = NULL;
     SC_TailAddress = NULL;
+    memset(SC_ClassTail, 0, sizeof(SC_ClassTail));
+    memset(SC_ClassCount, 0, sizeof(SC_ClassCount));
+    memset(SC_CoalesceTable, 0, sizeof(SC_CoalesceTable));
 }
 
 /*****************************************************************************//**
@@ -1088,20 +1328,24 @@ static void sc_cancel_configurations(void)
 * @version
 * 11/06/2014    Created.
 *******************************************************************************/
-uint8_t * SC_ProcessShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg)
+SC_CONF_RESULT_PTR SC_ProcessShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg)
 {
-    uint8_t*  p_rslt;
-    p_rslt = (uint8_t *)OS_GetMsgMemBlock(sizeof(uint8_t));
+    SC_CONF_RESULT_PTR p_rslt;
+    p_rslt = (SC_CONF_RESULT_PTR)OS_GetMsgMemBlock(sizeof(SC_CONF_RESULT));
     uint8_t res_type = p_ser_msg->generic_conf.confirmation_type;
+    p_rslt->conf_type = res_type;
+    p_rslt->handle = 0;
+    p_rslt->status = (uint8_t)p_ser_msg->generic_conf.status;
     switch (res_type) {
         case MSG_TYPE_SEND_SHADE_DATA_CONF:
-            *p_rslt = (uint8_t)p_ser_msg->shade_conf.status;
+            p_rslt->status = (uint8_t)p_ser_msg->shade_conf.status;
+            p_rslt->handle = p_ser_msg->shade_conf.handle;
             break;
         case MSG_TYPE_SEND_BEACON_CONF:
-            *p_rslt = (uint8_t)p_ser_msg->beacon_conf.status;
+            p_rslt->status = (uint8_t)p_ser_msg->beacon_conf.status;
             break;
         case MSG_TYPE_SEND_GROUP_SET_CONF:
-            *p_rslt = (uint8_t)p_ser_msg->group_conf.status;
+            p_rslt->status = (uint8_t)p_ser_msg->group_conf.status;
             break;
         default:
             break;
@@ -1110,29 +1354,51 @@ uint8_t * SC_ProcessShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg)
     return p_rslt;
 }
 
+/*****************************************************************************//**
+* @brief Determine whether a confirmation from the Nordic answers a config record.
+*
+* @param p_cfg_rec.  Config record waiting for a serial response.
+* @param p_ser_resp.  The confirmation.
+* @return true if the request type matches and, for shade data, the tx handle.
+*******************************************************************************/
+static bool sc_is_confirmation_for(RNC_CONFIG_REC_PTR p_cfg_rec, SC_CONF_RESULT_PTR p_ser_resp)
+{
+    uint8_t req_type = RNC_GetTransportByte(p_cfg_rec->ser_msg, 1);
+
+    if (RFO_ExpectedConfirmation(req_type) != p_ser_resp->conf_type) {
+        return false;
+    }
+    if (p_ser_resp->conf_type == MSG_TYPE_SEND_SHADE_DATA_CONF) {
+        return (RNC_GetTransportByte(p_cfg_rec->ser_msg, SHADE_DATA_REQUEST_HANDLE_INDEX)
+                == p_ser_resp->handle);
+    }
+    return true;
+}
+
 /*****************************************************************************//**
 * @brief This function is called when an event is received indicating that a<br/>
 *  serial response has been received from the Nordic to a shade data config request.
 *
-* @param p_ser_resp is a pointer to the result code of the serial message.
+* @param p_ser_resp is a pointer to the result of the serial message.
 * @return nothing.
 * @author Neal Shurmantine
 * @version
 * 11/06/2014    Created.
 *******************************************************************************/
-void SC_HandleShadeConfirmationResult(uint8_t* p_ser_resp)
+void SC_HandleShadeConfirmationResult(SC_CONF_RESULT_PTR p_ser_resp)
 {
     RNC_CONFIG_REC_PTR p_msg_list;
     RNC_CONFIG_REC_PTR p_active_msg = NULL;
+    uint32_t now;
 
-    if (*p_ser_resp != SC_RSLT_TIMEOUT) {
+    if (p_ser_resp->status != SC_RSLT_TIMEOUT) {
         //if the result is a serial timeout then rfo_outbound task already knows
-        RFO_NotifySerialResponse(*p_ser_resp);
-        if (*p_ser_resp == SC_RSLT_SUCCESS) {
+        RFO_NotifySerialResponse(p_ser_resp->conf_type, p_ser_resp->handle, p_ser_resp->status);
+        if (p_ser_resp->status == SC_RSLT_SUCCESS) {
             printf("ACK\n");
         }
         else {
-            printf("NACK(%02X)\n", *p_ser_resp);
+            printf("NACK(%02X)\n", p_ser_resp->status);
         }
     }
     else {
@@ -1143,12 +1409,13 @@ void SC_HandleShadeConfirmationResult(uint8_t* p_ser_resp)
     }
 
     //Search thru list of pending messages to find the one that is waiting
-    // for a serial response
+    // for this serial response, several may be in flight at once
     p_msg_list = SC_HeadAddress;
     while (p_msg_list != NULL)
     {
         //if message found then
-        if (p_msg_list->state == WAITING_FOR_SER_ACK_STATE)
+        if ((p_msg_list->state == WAITING_FOR_SER_ACK_STATE)
+                && (sc_is_confirmation_for(p_msg_list, p_ser_resp) == true))
         {
             //point to the config record
             p_active_msg = p_msg_list;
@@ -1163,18 +1430,14 @@ void SC_HandleShadeConfirmationResult(uint8_t* p_ser_resp)
     //if config record found that was waiting for a serial response
     if (p_active_msg != NULL)
     {
+        now = OS_GetMsecTick();
+        RFP_NoteConfirmation(p_ser_resp->status, now - p_active_msg->sent_tick);
         p_active_msg->state = WAITING_TO_SEND_NEXT;
-        if (SC_SingleShadeBatteryCheck == true) {
-            p_active_msg->rf_ack_tick_count = SC_SHADE_BATT_REQ_RF_TICK_MAX;
-        }
-        else
-        {
-            p_active_msg->rf_ack_tick_count = SC_SHADE_RF_TICK_MAX;
-        }
-        RNC_StartTickTimer();
+        p_active_msg->send_next_tick = now + RFP_GetHoldMsec(SC_SingleShadeBatteryCheck);
+        sc_start_pacing_timer();
     }
     //free serial response memory
-    OS_ReleaseMsgMemBlock((uint8_t *)p_ser_resp);
+    OS_ReleaseMsgMemBlock((void *)p_ser_resp);
 }
 
 /*****************************************************************************//**
@@ -1189,10 +1452,10 @@ void SC_HandleShadeConfirmationResult(uint8_t* p_ser_resp)
 *******************************************************************************/
 void SC_HandleShadeIndication(PARSE_KEY_STRUCT_PTR p_rf_response)
 {
-    uint16_t cksm;
     uint16_t len;
-    uint8_t c;
 
+    //any shade traffic, duplicates included, takes air time
+    RFP_NoteIndication();
     if (p_rf_response->generic_ind.indication_type == MSG_TYPE_SHADE_DATA_INDICATION) {
 
         // printf("marker1\n");
@@ -1201,19 +1464,17 @@ void SC_HandleShadeIndication(PARSE_KEY_STRUCT_PTR p_rf_response)
 
             // printf("marker2\n");
 
-            cksm = (uint8_t)(p_rf_response->shade_data_ind.source_adr.Device_Id>>8);
-            cksm += (uint8_t)(p_rf_response->shade_data_ind.source_adr.Device_Id & 0xff);
-            len = p_rf_response->shade_data_ind.payload_len - SHADE_INDICATION_HEADER_SIZE;
-            for (c = 0; c < len; ++c)
-            {
-                cksm += p_rf_response->shade_data_ind.msg_payload[c];
+            if (p_rf_response->shade_data_ind.payload_len < SHADE_INDICATION_HEADER_SIZE) {
+                //too short to hold a header, let alone a payload
+                return;
             }
-            if (cksm != SC_RedundantChecksum) {
+            len = p_rf_response->shade_data_ind.payload_len - SHADE_INDICATION_HEADER_SIZE;
+            if (RFD_IsDuplicate(p_rf_response->shade_data_ind.source_adr.Device_Id,
+                    p_rf_response->shade_data_ind.msg_payload, len) == false) {
 
                 // printf("marker3\n");
                 sc_shade_indication_received(p_rf_response);
             }
-            SC_RedundantChecksum = cksm;
         }
     }
     else if (p_rf_response->generic_ind.indication_type == MSG_TYPE_BEACON_INDICATION) {
@@ -1310,7 +1571,7 @@ static void SC_load_slave_data_request(SYSTEM_INDICATION_STRUCT_PTR p_udp_msg)
     req.adr.Unique_Id = 0;
     req.adr.Device_Id = ALL_DEVICES_ADDRESS;
     req.tx_opt = TX_OPTION | TX_OPTION_NO_NET_HEADER;
-    SC_RedundantChecksum = 0xffff;
+    RFD_Flush();
 
     req.len = p_udp_msg->payload_len-2;
     memcpy(req.msg,p_udp_msg->payload,req.len);
@@ -1546,6 +1807,7 @@ static void sc_indication_cur_pos(uint16_t id, uint16_t val, ePosKind kind)
     SC_Positions.device_id = id;
 
     if (SC_FinalPacketData == true) {
+        SST_UpdatePositions(SC_Positions.device_id, &SC_Positions.positions);
         IPC_Client_ReportShadePosition(&SC_Positions);
 
         /*
@@ -1606,6 +1868,7 @@ static void sc_indication_nordic_fw(uint16_t id, uint8_t* p_data)
 {
 printf("ID=%04X\n",id);
     printf("Nordic FW Resp: %02X %02X %02X %02X\n", p_data[0], p_data[1], p_data[2], p_data[3]);
+    SST_UpdateNordicFw(id, p_data);
 }
 
 /*****************************************************************************//**
@@ -1623,6 +1886,7 @@ static void sc_indication_motor_fw(uint16_t id, uint8_t* p_data)
 {
 printf("ID=%04X\n",id);
     printf("Motor FW Resp:  %02X %02X %02X %02X\n", p_data[0], p_data[1], p_data[2], p_data[3]);
+    SST_UpdateMotorFw(id, p_data);
 }
 
 /*****************************************************************************//**
@@ -1754,6 +2018,7 @@ void SC_DisableNetworkJoin(uint16_t token)
     if (SC_NetworkJoinScheduleToken != token) {
         SCH_RemoveScheduledEvent(SC_NetworkJoinScheduleToken);
     }
+    SC_NetworkJoinScheduleToken = NULL_TOKEN;
     LED_NetworkID(RC_IsNetworkIdAssigned());
     SC_JoinEnabled = false;
 }
@@ -1791,12 +2056,29 @@ bool SC_IsNetworkJoiningActive(void)
 *******************************************************************************/
 static void sc_indication_batt_level(uint16_t id, uint8_t* p_data)
 {
+    SST_UpdateBattery(id, *p_data);
     if (SC_SingleShadeBatteryCheck == true) {
-#ifdef USE_ME
-        IPC_Client_UpdateBatteryStatus(id, *p_data);
-#else
+        BATT_CHECK_STRUCT_PTR p_shades;
+        COARSE_BATTERY_LEVEL lvl = NO_VALUE;
         char lvl_str[7];
-        COARSE_BATTERY_LEVEL lvl = IPC_Client_UpdateBatteryStatus(id, *p_data);
+        uint16_t count;
+        uint16_t n;
+
+        IPC_Client_UpdateBatteryStatus(id, *p_data);
+        //the shade's type comes with the battery powered shade list, as
+        //for the weekly check
+        count = SI_GetShadeCount();
+        if (count != 0) {
+            p_shades = (BATT_CHECK_STRUCT_PTR)OS_GetMemBlock(count * sizeof(BATT_CHECK_STRUCT));
+            count = SI_GetShadeBattData(p_shades);
+            for (n = 0; n < count; ++n) {
+                if (p_shades[n].shade_id == id) {
+                    lvl = SC_GetCoarseBatteryLevel(p_shades[n].type, *p_data);
+                    break;
+                }
+            }
+            OS_ReleaseMemBlock((void *)p_shades);
+        }
         if (lvl == RED) {
             strcpy(lvl_str,"RED");
         }
@@ -1809,65 +2091,57 @@ static void sc_indication_batt_level(uint16_t id, uint8_t* p_data)
         else {
             strcpy(lvl_str,"NONE");
         }
+        printf("ID = %04x, voltage = %d\n", id, *p_data);
         printf("Level = %s\n",lvl_str);
-#endif
     }
     else {
-        uint16_t n;
-        for (n=0; n<MaxShades; ++n) {
-            if (p_BattCheckData[n].shade_id == id) {
-                p_BattCheckData[n].replicate_level[p_BattCheckData[n].replicate_counter] = *p_data;
-                ++p_BattCheckData[n].replicate_counter;
-                break;
-            }
-        }
+        BSW_NoteReading(id, *p_data);
     }
 }
 
 /*****************************************************************************//**
-* @brief Analyze data from periodic battery check.  Up to 7 attempts are made to
-*    determine the battery level of each shade.  If the shade has responded 5 times
-*    then the highest measured value is determined from the 5 readings.  This value
-*    is considered the true value and is used to determine if the battery
-*    is low.
+* @brief Report data from periodic battery check.  The sweep has settled each
+*    shade's level as the highest of its readings, or 0 if it did not answer
+*    often enough.  This value is considered the true value and is used to
+*    determine if the battery is low.
 *
-* @param nothing.
+* @param p_data.  Shades swept.
+* @param count.  Number of shades.
 * @return none.
 * @author Neal Shurmantine
 * @version
 * 09/19/2016    Created.
 *******************************************************************************/
-static void SC_store_weekly_battery_levels(void)
+static void SC_store_weekly_battery_levels(BATT_CHECK_STRUCT_PTR p_data, uint16_t count)
 {
     uint16_t n;
-    uint16_t j;
     uint8_t max_level;
     char lvl_str[7];
-    for (n=0; n < MaxShades; ++n) {
-        max_level = 0;
-        if (p_BattCheckData[n].replicate_counter >= MAX_BATTERY_MEASUREMENTS_PER_SHADE) {
-            for (j=0; j < MAX_BATTERY_MEASUREMENTS_PER_SHADE; ++j) {
-                if (max_level < p_BattCheckData[n].replicate_level[j]) {
-                    max_level = p_BattCheckData[n].replicate_level[j];
-                }
-            }
+    for (n=0; n < count; ++n) {
+        max_level = (uint8_t)p_data[n].bat_level;
+        IPC_Client_UpdateBatteryStatus(p_data[n].shade_id,max_level);
+        if (max_level == 0) {
+            //did not answer
+            p_data[n].coarse_lvl = NO_VALUE;
+        }
+        else {
+            p_data[n].coarse_lvl = SC_GetCoarseBatteryLevel(p_data[n].type, max_level);
         }
-        p_BattCheckData[n].coarse_lvl = IPC_Client_UpdateBatteryStatus(p_BattCheckData[n].shade_id,max_level);
-        if (p_BattCheckData[n].coarse_lvl == RED) {
+        if (p_data[n].coarse_lvl == RED) {
             SC_LowBatteryCount++;
             strcpy(lvl_str,"RED");
         }
-        else if (p_BattCheckData[n].coarse_lvl == YELLOW) {
+        else if (p_data[n].coarse_lvl == YELLOW) {
             SC_LowBatteryCount++;
             strcpy(lvl_str,"YELLOW");
         }
-        else if (p_BattCheckData[n].coarse_lvl == GREEN) {
+        else if (p_data[n].coarse_lvl == GREEN) {
             strcpy(lvl_str,"GREEN");
         }
         else {
             strcpy(lvl_str,"NONE");
         }
-        printf("ID = %04x, voltage = %d coarse_lvl=%s\n", p_BattCheckData[n].shade_id, max_level, lvl_str);
+        printf("ID = %04x, voltage = %d coarse_lvl=%s\n", p_data[n].shade_id, max_level, lvl_str);
         if (flashDataNeedsWritten == true) {
             writeDataBufferToCurrentSector();
             SC_MaintainFlash = true;
@@ -1942,6 +2216,14 @@ void SC_ScheduleBatteryCheck(void)
         SCH_RemoveScheduledEvent(SC_BatteryCheckToken);
     }
     SC_BatteryCheckToken = SCH_ScheduleDaily(&day, SC_BeginBatteryCheckProcess);
+
+    //first call after start up, pick up a sweep the reboot cut short
+    if (SC_BatteryResumeChecked == false) {
+        SC_BatteryResumeChecked = true;
+        if (BSW_HasSavedSweep() == true) {
+            SCH_ScheduleEventPostSeconds(SC_BATTERY_RESUME_DELAY_SECONDS, SC_resume_battery_check);
+        }
+    }
 }
 
 /*****************************************************************************//**
@@ -1993,23 +2275,16 @@ void SC_BeginBatteryCheckProcess(uint16_t token)
     localtime_r(&now, &date);
     if ((date.tm_wday == 0) || (SC_IsForceBatteryCheck == true)) {  //Sunday=0
         SC_IsForceBatteryCheck = false;
-        SC_LowBatteryCount = 0;
-        //get total number of shades and reserve memory
-        MaxShades = SI_GetShadeCount();
-        if (MaxShades) {
-            p_BattCheckData = (BATT_CHECK_STRUCT_PTR)OS_GetMemBlock(MaxShades*sizeof(BATT_CHECK_STRUCT));
-
-            //fill out list of BATT_CHECK_STRUCT with all non-plugged shade data
-            MaxShades = SI_GetShadeBattData(p_BattCheckData);
-            if (MaxShades) {
+        if (BSW_IsActive() == true) {
+            LOG_LogEvent("Battery Check Busy");
+        }
+        else {
+            SC_LowBatteryCount = 0;
+            SC_MaintainFlash = false;
+            if (BSW_Start(SC_battery_sweep_done) == true) {
                 LOG_LogEvent("Check Shade Batteries");
-                ShadeIndex = 0;
-                BattCheckRetryCount = 0;
-                SC_MaintainFlash = false;
-                SC_batt_check_proc_continue(0);
             }
             else {
-                OS_ReleaseMemBlock((void *)p_BattCheckData);
                 LOG_LogEvent("No Batt Powered Shades");
             }
         }
@@ -2022,47 +2297,40 @@ void SC_BeginBatteryCheckProcess(uint16_t token)
 }
 
 /*****************************************************************************//**
-* @brief This function is called from the scheduler as part of the battery checking
-*        process. Each shade battery request is scheduled with a 4 second interval
-*        between messages.  The call is made up to 7 times (BATTERY_CHECK_RETRY_MAX)
-*        for each shade or until the shade responds with its battery level 
-*        5 times (MAX_BATTERY_MEASUREMENTS_PER_SHADE).
+* @brief This function is called by the battery sweep once every shade has
+*        been measured.  It stores the levels and reports low batteries.
+*        Note: this function is called in the context of the SCH_ScheduleTask.
 *
-* @param token. Unused but required as part of the scheduler callback.
+* @param p_data.  Shades swept, released by the sweep on return.
+* @param count.  Number of shades.
 * @return none.
-* @author Neal Shurmantine
-* @version
-* 03/09/2015    Created.
 *******************************************************************************/
-static void SC_batt_check_proc_continue(uint16_t token)
+static void SC_battery_sweep_done(BATT_CHECK_STRUCT_PTR p_data, uint16_t count)
 {
-    P3_Address_Internal_Type address;
-
-    while(ShadeIndex < MaxShades) {
-        if ((p_BattCheckData[ShadeIndex].replicate_counter < MAX_BATTERY_MEASUREMENTS_PER_SHADE) && 
-                (BattCheckRetryCount < BATTERY_CHECK_RETRY_MAX)) {
-            break;
+    SC_store_weekly_battery_levels(p_data, count);
+    if (SC_MaintainFlash == true) {
+        maintainFlash(1);
     }
-        ++ShadeIndex;
-        BattCheckRetryCount = 0;
-            }
-    if (ShadeIndex < MaxShades) {
-            ++BattCheckRetryCount;
-        address.Unique_Id = 0;
-        address.Device_Id = p_BattCheckData[ShadeIndex].shade_id;
-        SC_RequestBatteryLevel(P3_Address_Mode_Device_Id, &address, NULL);
-        SCH_ScheduleEventPostSeconds(SECONDS_BETWEEN_BATTERY_CHECKS, SC_batt_check_proc_continue);
-        }
-        else {
-        SC_store_weekly_battery_levels();
-        MaxShades = 0;
-        OS_ReleaseMemBlock((void *)p_BattCheckData);
-        if (SC_MaintainFlash == true) {
-            maintainFlash(1);
-        }
-        RDS_TriggerRemoteSync(NULL_TOKEN);
-        if (SC_LowBatteryCount != 0) {
-            RMT_FaultNotification(0);
+    RDS_TriggerRemoteSync(NULL_TOKEN);
+    if (SC_LowBatteryCount != 0) {
+        RMT_FaultNotification(0);
+    }
+}
+
+/*****************************************************************************//**
+* @brief This function is called from the scheduler some time after start up
+*        if a battery sweep was cut short by a reboot, and carries it on.
+*
+* @param token. Unused but required as part of the scheduler callback.
+* @return none.
+*******************************************************************************/
+static void SC_resume_battery_check(uint16_t token)
+{
+    if (BSW_IsActive() == false) {
+        SC_LowBatteryCount = 0;
+        SC_MaintainFlash = false;
+        if (BSW_Resume(SC_battery_sweep_done) == true) {
+            LOG_LogEvent("Resume Battery Check");
         }
     }
 }
@@ -2140,8 +2408,7 @@ void SC_DiscoverShades(bool is_absolute,uint16_t type)
 *******************************************************************************/
 static void sc_continue_discovery(void)
 {
-    SC_DiscoverHead = NULL;
-    SC_DiscoverTail = NULL;
+    SCD_Reset(&SC_Discovered);
     SC_DiscoveryActive = true;
     SC_CapturingShades = false;
     if (SC_AbsoluteDiscoveryActive == true) {
@@ -2178,7 +2445,6 @@ bool SC_IsDiscoveryActive(void)
 *******************************************************************************/
 void sc_beacon_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response)
 {
-    uint8_t dev_type;
     if ((SC_JoinEnabled == true) && (p_rf_response->beacon_ind.source_network_id != ALL_NETWORK_ID)
                 && (p_rf_response->beacon_ind.source_network_id != FACTORY_DEFAULT_NETWORK_ID)) {
         SC_DisableNetworkJoin(0);
@@ -2188,17 +2454,7 @@ void sc_beacon_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response)
     else if (SC_DiscoveryActive == true) {
         if ((p_rf_response->beacon_ind.source_device_id != 0)  //ignore echoed beacon from hub
             && (p_rf_response->beacon_ind.payload_len == (BEACON_INDICATION_HEADER_SIZE + 1)) ) {
-            if (SC_is_redundant_discovery_response(p_rf_response->beacon_ind.source_device_id ) == false) {
-                printf("NID=%04X ID=%04X TYPE=%d\n", p_rf_response->beacon_ind.source_network_id,
-                                    p_rf_response->beacon_ind.source_device_id,
-                                    p_rf_response->beacon_ind.msg_payload[0]);
-                dev_type = p_rf_response->beacon_ind.msg_payload[0];
-                if ((SC_DiscoveryType == dtAny)
-                            || ((SC_DiscoveryType == dtSceneController) && (dev_type == SC_SCENE_CONTROLLER_TYPE))
-                            || ((SC_DiscoveryType == dtShades) && (dev_type != SC_SCENE_CONTROLLER_TYPE) )) {
-                    SC_create_discover_record(p_rf_response);
-                }
-            }
+            SC_record_discover_response(p_rf_response);
         }
     }
 //#ifdef DEBUG_PRINT
@@ -2209,31 +2465,6 @@ void sc_beacon_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response)
 //#endif
 }
 
-/*****************************************************************************//**
-* @brief Scan through the list of shade discovery responses to see if this
-*       shade ID is alreay present.
-*
-* @param id. Id of shade to check
-* @return none.
-* @author Neal Shurmantine
-* @version
-* 08/19/2015    Created.
-*******************************************************************************/
-static bool SC_is_redundant_discovery_response(uint16_t id)
-{
-    bool redund = false;
-    SC_SHADE_DISC_REC_PTR p_cfg_rec = SC_DiscoverHead;
-
-    while(p_cfg_rec != NULL) {
-        if (p_cfg_rec->shade_rsp.device_id == id) {
-            redund = true;
-            break;
-        }
-        p_cfg_rec = p_cfg_rec->p_next_rec;
-    }
-    return redund;
-}
-
 /*****************************************************************************//**
 * @brief This callback function executes after a message has been sent to set
 *     the discovered flag of a shade.  If all messages on the list have been
@@ -2266,45 +2497,39 @@ static void SC_discovery_callback(void * p_unused)
 }
 
 /*****************************************************************************//**
-* @brief This function allocates memory and adds an entry on the linked list of
-*     devices responding to discovery.
+* @brief This function notes a response to the discovery beacon in the registry
+*     of devices that answered.  A device is kept for processing the first time
+*     it answers if it is of the type being discovered; later answers only
+*     update its entry.
 *
 * @param p_rf_response. Raw serial message data from Nordic
-* @return SC_SHADE_DISC_REC_PTR.  Pointer to this record.
-* @author Neal Shurmantine
-* @version
-* 11/06/2014    Created(date approximate).
+* @return none.
 *******************************************************************************/
-static SC_SHADE_DISC_REC_PTR SC_create_discover_record(PARSE_KEY_STRUCT_PTR p_rf_response)
+static void SC_record_discover_response(PARSE_KEY_STRUCT_PTR p_rf_response)
 {
-    SC_SHADE_DISC_REC_PTR p_cfg_rec;
-    SC_SHADE_DISC_REC_PTR p_last_rec;
+    SCD_ENTRY_PTR p_entry;
+    bool is_new;
+    bool wanted;
     uint8_t type;
 
-    p_cfg_rec = (SC_SHADE_DISC_REC_PTR)OS_GetMemBlock(sizeof(SC_SHADE_DISC_REC));
-
-    //if no records in the list
-    if (SC_DiscoverHead == NULL)
-    {
-        //create list with this record only
-        SC_DiscoverHead = p_cfg_rec;
-        SC_DiscoverTail = p_cfg_rec;
-    }
-    else
-    {
-        //add this record to the end of the list
-        p_last_rec = SC_DiscoverTail;
-        p_last_rec->p_next_rec = p_cfg_rec;
-        SC_DiscoverTail = p_cfg_rec;
+    p_entry = SCD_Record(&SC_Discovered, &p_rf_response->beacon_ind, &is_new);
+    if ((p_entry == NULL) || (is_new == false)) {
+        return;
     }
-    p_cfg_rec->p_next_rec = NULL;
-    p_cfg_rec->shade_rsp.device_id = p_rf_response->beacon_ind.source_device_id;
-    p_cfg_rec->shade_rsp.uuid = p_rf_response->beacon_ind.source_adr.Unique_Id;
-    p_cfg_rec->shade_rsp.network_id = p_rf_response->beacon_ind.source_network_id;
+    printf("NID=%04X ID=%04X TYPE=%d\n", p_rf_response->beacon_ind.source_network_id,
+                        p_rf_response->beacon_ind.source_device_id,
+                        p_rf_response->beacon_ind.msg_payload[0]);
 
     type = p_rf_response->beacon_ind.msg_payload[0];
+    wanted = (SC_DiscoveryType == dtAny)
+                || ((SC_DiscoveryType == dtSceneController) && (type == SC_SCENE_CONTROLLER_TYPE))
+                || ((SC_DiscoveryType == dtShades) && (type != SC_SCENE_CONTROLLER_TYPE) );
+    if (wanted == false) {
+        SCD_Ignore(&SC_Discovered, p_entry);
+        return;
+    }
 #ifdef SPOOF_SHADE_TYPES
-    switch (p_cfg_rec->shade_rsp.device_id) {
+    switch (p_entry->shade_rsp.device_id) {
         case 0x4873:
             type = 14;
             break;
@@ -2328,11 +2553,9 @@ static SC_SHADE_DISC_REC_PTR SC_create_discover_record(PARSE_KEY_STRUCT_PTR p_rf
     }
 #endif
 
-    p_cfg_rec->shade_rsp.shade_type = type;
+    p_entry->shade_rsp.shade_type = type;
 
     SC_AvoidContinueDiscovery = (type == SC_SCENE_CONTROLLER_TYPE);
-
-    return p_cfg_rec;
 }
 
 /*****************************************************************************//**
@@ -2349,7 +2572,7 @@ static SC_SHADE_DISC_REC_PTR SC_create_discover_record(PARSE_KEY_STRUCT_PTR p_rf
 *******************************************************************************/
 void SC_discovery_timeout(uint16_t token)
 {
-    if (SC_DiscoverHead == NULL) {
+    if (SCD_HeardCount(&SC_Discovered) == 0) {
         if (SC_AbsoluteDiscoveryActive || SC_AvoidContinueDiscovery) {
             SC_AbsoluteDiscoveryActive = false;
             SC_DiscoveryActive = false;
@@ -2376,9 +2599,10 @@ void SC_discovery_timeout(uint16_t token)
 }
 
 /*****************************************************************************//**
-* @brief This function goes through the linked list of devices that responed to
-*   the discovery beacon and queues up a set-discovered flag message to be
-*   sent to each.  The HTTP task is also notified of a new responder.
+* @brief This function goes through the registry of devices that responed to
+*   the discovery beacon, in the order they were first heard, and queues up a
+*   set-discovered flag message to be sent to each.  The HTTP task is also
+*   notified of a new responder.
 *
 *   Note: This function is called in the context of the RNC task.
 *
@@ -2391,35 +2615,17 @@ void SC_discovery_timeout(uint16_t token)
 void SC_ProcessDiscoveredList(void)
 {
     P3_Address_Internal_Type address;
+    SCD_ENTRY_PTR p_entry;
 
-    while(SC_DiscoverHead != NULL) {
-        DISCOVERY_DATA_STRUCT_PTR p_disc_data = &SC_DiscoverHead->shade_rsp;
+    while((p_entry = SCD_NextHeard(&SC_Discovered)) != NULL) {
+        DISCOVERY_DATA_STRUCT_PTR p_disc_data = &p_entry->shade_rsp;
         address.Unique_Id = 0;
         address.Device_Id = p_disc_data->device_id;
         SC_SetDiscoveredFlagProc(P3_Address_Mode_Device_Id, &address);
         IPC_Client_RecordDiscovery(p_disc_data);
-        SC_remove_discovered_shade_from_list();
     }
 }
 
-/*****************************************************************************//**
-* @brief Remove an entry from the linked list of devices that responded to
-*    the beacon discovery message and free memory.
-*
-* @param none.
-* @return nothing.
-* @author Neal Shurmantine
-* @version
-* 11/06/2014    Created(date approximate).
-*******************************************************************************/
-static void SC_remove_discovered_shade_from_list(void)
-{
-    SC_SHADE_DISC_REC_PTR p_cfg_rec;
-    p_cfg_rec = SC_DiscoverHead;
-    SC_DiscoverHead = p_cfg_rec->p_next_rec;
-    OS_ReleaseMemBlock((void *)p_cfg_rec);
-}
-
 
 //----------------------------SCENE CONTROLLER-----------------------------------
 
@@ -2462,6 +2668,42 @@ static void sc_group_set_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response)
 {
 }
 
+/*****************************************************************************//**
+* @brief Arm the rnc tick timer for the earliest end of hold among the messages
+*   waiting to send next, or stop it if there are none.
+*
+* @param none.
+* @return none.
+*******************************************************************************/
+static void sc_start_pacing_timer(void)
+{
+    RNC_CONFIG_REC * p_msg_list;
+    uint32_t now = OS_GetMsecTick();
+    int32_t remaining;
+    int32_t wait = 0;
+    bool holding = false;
+
+    p_msg_list = SC_HeadAddress;
+    while (p_msg_list != NULL)
+    {
+        if (p_msg_list->state == WAITING_TO_SEND_NEXT)
+        {
+            remaining = (int32_t)(p_msg_list->send_next_tick - now);
+            if ((holding == false) || (remaining < wait)) {
+                wait = remaining;
+            }
+            holding = true;
+        }
+        p_msg_list = p_msg_list->p_next_rec;
+    }
+    if (holding == true) {
+        RNC_StartTickTimer((wait > 0) ? (uint32_t)wait : 1);
+    }
+    else {
+        RNC_StopTickTimer();
+    }
+}
+
 /*****************************************************************************//**
 * @brief This function is called after a timeout expires following the transmission
 *   of a message to a shade.  If a callback has been assigned for this message
@@ -2477,32 +2719,40 @@ static void sc_group_set_indication_received(PARSE_KEY_STRUCT_PTR p_rf_response)
 void SC_ProcessRFTimeout(void)
 {
     RNC_CONFIG_REC * p_msg_list;
+    void(*p_callback)(void*);
+    bool cleared = false;
+    uint32_t now = OS_GetMsecTick();
 
+    //with a window of messages in flight several may be holding, each
+    //  until its own time; clear expired messages one at a time from
+    //  the head since a callback may change the list
     p_msg_list = SC_HeadAddress;
     while (p_msg_list != NULL)
     {
-        if (p_msg_list->state == WAITING_TO_SEND_NEXT)
+        if ((p_msg_list->state == WAITING_TO_SEND_NEXT)
+                && ((int32_t)(now - p_msg_list->send_next_tick) >= 0))
         {
-            //if wait has expired then
-            --p_msg_list->rf_ack_tick_count;
-            if (p_msg_list->rf_ack_tick_count == 0)
-            {
-                if (SC_DiscoveryActive == false) {
-                    LED_Flicker(false);
-                }
-                SC_clear_item_in_list(p_msg_list);
-                if (p_msg_list->p_callback != NULL) {
-                    (*p_msg_list->p_callback)(NULL);
-                }
-                SC_GetNextMessageToSend();
+            //the record is freed, keep the callback
+            p_callback = p_msg_list->p_callback;
+            SC_clear_item_in_list(p_msg_list);
+            if (p_callback != NULL) {
+                (*p_callback)(NULL);
             }
-            //exit loop, only one message will have this state
-            p_msg_list = NULL;
+            cleared = true;
+            p_msg_list = SC_HeadAddress;
         }
         else {
             p_msg_list = p_msg_list->p_next_rec;
         }
     }
+    if (cleared == true)
+    {
+        if (SC_DiscoveryActive == false) {
+            LED_Flicker(false);
+        }
+        SC_GetNextMessageToSend();
+    }
+    sc_start_pacing_timer();
 }
 
 //----------------------------RESET ALL SHADES ----------------------------------
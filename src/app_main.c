@@ -49,6 +49,7 @@ THREAD_TEMPLATE_STRUCT  ThreadList[] =
     { NBT_BOOTLOAD_TASK_NUM, nbt_nordic_download_task, 6000, NBT_BOOTLOAD_TASK_PRI, "NBT_BootloadTask"},
     { RMT_REMOTE_SERVER_TASK_NUM, RMT_remote_server_task, 20000, RMT_REMOTE_SERVER_TASK_PRI, "RMT_RemoteServerTask"},
     { IPC_SERVER_TASK_NUM, ipc_server_task, 10000, IPC_SERVER_TASK_PRI, "ipc_server_task"},
+    { IPC_REPORT_TASK_NUM, ipc_report_task, 4000, IPC_REPORT_TASK_PRI, "ipc_report_task"},
     { 0 }
 };
 
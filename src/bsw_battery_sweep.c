@@ -0,0 +1,582 @@
+/***************************************************************************//**
+ * @file bsw_battery_sweep.c
+ * @brief Reads the battery level of every battery powered shade.
+ *
+ *  The weekly battery check used to ask one shade at a time, a request
+ *  every SECONDS_BETWEEN_BATTERY_CHECKS, so a large house kept the radio
+ *  busy for a long time.  Here a window of shades is asked at once; each
+ *  tick sends one request to every shade in the window and a shade leaves
+ *  the window when it is done:
+ *
+ *  - MAX_BATTERY_MEASUREMENTS_PER_SHADE readings have come back, or
+ *  - BSW_STABLE_READINGS readings agree to within BSW_STABLE_SPREAD, or
+ *  - so many of its BATTERY_CHECK_RETRY_MAX requests went unanswered
+ *    that it can no longer give the readings it needs.
+ *
+ *  The level kept is the highest reading, or 0 if there were not enough.
+ *
+ *  The requests go out in the lowest priority class and a tick sends
+ *  nothing while user commands or scenes are queued, or while a window's
+ *  worth of maintenance messages is still waiting to go out, or while
+ *  the reports to the databases are backed up.
+ *
+ *  The shades finished so far are written to BATT_SWEEP_FILENAME as the
+ *  sweep goes, so a sweep cut short by a reboot is picked up where it
+ *  stopped rather than started over.
+ *
+ *  Ticks run in the schedule task and readings arrive in the rnc task;
+ *  the sweep state is shared under BSW_Mutex.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "os.h"
+#include "file_names.h"
+#include "SCH_ScheduleTask.h"
+#include "ipc_client_report.h"
+#include "bsw_battery_sweep.h"
+
+/* Local Symbols
+*******************************************************************************/
+#define BSW_FILE_MAGIC      0x42535750      //"BSWP"
+#define BSW_FILE_VERSION    1
+#define BSW_TEMP_FILENAME   BATT_SWEEP_FILENAME ".tmp"
+
+typedef enum {
+    BSW_SHADE_WAITING,
+    BSW_SHADE_ACTIVE,
+    BSW_SHADE_DONE
+} BSW_SHADE_STATE_T;
+
+typedef struct BSW_SHADE_TAG
+{
+    uint8_t tries;              //requests sent
+    uint8_t state;              //BSW_SHADE_STATE_T
+} BSW_SHADE;
+
+typedef struct BSW_FILE_HEADER_TAG
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;             //BSW_FILE_ENTRY records that follow
+    int64_t started;            //time_t the sweep began
+} __attribute__((packed)) BSW_FILE_HEADER;
+
+typedef struct BSW_FILE_ENTRY_TAG
+{
+    uint16_t shade_id;
+    uint16_t bat_level;
+} __attribute__((packed)) BSW_FILE_ENTRY;
+
+/* Local variables
+*******************************************************************************/
+static pthread_mutex_t BSW_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static BATT_CHECK_STRUCT_PTR BSW_Data;
+static BSW_SHADE * BSW_Shade;
+static uint16_t BSW_Count;
+/** Next shade to bring into the window. */
+static uint16_t BSW_Cursor;
+/** Shades in the window, as indexes into BSW_Data. */
+static uint16_t BSW_Active[BSW_WINDOW_MAX];
+static uint16_t BSW_ActiveCount;
+static uint16_t BSW_Window = BSW_WINDOW_DEFAULT;
+static time_t BSW_Started;
+static BSW_DONE_CALLBACK BSW_Done;
+static BSW_STATS BSW_Stats;
+
+/* Local Function Declarations
+*******************************************************************************/
+static bool bsw_begin(BSW_DONE_CALLBACK p_done, bool resume);
+static void bsw_tick(uint16_t token);
+static bool bsw_is_finished(uint16_t n);
+static bool bsw_is_stable(BATT_CHECK_STRUCT_PTR p_shade);
+static void bsw_retire(uint16_t n);
+static void bsw_save(void);
+static bool bsw_load(void);
+static bool bsw_read_header(FILE * f_handle, BSW_FILE_HEADER * p_header);
+
+/*******************************************************************************
+* Procedure:    BSW_Start
+* Purpose:      Begin a sweep of all battery powered shades.
+* Passed:       function to call with the results when the sweep is done
+*
+* Returned:     false if a sweep is already running or there are no
+*               battery powered shades
+* Globals:      none
+*******************************************************************************/
+bool BSW_Start(BSW_DONE_CALLBACK p_done)
+{
+    return bsw_begin(p_done, false);
+}
+
+/*******************************************************************************
+* Procedure:    BSW_Resume
+* Purpose:      Carry on with a sweep saved before the last reboot.
+* Passed:       function to call with the results when the sweep is done
+*
+* Returned:     false if a sweep is already running or there is no recent
+*               saved sweep to resume
+* Globals:      none
+*******************************************************************************/
+bool BSW_Resume(BSW_DONE_CALLBACK p_done)
+{
+    return bsw_begin(p_done, true);
+}
+
+/*******************************************************************************
+* Procedure:    BSW_HasSavedSweep
+* Purpose:      Tell whether a recent unfinished sweep was saved.
+* Passed:       none
+*
+* Returned:     true if BSW_Resume would have something to resume
+* Globals:      none
+*******************************************************************************/
+bool BSW_HasSavedSweep(void)
+{
+    BSW_FILE_HEADER header;
+    bool rtn = false;
+    FILE * f_handle = fopen(BATT_SWEEP_FILENAME, "r");
+
+    if (f_handle != NULL) {
+        rtn = bsw_read_header(f_handle, &header);
+        fclose(f_handle);
+    }
+    return rtn;
+}
+
+/*******************************************************************************
+* Procedure:    BSW_IsActive
+* Purpose:      Tell whether a sweep is running.
+* Passed:       none
+*
+* Returned:     true if it is
+* Globals:      none
+*******************************************************************************/
+bool BSW_IsActive(void)
+{
+    bool active;
+
+    pthread_mutex_lock(&BSW_Mutex);
+    active = BSW_Stats.active;
+    pthread_mutex_unlock(&BSW_Mutex);
+    return active;
+}
+
+/*******************************************************************************
+* Procedure:    BSW_NoteReading
+* Purpose:      Keep a battery reading if the shade is being asked.
+* Passed:       id of the shade and the level it gave, 100 mV units
+*
+* Returned:     true if the reading belongs to the sweep
+* Globals:      none
+*******************************************************************************/
+bool BSW_NoteReading(uint16_t shade_id, uint8_t level)
+{
+    BATT_CHECK_STRUCT_PTR p_shade;
+    bool rtn = false;
+    uint16_t i;
+
+    pthread_mutex_lock(&BSW_Mutex);
+    if (BSW_Stats.active == true) {
+        for (i = 0; i < BSW_ActiveCount; ++i) {
+            p_shade = &BSW_Data[BSW_Active[i]];
+            if (p_shade->shade_id == shade_id) {
+                if (p_shade->replicate_counter < MAX_BATTERY_MEASUREMENTS_PER_SHADE) {
+                    p_shade->replicate_level[p_shade->replicate_counter++] = level;
+                    ++BSW_Stats.readings;
+                }
+                rtn = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&BSW_Mutex);
+    return rtn;
+}
+
+/*******************************************************************************
+* Procedure:    BSW_SetWindow
+* Purpose:      Set how many shades are asked at the same time.
+* Passed:       the window, 1 to BSW_WINDOW_MAX
+*
+* Returned:     false if out of range
+* Globals:      none
+* Notes:        A smaller window takes effect as shades leave the current
+*               one.
+*******************************************************************************/
+bool BSW_SetWindow(uint16_t window)
+{
+    if ((window == 0) || (window > BSW_WINDOW_MAX)) {
+        return false;
+    }
+    pthread_mutex_lock(&BSW_Mutex);
+    BSW_Window = window;
+    pthread_mutex_unlock(&BSW_Mutex);
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    BSW_GetStats
+* Purpose:      Copy out the sweep counters.
+* Passed:       where to put them
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void BSW_GetStats(BSW_STATS * p_stats)
+{
+    pthread_mutex_lock(&BSW_Mutex);
+    *p_stats = BSW_Stats;
+    p_stats->window = BSW_Window;
+    p_stats->in_flight = BSW_ActiveCount;
+    pthread_mutex_unlock(&BSW_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    bsw_begin
+* Purpose:      Collect the battery powered shades and start the ticks.
+* Passed:       function to call when done, true to pick up the saved sweep
+*
+* Returned:     true if a sweep was started
+* Globals:      none
+*******************************************************************************/
+static bool bsw_begin(BSW_DONE_CALLBACK p_done, bool resume)
+{
+    uint16_t count;
+
+    pthread_mutex_lock(&BSW_Mutex);
+    if (BSW_Stats.active == true) {
+        pthread_mutex_unlock(&BSW_Mutex);
+        return false;
+    }
+    count = SI_GetShadeCount();
+    if (count == 0) {
+        pthread_mutex_unlock(&BSW_Mutex);
+        return false;
+    }
+    BSW_Data = (BATT_CHECK_STRUCT_PTR)OS_GetMemBlock(count * sizeof(BATT_CHECK_STRUCT));
+    //fill out list of BATT_CHECK_STRUCT with all non-plugged shade data
+    BSW_Count = SI_GetShadeBattData(BSW_Data);
+    if (BSW_Count == 0) {
+        OS_ReleaseMemBlock((void *)BSW_Data);
+        pthread_mutex_unlock(&BSW_Mutex);
+        return false;
+    }
+    BSW_Shade = (BSW_SHADE *)OS_GetMemBlock(BSW_Count * sizeof(BSW_SHADE));
+    memset(BSW_Shade, 0, BSW_Count * sizeof(BSW_SHADE));
+    memset(&BSW_Stats, 0, sizeof(BSW_Stats));
+    BSW_Cursor = 0;
+    BSW_ActiveCount = 0;
+    BSW_Done = p_done;
+    BSW_Stats.shades = BSW_Count;
+
+    if (resume == true) {
+        if (bsw_load() == false) {
+            OS_ReleaseMemBlock((void *)BSW_Shade);
+            OS_ReleaseMemBlock((void *)BSW_Data);
+            pthread_mutex_unlock(&BSW_Mutex);
+            return false;
+        }
+        BSW_Stats.resumed = true;
+    }
+    else {
+        OS_GetTimeLocal(&BSW_Started);
+        bsw_save();
+    }
+    BSW_Stats.active = true;
+    pthread_mutex_unlock(&BSW_Mutex);
+
+    bsw_tick(0);
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    bsw_tick
+* Purpose:      Move finished shades out of the window, fill it and ask
+*               every shade in it for its level.
+* Passed:       token. Unused but required as part of the scheduler callback.
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+static void bsw_tick(uint16_t token)
+{
+    P3_Address_Internal_Type address;
+    BATT_CHECK_STRUCT_PTR p_data;
+    BSW_DONE_CALLBACK p_done;
+    bool changed = false;
+    uint16_t count;
+    uint16_t n;
+    uint16_t i;
+
+    pthread_mutex_lock(&BSW_Mutex);
+    if (BSW_Stats.active == false) {
+        pthread_mutex_unlock(&BSW_Mutex);
+        return;
+    }
+    //stay behind user traffic and don't pile up requests of our own
+    if ((SC_GetQueuedCount(SC_PRIORITY_INTERACTIVE) != 0)
+            || (SC_GetQueuedCount(SC_PRIORITY_SCENE) != 0)
+            || (SC_GetQueuedCount(SC_PRIORITY_MAINTENANCE) >= BSW_Window)
+            || (IPC_Report_IsBackedUp() == true)) {
+        ++BSW_Stats.deferred_ticks;
+        SCH_ScheduleEventPostSeconds(SECONDS_BETWEEN_BATTERY_CHECKS, bsw_tick);
+        pthread_mutex_unlock(&BSW_Mutex);
+        return;
+    }
+
+    for (i = 0; i < BSW_ActiveCount; ) {
+        n = BSW_Active[i];
+        if (bsw_is_finished(n) == true) {
+            bsw_retire(n);
+            BSW_Active[i] = BSW_Active[--BSW_ActiveCount];
+            changed = true;
+        }
+        else {
+            ++i;
+        }
+    }
+    while ((BSW_ActiveCount < BSW_Window) && (BSW_Cursor < BSW_Count)) {
+        if (BSW_Shade[BSW_Cursor].state == BSW_SHADE_WAITING) {
+            BSW_Shade[BSW_Cursor].state = BSW_SHADE_ACTIVE;
+            BSW_Active[BSW_ActiveCount++] = BSW_Cursor;
+        }
+        ++BSW_Cursor;
+    }
+    if (changed == true) {
+        bsw_save();
+    }
+
+    if (BSW_ActiveCount != 0) {
+        for (i = 0; i < BSW_ActiveCount; ++i) {
+            n = BSW_Active[i];
+            ++BSW_Shade[n].tries;
+            ++BSW_Stats.requests;
+            address.Unique_Id = 0;
+            address.Device_Id = BSW_Data[n].shade_id;
+            SC_RequestBatteryLevel(P3_Address_Mode_Device_Id, &address, NULL);
+        }
+        SCH_ScheduleEventPostSeconds(SECONDS_BETWEEN_BATTERY_CHECKS, bsw_tick);
+        pthread_mutex_unlock(&BSW_Mutex);
+        return;
+    }
+
+    //every shade is done
+    remove(BATT_SWEEP_FILENAME);
+    BSW_Stats.active = false;
+    p_data = BSW_Data;
+    count = BSW_Count;
+    p_done = BSW_Done;
+    OS_ReleaseMemBlock((void *)BSW_Shade);
+    BSW_Data = NULL;
+    BSW_Shade = NULL;
+    BSW_Count = 0;
+    pthread_mutex_unlock(&BSW_Mutex);
+
+    if (p_done != NULL) {
+        p_done(p_data, count);
+    }
+    OS_ReleaseMemBlock((void *)p_data);
+}
+
+/*******************************************************************************
+* Procedure:    bsw_is_finished
+* Purpose:      Tell whether a shade in the window needs no more requests.
+* Passed:       index of the shade
+*
+* Returned:     true if it is done
+* Globals:      none
+*******************************************************************************/
+static bool bsw_is_finished(uint16_t n)
+{
+    BATT_CHECK_STRUCT_PTR p_shade = &BSW_Data[n];
+    uint16_t missing = MAX_BATTERY_MEASUREMENTS_PER_SHADE - p_shade->replicate_counter;
+    uint16_t needed;
+
+    if ((missing == 0) || (bsw_is_stable(p_shade) == true)) {
+        return true;
+    }
+    //readings that disagree never come to agree, so past BSW_STABLE_READINGS
+    //only a full set will do
+    if (p_shade->replicate_counter < BSW_STABLE_READINGS) {
+        needed = BSW_STABLE_READINGS - p_shade->replicate_counter;
+    }
+    else {
+        needed = missing;
+    }
+    //out of tries, or too few left to ever get the readings
+    return ((BSW_Shade[n].tries + needed) > BATTERY_CHECK_RETRY_MAX);
+}
+
+/*******************************************************************************
+* Procedure:    bsw_is_stable
+* Purpose:      Tell whether a shade's readings already agree.
+* Passed:       the shade
+*
+* Returned:     true if there are at least BSW_STABLE_READINGS and they are
+*               within BSW_STABLE_SPREAD of each other
+* Globals:      none
+*******************************************************************************/
+static bool bsw_is_stable(BATT_CHECK_STRUCT_PTR p_shade)
+{
+    uint16_t lo = 0xffff;
+    uint16_t hi = 0;
+    uint16_t j;
+
+    if (p_shade->replicate_counter < BSW_STABLE_READINGS) {
+        return false;
+    }
+    for (j = 0; j < p_shade->replicate_counter; ++j) {
+        if (p_shade->replicate_level[j] < lo) {
+            lo = p_shade->replicate_level[j];
+        }
+        if (p_shade->replicate_level[j] > hi) {
+            hi = p_shade->replicate_level[j];
+        }
+    }
+    return ((hi - lo) <= BSW_STABLE_SPREAD);
+}
+
+/*******************************************************************************
+* Procedure:    bsw_retire
+* Purpose:      Settle the level of a shade leaving the window.
+* Passed:       index of the shade
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+static void bsw_retire(uint16_t n)
+{
+    BATT_CHECK_STRUCT_PTR p_shade = &BSW_Data[n];
+    uint16_t j;
+
+    p_shade->bat_level = 0;
+    if ((p_shade->replicate_counter >= MAX_BATTERY_MEASUREMENTS_PER_SHADE)
+            || (bsw_is_stable(p_shade) == true)) {
+        if (p_shade->replicate_counter < MAX_BATTERY_MEASUREMENTS_PER_SHADE) {
+            ++BSW_Stats.early_stops;
+        }
+        for (j = 0; j < p_shade->replicate_counter; ++j) {
+            if (p_shade->bat_level < p_shade->replicate_level[j]) {
+                p_shade->bat_level = p_shade->replicate_level[j];
+            }
+        }
+    }
+    else {
+        ++BSW_Stats.no_level;
+    }
+    BSW_Shade[n].state = BSW_SHADE_DONE;
+    ++BSW_Stats.done;
+}
+
+/*******************************************************************************
+* Procedure:    bsw_save
+* Purpose:      Write the shades finished so far.
+* Passed:       none
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        Written to a temporary file and renamed so a reboot in the
+*               middle leaves the last complete copy.
+*******************************************************************************/
+static void bsw_save(void)
+{
+    BSW_FILE_HEADER header;
+    BSW_FILE_ENTRY entry;
+    FILE * f_handle;
+    uint16_t n;
+    bool ok;
+
+    f_handle = fopen(BSW_TEMP_FILENAME, "w");
+    if (f_handle == NULL) {
+        return;
+    }
+    header.magic = BSW_FILE_MAGIC;
+    header.version = BSW_FILE_VERSION;
+    header.count = BSW_Stats.done;
+    header.started = (int64_t)BSW_Started;
+    ok = (fwrite(&header, sizeof(header), 1, f_handle) == 1);
+    for (n = 0; (n < BSW_Count) && (ok == true); ++n) {
+        if (BSW_Shade[n].state == BSW_SHADE_DONE) {
+            entry.shade_id = BSW_Data[n].shade_id;
+            entry.bat_level = BSW_Data[n].bat_level;
+            ok = (fwrite(&entry, sizeof(entry), 1, f_handle) == 1);
+        }
+    }
+    if ((fclose(f_handle) == 0) && (ok == true)) {
+        rename(BSW_TEMP_FILENAME, BATT_SWEEP_FILENAME);
+    }
+}
+
+/*******************************************************************************
+* Procedure:    bsw_load
+* Purpose:      Mark the shades a saved sweep had finished as done.
+* Passed:       none
+*
+* Returned:     false if there is no recent saved sweep
+* Globals:      none
+* Notes:        Shades no longer in the database are passed over; shades
+*               added since are swept.
+*******************************************************************************/
+static bool bsw_load(void)
+{
+    BSW_FILE_HEADER header;
+    BSW_FILE_ENTRY entry;
+    FILE * f_handle;
+    uint16_t e;
+    uint16_t n;
+
+    f_handle = fopen(BATT_SWEEP_FILENAME, "r");
+    if (f_handle == NULL) {
+        return false;
+    }
+    if (bsw_read_header(f_handle, &header) == false) {
+        fclose(f_handle);
+        return false;
+    }
+    BSW_Started = (time_t)header.started;
+    for (e = 0; e < header.count; ++e) {
+        if (fread(&entry, sizeof(entry), 1, f_handle) != 1) {
+            break;
+        }
+        for (n = 0; n < BSW_Count; ++n) {
+            if ((BSW_Data[n].shade_id == entry.shade_id) && (BSW_Shade[n].state != BSW_SHADE_DONE)) {
+                BSW_Data[n].bat_level = entry.bat_level;
+                BSW_Shade[n].state = BSW_SHADE_DONE;
+                ++BSW_Stats.done;
+                break;
+            }
+        }
+    }
+    fclose(f_handle);
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    bsw_read_header
+* Purpose:      Read and check the header of a saved sweep.
+* Passed:       the open file, where to put the header
+*
+* Returned:     true if it is a saved sweep of this version begun less
+*               than BSW_RESUME_MAX_AGE_SEC ago
+* Globals:      none
+*******************************************************************************/
+static bool bsw_read_header(FILE * f_handle, BSW_FILE_HEADER * p_header)
+{
+    time_t now;
+
+    if (fread(p_header, sizeof(BSW_FILE_HEADER), 1, f_handle) != 1) {
+        return false;
+    }
+    if ((p_header->magic != BSW_FILE_MAGIC) || (p_header->version != BSW_FILE_VERSION)) {
+        return false;
+    }
+    OS_GetTimeLocal(&now);
+    return ((now >= (time_t)p_header->started)
+            && ((now - (time_t)p_header->started) < BSW_RESUME_MAX_AGE_SEC));
+}
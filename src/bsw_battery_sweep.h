@@ -0,0 +1,48 @@
+/***************************************************************************//**
+ * @file bsw_battery_sweep.h
+ * @brief Include file for bsw_battery_sweep.c
+ *
+ ******************************************************************************/
+#ifndef __BSW_BATTERY_SWEEP_H
+#define __BSW_BATTERY_SWEEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rf_serial_api.h"
+
+//shades asked at the same time
+#define BSW_WINDOW_DEFAULT      4
+#define BSW_WINDOW_MAX          16
+//a shade is done early once this many readings agree to within BSW_STABLE_SPREAD
+#define BSW_STABLE_READINGS     3
+#define BSW_STABLE_SPREAD       1       //100 mV units
+//a saved sweep older than this is started over
+#define BSW_RESUME_MAX_AGE_SEC  (7 * 24 * 60 * 60)
+
+typedef struct BSW_STATS_TAG
+{
+    bool active;
+    bool resumed;               //the sweep picked up a saved one
+    uint16_t window;
+    uint16_t shades;            //in the sweep
+    uint16_t done;              //finished, with or without a level
+    uint16_t in_flight;         //being asked now
+    uint32_t requests;          //battery requests sent
+    uint32_t readings;          //answers kept
+    uint32_t early_stops;       //shades done on agreeing readings
+    uint32_t no_level;          //shades that never gave enough readings
+    uint32_t deferred_ticks;    //ticks skipped for other RF traffic
+} BSW_STATS;
+
+typedef void (*BSW_DONE_CALLBACK)(BATT_CHECK_STRUCT_PTR p_data, uint16_t count);
+
+//public function prototypes:
+bool BSW_Start(BSW_DONE_CALLBACK p_done);
+bool BSW_Resume(BSW_DONE_CALLBACK p_done);
+bool BSW_HasSavedSweep(void);
+bool BSW_IsActive(void);
+bool BSW_NoteReading(uint16_t shade_id, uint8_t level);
+bool BSW_SetWindow(uint16_t window);
+void BSW_GetStats(BSW_STATS * p_stats);
+
+#endif
@@ -41,6 +41,20 @@ const SHELL_COMMAND_STRUCT Shell_commands[] = {
     { "pos_single", Shell_position_single_shade },
     { "jog", Shell_jog },
     { "req_shade_pos",     Shell_get_shade_position },
+    { "mem",       Shell_mem },
+    { "os_stats",  Shell_os_stats },
+    { "uart",      Shell_uart },
+    { "ring_bench", Shell_ring_bench },
+    { "disc_bench", Shell_disc_bench },
+    { "rfo",       Shell_rfo },
+    { "rfp",       Shell_rfp },
+    { "rfd",       Shell_rfd },
+    { "bsw",       Shell_bsw },
+    { "dbq",       Shell_dbq },
+    { "sst",       Shell_sst },
+    { "eph",       Shell_eph },
+    { "ipcs",      Shell_ipcs },
+    { "ipc_stress", Shell_ipc_stress },
     { "test",      Shell_test },
     { "help",      Shell_help },
     { "?",         Shell_command_list },
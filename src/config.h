@@ -20,6 +20,7 @@
 #define AWS_IOT_TASK_NUM            13
 #define IPC_SERVER_TASK_NUM         14
 #define SHELL_TASK_NUM            15
+#define IPC_REPORT_TASK_NUM       16
 
 /* TASK PRIORITIES 1-99 (larger num = higher priority) */
 #define MAIN_TASK_PRI               2
@@ -38,6 +39,71 @@
 #define AWS_IOT_TASK_PRI            9
 #define IPC_SERVER_TASK_PRI         11
 #define SHELL_TASK_PRI              9
+#define IPC_REPORT_TASK_PRI         8
+
+/* MEMORY POOLS
+ * {block size, number of blocks} in increasing block size.  Requests that
+ * don't fit, or arrive when a pool is empty, come from the heap instead.
+ * Define OS_MEM_DEBUG to poison released blocks and catch use after release.
+ */
+#define OS_MEM_POOL_CONFIG \
+    {   32, 256 }, \
+    {   64, 256 }, \
+    {  128, 128 }, \
+    {  256,  64 }, \
+    {  512,  32 }, \
+    { 1024,  16 }, \
+    { 2048,   8 }, \
+    { 8192,   8 }
+#define OS_MEM_CACHE_DEPTH          8   //blocks a task may hold per pool
+#define OS_MEM_CACHE_BATCH          4   //blocks moved to/from the pool at once
+
+/* NORDIC UART RECEIVE
+ * rx_task reads up to RFU_RX_CHUNK_SIZE bytes per read and wakes the
+ * inbound parser once RFU_RX_BATCH_BYTES are queued or the line has been
+ * quiet for RFU_RX_BATCH_IDLE_MSEC.  A batch of 1 wakes it on every read.
+ * Both can be changed at run time with RFU_SetRxBatching.
+ */
+#define RFU_RX_CHUNK_SIZE           64
+#define RFU_RX_BATCH_BYTES          1
+#define RFU_RX_BATCH_IDLE_MSEC      2
+
+/* Preallocated frame slots rfi_inbound assembles received frames in.  They
+ * are held until the handler of each frame releases it.
+ */
+#define RFI_FRAME_SLOTS             16
+
+/* REPORTS TO THE DATABASES
+ * 1 sends everything the ipc_report task finds waiting as one
+ * "report_batch" message, 0 sends one message per report for a databases
+ * process that doesn't know report_batch.  With 1, the task goes over to
+ * one message per report the first time the databases refuse a batch.
+ */
+#define IPC_REPORT_BATCHED          1
+
+/* IPC SERVER
+ * Requests from other processes are handed to this many worker threads.
+ * Each connection has at most one request in progress; while it does,
+ * nothing more is read from it.  Past IPC_SERVER_MAX_CLIENTS connections
+ * wait in the listen backlog.  Connections with nothing in progress are
+ * closed after IPC_SERVER_IDLE_SEC.
+ */
+#define IPC_SERVER_WORKERS          4
+#define IPC_SERVER_MAX_CLIENTS      32
+#define IPC_SERVER_IDLE_SEC         30
+
+/* IPC CLIENT
+ * Requests to other processes share one connection per process that is
+ * kept open.  Once the other process has shown it keeps connections
+ * open, up to IPC_CLIENT_PIPELINE_DEPTH requests are sent without
+ * waiting for the answers before.  IPC_CLIENT_REQUEST_IDS 1 adds a
+ * "request_id" to each request, 0 sends them as they are for a process
+ * that doesn't accept it.
+ */
+#define IPC_CLIENT_PIPELINE_DEPTH   4
+#define IPC_CLIENT_REQUEST_IDS      1
+#define IPC_CLIENT_CONNECT_WAIT_MSEC    750
+#define IPC_CLIENT_RESPONSE_WAIT_MSEC   5000
 
 /* TASK FUNCTIONS */
 extern void *main_task(void *);
@@ -55,6 +121,7 @@ extern void *RMT_remote_server_task(void * temp);
 extern void *aws_iot_task(void * temp);
 extern void *ipc_server_task(void * temp);
 extern void *shell_task(void * temp);
+extern void *ipc_report_task(void * temp);
 
 /* TASK IDs */
 extern pthread_t Thread1TaskId;
@@ -72,6 +139,7 @@ extern pthread_t RMT_RemoteServerTaskId;
 extern pthread_t AwsIotTaskId;
 extern pthread_t IPCServerTaskId;
 extern pthread_t ShellTaskId;
+extern pthread_t IPCReportTaskId;
 
 typedef struct
 {
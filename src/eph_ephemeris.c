@@ -0,0 +1,344 @@
+/***************************************************************************//**
+ * @file eph_ephemeris.c
+ * @brief Sunrise and sunset times for the hub's location.
+ *
+ *  Sunrise and sunset relative scenes used only the times sent by the
+ *  remote time server, which cover the day they were sent; after a
+ *  reboot without a connection, or once the day rolls over before the
+ *  next answer, they are stale.  Here the times are worked out from the
+ *  latitude and longitude with the NOAA approximations (equation of time
+ *  and declination as Fourier series, 90.833 degree zenith for refraction
+ *  and the solar disc), good to a minute or two away from the poles.
+ *
+ *  A whole year is worked out at once into a table of 366 days, about
+ *  1.5 KB, so resolving a scene is a lookup.  The table is kept in
+ *  minutes from UTC midnight so it depends on the location and year
+ *  only; the local time is the UTC time plus the offset in effect, which
+ *  the time server keeps current through daylight saving changes.
+ *
+ *  The table is built on first use, and again when the year or the
+ *  location differs from the one it was built for, or after
+ *  EPH_Invalidate.  It is shared under EPH_Mutex.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "os.h"
+#include "SCH_ScheduleTask.h"
+#include "eph_ephemeris.h"
+
+/* Local Symbols
+*******************************************************************************/
+#define EPH_PI                  3.14159265358979323846
+#define EPH_RADIANS(deg)        ((deg) * EPH_PI / 180.0)
+#define EPH_DEGREES(rad)        ((rad) * 180.0 / EPH_PI)
+//sun's centre below the horizon at sunrise and sunset
+#define EPH_ZENITH_DEG          90.833
+#define EPH_MINUTES_IN_DAY      1440
+
+extern float latitude;
+extern float longitude;
+
+/* Local Function Declarations
+*******************************************************************************/
+static bool eph_solve(int16_t year, uint16_t yday, float lat, float lon,
+                      bool rising, double utc_minutes, double * p_minutes);
+static uint16_t eph_days_in_year(int16_t year);
+static void eph_year_day(time_t local_time, int16_t * p_year, uint16_t * p_yday);
+static uint16_t eph_local_minutes(int16_t utc_minutes, int32_t utc_offset);
+static uint64_t eph_usec(void);
+
+/* Local variables
+*******************************************************************************/
+static pthread_mutex_t EPH_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static EPH_TABLE EPH_Table;
+static EPH_STATS EPH_Stats;
+
+/*******************************************************************************
+* Procedure:    EPH_ComputeDay
+* Purpose:      Work out the sunrise and sunset of one day directly.
+* Passed:       year (e.g. 2016), day of the year (tm_yday, 0 based),
+*               location in degrees (north and east positive), and whether
+*               to refine each time by working the sun's position out
+*               again at the time found instead of at noon UTC
+*
+* Returned:     false if neither happens that day; a time that does not
+*               happen is EPH_NO_EVENT
+* Globals:      none
+*******************************************************************************/
+bool EPH_ComputeDay(int16_t year, uint16_t yday, float latitude, float longitude,
+                    bool refine, EPH_DAY * p_day)
+{
+    double minutes;
+    double estimate;
+    uint8_t pass;
+    uint8_t event;
+    int16_t * p_result;
+
+    for (event = 0; event < 2; ++event) {
+        p_result = (event == 0) ? &p_day->sunrise : &p_day->sunset;
+        *p_result = EPH_NO_EVENT;
+        estimate = EPH_MINUTES_IN_DAY / 2;
+        for (pass = 0; pass < (refine ? 3 : 1); ++pass) {
+            if (eph_solve(year, yday, latitude, longitude, (event == 0), estimate, &minutes) == false) {
+                break;
+            }
+            estimate = minutes;
+            *p_result = (int16_t)lround(minutes);
+        }
+    }
+    return ((p_day->sunrise != EPH_NO_EVENT) || (p_day->sunset != EPH_NO_EVENT));
+}
+
+/*******************************************************************************
+* Procedure:    EPH_BuildTable
+* Purpose:      Work out every day of a year.
+* Passed:       table to fill, year, location in degrees
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void EPH_BuildTable(EPH_TABLE * p_table, int16_t year, float latitude, float longitude)
+{
+    uint16_t yday;
+
+    p_table->days = eph_days_in_year(year);
+    p_table->latitude = latitude;
+    p_table->longitude = longitude;
+    for (yday = 0; yday < p_table->days; ++yday) {
+        EPH_ComputeDay(year, yday, latitude, longitude, false, &p_table->day[yday]);
+    }
+    p_table->year = year;
+}
+
+/*******************************************************************************
+* Procedure:    EPH_IsAvailable
+* Purpose:      Determine if the hub's location is known.
+* Passed:       nothing
+*
+* Returned:     true if latitude and longitude are set
+* Globals:      latitude, longitude
+*******************************************************************************/
+bool EPH_IsAvailable(void)
+{
+    return ((latitude != 0) && (longitude != 0));
+}
+
+/*******************************************************************************
+* Procedure:    EPH_Invalidate
+* Purpose:      Have the table built again at the next lookup.
+* Passed:       nothing
+*
+* Returned:     nothing
+* Globals:      EPH_Table
+* Notes:        Called when the clock or time zone is set, which is also
+*               when the location may have changed.
+*******************************************************************************/
+void EPH_Invalidate(void)
+{
+    pthread_mutex_lock(&EPH_Mutex);
+    EPH_Table.year = 0;
+    pthread_mutex_unlock(&EPH_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    EPH_GetSunMinutes
+* Purpose:      Look up the local sunrise and sunset of a day.
+* Passed:       local time in the day (as from OS_GetTimeLocal), seconds
+*               local time is ahead of UTC, where to put the minutes after
+*               local midnight of sunrise and sunset
+*
+* Returned:     false, with nothing written, if the location is not known
+*               or the sun does not both rise and set that day
+* Globals:      EPH_Table, latitude, longitude
+*******************************************************************************/
+bool EPH_GetSunMinutes(time_t local_time, int32_t utc_offset,
+                       uint16_t * p_sunrise, uint16_t * p_sunset)
+{
+    int16_t year;
+    uint16_t yday;
+    EPH_DAY day;
+    uint64_t start;
+    bool found = false;
+
+    if (EPH_IsAvailable() == false) {
+        pthread_mutex_lock(&EPH_Mutex);
+        ++EPH_Stats.misses;
+        pthread_mutex_unlock(&EPH_Mutex);
+        return false;
+    }
+    eph_year_day(local_time, &year, &yday);
+
+    pthread_mutex_lock(&EPH_Mutex);
+    if ((EPH_Table.year != year)
+            || (EPH_Table.latitude != latitude)
+            || (EPH_Table.longitude != longitude)) {
+        start = eph_usec();
+        EPH_BuildTable(&EPH_Table, year, latitude, longitude);
+        EPH_Stats.build_usec = (uint32_t)(eph_usec() - start);
+        ++EPH_Stats.builds;
+    }
+    day = EPH_Table.day[yday];
+    if ((day.sunrise != EPH_NO_EVENT) && (day.sunset != EPH_NO_EVENT)) {
+        ++EPH_Stats.lookups;
+        found = true;
+    }
+    else {
+        ++EPH_Stats.misses;
+    }
+    pthread_mutex_unlock(&EPH_Mutex);
+
+    if (found == true) {
+        *p_sunrise = eph_local_minutes(day.sunrise, utc_offset);
+        *p_sunset = eph_local_minutes(day.sunset, utc_offset);
+    }
+    return found;
+}
+
+/*******************************************************************************
+* Procedure:    EPH_GetStats
+* Purpose:      Copy out the counters.
+* Passed:       where to put them
+*
+* Returned:     nothing
+* Globals:      EPH_Stats
+*******************************************************************************/
+void EPH_GetStats(EPH_STATS * p_stats)
+{
+    pthread_mutex_lock(&EPH_Mutex);
+    *p_stats = EPH_Stats;
+    pthread_mutex_unlock(&EPH_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    eph_solve
+* Purpose:      Work out one sunrise or sunset with the sun's position
+*               taken at a given time of the day.
+* Passed:       year, day of the year, location in degrees, true for
+*               sunrise, minutes from UTC midnight to take the position
+*               at, where to put the result in minutes from UTC midnight
+*
+* Returned:     false if the sun does not rise or set that day
+* Globals:      none
+*******************************************************************************/
+static bool eph_solve(int16_t year, uint16_t yday, float lat, float lon,
+                      bool rising, double utc_minutes, double * p_minutes)
+{
+    double gamma;
+    double eqtime;
+    double decl;
+    double cos_ha;
+    double ha;
+    double lat_rad = EPH_RADIANS(lat);
+
+    //fractional year in radians
+    gamma = 2.0 * EPH_PI / eph_days_in_year(year)
+            * (yday + (utc_minutes / 60.0 - 12.0) / 24.0);
+    eqtime = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma)
+            - 0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma));
+    decl = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma)
+            - 0.006758 * cos(2 * gamma) + 0.000907 * sin(2 * gamma)
+            - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma);
+
+    cos_ha = cos(EPH_RADIANS(EPH_ZENITH_DEG)) / (cos(lat_rad) * cos(decl))
+            - tan(lat_rad) * tan(decl);
+    if ((cos_ha > 1.0) || (cos_ha < -1.0)) {
+        return false;
+    }
+    ha = EPH_DEGREES(acos(cos_ha));
+    if (rising == true) {
+        *p_minutes = 720.0 - 4.0 * (lon + ha) - eqtime;
+    }
+    else {
+        *p_minutes = 720.0 - 4.0 * (lon - ha) - eqtime;
+    }
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    eph_days_in_year
+* Purpose:      Determine the number of days in a year.
+* Passed:       year
+*
+* Returned:     365 or 366
+* Globals:      none
+*******************************************************************************/
+static uint16_t eph_days_in_year(int16_t year)
+{
+    if (((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0)) {
+        return 366;
+    }
+    return 365;
+}
+
+/*******************************************************************************
+* Procedure:    eph_year_day
+* Purpose:      Find the year and day of the year of a time.
+* Passed:       local time (as from OS_GetTimeLocal), where to put the
+*               year and the day of the year (0 based, as tm_yday)
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        Same answer as gmtime_r, which costs more than the lookup
+*               itself.  Days are counted in years that start on March 1
+*               so the leap day is the last of the year.
+*******************************************************************************/
+static void eph_year_day(time_t local_time, int16_t * p_year, uint16_t * p_yday)
+{
+    int64_t days = local_time / DAY_IN_SEC;
+    int64_t era;
+    uint32_t day_of_era;
+    uint32_t year_of_era;
+    uint32_t day_of_year;       //from March 1
+    int32_t year;
+
+    if ((local_time % DAY_IN_SEC) < 0) {
+        --days;
+    }
+    days += 719468;             //1970-01-01 from 0000-03-01
+    era = ((days >= 0) ? days : days - 146096) / 146097;
+    day_of_era = (uint32_t)(days - era * 146097);
+    year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    year = (int32_t)(year_of_era + era * 400);
+    day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    if (day_of_year >= 306) {
+        //January or February of the next year
+        *p_year = (int16_t)(year + 1);
+        *p_yday = (uint16_t)(day_of_year - 306);
+    }
+    else {
+        *p_year = (int16_t)year;
+        *p_yday = (uint16_t)(day_of_year + 59 + eph_days_in_year((int16_t)year) - 365);
+    }
+}
+
+/*******************************************************************************
+* Procedure:    eph_local_minutes
+* Purpose:      Convert minutes from UTC midnight to minutes after local
+*               midnight.
+* Passed:       UTC minutes, seconds local time is ahead of UTC
+*
+* Returned:     0 to 1439
+* Globals:      none
+*******************************************************************************/
+static uint16_t eph_local_minutes(int16_t utc_minutes, int32_t utc_offset)
+{
+    int32_t minutes = utc_minutes + utc_offset / 60;
+
+    minutes %= EPH_MINUTES_IN_DAY;
+    if (minutes < 0) {
+        minutes += EPH_MINUTES_IN_DAY;
+    }
+    return (uint16_t)minutes;
+}
+
+static uint64_t eph_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,50 @@
+/***************************************************************************//**
+ * @file eph_ephemeris.h
+ * @brief Include file for eph_ephemeris.c
+ *
+ ******************************************************************************/
+#ifndef __EPH_EPHEMERIS_H
+#define __EPH_EPHEMERIS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define EPH_MAX_DAYS        366
+//the sun does not rise or set that day (polar day or night)
+#define EPH_NO_EVENT        INT16_MIN
+
+typedef struct EPH_DAY_TAG
+{
+    int16_t sunrise;            //minutes from UTC midnight, may be < 0 or >= 1440
+    int16_t sunset;
+} EPH_DAY;
+
+typedef struct EPH_TABLE_TAG
+{
+    int16_t year;               //0 while not built
+    uint16_t days;
+    float latitude;
+    float longitude;
+    EPH_DAY day[EPH_MAX_DAYS];  //by tm_yday
+} EPH_TABLE;
+
+typedef struct EPH_STATS_TAG
+{
+    uint32_t builds;            //times the table was filled
+    uint32_t build_usec;        //how long the last fill took
+    uint32_t lookups;           //days answered from the table
+    uint32_t misses;            //no location, or no sunrise or sunset that day
+} EPH_STATS;
+
+//public function prototypes:
+bool EPH_ComputeDay(int16_t year, uint16_t yday, float latitude, float longitude,
+                    bool refine, EPH_DAY * p_day);
+void EPH_BuildTable(EPH_TABLE * p_table, int16_t year, float latitude, float longitude);
+bool EPH_IsAvailable(void);
+void EPH_Invalidate(void);
+bool EPH_GetSunMinutes(time_t local_time, int32_t utc_offset,
+                       uint16_t * p_sunrise, uint16_t * p_sunset);
+void EPH_GetStats(EPH_STATS * p_stats);
+
+#endif
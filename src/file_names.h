@@ -26,4 +26,5 @@
 #define RDS_SYNC_FILENAME     "hub_syn.jso"
 #define REG_DATA_FILENAME     "reg.dat"
 #define RADIO_CONFIG_FILENAME  "rf_config"
+#define BATT_SWEEP_FILENAME    "batt_sweep"
 #endif 
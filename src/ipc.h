@@ -20,6 +20,7 @@
 #define IPC_CORE_MAX_RESPONSE_SIZE  8192
 
 char * IPC_ProcessPacket(char * p_json);
+void IPC_InitActions(void);
 
 #endif
 
@@ -14,11 +14,20 @@
 #include <string.h>
 #include "JSONReader.h"
 #include "ipc_client_cmd_to_db.h"
+#include "ipc_client_report.h"
 #include "os.h"
 
+/* Local Constants and Definitions
+*******************************************************************************/
+//queue keys, a newer report with the same key replaces a waiting one
+#define REPORT_KEY_SHADE_POSITION   1
+#define REPORT_KEY_SCENE_POSITION   2
+#define REPORT_KEY_BATTERY          3
+#define REPORT_KEY(kind, id, detail) \
+    (((uint64_t)(kind) << 48) | ((uint64_t)(detail) << 16) | (uint64_t)(id))
+
 /* Global Variables
 *******************************************************************************/
-extern char clientJSON[MAX_JSON_LENGTH];
 
 void IPC_Client_ReportShadePosition(SHADE_POSITION_PTR shade_pos)
 {
@@ -50,19 +59,24 @@ typedef struct {
             }
         }
 */
+    char item[IPC_REPORT_ITEM_SIZE];
+    uint16_t kinds;
+
     if (shade_pos->positions.posCount == 1) {
-        snprintf(clientJSON,MAX_JSON_LENGTH, REPORT_SHADE_POS_KIND1ONLY_CMD, shade_pos->device_id,
-                                                        shade_pos->positions.posKind[0],
-                                                        shade_pos->positions.position[0]);
+        snprintf(item,sizeof(item), REPORT_SHADE_POS_KIND1ONLY_CMD, shade_pos->device_id,
+                                                        shade_pos->positions.position[0],
+                                                        shade_pos->positions.posKind[0]);
+        kinds = shade_pos->positions.posKind[0];
     }
     else {
-        snprintf(clientJSON,MAX_JSON_LENGTH, REPORT_SHADE_POS_KIND1AND2_CMD, shade_pos->device_id,
-                                                        shade_pos->positions.posKind[0],
+        snprintf(item,sizeof(item), REPORT_SHADE_POS_KIND1AND2_CMD, shade_pos->device_id,
                                                         shade_pos->positions.position[0],
-                                                        shade_pos->positions.posKind[1],
-                                                        shade_pos->positions.position[1]);
+                                                        shade_pos->positions.posKind[0],
+                                                        shade_pos->positions.position[1],
+                                                        shade_pos->positions.posKind[1]);
+        kinds = shade_pos->positions.posKind[0] | (shade_pos->positions.posKind[1] << 8);
     }
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(REPORT_KEY(REPORT_KEY_SHADE_POSITION, shade_pos->device_id, kinds), item);
 }
 
 void IPC_Client_ReportScenePosition(SHADE_POSITION_PTR p_shade_pos, uint8_t scene_num)
@@ -82,49 +96,46 @@ void IPC_Client_ReportScenePosition(SHADE_POSITION_PTR p_shade_pos, uint8_t scen
     }
 }
 */
+    char item[IPC_REPORT_ITEM_SIZE];
+
     if (p_shade_pos->positions.posCount == 1) {
-        snprintf(clientJSON,MAX_JSON_LENGTH, REPORT_SCENE_POSITION_KIND1ONLY_CMD, scene_num,
+        snprintf(item,sizeof(item), REPORT_SCENE_POSITION_KIND1ONLY_CMD, scene_num,
                                                         p_shade_pos->device_id,
-                                                        p_shade_pos->positions.posKind[0],
-                                                        p_shade_pos->positions.position[0]);
+                                                        p_shade_pos->positions.position[0],
+                                                        p_shade_pos->positions.posKind[0]);
     }
     else {
-        snprintf(clientJSON,MAX_JSON_LENGTH, REPORT_SCENE_POSITION_KIND1AND2_CMD, scene_num,
+        snprintf(item,sizeof(item), REPORT_SCENE_POSITION_KIND1AND2_CMD, scene_num,
                                                         p_shade_pos->device_id,
-                                                        p_shade_pos->positions.posKind[0],
                                                         p_shade_pos->positions.position[0],
-                                                        p_shade_pos->positions.posKind[1],
-                                                        p_shade_pos->positions.position[1]);
+                                                        p_shade_pos->positions.posKind[0],
+                                                        p_shade_pos->positions.position[1],
+                                                        p_shade_pos->positions.posKind[1]);
     }
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(REPORT_KEY(REPORT_KEY_SCENE_POSITION, p_shade_pos->device_id, scene_num), item);
 }
 
 void IPC_Client_RecordDiscovery(DISCOVERY_DATA_STRUCT_PTR p_disc_data)
 {
-    snprintf(clientJSON,MAX_JSON_LENGTH, RECORD_DISCOVERY_CMD, p_disc_data->uuid,
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), RECORD_DISCOVERY_CMD, p_disc_data->uuid,
                                                     p_disc_data->network_id,
                                                     p_disc_data->device_id,
                                                     p_disc_data->shade_type);
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(IPC_REPORT_NO_KEY, item);
 }
 
-uint8_t IPC_Client_UpdateBatteryStatus(uint16_t shade_id, uint8_t measured)
+void IPC_Client_UpdateBatteryStatus(uint16_t shade_id, uint8_t measured)
 {
-    uint16_t socket;
-    uint8_t level;
-    snprintf(clientJSON,MAX_JSON_LENGTH, UPDATE_BATTERY_STATUS_CMD, shade_id, measured);
-    if(connectSocket(DATABASE_CLIENT_PATH, &socket)) {
-        sendMessage(clientJSON,strlen(clientJSON),socket); // make request
-        IPC_RECEIVE_MSG_PTR p_msg = startListening(socket); // wait for response
-        if (p_msg->len) {
-            IPC_PrintClientJson(clientJSON, p_msg->p_buff);
-            if (interpret_data(p_msg->p_buff,"databases") == true) {
-                findJSONuint8(p_msg->p_buff, "data\\level", &level);
-            }
-        }
-        free_msg_mem(p_msg);
-    }
-    return level;
+/*
+    The database used to answer with the coarse level, callers now work it
+    out themselves with SC_GetCoarseBatteryLevel and nothing waits here.
+*/
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), UPDATE_BATTERY_STATUS_CMD, shade_id, measured);
+    IPC_Report_Queue(REPORT_KEY(REPORT_KEY_BATTERY, shade_id, 0), item);
 }
 
 void IPC_Client_SceneControllerClearedAnnouncement(uint16_t scene_controller_id)
@@ -140,8 +151,10 @@ replaces: receivedSCClearAnnouncement()
 }
 */
 
-    snprintf(clientJSON,MAX_JSON_LENGTH, SC_RECEIVED_CLEAR_ANNOUNCEMENT_CMD, scene_controller_id);
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), SC_RECEIVED_CLEAR_ANNOUNCEMENT_CMD, scene_controller_id);
+    IPC_Report_Queue(IPC_REPORT_NO_KEY, item);
 }
 
 void IPC_Client_SceneControllerDatabaseUpdateRequest(uint16_t scene_controller_id, uint8_t version)
@@ -158,10 +171,12 @@ replaces: updateRequestForSceneControllerWithIDAndVersion()
 }
 */
 
-    snprintf(clientJSON,MAX_JSON_LENGTH, SC_DATABASE_UPDATE_REQUEST_CMD, 
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), SC_DATABASE_UPDATE_REQUEST_CMD,
                                             scene_controller_id,
                                             version);
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(IPC_REPORT_NO_KEY, item);
 }
 
 void IPC_Client_SceneControllerUpdatePacketRequest(uint16_t scene_controller_id, uint8_t rec_num, uint8_t version)
@@ -178,11 +193,13 @@ replaces: updateRequestForSceneControllerMember()
     }
 }
 */
-    snprintf(clientJSON,MAX_JSON_LENGTH, SC_UPDATE_REQUEST_FOR_MEMBER_CMD, 
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), SC_UPDATE_REQUEST_FOR_MEMBER_CMD,
                                             scene_controller_id,
                                             rec_num,
                                             version);
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(IPC_REPORT_NO_KEY, item);
 }
 
 void IPC_Client_SceneControllerTrigger(uint16_t scene_controller_id, uint8_t scene_type, uint16_t scene_id, uint8_t version)
@@ -201,12 +218,14 @@ replaces: receivedSCTriggerForSceneWithID()
 }
 */
 
-    snprintf(clientJSON,MAX_JSON_LENGTH, SC_TRIGGER_CMD, 
+    char item[IPC_REPORT_ITEM_SIZE];
+
+    snprintf(item,sizeof(item), SC_TRIGGER_CMD,
                                             scene_controller_id,
                                             scene_type,
                                             scene_id,
                                             version);
-    ipc_expect_no_response(DATABASE_CLIENT_PATH);
+    IPC_Report_Queue(IPC_REPORT_NO_KEY, item);
 }
 
 #define SCHEDULE_EVENTS_KEY_STRING  "data\\scheduledEvents[%d]\\%s"
@@ -315,24 +334,21 @@ ALL_RAW_DB_STR_PTR ipc_get_schedules_from_json(char * p_json)
 
 ALL_RAW_DB_STR_PTR IPC_Client_GetScheduledEvents(void)
 {
-    uint16_t socket;
     ALL_RAW_DB_STR_PTR p_sched_list_str;
+    IPC_CLIENT_CONTEXT * p_ctx = IPC_Client_Begin(DATABASE_CLIENT_PATH);
+    IPC_RECEIVE_MSG_PTR p_msg;
     p_sched_list_str = (ALL_RAW_DB_STR_PTR)OS_GetMemBlock(2);
     p_sched_list_str->count = -1;
 
-    snprintf(clientJSON,MAX_JSON_LENGTH, GET_SCHEDULED_EVENTS_CMD);
-    if(connectSocket(DATABASE_CLIENT_PATH, &socket)) {
-        sendMessage(clientJSON,strlen(clientJSON),socket); // make request
-        IPC_RECEIVE_MSG_PTR p_msg = startListening(socket); // wait for response
-        if (p_msg->len) {
-            IPC_PrintClientJson(clientJSON, p_msg->p_buff);
-            if (interpret_data(p_msg->p_buff,"databases") == true) {
-                OS_ReleaseMemBlock((void *)p_sched_list_str);
-                p_sched_list_str = ipc_get_schedules_from_json(p_msg->p_buff);
-            }
+    IPC_Client_Format(p_ctx, GET_SCHEDULED_EVENTS_CMD);
+    p_msg = IPC_Client_Send(p_ctx);
+    if (p_msg != NULL) {
+        if (interpret_data(p_msg->p_buff,"databases") == true) {
+            OS_ReleaseMemBlock((void *)p_sched_list_str);
+            p_sched_list_str = ipc_get_schedules_from_json(p_msg->p_buff);
         }
-        free_msg_mem(p_msg);
     }
+    IPC_Client_End(p_ctx);
     return p_sched_list_str;
 }
 
@@ -14,23 +14,24 @@
 #include "rf_serial_api.h"
 #include "stub.h"
 
-#define REPORT_SHADE_POS_KIND1ONLY_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"report_shade_position\",\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d}}}"
-#define REPORT_SHADE_POS_KIND1AND2_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"report_shade_position\",\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d,\"position2\":%d,\"posKind2\":%d}}}"
-#define REPORT_SCENE_POSITION_KIND1ONLY_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"report_scene_position\",\"scene_id\":%d,\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d}}}"
-#define REPORT_SCENE_POSITION_KIND1AND2_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"report_scene_position\",\"scene_id\":%d,\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d,\"position2\":%d,\"posKind2\":%d}}}"
-#define RECORD_DISCOVERY_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"record_discovery\",\"uuid\":%llu,\"network_id\":%d,\"device_id\":%d,\"shade_type\":%d}}"
-#define UPDATE_BATTERY_STATUS_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"update_battery_status\",\"shade_id\":%d,\"voltage\":%d}}"
-#define SC_RECEIVED_CLEAR_ANNOUNCEMENT_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"received_sc_clear_announcement\",\"scene_controller_id\":%d}}"
-#define SC_DATABASE_UPDATE_REQUEST_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"update_request_for_sc_with_id_and_ver\",\"scene_controller_id\":%d,\"version\":%d}}"
-#define SC_UPDATE_REQUEST_FOR_MEMBER_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"update_request_for_sc_member\",\"scene_controller_id\":%d,\"rec_num\":%d,\"version\":%d}}"
-#define SC_TRIGGER_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"received_sc_trigger\",\"scene_controller_id\":%d,\"scene_type\":%d,\"scene_id\":%d,\"version\":%d}}"
+//reports are queued by ipc_client_report, which adds the "databases" envelope
+#define REPORT_SHADE_POS_KIND1ONLY_CMD "{\"action\":\"report_shade_position\",\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d}}"
+#define REPORT_SHADE_POS_KIND1AND2_CMD "{\"action\":\"report_shade_position\",\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d,\"position2\":%d,\"posKind2\":%d}}"
+#define REPORT_SCENE_POSITION_KIND1ONLY_CMD "{\"action\":\"report_scene_position\",\"scene_id\":%d,\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d}}"
+#define REPORT_SCENE_POSITION_KIND1AND2_CMD "{\"action\":\"report_scene_position\",\"scene_id\":%d,\"shade_id\":%d,\"positions\":{\"position1\":%d,\"posKind1\":%d,\"position2\":%d,\"posKind2\":%d}}"
+#define RECORD_DISCOVERY_CMD "{\"action\":\"record_discovery\",\"uuid\":%llu,\"network_id\":%d,\"device_id\":%d,\"shade_type\":%d}"
+#define UPDATE_BATTERY_STATUS_CMD "{\"action\":\"update_battery_status\",\"shade_id\":%d,\"voltage\":%d}"
+#define SC_RECEIVED_CLEAR_ANNOUNCEMENT_CMD "{\"action\":\"received_sc_clear_announcement\",\"scene_controller_id\":%d}"
+#define SC_DATABASE_UPDATE_REQUEST_CMD "{\"action\":\"update_request_for_sc_with_id_and_ver\",\"scene_controller_id\":%d,\"version\":%d}"
+#define SC_UPDATE_REQUEST_FOR_MEMBER_CMD "{\"action\":\"update_request_for_sc_member\",\"scene_controller_id\":%d,\"rec_num\":%d,\"version\":%d}"
+#define SC_TRIGGER_CMD "{\"action\":\"received_sc_trigger\",\"scene_controller_id\":%d,\"scene_type\":%d,\"scene_id\":%d,\"version\":%d}"
 #define GET_SCHEDULED_EVENTS_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"get_scheduled_events\"}}"
 #define GET_SHADES_CMD "{\"type\":\"databases\",\"data\":{\"action\":\"get_shades\"}}"
 
 void IPC_Client_ReportShadePosition(SHADE_POSITION_PTR shade_pos);
 void IPC_Client_ReportScenePosition(SHADE_POSITION_PTR p_shade_pos, uint8_t scene_num);
 void IPC_Client_RecordDiscovery(DISCOVERY_DATA_STRUCT_PTR p_disc_data);
-uint8_t IPC_Client_UpdateBatteryStatus(uint16_t shade_id, uint8_t measured);
+void IPC_Client_UpdateBatteryStatus(uint16_t shade_id, uint8_t measured);
 void IPC_Client_SceneControllerClearedAnnouncement(uint16_t scene_controller_id);
 void IPC_Client_SceneControllerDatabaseUpdateRequest(uint16_t scene_controller_id, uint8_t version);
 void IPC_Client_SceneControllerUpdatePacketRequest(uint16_t scene_controller_id, uint8_t rec_num, uint8_t version);
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <stdarg.h>
 
 #include "os.h"
 #include "ipc_client_core.h"
@@ -41,13 +42,14 @@
 
 /* Local variables
 *******************************************************************************/
-char clientJSON[MAX_JSON_LENGTH];
 
 
 void IPC_PrintClientJson(char * p_json, char * p_full_resp)
 {
 #ifdef PRINT_IPC_JSON
     char *p_dsp;
+    //keep another task's exchange from landing in the middle of this one
+    flockfile(stdout);
     printf("Sent:\n");
     p_dsp = p_json;
     while (*p_dsp) {
@@ -63,21 +65,94 @@ void IPC_PrintClientJson(char * p_json, char * p_full_resp)
         ++p_dsp;
     }
     printf("\n");
+    funlockfile(stdout);
 #endif
 }
 
-IPC_RECEIVE_MSG_PTR ipc_client_communicate(char * p_path)
+/**
+ * @brief Send a request to another process and wait for its response.
+ *
+ * @param p_path The process's socket.
+ * @param p_json The request.
+ * @return The response, or NULL if there was none.  Free it with
+ *     free_msg_mem.
+ */
+IPC_RECEIVE_MSG_PTR IPC_Client_Request(char * p_path, char * p_json)
+{
+    IPC_RECEIVE_MSG_PTR p_msg = exchangeMessage(p_path, p_json, strlen(p_json));
+    if (p_msg != NULL) {
+        IPC_PrintClientJson(p_json, p_msg->p_buff);
+    }
+    return p_msg;
+}
+
+/**
+ * @brief Get a context to build requests in and keep their answers.
+ *
+ * @param p_path The process the requests go to.
+ * @return The context, to be given back with IPC_Client_End.
+ */
+IPC_CLIENT_CONTEXT * IPC_Client_Begin(char * p_path)
+{
+    IPC_CLIENT_CONTEXT * p_ctx = (IPC_CLIENT_CONTEXT *)OS_GetMemBlock(sizeof(IPC_CLIENT_CONTEXT));
+    p_ctx->p_path = p_path;
+    p_ctx->print = true;
+    return p_ctx;
+}
+
+/**
+ * @brief Build the request in a context, printf style.
+ *
+ * @return false if it didn't fit in MAX_JSON_LENGTH; the request is
+ *     then empty.
+ */
+bool IPC_Client_Format(IPC_CLIENT_CONTEXT * p_ctx, const char * p_format, ...)
 {
-    uint16_t socket;
-    if(connectSocket(p_path,&socket)) {
-        sendMessage(clientJSON,strlen(clientJSON),socket); // make request
-        IPC_RECEIVE_MSG_PTR p_msg = startListening(socket);             // wait for response
-        if (p_msg->len) {
-            IPC_PrintClientJson(clientJSON,p_msg->p_buff);
+    va_list args;
+    int len;
+
+    va_start(args, p_format);
+    len = vsnprintf(p_ctx->request, sizeof(p_ctx->request), p_format, args);
+    va_end(args);
+    if ((len < 0) || (len >= (int)sizeof(p_ctx->request))) {
+        p_ctx->request[0] = '\0';
+        p_ctx->len = 0;
+        return false;
+    }
+    p_ctx->len = len;
+    return true;
+}
+
+/**
+ * @brief Send the request built in a context and wait for the answer.
+ *
+ * @return The answer, also left in p_resp until the next send or
+ *     IPC_Client_End, or NULL if there was none.  Don't free it.
+ */
+IPC_RECEIVE_MSG_PTR IPC_Client_Send(IPC_CLIENT_CONTEXT * p_ctx)
+{
+    if (p_ctx->p_resp != NULL) {
+        free_msg_mem(p_ctx->p_resp);
+        p_ctx->p_resp = NULL;
+    }
+    if (p_ctx->len != 0) {
+        p_ctx->p_resp = exchangeMessage(p_ctx->p_path, p_ctx->request, p_ctx->len);
+        if ((p_ctx->p_resp != NULL) && p_ctx->print) {
+            IPC_PrintClientJson(p_ctx->request, p_ctx->p_resp->p_buff);
         }
-        return p_msg;
     }
-    return NULL;
+    return p_ctx->p_resp;
+}
+
+/**
+ * @brief Give back a context and the last answer in it.
+ */
+void IPC_Client_End(IPC_CLIENT_CONTEXT * p_ctx)
+{
+    if (p_ctx->p_resp != NULL) {
+        free_msg_mem(p_ctx->p_resp);
+    }
+    OS_ReleaseMemBlock(p_ctx);
 }
 
 bool interpret_data(char *p_json_resp, char * p_msg_type)
@@ -110,13 +185,5 @@ void free_msg_mem(IPC_RECEIVE_MSG_PTR p_msg)
     OS_ReleaseMemBlock(p_msg);
 }
 
-void ipc_expect_no_response(char *p_socket_path)
-{
-    IPC_RECEIVE_MSG_PTR p_msg = ipc_client_communicate(p_socket_path);
-    if (p_msg != NULL) {
-        free_msg_mem(p_msg);
-    }
-}
-
 
 /** @} */
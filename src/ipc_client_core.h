@@ -20,20 +20,50 @@
 #define TRUE_STR    "True"
 #define FALSE_STR   "False"
 
-#define socketBufferSize_ 8192
-#define retries_ 1500
+//largest response read from another process
+#define IPC_CLIENT_MAX_RESPONSE_SIZE 32768
 
 typedef struct {
     uint16_t len;
     char * p_buff;
 }IPC_RECEIVE_MSG, *IPC_RECEIVE_MSG_PTR;
 
+typedef struct IPC_CLIENT_STATS_TAG
+{
+    uint32_t requests;          //requests sent
+    uint32_t answered;
+    uint32_t failed;            //given up on without an answer
+    uint32_t resent;            //sent again after their connection was lost
+    uint32_t timeouts;          //no answer in IPC_CLIENT_RESPONSE_WAIT_MSEC
+    uint32_t connects;
+    uint32_t connect_failures;
+    uint32_t held_off;          //failed at once while connecting is held off
+    uint16_t in_flight;         //sent and not yet answered
+    uint16_t in_flight_high_water;
+    bool persistent;            //the other end keeps connections open
+} IPC_CLIENT_STATS;
+
+/** A caller's own request and response.  Any number of tasks may each
+ *  have one and send at the same time. */
+typedef struct IPC_CLIENT_CONTEXT_TAG
+{
+    char * p_path;                  //the process to ask
+    bool print;                     //show requests and responses on the console
+    uint16_t len;
+    IPC_RECEIVE_MSG_PTR p_resp;     //answer to the last IPC_Client_Send, NULL if none
+    char request[MAX_JSON_LENGTH];
+} IPC_CLIENT_CONTEXT;
+
 // for client
-bool connectSocket(char *p_path,uint16_t *p_socket);
-int sendMessage(char* msg, uint16_t len, uint16_t socket);
-IPC_RECEIVE_MSG_PTR startListening(uint16_t socket);
+IPC_CLIENT_CONTEXT * IPC_Client_Begin(char * p_path);
+bool IPC_Client_Format(IPC_CLIENT_CONTEXT * p_ctx, const char * p_format, ...);
+IPC_RECEIVE_MSG_PTR IPC_Client_Send(IPC_CLIENT_CONTEXT * p_ctx);
+void IPC_Client_End(IPC_CLIENT_CONTEXT * p_ctx);
+IPC_RECEIVE_MSG_PTR exchangeMessage(char *socket_path, char *msg, uint16_t len);
+void getConnectionStats(char *socket_path, IPC_CLIENT_STATS *p_stats);
+void resetConnectionStats(char *socket_path);
+IPC_RECEIVE_MSG_PTR IPC_Client_Request(char * p_path, char * p_json);
 bool interpret_data(char *p_json_resp, char * p_msg_type);
-void ipc_expect_no_response(char *);
 void free_msg_mem(IPC_RECEIVE_MSG_PTR p_msg);
 void IPC_PrintClientJson(char * p_json, char * p_full_resp);
 
@@ -0,0 +1,363 @@
+/** @file
+ *
+ * @defgroup ipc_client_report IPC Report Queue
+ * @{
+ * @brief Queues reports from the hub core to the databases and sends them
+ *     from the ipc_report task.
+ *
+ * @details Reports of shade positions, battery levels and the like used to
+ *     be sent by the task that produced them, the rnc task mostly, which
+ *     then waited on a new connection and the database's answer before
+ *     it could go back to the radio.  Now they are queued and the
+ *     ipc_report task sends them.
+ *
+ *     A report carries a key naming what it is about, a shade's position
+ *     say.  A newer report with the same key replaces the waiting one in
+ *     place, so only the latest state goes out.  The task waits
+ *     IPC_REPORT_WINDOW_MSEC after the first report of a burst, then sends
+ *     everything waiting as one "report_batch" message (or one message per
+ *     report if IPC_REPORT_BATCHED is 0).  When the queue is backed up it
+ *     sends at once.  If the databases refuse a report_batch, the task
+ *     goes over to one message per report and sends the batch again.
+ *
+ *     Reports stay in the queue until the databases answer the message
+ *     they went in.  With no answer they are sent again after
+ *     IPC_REPORT_RETRY_MSEC.  A report being sent is not replaced by a
+ *     newer one with its key; the newer one waits behind it.
+ *
+ *     A full queue drops its oldest report for the new one; producers
+ *     never wait.  IPC_Report_IsBackedUp lets producers of bulk traffic
+ *     hold back.
+ *
+ */
+
+/* Includes
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "os.h"
+#include "config.h"
+#include "JSONReader.h"
+#include "ipc_client_core.h"
+#include "ipc_client_report.h"
+
+/* Local Constants and Definitions
+*******************************************************************************/
+#define IPC_REPORT_EVENT        BIT0
+
+typedef struct IPC_REPORT_ENTRY_TAG
+{
+    uint64_t key;
+    uint16_t len;
+    char item[IPC_REPORT_ITEM_SIZE];
+} IPC_REPORT_ENTRY;
+
+/* Local Function Declarations
+*******************************************************************************/
+static uint16_t ipc_report_take(char * p_buff, uint16_t size);
+static void ipc_report_finish(bool done);
+static bool ipc_report_accepted(char * p_resp);
+static void ipc_report_send(char * p_buff, uint16_t reports);
+
+/* Local variables
+*******************************************************************************/
+static pthread_mutex_t IPC_ReportMutex = PTHREAD_MUTEX_INITIALIZER;
+static void * IPC_ReportEvent;
+/** Waiting reports, oldest at IPC_ReportHead. */
+static IPC_REPORT_ENTRY IPC_ReportQueue[IPC_REPORT_QUEUE_DEPTH];
+static uint16_t IPC_ReportHead;
+static uint16_t IPC_ReportCount;
+/** Reports from IPC_ReportHead on that are in the message being sent. */
+static uint16_t IPC_ReportSending;
+static IPC_REPORT_STATS IPC_ReportStats;
+/** Cleared for good if the databases refuse a report_batch. */
+static bool IPC_ReportBatched = (IPC_REPORT_BATCHED != 0);
+/** Message being sent, only touched by the ipc_report task. */
+static char IPC_ReportJSON[MAX_JSON_LENGTH];
+
+/**
+ * @brief Queue a report for the databases.
+ *
+ * @param key What the report is about; a waiting report with the same key
+ *     is replaced.  IPC_REPORT_NO_KEY for a report that must not be.
+ * @param p_item The report's "data" object.
+ * @return false if the report is too long to queue.
+ */
+bool IPC_Report_Queue(uint64_t key, char * p_item)
+{
+    IPC_REPORT_ENTRY * p_entry = NULL;
+    uint16_t len = strlen(p_item);
+    uint16_t n;
+
+    pthread_mutex_lock(&IPC_ReportMutex);
+    ++IPC_ReportStats.queued;
+    if (len >= IPC_REPORT_ITEM_SIZE) {
+        ++IPC_ReportStats.too_long;
+        pthread_mutex_unlock(&IPC_ReportMutex);
+        return false;
+    }
+    if (key != IPC_REPORT_NO_KEY) {
+        //not the ones being sent, they might not get there
+        for (n = IPC_ReportSending; n < IPC_ReportCount; ++n) {
+            p_entry = &IPC_ReportQueue[(IPC_ReportHead + n) % IPC_REPORT_QUEUE_DEPTH];
+            if (p_entry->key == key) {
+                ++IPC_ReportStats.coalesced;
+                break;
+            }
+            p_entry = NULL;
+        }
+    }
+    if (p_entry == NULL) {
+        if (IPC_ReportCount == IPC_REPORT_QUEUE_DEPTH) {
+            //drop the oldest
+            IPC_ReportHead = (IPC_ReportHead + 1) % IPC_REPORT_QUEUE_DEPTH;
+            --IPC_ReportCount;
+            if (IPC_ReportSending != 0) {
+                --IPC_ReportSending;
+            }
+            ++IPC_ReportStats.dropped;
+        }
+        p_entry = &IPC_ReportQueue[(IPC_ReportHead + IPC_ReportCount) % IPC_REPORT_QUEUE_DEPTH];
+        ++IPC_ReportCount;
+        if (IPC_ReportCount == IPC_REPORT_HIGH_WATER + 1) {
+            ++IPC_ReportStats.backed_up;
+        }
+        if (IPC_ReportCount > IPC_ReportStats.high_water) {
+            IPC_ReportStats.high_water = IPC_ReportCount;
+        }
+    }
+    p_entry->key = key;
+    p_entry->len = len;
+    memcpy(p_entry->item, p_item, len + 1);
+    if (IPC_ReportEvent != NULL) {
+        OS_EventSet(IPC_ReportEvent, IPC_REPORT_EVENT);
+    }
+    pthread_mutex_unlock(&IPC_ReportMutex);
+    return true;
+}
+
+/**
+ * @brief Tell whether more reports are waiting than the task keeps up with.
+ *
+ * @return true above IPC_REPORT_HIGH_WATER.
+ */
+bool IPC_Report_IsBackedUp(void)
+{
+    return (__atomic_load_n(&IPC_ReportCount, __ATOMIC_RELAXED) > IPC_REPORT_HIGH_WATER);
+}
+
+/**
+ * @brief Copy out the queue counters.
+ *
+ * @param p_stats Where to put them.
+ */
+void IPC_Report_GetStats(IPC_REPORT_STATS * p_stats)
+{
+    pthread_mutex_lock(&IPC_ReportMutex);
+    *p_stats = IPC_ReportStats;
+    p_stats->waiting = IPC_ReportCount;
+    p_stats->batched = IPC_ReportBatched;
+    pthread_mutex_unlock(&IPC_ReportMutex);
+}
+
+/**
+ * @brief Clear the queue counters.
+ */
+void IPC_Report_ResetStats(void)
+{
+    pthread_mutex_lock(&IPC_ReportMutex);
+    memset(&IPC_ReportStats, 0, sizeof(IPC_ReportStats));
+    IPC_ReportStats.high_water = IPC_ReportCount;
+    pthread_mutex_unlock(&IPC_ReportMutex);
+}
+
+/**
+ * @brief The ipc_report task.  Waits for reports and sends them to the
+ *     databases.
+ *
+ * @param temp Unused.
+ */
+void *ipc_report_task(void * temp)
+{
+    void * event_handle = OS_EventCreate(0,false);
+    uint16_t len;
+    uint16_t reports;
+
+    pthread_mutex_lock(&IPC_ReportMutex);
+    IPC_ReportEvent = event_handle;
+    if (IPC_ReportCount != 0) {
+        OS_EventSet(event_handle, IPC_REPORT_EVENT);
+    }
+    pthread_mutex_unlock(&IPC_ReportMutex);
+printf("ipc_report_task\n");
+    while (1) {
+        OS_TaskWaitEvents(event_handle, IPC_REPORT_EVENT, WAIT_TIME_INFINITE);
+        //let the rest of a burst arrive and replace what it makes stale
+        if (IPC_Report_IsBackedUp() == false) {
+            OS_TaskSleep(IPC_REPORT_WINDOW_MSEC);
+        }
+        do {
+            reports = 0;
+            len = 0;
+            if (IPC_ReportBatched) {
+                len = snprintf(IPC_ReportJSON, sizeof(IPC_ReportJSON), "%s", IPC_REPORT_BATCH_HEAD);
+                while (1) {
+                    uint16_t item_len = ipc_report_take(&IPC_ReportJSON[len],
+                            sizeof(IPC_ReportJSON) - len - sizeof(IPC_REPORT_BATCH_TAIL) - 1);
+                    if (item_len == 0) {
+                        break;
+                    }
+                    len += item_len;
+                    IPC_ReportJSON[len++] = ',';
+                    ++reports;
+                }
+                if (reports != 0) {
+                    //replaces the last comma
+                    len += snprintf(&IPC_ReportJSON[len - 1], sizeof(IPC_ReportJSON) - len + 1,
+                            "%s", IPC_REPORT_BATCH_TAIL) - 1;
+                }
+            }
+            else {
+                len = snprintf(IPC_ReportJSON, sizeof(IPC_ReportJSON), "%s", IPC_REPORT_ENVELOPE_HEAD);
+                reports = ipc_report_take(&IPC_ReportJSON[len],
+                        sizeof(IPC_ReportJSON) - len - sizeof(IPC_REPORT_ENVELOPE_TAIL)) ? 1 : 0;
+                len = strlen(strcat(IPC_ReportJSON, IPC_REPORT_ENVELOPE_TAIL));
+            }
+            if (reports != 0) {
+                ipc_report_send(IPC_ReportJSON, reports);
+            }
+        } while (reports != 0);
+    }
+}
+
+/**
+ * @brief Copy the oldest report not yet in the message into it, if it
+ *     fits.  It stays queued until ipc_report_finish.  Clears the task's
+ *     event once every waiting report is in the message.
+ *
+ * @param p_buff Where to put it, with its terminating 0.
+ * @param size Room there.
+ * @return the length of the report, 0 if there was none or it must wait
+ *     for the next message.
+ */
+static uint16_t ipc_report_take(char * p_buff, uint16_t size)
+{
+    IPC_REPORT_ENTRY * p_entry;
+    uint16_t len = 0;
+
+    pthread_mutex_lock(&IPC_ReportMutex);
+    if (IPC_ReportSending < IPC_ReportCount) {
+        p_entry = &IPC_ReportQueue[(IPC_ReportHead + IPC_ReportSending) % IPC_REPORT_QUEUE_DEPTH];
+        if (p_entry->len < size) {
+            len = p_entry->len;
+            memcpy(p_buff, p_entry->item, len + 1);
+            ++IPC_ReportSending;
+        }
+    }
+    if (IPC_ReportSending == IPC_ReportCount) {
+        OS_EventClear(IPC_ReportEvent, IPC_REPORT_EVENT);
+    }
+    pthread_mutex_unlock(&IPC_ReportMutex);
+    return len;
+}
+
+/**
+ * @brief Finish with the reports in the message just sent.
+ *
+ * @param done true to take them out of the queue, false to leave them
+ *     there for the next message.
+ */
+static void ipc_report_finish(bool done)
+{
+    pthread_mutex_lock(&IPC_ReportMutex);
+    if (done) {
+        IPC_ReportHead = (IPC_ReportHead + IPC_ReportSending) % IPC_REPORT_QUEUE_DEPTH;
+        IPC_ReportCount -= IPC_ReportSending;
+    }
+    IPC_ReportSending = 0;
+    pthread_mutex_unlock(&IPC_ReportMutex);
+}
+
+/**
+ * @brief Tell whether the databases took a message.
+ *
+ * @param p_resp Their answer.
+ * @return false if it is a nack, carries an error, or isn't from the
+ *     databases at all.
+ */
+static bool ipc_report_accepted(char * p_resp)
+{
+    //findJSONString doesn't bound its copy, but counts it in 8 bits
+    char value[256];
+
+    if (interpret_data(p_resp, "databases") == true) {
+        return (findJSONString(p_resp, "data\\error", value) == false);
+    }
+    //a bare {"type":"databases","data":"ack"}
+    if (findJSONString(p_resp, "type", value) && (strcmp(value, "databases") == 0)) {
+        return (findJSONString(p_resp, "data", value) && (strcmp(value, "ack") == 0));
+    }
+    return false;
+}
+
+/**
+ * @brief Send one message to the databases and settle the reports in it.
+ *
+ * @details With no answer the reports are left queued and the task waits
+ *     IPC_REPORT_RETRY_MSEC before its next message.  A refused
+ *     report_batch turns batching off and leaves the reports queued to
+ *     go one by one.  A single report that is refused is dropped, sending
+ *     it again would get the same answer.
+ *
+ * @param p_buff The message.
+ * @param reports Number of reports in it.
+ */
+static void ipc_report_send(char * p_buff, uint16_t reports)
+{
+    IPC_RECEIVE_MSG_PTR p_msg;
+    bool answered = false;
+    bool accepted = false;
+
+    p_msg = IPC_Client_Request(DATABASE_CLIENT_PATH, p_buff);
+    if (p_msg != NULL) {
+        if (p_msg->len != 0) {
+            answered = true;
+            accepted = ipc_report_accepted(p_msg->p_buff);
+        }
+        free_msg_mem(p_msg);
+    }
+
+    if (answered == false) {
+        ipc_report_finish(false);
+        pthread_mutex_lock(&IPC_ReportMutex);
+        ++IPC_ReportStats.failures;
+        IPC_ReportStats.retried += reports;
+        pthread_mutex_unlock(&IPC_ReportMutex);
+        OS_TaskSleep(IPC_REPORT_RETRY_MSEC);
+    }
+    else if ((accepted == false) && IPC_ReportBatched) {
+        printf("databases refused report_batch, sending reports one by one\n");
+        IPC_ReportBatched = false;
+        ipc_report_finish(false);
+        pthread_mutex_lock(&IPC_ReportMutex);
+        ++IPC_ReportStats.messages;
+        IPC_ReportStats.retried += reports;
+        pthread_mutex_unlock(&IPC_ReportMutex);
+    }
+    else {
+        ipc_report_finish(true);
+        pthread_mutex_lock(&IPC_ReportMutex);
+        ++IPC_ReportStats.messages;
+        if (accepted) {
+            IPC_ReportStats.sent += reports;
+        }
+        else {
+            IPC_ReportStats.rejected += reports;
+        }
+        pthread_mutex_unlock(&IPC_ReportMutex);
+    }
+}
+
+/** @} */
@@ -0,0 +1,59 @@
+/** @file
+ *
+ * @defgroup ipc_client_report Header file for the IPC report queue
+ * @{
+ * @brief Reports from the hub core to the databases, sent from a task of
+ *     their own.
+ *
+ */
+
+#ifndef IPC_CLIENT_REPORT_H__
+#define IPC_CLIENT_REPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//room for a report on every shade, as when a battery sweep finishes
+#define IPC_REPORT_QUEUE_DEPTH      256
+#define IPC_REPORT_ITEM_SIZE        192
+//above this many waiting reports the queue is backed up
+#define IPC_REPORT_HIGH_WATER       ((IPC_REPORT_QUEUE_DEPTH * 3) / 4)
+//reports arriving this soon after the first are sent with it
+#define IPC_REPORT_WINDOW_MSEC      250
+//wait after a message the databases didn't answer before sending it again
+#define IPC_REPORT_RETRY_MSEC       1000
+
+//the "data" object of each report is queued, the envelope is added when sent
+#define IPC_REPORT_ENVELOPE_HEAD    "{\"type\":\"databases\",\"data\":"
+#define IPC_REPORT_ENVELOPE_TAIL    "}"
+#define IPC_REPORT_BATCH_HEAD       "{\"type\":\"databases\",\"data\":{\"action\":\"report_batch\",\"reports\":["
+#define IPC_REPORT_BATCH_TAIL       "]}}"
+
+//key of a report that never replaces another
+#define IPC_REPORT_NO_KEY           0
+
+typedef struct IPC_REPORT_STATS_TAG
+{
+    uint32_t queued;            //reports offered
+    uint32_t coalesced;         //replaced a waiting report with the same key
+    uint32_t dropped;           //oldest reports pushed out of a full queue
+    uint32_t too_long;          //refused, longer than IPC_REPORT_ITEM_SIZE
+    uint32_t sent;              //reports the databases took
+    uint32_t messages;          //messages they went in
+    uint32_t rejected;          //reports the databases refused one by one, not sent again
+    uint32_t failures;          //messages with no answer, their reports were put back
+    uint32_t retried;           //reports put back for another try
+    uint32_t backed_up;         //times the queue went over IPC_REPORT_HIGH_WATER
+    uint16_t waiting;
+    uint16_t high_water;        //most reports ever waiting
+    bool batched;               //false once the databases refused a report_batch
+} IPC_REPORT_STATS;
+
+bool IPC_Report_Queue(uint64_t key, char * p_item);
+bool IPC_Report_IsBackedUp(void);
+void IPC_Report_GetStats(IPC_REPORT_STATS * p_stats);
+void IPC_Report_ResetStats(void);
+
+#endif
+
+/** @} */
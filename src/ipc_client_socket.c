@@ -1,6 +1,6 @@
 /** @file
  *
- * @defgroup ipc_client_socket.c 
+ * @defgroup ipc_client_socket.c
  * @{
  * @brief Code for creating socket for the hub core socket to use to communicate
  *     with other processes.
@@ -8,27 +8,111 @@
  * @details This module contains the code for creating and using the socket
  *     required by the IPC client from hub core.
  *
+ *     There is one connection per socket path and it is kept open between
+ *     requests.  Callers on any task share it: requests are written in
+ *     turn, and whichever caller is waiting reads the responses as they
+ *     come and hands each to the request it answers, found by its
+ *     "request_id" if the other end sends one back and otherwise by order.
+ *
+ *     Until the other end has answered two requests on one connection it
+ *     isn't known to keep connections open, so only one request is sent
+ *     at a time.  After that up to IPC_CLIENT_PIPELINE_DEPTH are.  If it
+ *     closes the connection after an answer it is taken to want a new
+ *     connection per request and gets one, as it always used to.
+ *
+ *     A request whose connection is lost before it is answered is sent
+ *     once more on a new one.  Connecting is retried with a doubling
+ *     wait for up to IPC_CLIENT_CONNECT_WAIT_MSEC; once that has failed,
+ *     requests fail at once for a hold off that doubles with each failed
+ *     attempt, so a process that is down doesn't stall every caller.
+ *
  */
 
 /* Includes
 *******************************************************************************/
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 
 #include "os.h"
+#include "config.h"
 #include "ipc_client_core.h"
+#include "ipc_frame.h"
+#include "JSONReader.h"
+
+/* Local Constants and Definitions
+*******************************************************************************/
+//different sockets the hub core talks to as a client, the databases and
+//the stand-in ipc_stress sets up
+#define IPC_CONNECTION_MAX_PATHS    2
+//first and longest wait between connect attempts
+#define IPC_CONNECT_BACKOFF_MIN_MSEC    1
+#define IPC_CONNECT_BACKOFF_MAX_MSEC    100
+//first and longest time requests fail at once after connecting failed
+#define IPC_HOLD_OFF_MIN_MSEC       250
+#define IPC_HOLD_OFF_MAX_MSEC       8000
+//a request is sent at most this many times
+#define IPC_MAX_SENDS               2
 
-typedef enum {errNone = 0, errMakeSocket, errConnectSocket} eErr;
+typedef enum {peerUnknown = 0, peerPersistent, peerOneShot} ePeer;
 
-static struct sockaddr_un addr;
-static eErr error;
-static bool made;
+typedef struct IPC_PENDING_TAG
+{
+    char * p_msg;
+    uint16_t len;
+    uint32_t id;
+    uint8_t sends;
+    bool done;
+    IPC_RECEIVE_MSG_PTR p_resp;     //NULL if there was no answer
+} IPC_PENDING;
+
+typedef struct IPC_CONNECTION_TAG
+{
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;         //a request was answered or a slot came free
+    int fd;                         //-1 while not connected
+    ePeer peer;
+    uint16_t answered;              //on this connection
+    bool reading;                   //a caller is reading responses
+    uint32_t next_id;
+    uint32_t retry_msec;            //OS_GetMsecTick when connecting may be tried again
+    uint32_t hold_off_msec;
+    IPC_PENDING * p_pending[IPC_CLIENT_PIPELINE_DEPTH];     //in the order sent
+    uint16_t in_flight;
+    //only the reading caller touches these
+    char in[IPC_CLIENT_MAX_RESPONSE_SIZE];
+    uint32_t in_len;
+    IPC_FRAME frame;
+    IPC_CLIENT_STATS stats;
+} IPC_CONNECTION;
+
+/* Local Function Declarations
+*******************************************************************************/
+static IPC_CONNECTION * findConnection(char *socket_path);
+static bool openConnection(IPC_CONNECTION *p_conn);
+static void closeConnection(IPC_CONNECTION *p_conn);
+static bool writeAll(int fd, char *p_head, uint32_t head_len, char *p_body, uint32_t body_len);
+static bool writeRequest(IPC_CONNECTION *p_conn, IPC_PENDING *p_req);
+static void readResponse(IPC_CONNECTION *p_conn);
+static IPC_RECEIVE_MSG_PTR takeResponse(IPC_CONNECTION *p_conn);
+static void answerRequest(IPC_CONNECTION *p_conn, IPC_RECEIVE_MSG_PTR p_resp);
+static void finishRequest(IPC_CONNECTION *p_conn, uint16_t idx, IPC_RECEIVE_MSG_PTR p_resp);
+static void connectionLost(IPC_CONNECTION *p_conn, bool resend);
+
+/* Local variables
+*******************************************************************************/
+static pthread_mutex_t IPC_ConnectionsMutex = PTHREAD_MUTEX_INITIALIZER;
+static IPC_CONNECTION IPC_Connections[IPC_CONNECTION_MAX_PATHS];
 
 
 static struct sockaddr_un makeAddress(char *socket_path)
@@ -47,78 +131,447 @@ static struct sockaddr_un makeAddress(char *socket_path)
     return addr;
 }
 
-static bool tryToConnect(char *socket_path, uint16_t *p_socket)
+/**
+ * @brief Send a request and wait for its response.
+ *
+ * @param socket_path The process to ask.
+ * @param msg The request, a JSON object.  Must stay put until this returns.
+ * @param len Its length.
+ * @return The response, or NULL if there was none.  Free it with
+ *     free_msg_mem.
+ */
+IPC_RECEIVE_MSG_PTR exchangeMessage(char *socket_path, char *msg, uint16_t len)
 {
-    bool success = true;
+    IPC_CONNECTION *p_conn = findConnection(socket_path);
+    IPC_PENDING req;
+    uint16_t depth;
 
-    // make path
-    addr = makeAddress(socket_path);
+    memset(&req, 0, sizeof(req));
+    req.p_msg = msg;
+    req.len = len;
 
-    // try to make socket
-    if(!made) {
-        *p_socket = socket(AF_UNIX, SOCK_STREAM, 0);
-        made = (*p_socket != -1);
-        if(!made) {
-            if(!error) error = errMakeSocket;
-            success = false;
+    pthread_mutex_lock(&p_conn->mutex);
+    while (1) {
+        depth = (p_conn->peer == peerPersistent) ? IPC_CLIENT_PIPELINE_DEPTH : 1;
+        if (p_conn->in_flight < depth) {
+            break;
         }
+        pthread_cond_wait(&p_conn->changed, &p_conn->mutex);
+    }
+
+    if ((p_conn->fd == -1) && (openConnection(p_conn) == false)) {
+        ++p_conn->stats.failed;
+        pthread_cond_broadcast(&p_conn->changed);
+        pthread_mutex_unlock(&p_conn->mutex);
+        return NULL;
+    }
+
+    req.id = p_conn->next_id++;
+    p_conn->p_pending[p_conn->in_flight++] = &req;
+    if (p_conn->in_flight > p_conn->stats.in_flight_high_water) {
+        p_conn->stats.in_flight_high_water = p_conn->in_flight;
+    }
+    ++p_conn->stats.requests;
+    if (writeRequest(p_conn, &req) == false) {
+        //wakes the reader, which starts over on a new connection
+        shutdown(p_conn->fd, SHUT_RDWR);
     }
 
-    // try to connect socket
-    if(success) {
-        if(connect(*p_socket, (struct sockaddr*) & addr, sizeof(addr)) == -1) {
-            if(!error) error = errConnectSocket;
-            success = false;
+    while (req.done == false) {
+        if (p_conn->reading == false) {
+            readResponse(p_conn);
+        }
+        else {
+            pthread_cond_wait(&p_conn->changed, &p_conn->mutex);
         }
-        else printf("connected\n");
     }
-    return success;
+    pthread_mutex_unlock(&p_conn->mutex);
+    return req.p_resp;
 }
 
-bool connectSocket(char *socket_path, uint16_t * p_socket)
+/**
+ * @brief Copy out the counters of the connection to a process.
+ */
+void getConnectionStats(char *socket_path, IPC_CLIENT_STATS *p_stats)
 {
-    bool connected = false;
-    uint16_t ctr = retries_;
+    IPC_CONNECTION *p_conn = findConnection(socket_path);
+
+    pthread_mutex_lock(&p_conn->mutex);
+    *p_stats = p_conn->stats;
+    p_stats->in_flight = p_conn->in_flight;
+    p_stats->persistent = (p_conn->peer == peerPersistent);
+    pthread_mutex_unlock(&p_conn->mutex);
+}
 
-    error = errNone;
-    made = false;
+/**
+ * @brief Clear the counters of the connection to a process.
+ */
+void resetConnectionStats(char *socket_path)
+{
+    IPC_CONNECTION *p_conn = findConnection(socket_path);
+
+    pthread_mutex_lock(&p_conn->mutex);
+    memset(&p_conn->stats, 0, sizeof(p_conn->stats));
+    pthread_mutex_unlock(&p_conn->mutex);
+}
 
-    while(!connected && ctr) {
-        connected = tryToConnect(socket_path, p_socket);
-        if(!connected) {
-            usleep(500);
-            ctr--;
-            printf(".");
+/**
+ * @brief Find the connection to a process, setting one up the first time.
+ */
+static IPC_CONNECTION * findConnection(char *socket_path)
+{
+    IPC_CONNECTION *p_conn = NULL;
+    uint16_t idx;
+
+    pthread_mutex_lock(&IPC_ConnectionsMutex);
+    for (idx = 0; idx < IPC_CONNECTION_MAX_PATHS; ++idx) {
+        p_conn = &IPC_Connections[idx];
+        if (p_conn->path[0] == '\0') {
+            strncpy(p_conn->path, socket_path, sizeof(p_conn->path) - 1);
+            pthread_mutex_init(&p_conn->mutex, NULL);
+            pthread_cond_init(&p_conn->changed, NULL);
+            p_conn->fd = -1;
+            break;
+        }
+        if (strcmp(p_conn->path, socket_path) == 0) {
+            break;
         }
     }
+    pthread_mutex_unlock(&IPC_ConnectionsMutex);
+    if (idx == IPC_CONNECTION_MAX_PATHS) {
+        //IPC_CONNECTION_MAX_PATHS is too small
+        OS_Error(OS_ERR_THREAD_FAIL);
+    }
+    return p_conn;
+}
 
-    if(!connected) {
-        printf("socket error: ");
-        switch(error) {
-            case errMakeSocket: printf("could not make\n"); break;
-            case errConnectSocket: printf("could not connect\n"); break;
-            default: printf("unknown\n");
+/**
+ * @brief Connect, trying again with a doubling wait for up to
+ *     IPC_CLIENT_CONNECT_WAIT_MSEC.  Called with the connection locked.
+ *
+ * @return false if the process could not be reached or is being held off.
+ */
+static bool openConnection(IPC_CONNECTION *p_conn)
+{
+    struct sockaddr_un addr = makeAddress(p_conn->path);
+    struct timeval send_wait;
+    uint32_t start = OS_GetMsecTick();
+    uint32_t backoff = IPC_CONNECT_BACKOFF_MIN_MSEC;
+    int fd;
+
+    if ((p_conn->hold_off_msec != 0) && ((int32_t)(start - p_conn->retry_msec) < 0)) {
+        ++p_conn->stats.held_off;
+        return false;
+    }
+
+    while (1) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            printf("socket error: could not make\n");
+            break;
+        }
+        if (connect(fd, (struct sockaddr*) & addr, sizeof(addr)) == 0) {
+            //a stuck reader must not hold a writer, who holds the lock, forever
+            send_wait.tv_sec = IPC_CLIENT_RESPONSE_WAIT_MSEC / 1000;
+            send_wait.tv_usec = (IPC_CLIENT_RESPONSE_WAIT_MSEC % 1000) * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_wait, sizeof(send_wait));
+            printf("connected\n");
+            p_conn->fd = fd;
+            p_conn->answered = 0;
+            p_conn->in_len = 0;
+            IPC_FrameReset(&p_conn->frame);
+            p_conn->hold_off_msec = 0;
+            ++p_conn->stats.connects;
+            return true;
+        }
+        close(fd);
+        if ((OS_GetMsecTick() - start + backoff) > IPC_CLIENT_CONNECT_WAIT_MSEC) {
+            printf("socket error: could not connect\n");
+            break;
+        }
+        usleep(backoff * 1000);
+        backoff *= 2;
+        if (backoff > IPC_CONNECT_BACKOFF_MAX_MSEC) {
+            backoff = IPC_CONNECT_BACKOFF_MAX_MSEC;
         }
     }
-    return connected;
+
+    ++p_conn->stats.connect_failures;
+    if (p_conn->hold_off_msec == 0) {
+        p_conn->hold_off_msec = IPC_HOLD_OFF_MIN_MSEC;
+    }
+    else if (p_conn->hold_off_msec < IPC_HOLD_OFF_MAX_MSEC) {
+        p_conn->hold_off_msec *= 2;
+    }
+    p_conn->retry_msec = OS_GetMsecTick() + p_conn->hold_off_msec;
+    return false;
 }
 
-int sendMessage(char *msg, uint16_t len, uint16_t socket)
+static void closeConnection(IPC_CONNECTION *p_conn)
 {
-    return write(socket, msg, len);
+    close(p_conn->fd);
+    p_conn->fd = -1;
+    p_conn->in_len = 0;
+    IPC_FrameReset(&p_conn->frame);
+    printf("disconnected\n");
 }
 
-IPC_RECEIVE_MSG_PTR startListening(uint16_t socket)
+/**
+ * @brief Write a head and a body in one go; a process that reads its
+ *     request with a single read() must get both together.
+ */
+static bool writeAll(int fd, char *p_head, uint32_t head_len, char *p_body, uint32_t body_len)
 {
-    IPC_RECEIVE_MSG_PTR p_msg = (IPC_RECEIVE_MSG_PTR)OS_GetMemBlock(sizeof(IPC_RECEIVE_MSG));
-    p_msg->p_buff = (char*)OS_GetMemBlock(socketBufferSize_);
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t sent;
 
-    p_msg->len = read(socket, p_msg->p_buff, socketBufferSize_);
-    close(socket);
-    printf("disconnected\n");
+    iov[0].iov_base = p_head;
+    iov[0].iov_len = head_len;
+    iov[1].iov_base = p_body;
+    iov[1].iov_len = body_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
 
+    while ((iov[0].iov_len + iov[1].iov_len) > 0) {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if ((sent == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        if ((size_t)sent >= iov[0].iov_len) {
+            sent -= iov[0].iov_len;
+            iov[0].iov_len = 0;
+            iov[1].iov_base = (char *)iov[1].iov_base + sent;
+            iov[1].iov_len -= sent;
+        }
+        else {
+            iov[0].iov_base = (char *)iov[0].iov_base + sent;
+            iov[0].iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write a request, with its request_id when IPC_CLIENT_REQUEST_IDS
+ *     is set.  Called with the connection locked, so requests from
+ *     different callers don't interleave.
+ */
+static bool writeRequest(IPC_CONNECTION *p_conn, IPC_PENDING *p_req)
+{
+    char *p_msg = p_req->p_msg;
+    uint16_t len = p_req->len;
+    char head[32];
+
+    head[0] = '\0';
+    ++p_req->sends;
+#if IPC_CLIENT_REQUEST_IDS
+    if ((len > 0) && (*p_msg == '{')) {
+        uint32_t space = IPC_FrameSkipSpace(p_msg + 1, len - 1);
+        bool empty = ((1 + space) < len) && (p_msg[1 + space] == '}');
+
+        snprintf(head, sizeof(head), "{\"request_id\":%u%s", p_req->id, empty ? "" : ",");
+        ++p_msg;
+        --len;
+    }
+#endif
+    return writeAll(p_conn->fd, head, strlen(head), p_msg, len);
+}
+
+/**
+ * @brief Read until one response is complete and hand it to its request.
+ *     Called with the connection locked; it is unlocked while waiting.
+ *
+ * @details When the connection is lost the requests waiting on it are
+ *     sent again on a new one, or failed if they already were.
+ */
+static void readResponse(IPC_CONNECTION *p_conn)
+{
+    IPC_RECEIVE_MSG_PTR p_resp;
+    struct pollfd pfd;
+    ssize_t got = 0;
+    int ready;
+
+    p_conn->reading = true;
+    pfd.fd = p_conn->fd;
+    pfd.events = POLLIN;
+
+    while (1) {
+        p_resp = takeResponse(p_conn);
+        if (p_resp != NULL) {
+            answerRequest(p_conn, p_resp);
+            break;
+        }
+        if (p_conn->in_len == sizeof(p_conn->in)) {
+            printf("socket error: response too large\n");
+            connectionLost(p_conn, false);
+            break;
+        }
+
+        pthread_mutex_unlock(&p_conn->mutex);
+        ready = poll(&pfd, 1, IPC_CLIENT_RESPONSE_WAIT_MSEC);
+        if (ready > 0) {
+            got = read(pfd.fd, p_conn->in + p_conn->in_len, sizeof(p_conn->in) - p_conn->in_len);
+        }
+        pthread_mutex_lock(&p_conn->mutex);
+
+        if ((ready == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (ready == 0) {
+            printf("socket error: no response\n");
+            ++p_conn->stats.timeouts;
+            connectionLost(p_conn, false);
+            break;
+        }
+        if ((ready == -1) || (got <= 0)) {
+            if ((got == -1) && (errno == EINTR)) {
+                continue;
+            }
+            //closed right after answering: it wants a connection per
+            //request.  Only a clean close says so, not a timeout or error
+            if ((ready > 0) && (got == 0) && (p_conn->peer == peerUnknown) && (p_conn->answered > 0)) {
+                p_conn->peer = peerOneShot;
+            }
+            connectionLost(p_conn, true);
+            break;
+        }
+        p_conn->in_len += got;
+    }
+
+    p_conn->reading = false;
+    pthread_cond_broadcast(&p_conn->changed);
+}
+
+/**
+ * @brief Take the first complete response out of the read buffer.
+ *
+ * @return it, with its '\f' if it had one, or NULL if none is complete.
+ */
+static IPC_RECEIVE_MSG_PTR takeResponse(IPC_CONNECTION *p_conn)
+{
+    IPC_RECEIVE_MSG_PTR p_msg;
+    uint32_t space;
+    uint32_t skip;
+    uint32_t len;
+
+    if (p_conn->frame.scan == 0) {
+        space = IPC_FrameSkipSpace(p_conn->in, p_conn->in_len);
+        if (space > 0) {
+            memmove(p_conn->in, p_conn->in + space, p_conn->in_len - space);
+            p_conn->in_len -= space;
+        }
+    }
+    len = IPC_FrameEnd(&p_conn->frame, p_conn->in, p_conn->in_len, &skip);
+    if (len == 0) {
+        return NULL;
+    }
+
+    len += skip;
+    p_msg = (IPC_RECEIVE_MSG_PTR)OS_GetMemBlock(sizeof(IPC_RECEIVE_MSG));
+    p_msg->p_buff = (char*)OS_GetMemBlock(len + 1);
+    memcpy(p_msg->p_buff, p_conn->in, len);
+    p_msg->len = len;
+    p_conn->in_len -= len;
+    memmove(p_conn->in, p_conn->in + len, p_conn->in_len);
     return p_msg;
 }
 
+/**
+ * @brief Give a response to the request it answers.
+ */
+static void answerRequest(IPC_CONNECTION *p_conn, IPC_RECEIVE_MSG_PTR p_resp)
+{
+    uint16_t idx = 0;
+#if IPC_CLIENT_REQUEST_IDS
+    uint32_t id;
+
+    if (findJSONuint32(p_resp->p_buff, "request_id", &id)) {
+        for (idx = 0; idx < p_conn->in_flight; ++idx) {
+            if (p_conn->p_pending[idx]->id == id) {
+                break;
+            }
+        }
+    }
+#endif
+    if (p_conn->in_flight == 0) {
+        //nothing asked for it
+        free_msg_mem(p_resp);
+        return;
+    }
+    if (idx == p_conn->in_flight) {
+        idx = 0;
+    }
+    ++p_conn->stats.answered;
+    finishRequest(p_conn, idx, p_resp);
+
+    ++p_conn->answered;
+    if ((p_conn->answered >= 2) && (p_conn->peer == peerUnknown)) {
+        p_conn->peer = peerPersistent;
+    }
+    if ((p_conn->peer == peerOneShot) && (p_conn->in_flight == 0)) {
+        //it closes after each answer anyway
+        closeConnection(p_conn);
+    }
+}
+
+static void finishRequest(IPC_CONNECTION *p_conn, uint16_t idx, IPC_RECEIVE_MSG_PTR p_resp)
+{
+    IPC_PENDING *p_req = p_conn->p_pending[idx];
+
+    p_req->p_resp = p_resp;
+    p_req->done = true;
+    --p_conn->in_flight;
+    memmove(&p_conn->p_pending[idx], &p_conn->p_pending[idx + 1],
+            (p_conn->in_flight - idx) * sizeof(p_conn->p_pending[0]));
+}
+
+/**
+ * @brief Drop the connection and deal with the requests waiting on it.
+ *
+ * @param resend True to send each request that hasn't been sent twice
+ *     again on a new connection, false to fail them all.
+ */
+static void connectionLost(IPC_CONNECTION *p_conn, bool resend)
+{
+    uint16_t idx;
+
+    closeConnection(p_conn);
+
+    idx = 0;
+    while (idx < p_conn->in_flight) {
+        if ((resend == false) || (p_conn->p_pending[idx]->sends >= IPC_MAX_SENDS)) {
+            ++p_conn->stats.failed;
+            finishRequest(p_conn, idx, NULL);
+        }
+        else {
+            ++idx;
+        }
+    }
+    if (p_conn->in_flight == 0) {
+        return;
+    }
+
+    if (openConnection(p_conn) == true) {
+        for (idx = 0; idx < p_conn->in_flight; ++idx) {
+            ++p_conn->stats.resent;
+            if (writeRequest(p_conn, p_conn->p_pending[idx]) == false) {
+                shutdown(p_conn->fd, SHUT_RDWR);
+                break;
+            }
+        }
+    }
+    else {
+        while (p_conn->in_flight > 0) {
+            ++p_conn->stats.failed;
+            finishRequest(p_conn, 0, NULL);
+        }
+    }
+}
+
 
 /** @} */
@@ -0,0 +1,108 @@
+/** @file
+ *
+ * @defgroup ipc_frame IPC Framing
+ * @{
+ * @brief Finds where one IPC message ends and the next begins.
+ *
+ * @details A message is a JSON object.  It ends at the brace that closes
+ *     it or at a '\f', whichever comes first, and a '\f' right after the
+ *     closing brace belongs to the message.  Some processes end their
+ *     messages with '\f' and some don't, so neither can be relied on
+ *     alone.  Braces inside strings don't count.
+ *
+ *     The search keeps its place in an IPC_FRAME, so a message that
+ *     arrives in pieces is looked at one byte at a time only once.
+ *
+ */
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+
+#include "ipc_frame.h"
+
+/**@brief Start looking for a new message.
+ *
+ * @param p_frame The search state.
+ */
+void IPC_FrameReset(IPC_FRAME * p_frame)
+{
+    memset(p_frame, 0, sizeof(IPC_FRAME));
+}
+
+/**@brief Count the whitespace and '\f' in front of a message.
+ *
+ * @param p_buff The received bytes.
+ * @param len    How many.
+ * @return Number of bytes to drop.
+ */
+uint32_t IPC_FrameSkipSpace(const char * p_buff, uint32_t len)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < len; ++idx) {
+        if ((p_buff[idx] != ' ') && (p_buff[idx] != '\t') && (p_buff[idx] != '\r') &&
+            (p_buff[idx] != '\n') && (p_buff[idx] != '\f')) {
+            break;
+        }
+    }
+    return idx;
+}
+
+/**@brief Look for the end of the message at the start of a buffer.
+ *
+ * @param p_frame The search state, reset when a message is found.
+ * @param p_buff  The received bytes, starting with the message.
+ * @param len     How many.
+ * @param p_skip  Set to the number of bytes after the message that go
+ *     with it, 1 for a '\f' and otherwise 0.
+ * @return Length of the message, 0 if it is not all here yet.
+ */
+uint32_t IPC_FrameEnd(IPC_FRAME * p_frame, const char * p_buff, uint32_t len, uint32_t * p_skip)
+{
+    uint32_t idx;
+
+    *p_skip = 0;
+    for (idx = p_frame->scan; idx < len; ++idx) {
+        char c = p_buff[idx];
+
+        if (p_frame->in_string) {
+            if (p_frame->escape) {
+                p_frame->escape = false;
+            }
+            else if (c == '\\') {
+                p_frame->escape = true;
+            }
+            else if (c == '"') {
+                p_frame->in_string = false;
+            }
+            continue;
+        }
+        if (c == '\f') {
+            *p_skip = 1;
+            IPC_FrameReset(p_frame);
+            return idx;
+        }
+        if (c == '"') {
+            p_frame->in_string = true;
+        }
+        else if ((c == '{') || (c == '[')) {
+            p_frame->depth++;
+        }
+        else if (((c == '}') || (c == ']')) && (p_frame->depth > 0)) {
+            p_frame->depth--;
+            if (p_frame->depth == 0) {
+                ++idx;
+                if ((idx < len) && (p_buff[idx] == '\f')) {
+                    *p_skip = 1;
+                }
+                IPC_FrameReset(p_frame);
+                return idx;
+            }
+        }
+    }
+    p_frame->scan = len;
+    return 0;
+}
+
+/** @} */
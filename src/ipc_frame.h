@@ -0,0 +1,30 @@
+/** @file
+ *
+ * @defgroup ipc_frame IPC Framing
+ * @{
+ * @brief Header file for finding where one IPC message ends and the
+ *     next begins.
+ *
+ */
+
+#ifndef _IPC_FRAME_H_
+#define _IPC_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct IPC_FRAME_TAG
+{
+    uint32_t scan;              //bytes already searched
+    uint16_t depth;             //braces and brackets open at scan
+    bool in_string;
+    bool escape;
+} IPC_FRAME;
+
+void IPC_FrameReset(IPC_FRAME * p_frame);
+uint32_t IPC_FrameSkipSpace(const char * p_buff, uint32_t len);
+uint32_t IPC_FrameEnd(IPC_FRAME * p_frame, const char * p_buff, uint32_t len, uint32_t * p_skip);
+
+#endif
+
+/** @} */
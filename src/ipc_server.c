@@ -11,23 +11,42 @@
  * @details This task opens a socket to listen for messages from other
  *    processes.  Processing of messages occurs using the ipc_server_cmd module.
  *
+ *    One thread watches every connection with epoll and a pool of
+ *    IPC_SERVER_WORKERS threads runs IPC_ProcessPacket.  Requests are
+ *    framed as ipc_frame describes.  A client may send requests one after
+ *    another on the same connection.  Only one of them is with a worker
+ *    at a time and nothing more is read from the client until its
+ *    response has been written, so responses come back in order and a
+ *    client that sends faster than it reads is held back by its own
+ *    socket.  A client that closes after one request, as they all used
+ *    to, gets the same behaviour as before.
+ *
  */
 
 /* Includes
 *******************************************************************************/
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "ipc.h"
+#include "ipc_server.h"
+#include "ipc_frame.h"
 #include "os.h"
+#include "config.h"
 //#include "rf_serial_api.h"
 #include "JSONReader.h"
 
@@ -38,30 +57,210 @@
 *******************************************************************************/
 #define MAX_BACKLOG             10
 
+#define IPC_SERVER_EVENTS       16
+#define IPC_SERVER_TICK_MSEC    1000
+//a client's input buffer starts at this and doubles up to IPC_SERVER_MAX_REQUEST_SIZE
+#define IPC_SERVER_IN_START     1024
+
+//epoll tags of the two descriptors that are not clients; clients are tagged by index
+#define IPC_SERVER_LISTEN_TAG   IPC_SERVER_MAX_CLIENTS
+#define IPC_SERVER_WAKE_TAG     (IPC_SERVER_MAX_CLIENTS + 1)
+
+#define IPC_SERVER_OVERSIZE_RESP    "{\"type\":\"hub_core\",\"data\":{\"error\":\"request too large\"}}\f"
+
+typedef enum
+{
+    IPC_CLIENT_FREE = 0,
+    IPC_CLIENT_READING,         //waiting for a whole request
+    IPC_CLIENT_BUSY,            //request is with a worker
+    IPC_CLIENT_WRITING          //response did not go out in one write
+} IPC_CLIENT_STATE;
+
+typedef struct IPC_CLIENT_TAG
+{
+    int fd;
+    IPC_CLIENT_STATE state;
+    uint32_t events;            //what epoll is watching for
+    bool eof;                   //client has sent all it will
+    bool hangup;                //close once the response is written
+    bool gone;                  //client closed while its request was with a worker
+    char * p_in;
+    uint32_t in_size;
+    uint32_t in_len;
+    IPC_FRAME frame;            //search for the end of the request in p_in
+    char * p_request;
+    char * p_resp;
+    uint32_t resp_len;
+    uint32_t resp_sent;
+    uint64_t start_usec;        //when the request was complete, 0 for our own replies
+    uint32_t active_msec;       //last time anything was read or written
+    struct IPC_CLIENT_TAG * p_next;     //on the job or done list
+} IPC_CLIENT;
+
 /* Local Function Declarations
 *******************************************************************************/
+static int ipc_server_open(void);
+static void *ipc_server_worker(void * temp);
+static void ipc_server_accept(void);
+static void ipc_server_close(IPC_CLIENT * p_client);
+static void ipc_server_watch(IPC_CLIENT * p_client, uint32_t events);
+static void ipc_server_read(IPC_CLIENT * p_client);
+static uint32_t ipc_server_frame(IPC_CLIENT * p_client, uint32_t * p_skip);
+static void ipc_server_next(IPC_CLIENT * p_client, bool after_response);
+static void ipc_server_send(IPC_CLIENT * p_client);
+static void ipc_server_collect(void);
+static void ipc_server_sweep(void);
+static uint64_t ipc_server_usec(void);
 
 /* Local variables
 *******************************************************************************/
+static IPC_CLIENT IPC_Clients[IPC_SERVER_MAX_CLIENTS];
+static int IPC_EpollFd = -1;
+static int IPC_ListenFd = -1;
+static int IPC_WakeFd = -1;
+static bool IPC_ListenPaused = false;
+
+//jobs go to the workers and finished ones come back; both under IPC_ServerMutex
+static pthread_mutex_t IPC_ServerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t IPC_ServerWork = PTHREAD_COND_INITIALIZER;
+static IPC_CLIENT * p_IPC_JobHead = NULL;
+static IPC_CLIENT * p_IPC_JobTail = NULL;
+static uint16_t IPC_JobCount = 0;
+static IPC_CLIENT * p_IPC_DoneHead = NULL;
+
+//only the server task writes these; readers get a snapshot
+static IPC_SERVER_STATS IPC_ServerStats;
 
 /**@brief IPC server task
  *
  * @details Set up a socket and monitor for incoming packets
  *  used as interprocess communication.  When a packet is received,
- *  call a parser to process the packet.
+ *  hand it to a worker to be parsed and write back the response.
  */
 void *ipc_server_task(void * temp)
 {
-    int connfd = 0;
-    int listenfd = 0;
-    int pkt_size;
-    bool success = true;
+    struct epoll_event ev;
+    struct epoll_event events[IPC_SERVER_EVENTS];
+    pthread_t worker;
+    uint32_t last_sweep = OS_GetMsecTick();
+    uint16_t idx;
+    int count;
+
+    for (idx = 0; idx < IPC_SERVER_MAX_CLIENTS; ++idx) {
+        IPC_Clients[idx].fd = -1;
+    }
+
+    IPC_ListenFd = ipc_server_open();
+    if (IPC_ListenFd == -1) {
+        return 0;
+    }
+
+    IPC_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    IPC_WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((IPC_EpollFd == -1) || (IPC_WakeFd == -1)) {
+        printf("server epoll error\n");
+        return 0;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = IPC_SERVER_LISTEN_TAG;
+    epoll_ctl(IPC_EpollFd, EPOLL_CTL_ADD, IPC_ListenFd, &ev);
+    ev.data.u32 = IPC_SERVER_WAKE_TAG;
+    epoll_ctl(IPC_EpollFd, EPOLL_CTL_ADD, IPC_WakeFd, &ev);
+
+    IPC_InitActions();
+    for (idx = 0; idx < IPC_SERVER_WORKERS; ++idx) {
+        if (pthread_create(&worker, NULL, ipc_server_worker, NULL) != 0) {
+            printf("server worker error\n");
+            return 0;
+        }
+        pthread_detach(worker);
+    }
+
+    while (1) {
+        count = epoll_wait(IPC_EpollFd, events, IPC_SERVER_EVENTS, IPC_SERVER_TICK_MSEC);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("server epoll wait error\n");
+            break;
+        }
+
+        for (idx = 0; idx < count; ++idx) {
+            uint32_t tag = events[idx].data.u32;
+            IPC_CLIENT * p_client;
+
+            if (tag == IPC_SERVER_LISTEN_TAG) {
+                ipc_server_accept();
+                continue;
+            }
+            if (tag == IPC_SERVER_WAKE_TAG) {
+                ipc_server_collect();
+                continue;
+            }
+
+            p_client = &IPC_Clients[tag];
+            switch (p_client->state) {
+                case IPC_CLIENT_READING:
+                    ipc_server_read(p_client);
+                    break;
+                case IPC_CLIENT_WRITING:
+                    ipc_server_send(p_client);
+                    break;
+                case IPC_CLIENT_BUSY:
+                    //nothing is asked for while busy, so this is a hang up or
+                    //error; the worker's response is dropped when it comes back
+                    epoll_ctl(IPC_EpollFd, EPOLL_CTL_DEL, p_client->fd, NULL);
+                    p_client->events = 0;
+                    p_client->gone = true;
+                    break;
+                default:
+                    //closed earlier in this batch of events
+                    break;
+            }
+        }
+
+        if ((OS_GetMsecTick() - last_sweep) >= IPC_SERVER_TICK_MSEC) {
+            last_sweep = OS_GetMsecTick();
+            ipc_server_sweep();
+        }
+    }
+    return 0;
+}
+
+/**@brief Copy out the server counters.
+ *
+ * @param[out] p_stats Where to put them.
+ */
+void IPC_Server_GetStats(IPC_SERVER_STATS * p_stats)
+{
+    *p_stats = IPC_ServerStats;
+}
+
+/**@brief Clear the server counters.
+ */
+void IPC_Server_ResetStats(void)
+{
+    uint16_t active = IPC_ServerStats.active;
+
+    memset(&IPC_ServerStats, 0, sizeof(IPC_ServerStats));
+    IPC_ServerStats.active = active;
+    IPC_ServerStats.active_high_water = active;
+}
+
+/**@brief Create the listening socket.
+ *
+ * @return The socket, or -1 when it could not be set up.
+ */
+static int ipc_server_open(void)
+{
+    int listenfd;
     struct sockaddr_un addr;
 
-    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if(listenfd == -1) {
         printf("server socket error\n");
-        success = false;
+        return -1;
     }
 
     memset(&addr, 0, sizeof(addr));
@@ -78,38 +277,400 @@ void *ipc_server_task(void * temp)
 
     if (bind(listenfd, (struct sockaddr*)&addr,sizeof(addr))== -1) {
         printf("server bind error\n");
-        success = false;
+        close(listenfd);
+        return -1;
     }
 
     if (listen(listenfd, MAX_BACKLOG) == -1) {
         printf("Failed to listen\n");
-        return false;
+        close(listenfd);
+        return -1;
     }
+    return listenfd;
+}
 
-    while(success) {
-        char * p_json;
-        connfd = accept(listenfd, (struct sockaddr*)NULL ,NULL); // accept awaiting request
+/**@brief A worker thread.  Runs requests through IPC_ProcessPacket
+ *     and hands the responses back to the server task.
+ *
+ * @param temp Unused.
+ */
+static void *ipc_server_worker(void * temp)
+{
+    IPC_CLIENT * p_client;
+    uint64_t one = 1;
 
-        if(connfd == -1) {
-            printf("server accept error\n");
-            success = false;
+    while (1) {
+        pthread_mutex_lock(&IPC_ServerMutex);
+        while (p_IPC_JobHead == NULL) {
+            pthread_cond_wait(&IPC_ServerWork, &IPC_ServerMutex);
+        }
+        p_client = p_IPC_JobHead;
+        p_IPC_JobHead = p_client->p_next;
+        if (p_IPC_JobHead == NULL) {
+            p_IPC_JobTail = NULL;
+        }
+        IPC_JobCount--;
+        pthread_mutex_unlock(&IPC_ServerMutex);
+
+        p_client->p_resp = IPC_ProcessPacket(p_client->p_request);
+        OS_ReleaseMemBlock(p_client->p_request);
+        p_client->p_request = NULL;
+
+        pthread_mutex_lock(&IPC_ServerMutex);
+        p_client->p_next = p_IPC_DoneHead;
+        p_IPC_DoneHead = p_client;
+        pthread_mutex_unlock(&IPC_ServerMutex);
+        if (write(IPC_WakeFd, &one, sizeof(one)) != sizeof(one)) {
+            //only fails when the count is already huge, the task is awake
+        }
+    }
+    return 0;
+}
+
+/**@brief Take every waiting connection there is room for.
+ *
+ * @details When all IPC_SERVER_MAX_CLIENTS slots are in use the
+ *     listening socket is taken out of the poll set, so further
+ *     clients wait in the backlog until a connection closes.
+ */
+static void ipc_server_accept(void)
+{
+    struct epoll_event ev;
+    IPC_CLIENT * p_client;
+    uint16_t idx;
+    int connfd;
+
+    while (1) {
+        for (idx = 0; idx < IPC_SERVER_MAX_CLIENTS; ++idx) {
+            if (IPC_Clients[idx].state == IPC_CLIENT_FREE) {
+                break;
+            }
+        }
+        if (idx == IPC_SERVER_MAX_CLIENTS) {
+            if (IPC_ListenPaused == false) {
+                ev.events = 0;
+                ev.data.u32 = IPC_SERVER_LISTEN_TAG;
+                epoll_ctl(IPC_EpollFd, EPOLL_CTL_MOD, IPC_ListenFd, &ev);
+                IPC_ListenPaused = true;
+                IPC_ServerStats.full++;
+            }
+            return;
+        }
+
+        connfd = accept4(IPC_ListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                printf("server accept error\n");
+            }
+            return;
+        }
+
+        p_client = &IPC_Clients[idx];
+        memset(p_client, 0, sizeof(IPC_CLIENT));
+        p_client->fd = connfd;
+        p_client->state = IPC_CLIENT_READING;
+        p_client->p_in = OS_GetMemBlock(IPC_SERVER_IN_START);
+        p_client->in_size = IPC_SERVER_IN_START;
+        p_client->active_msec = OS_GetMsecTick();
+        p_client->events = EPOLLIN;
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        epoll_ctl(IPC_EpollFd, EPOLL_CTL_ADD, connfd, &ev);
+
+        IPC_ServerStats.accepted++;
+        IPC_ServerStats.active++;
+        if (IPC_ServerStats.active > IPC_ServerStats.active_high_water) {
+            IPC_ServerStats.active_high_water = IPC_ServerStats.active;
+        }
+    }
+}
+
+/**@brief Close a connection and free its slot.
+ *
+ * @param p_client The connection.  Must not be with a worker.
+ */
+static void ipc_server_close(IPC_CLIENT * p_client)
+{
+    struct epoll_event ev;
+
+    epoll_ctl(IPC_EpollFd, EPOLL_CTL_DEL, p_client->fd, NULL);
+    close(p_client->fd);
+    if (p_client->p_in != NULL) {
+        OS_ReleaseMemBlock(p_client->p_in);
+    }
+    if (p_client->p_resp != NULL) {
+        OS_ReleaseMemBlock(p_client->p_resp);
+    }
+    memset(p_client, 0, sizeof(IPC_CLIENT));
+    p_client->fd = -1;
+    IPC_ServerStats.active--;
+
+    if (IPC_ListenPaused == true) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = IPC_SERVER_LISTEN_TAG;
+        epoll_ctl(IPC_EpollFd, EPOLL_CTL_MOD, IPC_ListenFd, &ev);
+        IPC_ListenPaused = false;
+    }
+}
+
+/**@brief Change what epoll reports for a connection.
+ *
+ * @param p_client The connection.
+ * @param events   EPOLLIN, EPOLLOUT or 0 to hear only of hang ups.
+ */
+static void ipc_server_watch(IPC_CLIENT * p_client, uint32_t events)
+{
+    struct epoll_event ev;
+
+    if (p_client->events != events) {
+        ev.events = events;
+        ev.data.u32 = p_client - IPC_Clients;
+        epoll_ctl(IPC_EpollFd, EPOLL_CTL_MOD, p_client->fd, &ev);
+        p_client->events = events;
+    }
+}
+
+/**@brief Read what a connection has sent and start on any request
+ *     that is now complete.
+ *
+ * @param p_client The connection.
+ */
+static void ipc_server_read(IPC_CLIENT * p_client)
+{
+    ssize_t len;
+
+    if ((p_client->in_len == p_client->in_size) && (p_client->in_size < IPC_SERVER_MAX_REQUEST_SIZE)) {
+        char * p_bigger = OS_GetMemBlock(p_client->in_size * 2);
+        memcpy(p_bigger, p_client->p_in, p_client->in_len);
+        OS_ReleaseMemBlock(p_client->p_in);
+        p_client->p_in = p_bigger;
+        p_client->in_size *= 2;
+    }
+
+    len = read(p_client->fd, p_client->p_in + p_client->in_len, p_client->in_size - p_client->in_len);
+    if (len > 0) {
+        p_client->in_len += len;
+        p_client->active_msec = OS_GetMsecTick();
+        IPC_ServerStats.bytes_in += len;
+    }
+    else if (len == 0) {
+        p_client->eof = true;
+    }
+    else if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        return;
+    }
+    else {
+        ipc_server_close(p_client);
+        return;
+    }
+    ipc_server_next(p_client, false);
+}
+
+/**@brief Look for the end of the first request in a connection's buffer.
+ *
+ * @param p_client The connection.
+ * @param p_skip   Set to the bytes after the request that go with it.
+ * @return Length of the request, 0 if it is not all here yet.
+ */
+static uint32_t ipc_server_frame(IPC_CLIENT * p_client, uint32_t * p_skip)
+{
+    uint32_t space;
+
+    if (p_client->frame.scan == 0) {
+        space = IPC_FrameSkipSpace(p_client->p_in, p_client->in_len);
+        if (space > 0) {
+            memmove(p_client->p_in, p_client->p_in + space, p_client->in_len - space);
+            p_client->in_len -= space;
+        }
+    }
+    return IPC_FrameEnd(&p_client->frame, p_client->p_in, p_client->in_len, p_skip);
+}
+
+/**@brief Hand the next complete request of a connection to a worker.
+ *
+ * @details Called whenever the connection has nothing in progress.
+ *     If there is no complete request it goes back to reading, or is
+ *     closed when the client has finished sending.  Whatever is left
+ *     when the client stops sending is taken as a last request.
+ *
+ * @param p_client       The connection.
+ * @param after_response True when a response was just written.
+ */
+static void ipc_server_next(IPC_CLIENT * p_client, bool after_response)
+{
+    uint32_t skip;
+    uint32_t len = ipc_server_frame(p_client, &skip);
+
+    if (len == 0) {
+        if (p_client->eof) {
+            if (p_client->in_len == 0) {
+                ipc_server_close(p_client);
+                return;
+            }
+            len = p_client->in_len;
+        }
+        else if (p_client->in_len >= IPC_SERVER_MAX_REQUEST_SIZE) {
+            printf("server request too large\n");
+            IPC_ServerStats.oversize++;
+            p_client->in_len = 0;
+            p_client->hangup = true;
+            p_client->p_resp = OS_GetMemBlock(sizeof(IPC_SERVER_OVERSIZE_RESP));
+            strcpy(p_client->p_resp, IPC_SERVER_OVERSIZE_RESP);
+            p_client->resp_len = strlen(IPC_SERVER_OVERSIZE_RESP);
+            p_client->resp_sent = 0;
+            p_client->start_usec = 0;
+            ipc_server_send(p_client);
+            return;
+        }
+        else {
+            ipc_server_watch(p_client, EPOLLIN);
+            return;
+        }
+    }
+
+    if (after_response) {
+        IPC_ServerStats.pipelined++;
+    }
+    p_client->p_request = OS_GetMemBlock(len + 1);
+    memcpy(p_client->p_request, p_client->p_in, len);
+    p_client->in_len -= len + skip;
+    memmove(p_client->p_in, p_client->p_in + len + skip, p_client->in_len);
+
+    p_client->state = IPC_CLIENT_BUSY;
+    p_client->start_usec = ipc_server_usec();
+    ipc_server_watch(p_client, 0);
+
+    pthread_mutex_lock(&IPC_ServerMutex);
+    p_client->p_next = NULL;
+    if (p_IPC_JobTail == NULL) {
+        p_IPC_JobHead = p_client;
+    }
+    else {
+        p_IPC_JobTail->p_next = p_client;
+    }
+    p_IPC_JobTail = p_client;
+    IPC_JobCount++;
+    if (IPC_JobCount > IPC_ServerStats.queue_high_water) {
+        IPC_ServerStats.queue_high_water = IPC_JobCount;
+    }
+    pthread_cond_signal(&IPC_ServerWork);
+    pthread_mutex_unlock(&IPC_ServerMutex);
+}
+
+/**@brief Write as much of a connection's response as it will take.
+ *
+ * @details What doesn't fit is written when the socket has room again.
+ *     Once all of it is out the connection moves on to its next request.
+ *
+ * @param p_client The connection.
+ */
+static void ipc_server_send(IPC_CLIENT * p_client)
+{
+    ssize_t len;
+
+    while (p_client->resp_sent < p_client->resp_len) {
+        len = send(p_client->fd, p_client->p_resp + p_client->resp_sent,
+                   p_client->resp_len - p_client->resp_sent, MSG_NOSIGNAL);
+        if (len > 0) {
+            p_client->resp_sent += len;
+            p_client->active_msec = OS_GetMsecTick();
+            IPC_ServerStats.bytes_out += len;
+        }
+        else if ((len == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            if (p_client->state != IPC_CLIENT_WRITING) {
+                p_client->state = IPC_CLIENT_WRITING;
+                IPC_ServerStats.throttled++;
+            }
+            ipc_server_watch(p_client, EPOLLOUT);
+            return;
+        }
+        else if ((len == -1) && (errno == EINTR)) {
             continue;
         }
         else {
-            printf("\nserver accept\n");
-            p_json = OS_GetMemBlock(IPC_CORE_MAX_REQUEST_SIZE);
+            ipc_server_close(p_client);
+            return;
         }
+    }
 
-        pkt_size = read(connfd, p_json, IPC_CORE_MAX_REQUEST_SIZE);
-        if (pkt_size > 0) {
-            char * p_resp = IPC_ProcessPacket(p_json);
-            write(connfd, p_resp, strlen(p_resp));
-            OS_ReleaseMemBlock(p_resp);
+    OS_ReleaseMemBlock(p_client->p_resp);
+    p_client->p_resp = NULL;
+    if (p_client->start_usec != 0) {
+        uint32_t usec = ipc_server_usec() - p_client->start_usec;
+        IPC_ServerStats.requests++;
+        IPC_ServerStats.latency_total_usec += usec;
+        if (usec > IPC_ServerStats.latency_max_usec) {
+            IPC_ServerStats.latency_max_usec = usec;
         }
-        OS_ReleaseMemBlock(p_json);
-        close(connfd);
     }
-    return 0;
+
+    if (p_client->hangup) {
+        ipc_server_close(p_client);
+        return;
+    }
+    p_client->state = IPC_CLIENT_READING;
+    ipc_server_next(p_client, true);
+}
+
+/**@brief Pick up the responses the workers have finished.
+ */
+static void ipc_server_collect(void)
+{
+    IPC_CLIENT * p_client;
+    uint64_t count;
+
+    if (read(IPC_WakeFd, &count, sizeof(count)) != sizeof(count)) {
+        //already drained
+    }
+
+    pthread_mutex_lock(&IPC_ServerMutex);
+    p_client = p_IPC_DoneHead;
+    p_IPC_DoneHead = NULL;
+    pthread_mutex_unlock(&IPC_ServerMutex);
+
+    while (p_client != NULL) {
+        IPC_CLIENT * p_next = p_client->p_next;
+
+        p_client->p_next = NULL;
+        if (p_client->gone) {
+            ipc_server_close(p_client);
+        }
+        else {
+            p_client->resp_len = strlen(p_client->p_resp);
+            p_client->resp_sent = 0;
+            p_client->active_msec = OS_GetMsecTick();
+            ipc_server_send(p_client);
+        }
+        p_client = p_next;
+    }
+}
+
+/**@brief Close connections that have been quiet for IPC_SERVER_IDLE_SEC.
+ *
+ * @details Connections with a request at a worker are left alone,
+ *     however long it takes.
+ */
+static void ipc_server_sweep(void)
+{
+    uint32_t now = OS_GetMsecTick();
+    uint16_t idx;
+
+    for (idx = 0; idx < IPC_SERVER_MAX_CLIENTS; ++idx) {
+        IPC_CLIENT * p_client = &IPC_Clients[idx];
+
+        if (((p_client->state == IPC_CLIENT_READING) || (p_client->state == IPC_CLIENT_WRITING)) &&
+            ((now - p_client->active_msec) >= (IPC_SERVER_IDLE_SEC * 1000))) {
+            IPC_ServerStats.idle_closed++;
+            ipc_server_close(p_client);
+        }
+    }
+}
+
+static uint64_t ipc_server_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 /** @} */
@@ -0,0 +1,40 @@
+/** @file
+ *
+ * @defgroup ipc_server IPC Server
+ * @{
+ * @brief Header file for the IPC server task.
+ *
+ */
+
+#ifndef _IPC_SERVER_H_
+#define _IPC_SERVER_H_
+
+#include <stdint.h>
+
+//largest request one connection may send; JSONReader lengths are 16 bit
+#define IPC_SERVER_MAX_REQUEST_SIZE 32768
+
+typedef struct IPC_SERVER_STATS_TAG
+{
+    uint32_t accepted;          //connections taken
+    uint32_t requests;          //requests answered
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    uint32_t pipelined;         //requests that arrived while the one before was in progress
+    uint32_t throttled;         //responses the client did not take in one write
+    uint32_t oversize;          //requests over IPC_SERVER_MAX_REQUEST_SIZE, connection closed
+    uint32_t idle_closed;       //connections closed after IPC_SERVER_IDLE_SEC
+    uint32_t full;              //times IPC_SERVER_MAX_CLIENTS were connected
+    uint32_t latency_max_usec;  //longest from request received to response written
+    uint64_t latency_total_usec;
+    uint16_t active;            //connections open now
+    uint16_t active_high_water;
+    uint16_t queue_high_water;  //most requests waiting for a worker
+} IPC_SERVER_STATS;
+
+void IPC_Server_GetStats(IPC_SERVER_STATS * p_stats);
+void IPC_Server_ResetStats(void);
+
+#endif
+
+/** @} */
@@ -14,6 +14,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "ipc.h"
@@ -24,6 +27,8 @@
 #include "SCH_ScheduleTask.h"
 #include "stub.h"
 #include "RMT_RemoteServers.h"
+#include "sst_shade_state.h"
+#include "ipc_server.h"
 
 /* Global Variables
 *******************************************************************************/
@@ -48,14 +53,49 @@
 //#define MAX_TYPE_LENGTH  20
 #define MAX_DATA_TYPE_LENGTH    100
 
+//responses built with ipc_append are wrapped in IPC_RESPONSE_FULL in the same size buffer
+#define IPC_APPEND_MAX_SIZE   (IPC_CORE_MAX_RESPONSE_SIZE - MAX_DATA_TYPE_LENGTH - 32)
+
+
+//get_shade_state asks the shade for positions older than this unless told otherwise
+#define IPC_SHADE_STATE_MAX_AGE_SEC 300
+//most one shade adds to a get_shade_states response
+#define IPC_SHADE_STATE_MAX_JSON    512
 
 #define PRINT_IPC_JSON
 
+//what get_ipc_stats needs after the last action that fits
+#define IPC_STATS_TRUNCATED_ROOM    sizeof("],\"truncated\":true}")
+
+//entries in IPC_Functions, not counting the empty one that ends it
+#define IPC_ACTION_COUNT    (sizeof(IPC_Functions) / sizeof(IPC_Functions[0]) - 1)
+
+typedef struct IPC_ACTION_STATS_TAG
+{
+    uint32_t calls;
+    uint32_t max_usec;
+    uint64_t total_usec;
+    uint32_t hist[OS_STATS_HIST_BUCKETS];   //log2 usec, as the task latencies
+} IPC_ACTION_STATS;
+
 /* Local Function Declarations
 *******************************************************************************/
+static void ipc_build_action_index(void);
+static int ipc_compare_action_index(const void * p_a, const void * p_b);
+static int ipc_find_action_index(const void * p_key, const void * p_elem);
+static char * ipc_read_string(char * p, char * p_value, uint16_t size);
+static bool ipc_read_header(char * p_json, char * p_type, uint16_t type_size,
+                            char * p_action, uint16_t action_size);
+static uint32_t ipc_usec_now(void);
 
 /* Local variables
 *******************************************************************************/
+//IPC_Functions entries in order of their action names, for bsearch
+static uint8_t IPC_ActionIndex[IPC_ACTION_COUNT];
+static pthread_once_t IPC_ActionIndexOnce = PTHREAD_ONCE_INIT;
+//by IPC_Functions entry; workers update them at the same time
+static IPC_ACTION_STATS IPC_ActionStats[IPC_ACTION_COUNT];
+static uint32_t IPC_UnknownActions;
 
 
 char * ipc_ack_response(void)
@@ -312,6 +352,7 @@ char * ipc_delete_shade(char * p_json)
     if (success == true) {
         SC_ResetShade(P3_Address_Mode_Device_Id, &address, 
             SR_CLEAR_DISCOVERED_FLAG | SR_DEL_GROUP_7_TO_255 | SR_DELETE_SCENES);
+        SST_Remove(address.Device_Id);
         return ipc_ack_response();
     }
     else {
@@ -720,9 +761,206 @@ char * ipc_get_registration_error(char * p_json)
     return ipc_nack_response();
 }
 
+/**@brief Append formatted text to a response being built.
+ *
+ * @details Once the text no longer fits, *p_len is left past the
+ *    limit so later appends are dropped as well.
+ */
+static void ipc_append(char * p_resp, uint32_t *p_len, const char * p_fmt, ...)
+{
+    va_list args;
+    int32_t count;
+
+    if (*p_len >= IPC_APPEND_MAX_SIZE) {
+        return;
+    }
+    va_start(args, p_fmt);
+    count = vsnprintf(p_resp + *p_len, IPC_APPEND_MAX_SIZE - *p_len, p_fmt, args);
+    va_end(args);
+    if ((count < 0) || ((*p_len + count) >= IPC_APPEND_MAX_SIZE)) {
+        p_resp[*p_len] = '\0';
+        *p_len = IPC_APPEND_MAX_SIZE;
+    }
+    else {
+        *p_len += count;
+    }
+}
+
+char * ipc_get_os_stats(char * p_json)
+{
+    char * p_resp = OS_GetMemBlock(IPC_CORE_MAX_RESPONSE_SIZE);
+    uint32_t len = 0;
+    uint16_t idx;
+    uint16_t bucket;
+    bool first = true;
+    OS_TASK_STATS task;
+    OS_EVENT_STATS event;
+    OS_MBOX_STATS mbox;
+
+    ipc_append(p_resp, &len, "{\"tasks\":[");
+    for (idx = 0; OS_GetTaskStats(idx, &task) == true; ++idx) {
+        ipc_append(p_resp, &len, "%s{\"name\":\"%s\",\"run_usec\":%llu,\"wakeups\":%u,\"max_latency_usec\":%u,\"latency_hist\":[",
+                (idx == 0) ? "" : ",", task.name, (unsigned long long)task.run_usec,
+                task.wakeups, task.max_latency_usec);
+        for (bucket = 0; bucket < OS_STATS_HIST_BUCKETS; ++bucket) {
+            ipc_append(p_resp, &len, "%s%u", (bucket == 0) ? "" : ",", task.latency_hist[bucket]);
+        }
+        ipc_append(p_resp, &len, "]}");
+    }
+    ipc_append(p_resp, &len, "],\"events\":[");
+    for (idx = 0; OS_GetEventStats(idx, &event) == true; ++idx) {
+        ipc_append(p_resp, &len, "%s{\"owner\":\"%s\",\"pending\":%u,\"sets\":%u,\"waits\":%u,\"timeouts\":%u}",
+                (idx == 0) ? "" : ",", event.owner, event.pending, event.sets, event.waits, event.timeouts);
+    }
+    ipc_append(p_resp, &len, "],\"mailboxes\":[");
+    for (idx = 0; idx < MAX_MAILBOXES; ++idx) {
+        if (OS_GetMboxStats(idx, &mbox) == true) {
+            ipc_append(p_resp, &len, "%s{\"owner\":\"%s\",\"event_bit\":%u,\"depth\":%u,\"high_water\":%u,\"sent\":%u,\"received\":%u,\"max_dwell_usec\":%u,\"total_dwell_usec\":%llu}",
+                    first ? "" : ",", mbox.owner, mbox.event_bit, mbox.depth, mbox.high_water, mbox.sent,
+                    mbox.received, mbox.max_dwell_usec, (unsigned long long)mbox.total_dwell_usec);
+            first = false;
+        }
+    }
+    ipc_append(p_resp, &len, "]}");
+    if (len >= IPC_APPEND_MAX_SIZE) {
+        OS_ReleaseMemBlock(p_resp);
+        return ipc_nack_response();
+    }
+    return p_resp;
+}
+
+/**@brief Append a shade's state as a JSON object, left open for the
+ *    caller to add to and close.
+ */
+static void ipc_append_shade_state(char * p_resp, uint32_t *p_len, SST_SHADE_PTR p_shade)
+{
+    uint8_t n;
+
+    ipc_append(p_resp, p_len, "{\"shade_id\":%u,\"version\":%u",
+            p_shade->shade_id, p_shade->version);
+    if (p_shade->pos_msec != 0) {
+        ipc_append(p_resp, p_len, ",\"positions\":{");
+        for (n = 0; n < p_shade->positions.posCount; ++n) {
+            ipc_append(p_resp, p_len, "%s\"position%u\":%u,\"posKind%u\":%u", (n == 0) ? "" : ",",
+                    n + 1, p_shade->positions.position[n], n + 1, p_shade->positions.posKind[n]);
+        }
+        ipc_append(p_resp, p_len, "},\"position_age\":%u", SST_AgeSeconds(p_shade->pos_msec));
+    }
+    if (p_shade->batt_msec != 0) {
+        ipc_append(p_resp, p_len, ",\"voltage\":%u,\"voltage_age\":%u",
+                p_shade->batt_voltage, SST_AgeSeconds(p_shade->batt_msec));
+    }
+    if (p_shade->nordic_fw_msec != 0) {
+        ipc_append(p_resp, p_len, ",\"nordic_fw\":[%u,%u,%u,%u],\"nordic_fw_age\":%u",
+                p_shade->nordic_fw[0], p_shade->nordic_fw[1], p_shade->nordic_fw[2], p_shade->nordic_fw[3],
+                SST_AgeSeconds(p_shade->nordic_fw_msec));
+    }
+    if (p_shade->motor_fw_msec != 0) {
+        ipc_append(p_resp, p_len, ",\"motor_fw\":[%u,%u,%u,%u],\"motor_fw_age\":%u",
+                p_shade->motor_fw[0], p_shade->motor_fw[1], p_shade->motor_fw[2], p_shade->motor_fw[3],
+                SST_AgeSeconds(p_shade->motor_fw_msec));
+    }
+}
+
+/**@brief Answer with what is known of one shade.
+ *
+ * @details Positions older than "max_age" seconds (default
+ *    IPC_SHADE_STATE_MAX_AGE_SEC), or not known at all, are asked of the
+ *    shade and "refreshing" is true; the new positions arrive later as a
+ *    report to the databases and in the table.  Fresh positions cost no
+ *    radio traffic.
+ */
+char * ipc_get_shade_state(char * p_json)
+{
+    P3_Address_Internal_Type address;
+    uint32_t max_age = IPC_SHADE_STATE_MAX_AGE_SEC;
+    SST_SHADE shade;
+    bool refresh;
+    char * p_resp;
+    uint32_t len = 0;
+
+    address.Unique_Id = 0;
+    if (findJSONuint16(p_json, "data\\shade_id", &address.Device_Id) == false) {
+        return ipc_nack_response();
+    }
+    findJSONuint32(p_json, "data\\max_age", &max_age);
+
+    if (SST_Get(address.Device_Id, &shade) == false) {
+        memset(&shade, 0, sizeof(shade));
+        shade.shade_id = address.Device_Id;
+    }
+    refresh = (shade.pos_msec == 0) || (SST_AgeSeconds(shade.pos_msec) > max_age);
+    if (refresh == true) {
+        SC_GetShadePosition(P3_Address_Mode_Device_Id, &address);
+    }
+    p_resp = OS_GetMemBlock(IPC_CORE_MAX_RESPONSE_SIZE);
+    ipc_append_shade_state(p_resp, &len, &shade);
+    ipc_append(p_resp, &len, ",\"refreshing\":%s}", (refresh == true) ? "true" : "false");
+    return p_resp;
+}
+
+/**@brief Answer with the state of every shade changed since "since"
+ *    (default 0, every shade).  Never causes radio traffic.
+ *
+ * @details A response holds as many shades as fit; a non-zero "next" is
+ *    passed back as "start" for the rest.  The caller keeps "version" as
+ *    its next "since".  "full" means shades were removed since "since",
+ *    so every shade is included and the caller should replace its copy.
+ */
+char * ipc_get_shade_states(char * p_json)
+{
+    uint32_t since = 0;
+    uint16_t cursor = 0;
+    uint16_t next;
+    uint32_t version;
+    bool full = false;
+    bool first = true;
+    SST_SHADE shade;
+    char * p_resp;
+    uint32_t len = 0;
+
+    findJSONuint32(p_json, "data\\since", &since);
+    findJSONuint16(p_json, "data\\start", &cursor);
+    //taken first, a change made during the walk is seen again next time
+    version = SST_Version();
+    if ((since != 0) && (since < SST_RemovedVersion())) {
+        since = 0;
+        full = true;
+    }
+
+    p_resp = OS_GetMemBlock(IPC_CORE_MAX_RESPONSE_SIZE);
+    ipc_append(p_resp, &len, "{\"version\":%u,\"full\":%s,\"shades\":[",
+            version, (full == true) ? "true" : "false");
+    while (1) {
+        next = cursor;
+        if (SST_Next(&cursor, since, &shade) == false) {
+            next = 0;
+            break;
+        }
+        if ((len + IPC_SHADE_STATE_MAX_JSON) >= IPC_APPEND_MAX_SIZE) {
+            //left for the next request
+            break;
+        }
+        if (first == false) {
+            ipc_append(p_resp, &len, ",");
+        }
+        ipc_append_shade_state(p_resp, &len, &shade);
+        ipc_append(p_resp, &len, "}");
+        first = false;
+    }
+    ipc_append(p_resp, &len, "],\"next\":%u}", next);
+    if (len >= IPC_APPEND_MAX_SIZE) {
+        OS_ReleaseMemBlock(p_resp);
+        return ipc_nack_response();
+    }
+    return p_resp;
+}
+
 void ipc_print_server_json(char * p_json, char * p_full_resp)
 {
     char *p_dsp;
+    //the workers may all be printing at once
+    flockfile(stdout);
     printf("Received:\n");
     p_dsp = p_json;
     while (*p_dsp) {
@@ -738,23 +976,271 @@ void ipc_print_server_json(char * p_json, char * p_full_resp)
         ++p_dsp;
     }
     printf("\n");
+    funlockfile(stdout);
+}
+
+/**@brief Sort IPC_Functions by action name into IPC_ActionIndex.
+ *
+ * @details Run once, from IPC_InitActions or the first request.
+ */
+static void ipc_build_action_index(void)
+{
+    uint16_t n;
+
+    for (n = 0; n < IPC_ACTION_COUNT; ++n) {
+        IPC_ActionIndex[n] = n;
+    }
+    qsort(IPC_ActionIndex, IPC_ACTION_COUNT, sizeof(IPC_ActionIndex[0]), ipc_compare_action_index);
+    for (n = 1; n < IPC_ACTION_COUNT; ++n) {
+        if (strcmp(IPC_Functions[IPC_ActionIndex[n - 1]].p_action,
+                   IPC_Functions[IPC_ActionIndex[n]].p_action) == 0) {
+            printf("IPC action %s is in IPC_Functions twice\n", IPC_Functions[IPC_ActionIndex[n]].p_action);
+        }
+    }
+}
+
+static int ipc_compare_action_index(const void * p_a, const void * p_b)
+{
+    return strcmp(IPC_Functions[*(const uint8_t *)p_a].p_action,
+                  IPC_Functions[*(const uint8_t *)p_b].p_action);
+}
+
+static int ipc_find_action_index(const void * p_key, const void * p_elem)
+{
+    return strcmp((const char *)p_key, IPC_Functions[*(const uint8_t *)p_elem].p_action);
+}
+
+/**@brief Build the action lookup.  Called by the IPC server before it
+ *    takes requests.
+ */
+void IPC_InitActions(void)
+{
+    pthread_once(&IPC_ActionIndexOnce, ipc_build_action_index);
+}
+
+static uint32_t ipc_usec_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
 }
 
 static char * process_action(char * p_type, char * p_action, char * p_json)
 {
-    uint16_t n = 0; // length;
     char * p_resp = NULL;
+    const uint8_t * p_entry;
+    IPC_ACTION_STATS * p_stats;
+    uint32_t start;
+    uint32_t usec;
+    uint32_t bucket;
+    uint32_t max;
+
+    IPC_InitActions();
+    p_entry = bsearch(p_action, IPC_ActionIndex, IPC_ACTION_COUNT, sizeof(IPC_ActionIndex[0]),
+                      ipc_find_action_index);
+    if (p_entry == NULL) {
+        __atomic_add_fetch(&IPC_UnknownActions, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    start = ipc_usec_now();
+    p_resp = (*IPC_Functions[*p_entry].funct)(p_json);
+    usec = ipc_usec_now() - start;
+
+    p_stats = &IPC_ActionStats[*p_entry];
+    bucket = (usec == 0) ? 0 : 32 - __builtin_clz(usec);
+    if (bucket >= OS_STATS_HIST_BUCKETS) {
+        bucket = OS_STATS_HIST_BUCKETS - 1;
+    }
+    __atomic_add_fetch(&p_stats->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p_stats->total_usec, usec, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p_stats->hist[bucket], 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&p_stats->max_usec, __ATOMIC_RELAXED);
+    while ((usec > max) &&
+           !__atomic_compare_exchange_n(&p_stats->max_usec, &max, usec, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
 
-    // printf("*** process_message(%d) ***\n", pRxBuffer->generic.length);
+    return p_resp;
+}
 
-    while (IPC_Functions[n].p_action[0]) {
-        if (strcmp(IPC_Functions[n].p_action,p_action) == 0) {
-            p_resp = (*IPC_Functions[n].funct)(p_json);
-            break;
+/**@brief Copy a string value of the JSON at p, which is just past its
+ *    opening quote, and step past its closing quote.
+ *
+ * @return Where the scan carries on, NULL if the string never ends.
+ */
+static char * ipc_read_string(char * p, char * p_value, uint16_t size)
+{
+    uint16_t len = 0;
+
+    while ((*p != '"') && (*p != '\0')) {
+        if ((*p == '\\') && (p[1] != '\0')) {
+            if ((p_value != NULL) && (len + 1 < size)) {
+                p_value[len++] = *p;
+            }
+            ++p;
         }
-        ++n;
+        if ((p_value != NULL) && (len + 1 < size)) {
+            p_value[len++] = *p;
+        }
+        ++p;
+    }
+    if (p_value != NULL) {
+        p_value[len] = '\0';
     }
+    return (*p == '"') ? p + 1 : NULL;
+}
 
+/**@brief Find "type" and "data\\action" in one pass over a request.
+ *
+ * @details Does the work of two findJSONString calls without going
+ *    over the request twice.  Stops as soon as it has both.  Values
+ *    longer than their buffer are cut short.
+ *
+ * @return true if both were found; either may be found without the
+ *    other.
+ */
+static bool ipc_read_header(char * p_json, char * p_type, uint16_t type_size,
+                            char * p_action, uint16_t action_size)
+{
+    char * p = p_json;
+    char * p_key = NULL;        //last key seen, NULL when a value is expected next
+    bool want_key = false;
+    bool in_data = false;       //inside the object that is the value of top level "data"
+    bool have_type = false;
+    bool have_action = false;
+    uint32_t objects = 0;       //bit per depth, set for an object, clear for an array
+    uint16_t depth = 0;
+    uint16_t key_len = 0;
+
+    while ((*p != '\0') && !(have_type && have_action)) {
+        switch (*p) {
+            case '"':
+                if (want_key) {
+                    p_key = p + 1;
+                    p = ipc_read_string(p + 1, NULL, 0);
+                    if (p == NULL) {
+                        return false;
+                    }
+                    key_len = p - 1 - p_key;
+                    want_key = false;
+                    continue;
+                }
+                if ((depth == 1) && (p_key != NULL) && (key_len == 4) && (strncmp(p_key, "type", 4) == 0)) {
+                    p = ipc_read_string(p + 1, p_type, type_size);
+                    have_type = true;
+                }
+                else if (in_data && (depth == 2) && (p_key != NULL) && (key_len == 6) &&
+                         (strncmp(p_key, "action", 6) == 0)) {
+                    p = ipc_read_string(p + 1, p_action, action_size);
+                    have_action = true;
+                }
+                else {
+                    p = ipc_read_string(p + 1, NULL, 0);
+                }
+                if (p == NULL) {
+                    return false;
+                }
+                continue;
+            case '{':
+                if ((depth == 1) && (p_key != NULL) && (key_len == 4) && (strncmp(p_key, "data", 4) == 0)) {
+                    in_data = true;
+                }
+                ++depth;
+                if (depth < 32) {
+                    objects |= (1UL << depth);
+                }
+                want_key = true;
+                break;
+            case '[':
+                ++depth;
+                if (depth < 32) {
+                    objects &= ~(1UL << depth);
+                }
+                want_key = false;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0) {
+                    return false;
+                }
+                --depth;
+                if (depth == 1) {
+                    in_data = false;
+                }
+                want_key = false;
+                break;
+            case ',':
+                want_key = (depth < 32) && ((objects & (1UL << depth)) != 0);
+                break;
+            case ':':
+                want_key = false;
+                break;
+            default:
+                break;
+        }
+        ++p;
+    }
+    return have_type && have_action;
+}
+
+/**@brief Report the calls and times of each action, and the server's
+ *    counters.
+ */
+char * ipc_get_ipc_stats(char * p_json)
+{
+    char * p_resp = OS_GetMemBlock(IPC_CORE_MAX_RESPONSE_SIZE);
+    uint32_t len = 0;
+    uint32_t mark;
+    uint16_t n;
+    uint16_t bucket;
+    bool first = true;
+    bool first_bucket;
+    bool truncated = false;
+    IPC_ACTION_STATS stats;
+    IPC_SERVER_STATS server;
+
+    IPC_Server_GetStats(&server);
+    ipc_append(p_resp, &len, "{\"server\":{\"accepted\":%u,\"active\":%u,\"requests\":%u,\"bytes_in\":%u,"
+            "\"bytes_out\":%u,\"pipelined\":%u,\"throttled\":%u,\"oversize\":%u,\"queue_high_water\":%u,"
+            "\"max_latency_usec\":%u,\"total_latency_usec\":%llu},\"unknown_actions\":%u,\"actions\":[",
+            server.accepted, server.active, server.requests, server.bytes_in, server.bytes_out,
+            server.pipelined, server.throttled, server.oversize, server.queue_high_water,
+            server.latency_max_usec, (unsigned long long)server.latency_total_usec,
+            __atomic_load_n(&IPC_UnknownActions, __ATOMIC_RELAXED));
+    //actions that have been called, each with its histogram as
+    //[bucket,count] pairs for the buckets that aren't empty
+    for (n = 0; n < IPC_ACTION_COUNT; ++n) {
+        stats = IPC_ActionStats[n];
+        if (stats.calls == 0) {
+            continue;
+        }
+        mark = len;
+        ipc_append(p_resp, &len, "%s{\"action\":\"%s\",\"calls\":%u,\"max_latency_usec\":%u,\"total_usec\":%llu,\"latency_hist\":[",
+                first ? "" : ",", IPC_Functions[n].p_action, stats.calls, stats.max_usec,
+                (unsigned long long)stats.total_usec);
+        first_bucket = true;
+        for (bucket = 0; bucket < OS_STATS_HIST_BUCKETS; ++bucket) {
+            if (stats.hist[bucket] != 0) {
+                ipc_append(p_resp, &len, "%s[%u,%u]", first_bucket ? "" : ",",
+                        bucket, stats.hist[bucket]);
+                first_bucket = false;
+            }
+        }
+        ipc_append(p_resp, &len, "]}");
+        //leave room to close the list and flag that it was cut short
+        if (len + IPC_STATS_TRUNCATED_ROOM >= IPC_APPEND_MAX_SIZE) {
+            len = mark;
+            p_resp[len] = '\0';
+            truncated = true;
+            break;
+        }
+        first = false;
+    }
+    ipc_append(p_resp, &len, truncated ? "],\"truncated\":true}" : "]}");
+    if (len >= IPC_APPEND_MAX_SIZE) {
+        OS_ReleaseMemBlock(p_resp);
+        return ipc_nack_response();
+    }
     return p_resp;
 }
 
@@ -768,8 +1254,8 @@ static char * process_action(char * p_type, char * p_action, char * p_json)
 char * IPC_ProcessPacket(char * p_json)
 {
     char * p_resp = NULL;
-    char type[MAX_TYPE_STR_LENGTH];
-    char action[MAX_DATA_TYPE_LENGTH];
+    char type[MAX_TYPE_STR_LENGTH] = "";
+    char action[MAX_DATA_TYPE_LENGTH] = "";
     char * p_full_resp = OS_GetMemBlock(IPC_CORE_MAX_RESPONSE_SIZE);
 
     uint16_t length;
@@ -781,11 +1267,9 @@ char * IPC_ProcessPacket(char * p_json)
     }
 
     // first validate the data
-    if(findJSONString(p_json, "type", type)) {
-        if(findJSONString(p_json, "data\\action", action)) {
-            if(strcmp(type, "hub_core") == 0) {
-                p_resp = process_action(type, action, p_json);
-            }
+    if(ipc_read_header(p_json, type, sizeof(type), action, sizeof(action))) {
+        if(strcmp(type, "hub_core") == 0) {
+            p_resp = process_action(type, action, p_json);
         }
     }
 
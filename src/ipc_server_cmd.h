@@ -68,6 +68,10 @@ char * ipc_unregister_hub(char * p_json);
 char * ipc_register_hub(char * p_json);
 char * ipc_get_registration_status(char * p_json);
 char * ipc_get_registration_error(char * p_json);
+char * ipc_get_os_stats(char * p_json);
+char * ipc_get_ipc_stats(char * p_json);
+char * ipc_get_shade_state(char * p_json);
+char * ipc_get_shade_states(char * p_json);
 
 typedef struct IPC_PARSE_STRUCT_STRUCT
 {
@@ -125,6 +129,10 @@ const IPC_PARSE_STRUCT IPC_Functions[] = {
     { "register_hub", ipc_register_hub },
     { "get_registeration_status", ipc_get_registration_status },
     { "get_registration_error", ipc_get_registration_error },
+    { "get_os_stats", ipc_get_os_stats },
+    { "get_ipc_stats", ipc_get_ipc_stats },
+    { "get_shade_state", ipc_get_shade_state },
+    { "get_shade_states", ipc_get_shade_states },
     { "",NULL }
 };
 
@@ -17,6 +17,9 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "config.h"
 
 /* Global Variables
@@ -28,54 +31,210 @@ extern int32_t currentTimeOffset;
 #define MILLION  1000000L
 #define THOUSAND 1000L
 
-#define OS_TIMER_RESOLUTION_MSEC    10
+#define OS_TIMER_RESOLUTION_MSEC    1
 #define OS_TIMER_STACK_SIZE     1000
 
+//Timing wheel: OS_WHEEL_LEVELS levels of OS_WHEEL_SLOTS slots each.  A slot
+//in level n spans OS_WHEEL_SLOTS^n ticks, so four levels of 64 cover
+//about 4.6 hours; anything further out is parked in the last level and
+//re-placed each time it cascades.
+#define OS_WHEEL_BITS               6
+#define OS_WHEEL_SLOTS              (1 << OS_WHEEL_BITS)
+#define OS_WHEEL_MASK               (OS_WHEEL_SLOTS - 1)
+#define OS_WHEEL_LEVELS             4
+#define OS_WHEEL_MAX_DELTA          ((1ULL << (OS_WHEEL_BITS * OS_WHEEL_LEVELS)) - 1)
+
+//time to back off when a producer has claimed the tail of a mailbox
+//but has not yet linked its message (see mbox_pop)
+#define OS_MBOX_LINK_WAIT_MSEC      1
+
 typedef struct MSG_HEADER_STRUCTURE_TAG
 {
     uint16_t SIZE;
     void *p_next;
+    uint32_t sent_usec;         //for mailbox dwell time statistics
 } MESSAGE_HEADER_STRUCT, * MESSAGE_HEADER_STRUCT_PTR;
 
+/*
+ * Each mailbox is an intrusive multi-producer/single-consumer queue linked
+ * through the p_next field of the message header.  Producers only touch
+ * p_tail (atomic exchange) and the p_next of the previous tail; the owning
+ * task is the only consumer and is the only one to touch p_head.  The stub
+ * header keeps the list non-empty so no lock is ever needed.
+ */
 typedef struct
 {
     void *event_handle;
     uint16_t event_bit;
-    uint16_t count;
+    uint32_t count;
     void *p_head;
     void *p_tail;
+    MESSAGE_HEADER_STRUCT stub;
+    uint32_t high_water;
+    uint32_t sent;
+    uint32_t received;          //dwell fields below are consumer-only
+    uint32_t max_dwell_usec;
+    uint64_t total_dwell_usec;
 } MBOX_STRUCT, *MBOX_STRUCT_PTR;
 
+//Per-task and per-event bookkeeping for OS_GetTaskStats/OS_GetEventStats
+typedef struct
+{
+    THREAD_TEMPLATE_STRUCT_PTR p_template;
+    const char *name;
+    clockid_t cpu_clock;
+    bool started;
+    uint64_t run_base_usec;     //cpu time at the last OS_ResetStats
+    uint32_t wakeups;
+    uint32_t max_latency_usec;
+    uint32_t latency_hist[OS_STATS_HIST_BUCKETS];
+} OS_TASK_INFO_STRUCT, *OS_TASK_INFO_STRUCT_PTR;
+
 typedef struct
+{
+    OS_TASK_INFO_STRUCT_PTR p_owner;
+    bool waiting;
+    uint16_t wait_mask;
+    uint32_t wake_usec;         //when a bit the waiter wants was set, 0 if not yet
+    uint32_t sets;
+    uint32_t waits;
+    uint32_t timeouts;
+} OS_EVENT_INFO_STRUCT, *OS_EVENT_INFO_STRUCT_PTR;
+
+typedef struct TIMER_STRUCT_TAG
 {
     void *event_handle;
     uint16_t event_bit;
     bool enabled;
-    uint32_t count_down;
+    uint8_t level;
+    uint8_t slot;
+    uint32_t interval;          //non-zero for periodic timers
+    uint64_t expires;           //absolute tick
+    struct TIMER_STRUCT_TAG *p_next;
+    struct TIMER_STRUCT_TAG *p_prev;
 } TIMER_STRUCT, *TIMER_STRUCT_PTR;
 
+typedef struct
+{
+    uint64_t now;               //last tick processed by timer_thread
+    uint64_t armed;             //tick the timerfd is set for, 0 if disarmed
+    uint64_t occupied[OS_WHEEL_LEVELS];
+    TIMER_STRUCT_PTR slot[OS_WHEEL_LEVELS][OS_WHEEL_SLOTS];
+} TIMER_WHEEL_STRUCT;
+
+//Block pools. Every block handed out by OS_GetMemBlock/OS_GetMsgMemBlock
+//is preceded by this tag.  p_next is only used while the block is free.
+#define OS_MEM_HEAP_POOL            OS_MEM_NUM_POOLS
+#define OS_MEM_BLOCK_ALLOCATED      0xA110
+#define OS_MEM_BLOCK_RELEASED       0xF4EE
+#define OS_MEM_POISON               0xDB
+#define OS_MEM_ALIGN(x)             (((x) + 7) & ~7)
+//heap blocks held back from free() with OS_MEM_DEBUG, so releasing one
+//again is caught instead of reading freed memory
+#define OS_MEM_HEAP_QUARANTINE      64
+
+typedef struct OS_MEM_BLOCK_TAG
+{
+    struct OS_MEM_BLOCK_TAG *p_next;
+    uint16_t pool;
+    uint16_t state;
+} OS_MEM_BLOCK, *OS_MEM_BLOCK_PTR;
+
+typedef struct
+{
+    uint32_t block_size;
+    uint32_t num_blocks;
+} OS_MEM_POOL_CONFIG_STRUCT;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    OS_MEM_BLOCK_PTR p_free;
+    uint8_t *p_base;
+    uint32_t stride;
+    OS_MEM_POOL_STATS stats;
+} OS_MEM_POOL_STRUCT, *OS_MEM_POOL_STRUCT_PTR;
+
+typedef struct
+{
+    OS_MEM_BLOCK_PTR p_head;
+    uint32_t count;
+} OS_MEM_CACHE_STRUCT;
+
 /* Local Functions
 *******************************************************************************/
 static void *timer_thread(void *);
+static void timer_arm(uint16_t timer, uint32_t msec, uint32_t interval);
+static void mbox_push(MBOX_STRUCT_PTR p_mbox, MESSAGE_HEADER_STRUCT_PTR p_msg);
+static MESSAGE_HEADER_STRUCT_PTR mbox_pop(MBOX_STRUCT_PTR p_mbox);
+static void os_mem_init(void);
+static void *os_mem_alloc(uint32_t size);
+static void os_mem_release(void *p_mem);
+static void os_mem_pool_carve(OS_MEM_POOL_STRUCT_PTR p_pool, uint16_t pool);
+static void os_mem_stats_alloc(OS_MEM_POOL_STATS *p_stats);
+static OS_TASK_INFO_STRUCT_PTR task_info_alloc(const char *name);
+static void task_info_bind(OS_TASK_INFO_STRUCT_PTR p_task);
+static uint32_t stats_usec_now(void);
+static void stats_wait_begin(EVENT_STRUCT * p_ev, uint16_t mask);
+static void stats_wait_end(EVENT_STRUCT * p_ev, uint16_t mask);
 
 /* Local variables
 *******************************************************************************/
 static uint16_t NumMailboxes = MAX_MAILBOXES;
 static MBOX_STRUCT MboxParam[MAX_MAILBOXES];
 static EVENT_STRUCT OS_Event[MAX_THREADS];
+static OS_EVENT_INFO_STRUCT OS_EventInfo[MAX_THREADS];
+static OS_TASK_INFO_STRUCT OS_TaskInfo[MAX_THREADS];
+static uint16_t OS_NumTasks = 0;
+static __thread OS_TASK_INFO_STRUCT_PTR OS_CurrentTask = NULL;
 
 static TIMER_STRUCT TimerParam[MAX_TIMERS];
+static TIMER_WHEEL_STRUCT TimerWheel;
+static pthread_mutex_t TimerMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec TimerEpoch;
+static int TimerFd = -1;
 static uint16_t OS_NextAvailEvent = 0;
 static pthread_mutex_t OS_MsgMutex;
 static THREAD_TEMPLATE_STRUCT_PTR pThreadList;
 static uint16_t NumTimers = 0;
 static pthread_t OS_TimerThreadId = 0;
 
+static const OS_MEM_POOL_CONFIG_STRUCT MemPoolConfig[] = { OS_MEM_POOL_CONFIG };
+#define OS_MEM_NUM_POOLS    (sizeof(MemPoolConfig)/sizeof(MemPoolConfig[0]))
+//one extra entry at OS_MEM_HEAP_POOL tracks blocks that came from the heap,
+//pools made by OS_MsgPoolCreate follow it
+static OS_MEM_POOL_STRUCT MemPool[OS_MEM_NUM_POOLS + 1 + OS_MEM_MAX_MSG_POOLS];
+static uint16_t MemPoolsInUse = OS_MEM_NUM_POOLS + 1;
+static __thread OS_MEM_CACHE_STRUCT MemCache[OS_MEM_NUM_POOLS];
+static __thread bool MemCacheRegistered = false;
+static pthread_key_t MemCacheKey;
+#ifdef OS_MEM_DEBUG
+//oldest is freed when a new one comes in, under the heap pool's mutex
+static OS_MEM_BLOCK_PTR MemHeapQuarantine[OS_MEM_HEAP_QUARANTINE];
+static uint16_t MemHeapQuarantineNext;
+#endif
+
 
 void OS_Init(THREAD_TEMPLATE_STRUCT_PTR p_list)
 {
     pThreadList = p_list;
     pthread_mutex_init(&OS_MsgMutex, NULL);
+    os_mem_init();
+}
+
+/**@brief Entry point for every task started by OS_TaskCreate.
+ *
+ * @param[in]   the task's OS_TaskInfo entry
+ *
+ * @details Binds the thread to its statistics entry before the task
+ *     body runs, so events and waits made by the task are charged
+ *     to it from the start.
+ */
+static void *task_start(void *p_arg)
+{
+    OS_TASK_INFO_STRUCT_PTR p_task = (OS_TASK_INFO_STRUCT_PTR)p_arg;
+    task_info_bind(p_task);
+    return p_task->p_template->task_func(NULL);
 }
 
 pthread_t OS_TaskCreate(uint32_t template_index, void * parameter)
@@ -84,6 +243,7 @@ pthread_t OS_TaskCreate(uint32_t template_index, void * parameter)
     pthread_attr_t attr;
     struct sched_param param;
     THREAD_TEMPLATE_STRUCT_PTR p_template;
+    OS_TASK_INFO_STRUCT_PTR p_task;
     p_template = pThreadList;
 //printf("Create task %d\n",template_index);
     while (p_template->template_index != 0) {
@@ -97,7 +257,9 @@ pthread_t OS_TaskCreate(uint32_t template_index, void * parameter)
     pthread_attr_init(&attr);
     pthread_attr_setstacksize(&attr, p_template->stack_size);
 
-    pthread_create(&id,&attr,p_template->task_func,NULL);
+    p_task = task_info_alloc(p_template->task_name);
+    p_task->p_template = p_template;
+    pthread_create(&id,&attr,task_start,p_task);
     param.sched_priority = p_template->priority;
     if (pthread_setschedparam(id, SCHED_FIFO, &param) != 0) {
         OS_Error(OS_ERR_THREAD_FAIL);
@@ -125,6 +287,9 @@ void * OS_EventCreate(uint16_t event_group, bool clear)
         pthread_cond_init(&OS_Event[OS_NextAvailEvent].trigger, &con_attr);
 
         pthread_mutex_init(&OS_Event[OS_NextAvailEvent].mutex, NULL);
+        OS_Event[OS_NextAvailEvent].wake_fd = -1;
+        OS_Event[OS_NextAvailEvent].poll_fd = -1;
+        OS_EventInfo[OS_NextAvailEvent].p_owner = OS_CurrentTask;
         OS_NextAvailEvent++;
     }
     pthread_mutex_unlock(&OS_MsgMutex);
@@ -134,9 +299,20 @@ void * OS_EventCreate(uint16_t event_group, bool clear)
 void OS_EventSet(void * handle, uint16_t event_bit)
 {
     EVENT_STRUCT * p_ev = (EVENT_STRUCT*)handle;
+    OS_EVENT_INFO_STRUCT_PTR p_info = &OS_EventInfo[p_ev - OS_Event];
     pthread_mutex_lock(&p_ev->mutex);
+    p_info->sets++;
+    if (p_info->waiting && (event_bit & p_info->wait_mask) && (p_info->wake_usec == 0)) {
+        p_info->wake_usec = stats_usec_now() | 1;
+    }
     p_ev->spec_event |= event_bit;
-    pthread_cond_signal(&p_ev->trigger);
+    if (p_ev->wake_fd >= 0) {
+        uint64_t one = 1;
+        write(p_ev->wake_fd, &one, sizeof(one));
+    }
+    else {
+        pthread_cond_signal(&p_ev->trigger);
+    }
     pthread_mutex_unlock(&p_ev->mutex);
 }
 
@@ -148,10 +324,134 @@ void OS_EventClear(void * handle, uint16_t event_bit)
     pthread_mutex_unlock(&p_ev->mutex);
 }
 
+/**@brief Attach a file descriptor to a task's event.
+ *
+ * @param[in]   event handle for the task
+ * @param[in]   file descriptor to watch for input
+ * @param[in]   event bit to set while the descriptor is readable
+ *
+ * @returned  false if the descriptor could not be watched.
+ *
+ * @details Once a descriptor is attached the task's OS_TaskWaitEvents
+ *     blocks in epoll instead of on the condition variable, so one
+ *     wait covers event bits, mailboxes and descriptors together.
+ *     The bit behaves like any other event bit: it stays set until
+ *     the task clears it, and is set again on the next wait if the
+ *     descriptor still has data.
+ */
+bool OS_EventAttachFd(void * handle, int fd, uint16_t event_bit)
+{
+    EVENT_STRUCT * p_ev = (EVENT_STRUCT*)handle;
+    struct epoll_event ev;
+    bool rtn = true;
+
+    pthread_mutex_lock(&p_ev->mutex);
+    if (p_ev->poll_fd < 0) {
+        p_ev->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+        p_ev->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if ((p_ev->poll_fd < 0) || (p_ev->wake_fd < 0)) {
+            OS_Error(OS_ERR_EVENT_SET_FAIL);
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = 0;        //bit 0 is the wake up from OS_EventSet
+        epoll_ctl(p_ev->poll_fd, EPOLL_CTL_ADD, p_ev->wake_fd, &ev);
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = event_bit;
+    if (epoll_ctl(p_ev->poll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        rtn = false;
+    }
+    pthread_mutex_unlock(&p_ev->mutex);
+    return rtn;
+}
+
+/**@brief Stop watching a descriptor attached with OS_EventAttachFd.
+ *
+ * @param[in]   event handle for the task
+ * @param[in]   file descriptor to remove
+ *
+ * @details Must be called before the descriptor is closed.
+ */
+void OS_EventDetachFd(void * handle, int fd)
+{
+    EVENT_STRUCT * p_ev = (EVENT_STRUCT*)handle;
+    pthread_mutex_lock(&p_ev->mutex);
+    if (p_ev->poll_fd >= 0) {
+        epoll_ctl(p_ev->poll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    pthread_mutex_unlock(&p_ev->mutex);
+}
+
+/**@brief Block in epoll until a masked event bit is set.
+ *
+ * @param[in]   event with descriptors attached, mutex held
+ * @param[in]   event bits to wait for
+ * @param[in]   maximum wait in msec or WAIT_TIME_INFINITE
+ *
+ * @details Descriptor readiness is folded into spec_event, so the
+ *     caller sees the same bitmask as for a condition variable wait.
+ */
+static void wait_events_poll(EVENT_STRUCT * p_ev, uint16_t mask, int32_t delay)
+{
+    struct epoll_event ready[OS_EVENT_MAX_FDS];
+    struct timespec deadline;
+    int timeout = -1;
+    int num;
+    int idx;
+
+    if (delay != WAIT_TIME_INFINITE) {
+        clock_gettime(CLOCK_MONOTONIC,&deadline);
+        deadline.tv_sec += delay / 1000;
+        deadline.tv_nsec += (delay % 1000) * MILLION;
+        if (deadline.tv_nsec >= BILLION) {
+            deadline.tv_nsec -= BILLION;
+            deadline.tv_sec++;
+        }
+    }
+    while((p_ev->spec_event & mask) == 0) {
+        if (delay != WAIT_TIME_INFINITE) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC,&now);
+            timeout = (deadline.tv_sec - now.tv_sec) * THOUSAND
+                        + (deadline.tv_nsec - now.tv_nsec + MILLION - 1) / MILLION;
+            if (timeout <= 0) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&p_ev->mutex);
+        num = epoll_wait(p_ev->poll_fd, ready, OS_EVENT_MAX_FDS, timeout);
+        pthread_mutex_lock(&p_ev->mutex);
+        if (num < 0) {
+            if (errno != EINTR) {
+                OS_Error(OS_ERR_EVENT_SET_FAIL);
+            }
+            continue;
+        }
+        for (idx = 0; idx < num; ++idx) {
+            if (ready[idx].data.u32 == 0) {
+                uint64_t count;
+                read(p_ev->wake_fd, &count, sizeof(count));
+            }
+            else {
+                p_ev->spec_event |= (uint16_t)ready[idx].data.u32;
+            }
+        }
+    }
+}
+
 uint16_t OS_TaskWaitEvents(void * handle, uint16_t mask, int32_t delay)
 {
     struct timespec loc_delay; //{time_t  tv_sec seconds; long tv_nsec nanoseconds}
+    EVENT_STRUCT * p_ev = (EVENT_STRUCT*)handle;
 //printf("Start Wait for thread %d\n",(uint32_t)handle);
+    pthread_mutex_lock(&p_ev->mutex);
+    stats_wait_begin(p_ev, mask);
+    if (p_ev->poll_fd >= 0) {
+        wait_events_poll(p_ev, mask, delay);
+        stats_wait_end(p_ev, mask);
+        pthread_mutex_unlock(&p_ev->mutex);
+        return p_ev->spec_event;
+    }
     if (delay != WAIT_TIME_INFINITE) {
         struct timespec now;
         clock_gettime(CLOCK_MONOTONIC,&now);
@@ -162,8 +462,6 @@ uint16_t OS_TaskWaitEvents(void * handle, uint16_t mask, int32_t delay)
             loc_delay.tv_sec++;
         }
     }
-    EVENT_STRUCT * p_ev = (EVENT_STRUCT*)handle;
-    pthread_mutex_lock(&p_ev->mutex);
     while((p_ev->spec_event & mask) == 0) {
         if (delay != WAIT_TIME_INFINITE) {
             int err = pthread_cond_timedwait(&p_ev->trigger, &p_ev->mutex, &loc_delay);
@@ -176,6 +474,7 @@ uint16_t OS_TaskWaitEvents(void * handle, uint16_t mask, int32_t delay)
         }
     }
 //printf("Finished Wait for thread %d\n",(uint32_t)handle);
+    stats_wait_end(p_ev, mask);
     pthread_mutex_unlock(&p_ev->mutex);
     return p_ev->spec_event; //??
 }
@@ -193,19 +492,92 @@ uint16_t OS_TaskWaitEvents(void * handle, uint16_t mask, int32_t delay)
  */
 uint16_t OS_MboxCreate(void *event_handle, uint16_t event_bit )
 {
+    uint16_t mbox;
+    MBOX_STRUCT_PTR p_mbox;
+
+    pthread_mutex_lock(&OS_MsgMutex);
     if( NumMailboxes == 0) {
+        pthread_mutex_unlock(&OS_MsgMutex);
         OS_Error(OS_ERR_NO_MAILBOXES);
     }
-    else {
-        NumMailboxes--;
-        MboxParam[NumMailboxes].event_handle = event_handle;
-        MboxParam[NumMailboxes].event_bit = event_bit;
-        MboxParam[NumMailboxes].p_head = NULL;
-        MboxParam[NumMailboxes].p_tail = NULL;
-        MboxParam[NumMailboxes].count = 0;
+    NumMailboxes--;
+    mbox = NumMailboxes;
+    p_mbox = &MboxParam[mbox];
+    p_mbox->event_handle = event_handle;
+    p_mbox->event_bit = event_bit;
+    p_mbox->stub.SIZE = 0;
+    p_mbox->stub.p_next = NULL;
+    p_mbox->p_head = &p_mbox->stub;
+    p_mbox->p_tail = &p_mbox->stub;
+    p_mbox->high_water = 0;
+    p_mbox->sent = 0;
+    p_mbox->received = 0;
+    p_mbox->max_dwell_usec = 0;
+    p_mbox->total_dwell_usec = 0;
+    __atomic_store_n(&p_mbox->count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&OS_MsgMutex);
+//printf("Mailbox %d\n",mbox);
+    return mbox;
+}
+
+/**@brief Link a message onto the tail of a mailbox.
+ *
+ * @param[in]   mailbox to add to
+ * @param[in]   header of the message to add
+ *
+ * @details Safe to call from any number of tasks at once.  The
+ *     exchange on p_tail serializes producers; the message only
+ *     becomes visible to the consumer once the previous tail's
+ *     p_next is stored.
+ */
+static void mbox_push(MBOX_STRUCT_PTR p_mbox, MESSAGE_HEADER_STRUCT_PTR p_msg)
+{
+    MESSAGE_HEADER_STRUCT_PTR p_prev;
+
+    __atomic_store_n(&p_msg->p_next, NULL, __ATOMIC_RELAXED);
+    p_prev = (MESSAGE_HEADER_STRUCT_PTR)__atomic_exchange_n(&p_mbox->p_tail, (void*)p_msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&p_prev->p_next, (void*)p_msg, __ATOMIC_RELEASE);
+}
+
+/**@brief Unlink the oldest message from a mailbox.
+ *
+ * @param[in]   mailbox to remove from
+ *
+ * @returned  The message header or NULL if no message is linked yet.
+ *
+ * @details Must only be called by the task that owns the mailbox.
+ *     NULL can also be returned while a producer is between its
+ *     tail exchange and its link store, in which case the caller
+ *     should retry.
+ */
+static MESSAGE_HEADER_STRUCT_PTR mbox_pop(MBOX_STRUCT_PTR p_mbox)
+{
+    MESSAGE_HEADER_STRUCT_PTR p_head = (MESSAGE_HEADER_STRUCT_PTR)p_mbox->p_head;
+    MESSAGE_HEADER_STRUCT_PTR p_next = (MESSAGE_HEADER_STRUCT_PTR)__atomic_load_n(&p_head->p_next, __ATOMIC_ACQUIRE);
+
+    if (p_head == &p_mbox->stub) {
+        if (p_next == NULL) {
+            return NULL;
+        }
+        p_mbox->p_head = p_next;
+        p_head = p_next;
+        p_next = (MESSAGE_HEADER_STRUCT_PTR)__atomic_load_n(&p_head->p_next, __ATOMIC_ACQUIRE);
+    }
+    if (p_next != NULL) {
+        p_mbox->p_head = p_next;
+        return p_head;
     }
-//printf("Mailbox %d\n",NumMailboxes);
-    return NumMailboxes;
+    if (__atomic_load_n(&p_mbox->p_tail, __ATOMIC_ACQUIRE) != (void*)p_head) {
+        return NULL;
+    }
+    //last message in the list, put the stub back behind it so it can be removed
+    mbox_push(p_mbox, &p_mbox->stub);
+    p_next = (MESSAGE_HEADER_STRUCT_PTR)__atomic_load_n(&p_head->p_next, __ATOMIC_ACQUIRE);
+    if (p_next != NULL) {
+        p_mbox->p_head = p_next;
+        return p_head;
+    }
+    return NULL;
 }
 
 /**@brief Get a memory block for a message. *//********
@@ -230,14 +602,12 @@ void *OS_GetMsgMemBlock(uint16_t size)
     MESSAGE_HEADER_STRUCT * p_mem;
 
     size += MESSAGE_HEADER_SIZE;   //add room for block tag
-    pthread_mutex_lock(&OS_MsgMutex);
-    p_mem = (MESSAGE_HEADER_STRUCT * )calloc(size,sizeof(uint8_t));  //Get pointer to fixed block
+    p_mem = (MESSAGE_HEADER_STRUCT * )os_mem_alloc(size);  //Get pointer to fixed block
     if (p_mem == NULL) {
         OS_Error(OS_ERR_NO_MEMPOOL);
     }
     p_mem->SIZE = size;
     p_mem->p_next = NULL;
-    pthread_mutex_unlock(&OS_MsgMutex);
 
 //printf("Get:%08x\n\r",(uint32_t)p_mem);
     return ( ((uint8_t *)p_mem)+MESSAGE_HEADER_SIZE);  //return pointer to usable memory space
@@ -257,49 +627,53 @@ void *OS_GetMsgMemBlock(uint16_t size)
 void OS_MessageSend(uint16_t mailbox_index, void * p_envelope)
 {
 //printf("Sending to Mailbox %d\n",mailbox_index);
-    pthread_mutex_lock(&OS_MsgMutex);
+    MBOX_STRUCT_PTR p_mbox = &MboxParam[mailbox_index];
     MESSAGE_HEADER_STRUCT_PTR p_msg = (MESSAGE_HEADER_STRUCT_PTR)((uint8_t*)p_envelope - MESSAGE_HEADER_SIZE);
-    if (MboxParam[mailbox_index].p_head == NULL) {
-        MboxParam[mailbox_index].p_head = p_msg;
-        MboxParam[mailbox_index].count = 1;
+    uint32_t depth;
+    uint32_t high;
+    p_msg->sent_usec = stats_usec_now();
+    mbox_push(p_mbox, p_msg);
+    depth = __atomic_add_fetch(&p_mbox->count, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&p_mbox->sent, 1, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&p_mbox->high_water, __ATOMIC_RELAXED);
+    while ((depth > high)
+            && !__atomic_compare_exchange_n(&p_mbox->high_water, &high, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     }
-    else {
-        MESSAGE_HEADER_STRUCT_PTR p_mb_msg;
-        p_mb_msg = (MESSAGE_HEADER_STRUCT_PTR)MboxParam[mailbox_index].p_tail;
-        p_mb_msg->p_next = p_msg;
-        MboxParam[mailbox_index].count++;
-    }
-    MboxParam[mailbox_index].p_tail = p_msg;
-    p_msg->p_next = NULL;
-    OS_EventSet((EVENT_STRUCT*)MboxParam[mailbox_index].event_handle, MboxParam[mailbox_index].event_bit);
-    pthread_mutex_unlock(&OS_MsgMutex);
+    OS_EventSet((EVENT_STRUCT*)p_mbox->event_handle, p_mbox->event_bit);
 //printf("Sent to Mailbox %d\n",mailbox_index);
 }
 
 void *OS_MessageGet(uint16_t mailbox_index)
 {
+    MBOX_STRUCT_PTR p_mbox = &MboxParam[mailbox_index];
     MESSAGE_HEADER_STRUCT_PTR p_msg;
-    pthread_mutex_lock(&OS_MsgMutex);
 
-    if (MboxParam[mailbox_index].count == 0) {
+    if (__atomic_load_n(&p_mbox->count, __ATOMIC_ACQUIRE) == 0) {
         OS_Error(OS_ERR_MSG_QUEUE_FAIL);
     }
-    p_msg = (MESSAGE_HEADER_STRUCT_PTR)MboxParam[mailbox_index].p_head;
-    if (p_msg == NULL) {
-//printf("Error in mailbox %d\n",mailbox_index);
-        OS_Error(OS_ERR_MSG_QUEUE_MSG_FAIL);
+    //the count is only raised after a message is linked, but an earlier
+    //producer may still be mid-link; sleep rather than yield so a lower
+    //priority SCHED_FIFO producer gets to finish
+    while ((p_msg = mbox_pop(p_mbox)) == NULL) {
+        OS_TaskSleep(OS_MBOX_LINK_WAIT_MSEC);
     }
-    --MboxParam[mailbox_index].count;
-    if ( MboxParam[mailbox_index].count == 0) {
-        OS_EventClear(MboxParam[mailbox_index].event_handle,MboxParam[mailbox_index].event_bit);
-        MboxParam[mailbox_index].p_head = NULL;
-        MboxParam[mailbox_index].p_tail = NULL;
+    {
+        uint32_t dwell = stats_usec_now() - p_msg->sent_usec;
+        p_mbox->received++;
+        p_mbox->total_dwell_usec += dwell;
+        if (dwell > p_mbox->max_dwell_usec) {
+            p_mbox->max_dwell_usec = dwell;
+        }
     }
-    else {
-        MboxParam[mailbox_index].p_head = p_msg->p_next;
+    if (__atomic_sub_fetch(&p_mbox->count, 1, __ATOMIC_SEQ_CST) == 0) {
+        OS_EventClear(p_mbox->event_handle,p_mbox->event_bit);
+        //a sender may have raised the count between the decrement and the
+        //clear, in which case its event was just wiped out; put it back
+        if (__atomic_load_n(&p_mbox->count, __ATOMIC_SEQ_CST) != 0) {
+            OS_EventSet(p_mbox->event_handle,p_mbox->event_bit);
+        }
     }
-//printf("Mailbox (%d) Messages Left = %d\n",mailbox_index, MboxParam[mailbox_index].count);
-    pthread_mutex_unlock(&OS_MsgMutex);
+//printf("Mailbox (%d) Messages Left = %d\n",mailbox_index, p_mbox->count);
     return (uint8_t*)p_msg + MESSAGE_HEADER_SIZE;
 }
 
@@ -309,13 +683,13 @@ void OS_ReleaseMsgMemBlock(void *p_msg)
     MESSAGE_HEADER_STRUCT *p_env = (MESSAGE_HEADER_STRUCT *)((uint8_t*)p_msg - MESSAGE_HEADER_SIZE);
 //++msg_mem_count;
 //printf("Rel:%08x\n\r",(uint32_t)p_env);
-    free(p_env);
+    os_mem_release(p_env);
 //printf("MsgCnt:%d\r\n",msg_mem_count);
 }
 
 void * OS_GetMemBlock (uint16_t size)
 {
-    void *value = calloc(size,sizeof(uint8_t));
+    void *value = os_mem_alloc(size);
     if (value == 0) {
         OS_Error(OS_ERR_MEM_ALLOC_FAIL);
     }
@@ -327,84 +701,967 @@ void OS_ReleaseMemBlock(void *p_msg)
 {
 //++mem_count;
 //printf("MemCnt:%d\r\n",mem_count);
-    free(p_msg);
+    os_mem_release(p_msg);
+}
+
+/**@brief Return a thread's cached blocks to their pools.
+ *
+ * @param[in]   unused key value
+ *
+ * @details Registered as the MemCacheKey destructor so blocks
+ *     held by a task that exits are not lost to the pools.
+ */
+static void os_mem_cache_flush(void *unused)
+{
+    uint16_t pool;
+    OS_MEM_BLOCK_PTR p_blk;
+
+    for (pool = 0; pool < OS_MEM_NUM_POOLS; ++pool) {
+        pthread_mutex_lock(&MemPool[pool].mutex);
+        while ((p_blk = MemCache[pool].p_head) != NULL) {
+            MemCache[pool].p_head = p_blk->p_next;
+            p_blk->p_next = MemPool[pool].p_free;
+            MemPool[pool].p_free = p_blk;
+        }
+        MemCache[pool].count = 0;
+        pthread_mutex_unlock(&MemPool[pool].mutex);
+    }
+}
+
+/**@brief Carve the configured pools out of the heap.
+ *
+ * @details Called once from OS_Init before any task runs.  Each
+ *     pool is a single allocation split into equal blocks, all of
+ *     which start out on the pool's free list.
+ */
+static void os_mem_init(void)
+{
+    uint16_t pool;
+
+    pthread_key_create(&MemCacheKey, os_mem_cache_flush);
+    for (pool = 0; pool <= OS_MEM_NUM_POOLS; ++pool) {
+        OS_MEM_POOL_STRUCT_PTR p_pool = &MemPool[pool];
+        memset(p_pool, 0, sizeof(OS_MEM_POOL_STRUCT));
+        pthread_mutex_init(&p_pool->mutex, NULL);
+        if (pool == OS_MEM_HEAP_POOL) {
+            continue;
+        }
+        p_pool->stats.block_size = MemPoolConfig[pool].block_size;
+        p_pool->stats.num_blocks = MemPoolConfig[pool].num_blocks;
+        os_mem_pool_carve(p_pool, pool);
+    }
+}
+
+/**@brief Allocate a pool's storage and put every block on its free list.
+ *
+ * @param[in]   pool with block_size and num_blocks filled in
+ * @param[in]   index of the pool in MemPool
+ */
+static void os_mem_pool_carve(OS_MEM_POOL_STRUCT_PTR p_pool, uint16_t pool)
+{
+    uint32_t idx;
+
+    p_pool->stride = sizeof(OS_MEM_BLOCK) + OS_MEM_ALIGN(p_pool->stats.block_size);
+    p_pool->p_base = (uint8_t*)malloc(p_pool->stride * p_pool->stats.num_blocks);
+    if (p_pool->p_base == NULL) {
+        OS_Error(OS_ERR_NO_MEMPOOL);
+    }
+    for (idx = p_pool->stats.num_blocks; idx > 0; --idx) {
+        OS_MEM_BLOCK_PTR p_blk = (OS_MEM_BLOCK_PTR)(p_pool->p_base + (idx - 1) * p_pool->stride);
+        p_blk->pool = pool;
+        p_blk->state = OS_MEM_BLOCK_RELEASED;
+#ifdef OS_MEM_DEBUG
+        memset(p_blk + 1, OS_MEM_POISON, p_pool->stats.block_size);
+#endif
+        p_blk->p_next = p_pool->p_free;
+        p_pool->p_free = p_blk;
+    }
+}
+
+/**@brief Have the calling thread's cache flushed when it exits.
+ *
+ * @details Called before a thread first puts blocks in its cache,
+ *     whether by allocating or by releasing.
+ */
+static void os_mem_cache_register(void)
+{
+    if (MemCacheRegistered == false) {
+        pthread_setspecific(MemCacheKey, (void*)MemCache);
+        MemCacheRegistered = true;
+    }
+}
+
+/**@brief Take a free block from the calling thread's cache.
+ *
+ * @param[in]   pool index
+ *
+ * @returned  A free block or NULL if the pool is exhausted.
+ *
+ * @details When the cache is empty a batch of blocks is moved
+ *     over from the shared free list, so the pool mutex is only
+ *     taken once every OS_MEM_CACHE_BATCH allocations.
+ */
+static OS_MEM_BLOCK_PTR os_mem_cache_get(uint16_t pool)
+{
+    OS_MEM_CACHE_STRUCT *p_cache = &MemCache[pool];
+    OS_MEM_BLOCK_PTR p_blk;
+
+    if (p_cache->p_head == NULL) {
+        uint32_t n;
+        os_mem_cache_register();
+        pthread_mutex_lock(&MemPool[pool].mutex);
+        for (n = 0; (n < OS_MEM_CACHE_BATCH) && (MemPool[pool].p_free != NULL); ++n) {
+            p_blk = MemPool[pool].p_free;
+            MemPool[pool].p_free = p_blk->p_next;
+            p_blk->p_next = p_cache->p_head;
+            p_cache->p_head = p_blk;
+            p_cache->count++;
+        }
+        pthread_mutex_unlock(&MemPool[pool].mutex);
+        if (p_cache->p_head == NULL) {
+            return NULL;
+        }
+    }
+    p_blk = p_cache->p_head;
+    p_cache->p_head = p_blk->p_next;
+    p_cache->count--;
+    return p_blk;
+}
+
+/**@brief Put a released block in the calling thread's cache.
+ *
+ * @param[in]   pool index
+ * @param[in]   block being released
+ *
+ * @details Messages are usually released by a different task than
+ *     the one that allocated them, so once a cache grows past
+ *     OS_MEM_CACHE_DEPTH a batch is handed back to the pool.
+ */
+static void os_mem_cache_put(uint16_t pool, OS_MEM_BLOCK_PTR p_blk)
+{
+    OS_MEM_CACHE_STRUCT *p_cache = &MemCache[pool];
+
+    //a task that only releases would otherwise keep its cache on exit
+    os_mem_cache_register();
+    p_blk->p_next = p_cache->p_head;
+    p_cache->p_head = p_blk;
+    p_cache->count++;
+    if (p_cache->count > OS_MEM_CACHE_DEPTH) {
+        uint32_t n;
+        pthread_mutex_lock(&MemPool[pool].mutex);
+        for (n = 0; n < OS_MEM_CACHE_BATCH; ++n) {
+            p_blk = p_cache->p_head;
+            p_cache->p_head = p_blk->p_next;
+            p_blk->p_next = MemPool[pool].p_free;
+            MemPool[pool].p_free = p_blk;
+        }
+        p_cache->count -= OS_MEM_CACHE_BATCH;
+        pthread_mutex_unlock(&MemPool[pool].mutex);
+    }
+}
+
+/**@brief Allocate a zeroed block of at least size bytes.
+ *
+ * @param[in]   number of bytes required
+ *
+ * @returned  Pointer to the usable memory or NULL.
+ *
+ * @details The smallest pool that fits is used.  Requests larger
+ *     than any pool, or made while the pool is exhausted, fall back
+ *     to the heap and are counted so the pool sizes in config.h
+ *     can be tuned.
+ */
+static void *os_mem_alloc(uint32_t size)
+{
+    uint16_t pool;
+    OS_MEM_BLOCK_PTR p_blk = NULL;
+
+    for (pool = 0; pool < OS_MEM_NUM_POOLS; ++pool) {
+        if (size <= MemPool[pool].stats.block_size) {
+            p_blk = os_mem_cache_get(pool);
+            if (p_blk == NULL) {
+                __atomic_add_fetch(&MemPool[pool].stats.heap_fallbacks, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+    if (p_blk == NULL) {
+        pool = OS_MEM_HEAP_POOL;
+        p_blk = (OS_MEM_BLOCK_PTR)calloc(1, sizeof(OS_MEM_BLOCK) + size);
+        if (p_blk == NULL) {
+            return NULL;
+        }
+        p_blk->pool = pool;
+    }
+    else {
+        if (p_blk->state != OS_MEM_BLOCK_RELEASED) {
+            OS_Error(OS_ERR_MEMORY_FREE);
+        }
+#ifdef OS_MEM_DEBUG
+        {
+            //anything other than poison means the block was written after release
+            uint8_t *p_data = (uint8_t*)(p_blk + 1);
+            uint32_t idx;
+            for (idx = 0; idx < MemPool[pool].stats.block_size; ++idx) {
+                if (p_data[idx] != OS_MEM_POISON) {
+                    OS_Error(OS_ERR_MEM_USE_AFTER_FREE);
+                }
+            }
+        }
+#endif
+        memset(p_blk + 1, 0, size);
+    }
+    p_blk->p_next = NULL;
+    p_blk->state = OS_MEM_BLOCK_ALLOCATED;
+    os_mem_stats_alloc(&MemPool[pool].stats);
+    return (void*)(p_blk + 1);
+}
+
+/**@brief Count an allocation and track the pool's high water mark.
+ */
+static void os_mem_stats_alloc(OS_MEM_POOL_STATS *p_stats)
+{
+    uint32_t in_use;
+    uint32_t high;
+
+    __atomic_add_fetch(&p_stats->alloc_count, 1, __ATOMIC_RELAXED);
+    in_use = __atomic_add_fetch(&p_stats->in_use, 1, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&p_stats->high_water, __ATOMIC_RELAXED);
+    while ((in_use > high)
+            && !__atomic_compare_exchange_n(&p_stats->high_water, &high, in_use, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**@brief Release a block obtained from os_mem_alloc.
+ *
+ * @param[in]   pointer returned by os_mem_alloc
+ *
+ * @details Releasing a block twice is fatal.  With OS_MEM_DEBUG
+ *     defined the block is also poisoned so that writes made
+ *     through a stale pointer are caught when it is reused.
+ *
+ *     Heap blocks are given back to free(), so without OS_MEM_DEBUG
+ *     the check only covers pool blocks.  With it, the last
+ *     OS_MEM_HEAP_QUARANTINE heap blocks are held back and releasing
+ *     one of those again is caught too.
+ */
+static void os_mem_release(void *p_mem)
+{
+    OS_MEM_BLOCK_PTR p_blk = (OS_MEM_BLOCK_PTR)p_mem - 1;
+    uint16_t pool = p_blk->pool;
+
+    if (p_blk->state == OS_MEM_BLOCK_RELEASED) {
+        OS_Error(OS_ERR_MEM_DOUBLE_FREE);
+    }
+    if ((p_blk->state != OS_MEM_BLOCK_ALLOCATED) || (pool >= MemPoolsInUse)) {
+        OS_Error(OS_ERR_MEMORY_FREE);
+    }
+    p_blk->state = OS_MEM_BLOCK_RELEASED;
+    __atomic_sub_fetch(&MemPool[pool].stats.in_use, 1, __ATOMIC_RELAXED);
+    if (pool == OS_MEM_HEAP_POOL) {
+#ifdef OS_MEM_DEBUG
+        OS_MEM_BLOCK_PTR p_old;
+        pthread_mutex_lock(&MemPool[pool].mutex);
+        p_old = MemHeapQuarantine[MemHeapQuarantineNext];
+        MemHeapQuarantine[MemHeapQuarantineNext] = p_blk;
+        MemHeapQuarantineNext = (MemHeapQuarantineNext + 1) % OS_MEM_HEAP_QUARANTINE;
+        pthread_mutex_unlock(&MemPool[pool].mutex);
+        p_blk = p_old;
+#endif
+        free(p_blk);
+        return;
+    }
+#ifdef OS_MEM_DEBUG
+    memset(p_mem, OS_MEM_POISON, MemPool[pool].stats.block_size);
+#endif
+    if (pool < OS_MEM_HEAP_POOL) {
+        os_mem_cache_put(pool, p_blk);
+    }
+    else {
+        pthread_mutex_lock(&MemPool[pool].mutex);
+        p_blk->p_next = MemPool[pool].p_free;
+        MemPool[pool].p_free = p_blk;
+        pthread_mutex_unlock(&MemPool[pool].mutex);
+    }
+}
+
+/**@brief Create a pool of message blocks reserved for one user.
+ *
+ * @param[in]   usable size of each block
+ * @param[in]   number of blocks
+ *
+ * @returned  Pool handle for OS_GetPoolMsgBlock.
+ *
+ * @details For producers that must not compete with the rest of
+ *     the system for blocks.  Blocks are released with the usual
+ *     OS_ReleaseMsgMemBlock, by any task, and go back to this pool.
+ *     They bypass the per-task caches since they are normally
+ *     taken by one task and released by another.
+ */
+uint16_t OS_MsgPoolCreate(uint16_t size, uint16_t num_blocks)
+{
+    OS_MEM_POOL_STRUCT_PTR p_pool;
+    uint16_t pool;
+
+    pthread_mutex_lock(&OS_MsgMutex);
+    if (MemPoolsInUse >= (OS_MEM_NUM_POOLS + 1 + OS_MEM_MAX_MSG_POOLS)) {
+        pthread_mutex_unlock(&OS_MsgMutex);
+        OS_Error(OS_ERR_NO_MEMPOOL);
+    }
+    pool = MemPoolsInUse;
+    p_pool = &MemPool[pool];
+    memset(p_pool, 0, sizeof(OS_MEM_POOL_STRUCT));
+    pthread_mutex_init(&p_pool->mutex, NULL);
+    p_pool->stats.block_size = size + MESSAGE_HEADER_SIZE;
+    p_pool->stats.num_blocks = num_blocks;
+    os_mem_pool_carve(p_pool, pool);
+    //publish only once the pool is complete
+    __atomic_store_n(&MemPoolsInUse, pool + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&OS_MsgMutex);
+    return pool;
+}
+
+/**@brief Get a message block from a pool made by OS_MsgPoolCreate.
+ *
+ * @param[in]   pool handle
+ *
+ * @returned  Pointer to the usable memory, or NULL when every block
+ *    is in use.  Exhaustion is counted in the pool's heap_fallbacks
+ *    but no heap memory is taken; that is left to the caller.
+ *
+ * @details Unlike OS_GetMsgMemBlock the block is not cleared.
+ */
+void *OS_GetPoolMsgBlock(uint16_t pool)
+{
+    OS_MEM_POOL_STRUCT_PTR p_pool = &MemPool[pool];
+    OS_MEM_BLOCK_PTR p_blk;
+    MESSAGE_HEADER_STRUCT * p_mem;
+
+    pthread_mutex_lock(&p_pool->mutex);
+    p_blk = p_pool->p_free;
+    if (p_blk != NULL) {
+        p_pool->p_free = p_blk->p_next;
+    }
+    pthread_mutex_unlock(&p_pool->mutex);
+    if (p_blk == NULL) {
+        __atomic_add_fetch(&p_pool->stats.heap_fallbacks, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (p_blk->state != OS_MEM_BLOCK_RELEASED) {
+        OS_Error(OS_ERR_MEMORY_FREE);
+    }
+    p_blk->p_next = NULL;
+    p_blk->state = OS_MEM_BLOCK_ALLOCATED;
+    os_mem_stats_alloc(&p_pool->stats);
+
+    p_mem = (MESSAGE_HEADER_STRUCT *)(p_blk + 1);
+    p_mem->SIZE = p_pool->stats.block_size;
+    p_mem->p_next = NULL;
+    return ((uint8_t *)p_mem) + MESSAGE_HEADER_SIZE;
+}
+
+/**@brief Get the number of block pools.
+ *
+ * @returned  Number of pools.  The configured pools come first,
+ *    then the heap entry, then any made by OS_MsgPoolCreate.
+ */
+uint16_t OS_GetMemPoolCount(void)
+{
+    return __atomic_load_n(&MemPoolsInUse, __ATOMIC_ACQUIRE);
+}
+
+/**@brief Get a snapshot of a pool's usage.
+ *
+ * @param[in]   pool index, 0 to OS_GetMemPoolCount()-1
+ * @param[out]  statistics for the pool
+ *
+ * @returned  false if the pool index is out of range.
+ *
+ * @details The heap entry has a block size of zero.  Counters are
+ *     read without locking so a snapshot may be slightly skewed.
+ */
+bool OS_GetMemPoolStats(uint16_t pool, OS_MEM_POOL_STATS *p_stats)
+{
+    if (pool >= OS_GetMemPoolCount()) {
+        return false;
+    }
+    *p_stats = MemPool[pool].stats;
+    return true;
 }
 
 uint16_t OS_TimerCreate(void *event_handle, uint16_t event_bit)
 {
     uint16_t num_timers;
-    pthread_mutex_lock(&OS_MsgMutex);
+    pthread_mutex_lock(&TimerMutex);
     if( NumTimers == MAX_TIMERS) {
+        pthread_mutex_unlock(&TimerMutex);
         OS_Error(OS_ERR_NO_TIMERS);
     }
     else {
+        memset(&TimerParam[NumTimers], 0, sizeof(TIMER_STRUCT));
         TimerParam[NumTimers].event_handle = event_handle;
         TimerParam[NumTimers].event_bit = event_bit;
         TimerParam[NumTimers].enabled = false;
     }
     num_timers = NumTimers;
     NumTimers++;
-    pthread_mutex_unlock(&OS_MsgMutex);
+    pthread_mutex_unlock(&TimerMutex);
     return num_timers;
 }
 
+/**@brief Convert the monotonic clock to wheel ticks.
+ *
+ * @param[in]   true to round a partial tick up
+ *
+ * @returned  Ticks since the wheel was started.
+ */
+static uint64_t timer_ticks_now(bool round_up)
+{
+    struct timespec now;
+    uint64_t nsec;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    nsec = (uint64_t)(now.tv_sec - TimerEpoch.tv_sec) * BILLION + now.tv_nsec - TimerEpoch.tv_nsec;
+    if (round_up) {
+        nsec += (OS_TIMER_RESOLUTION_MSEC * MILLION) - 1;
+    }
+    return nsec / (OS_TIMER_RESOLUTION_MSEC * MILLION);
+}
+
+/**@brief Place an armed timer in the wheel slot for its expiry.
+ *
+ * @param[in]   timer to place, expires must already be set
+ *
+ * @details Level is chosen by distance from the wheel's current tick,
+ *     slot by the expiry's bits for that level.  Timers already due go
+ *     in the current level 0 slot so the next pass fires them.
+ *     TimerMutex must be held.
+ */
+static void timer_link(TIMER_STRUCT_PTR p_tmr)
+{
+    uint64_t when = p_tmr->expires;
+    uint64_t delta;
+    uint8_t level = 0;
+
+    if (when < TimerWheel.now) {
+        when = TimerWheel.now;
+    }
+    delta = when - TimerWheel.now;
+    if (delta > OS_WHEEL_MAX_DELTA) {
+        delta = OS_WHEEL_MAX_DELTA;
+        when = TimerWheel.now + delta;
+    }
+    while ((level < OS_WHEEL_LEVELS - 1) && (delta >> (OS_WHEEL_BITS * (level + 1)))) {
+        ++level;
+    }
+    p_tmr->level = level;
+    p_tmr->slot = (when >> (OS_WHEEL_BITS * level)) & OS_WHEEL_MASK;
+    p_tmr->p_prev = NULL;
+    p_tmr->p_next = TimerWheel.slot[level][p_tmr->slot];
+    if (p_tmr->p_next != NULL) {
+        p_tmr->p_next->p_prev = p_tmr;
+    }
+    TimerWheel.slot[level][p_tmr->slot] = p_tmr;
+    TimerWheel.occupied[level] |= (1ULL << p_tmr->slot);
+}
+
+/**@brief Remove a timer from its wheel slot.  TimerMutex must be held.
+ */
+static void timer_unlink(TIMER_STRUCT_PTR p_tmr)
+{
+    if (p_tmr->p_prev != NULL) {
+        p_tmr->p_prev->p_next = p_tmr->p_next;
+    }
+    else {
+        TimerWheel.slot[p_tmr->level][p_tmr->slot] = p_tmr->p_next;
+        if (p_tmr->p_next == NULL) {
+            TimerWheel.occupied[p_tmr->level] &= ~(1ULL << p_tmr->slot);
+        }
+    }
+    if (p_tmr->p_next != NULL) {
+        p_tmr->p_next->p_prev = p_tmr->p_prev;
+    }
+    p_tmr->p_next = NULL;
+    p_tmr->p_prev = NULL;
+}
+
+/**@brief Find the next tick at which the wheel has work to do.
+ *
+ * @returned  Tick of the next expiry or cascade, 0 if the wheel is empty.
+ *
+ * @details Uses the occupancy bitmaps, so the cost does not depend on
+ *     how many timers are armed.  TimerMutex must be held.
+ */
+static uint64_t timer_next_tick(void)
+{
+    uint64_t next = 0;
+    uint8_t level;
+
+    for (level = 0; level < OS_WHEEL_LEVELS; ++level) {
+        uint32_t shift = OS_WHEEL_BITS * level;
+        uint32_t pos = (TimerWheel.now >> shift) & OS_WHEEL_MASK;
+        uint64_t bits = TimerWheel.occupied[level];
+        uint32_t dist;
+        uint64_t tick;
+
+        if (bits == 0) {
+            continue;
+        }
+        //rotate so the slot after the current one is bit 0
+        pos = (pos + 1) & OS_WHEEL_MASK;
+        if (pos != 0) {
+            bits = (bits >> pos) | (bits << (OS_WHEEL_SLOTS - pos));
+        }
+        dist = __builtin_ctzll(bits) + 1;
+        if ((level == 0) && (TimerWheel.occupied[0] & (1ULL << (TimerWheel.now & OS_WHEEL_MASK)))) {
+            dist = 0;   //something due right now
+        }
+        tick = ((TimerWheel.now >> shift) + dist) << shift;
+        if ((next == 0) || (tick < next)) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/**@brief Point the timerfd at the wheel's next tick of interest.
+ *     TimerMutex must be held.
+ */
+static void timer_program(void)
+{
+    struct itimerspec its;
+    uint64_t next = timer_next_tick();
+
+    memset(&its, 0, sizeof(its));
+    if (next != 0) {
+        uint64_t nsec = next * OS_TIMER_RESOLUTION_MSEC * MILLION + TimerEpoch.tv_nsec;
+        its.it_value.tv_sec = TimerEpoch.tv_sec + nsec / BILLION;
+        its.it_value.tv_nsec = nsec % BILLION;
+    }
+    if (timerfd_settime(TimerFd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        OS_Error(OS_ERR_TIMER_FAIL);
+    }
+    TimerWheel.armed = next;
+}
+
+/**@brief Create the timerfd and timer thread on first use.
+ *     TimerMutex must be held.
+ */
+static void timer_start(void)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    pthread_t id;
+
+    clock_gettime(CLOCK_MONOTONIC, &TimerEpoch);
+    TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (TimerFd < 0) {
+        OS_Error(OS_ERR_TIMER_FAIL);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, OS_TIMER_STACK_SIZE);
+
+    pthread_create(&id,&attr,timer_thread,NULL);
+    param.sched_priority = TIMER_PRI;
+    if (pthread_setschedparam(id, SCHED_FIFO, &param) != 0) {
+        OS_Error(OS_ERR_THREAD_FAIL);
+    }
+    OS_TimerThreadId = id;
+}
+
+/**@brief Arm a timer, replacing any pending expiry.
+ *
+ * @param[in]   timer index
+ * @param[in]   time until the first expiry in msec
+ * @param[in]   period in msec for periodic timers, 0 for one-shot
+ */
+static void timer_arm(uint16_t timer, uint32_t msec, uint32_t interval)
+{
+    TIMER_STRUCT_PTR p_tmr = &TimerParam[timer];
+    uint64_t now;
+
+    pthread_mutex_lock(&TimerMutex);
+    if (OS_TimerThreadId == 0) {
+        timer_start();
+    }
+    if (p_tmr->enabled == true) {
+        timer_unlink(p_tmr);
+    }
+    now = timer_ticks_now(true);
+    if (TimerWheel.armed == 0) {
+        //nothing pending, let the wheel catch up with the clock for free
+        TimerWheel.now = timer_ticks_now(false);
+    }
+    p_tmr->expires = now + (msec / OS_TIMER_RESOLUTION_MSEC);
+    p_tmr->interval = interval;
+    p_tmr->enabled = true;
+    timer_link(p_tmr);
+    if ((TimerWheel.armed == 0) || (p_tmr->expires < TimerWheel.armed)) {
+        timer_program();
+    }
+    pthread_mutex_unlock(&TimerMutex);
+}
+
 void OS_TimerStop(uint16_t timer)
 {
-    TimerParam[timer].enabled = false;
+    pthread_mutex_lock(&TimerMutex);
+    if (TimerParam[timer].enabled == true) {
+        TimerParam[timer].enabled = false;
+        timer_unlink(&TimerParam[timer]);
+    }
+    pthread_mutex_unlock(&TimerMutex);
 }
 
+/**@brief Start a one-shot timer.
+ *
+ * @param[in]   timer index from OS_TimerCreate
+ * @param[in]   msec until the timer's event is set
+ *
+ * @details Despite the name the timer fires once; callers re-arm
+ *     it from their tick handler.  Re-arming a running timer
+ *     restarts it.
+ */
 void OS_TimerSetCyclicInterval(uint16_t timer, uint32_t msec)
 {
-    pthread_mutex_lock(&OS_MsgMutex);
+    timer_arm(timer, msec, 0);
+}
 
-    if (OS_TimerThreadId == 0) {
-        pthread_attr_t attr;
-        struct sched_param param;
-        pthread_t id;
-
-        pthread_attr_init(&attr);
-        pthread_attr_setstacksize(&attr, OS_TIMER_STACK_SIZE);
-    
-        pthread_create(&id,&attr,timer_thread,NULL);
-        param.sched_priority = TIMER_PRI;
-        if (pthread_setschedparam(id, SCHED_FIFO, &param) != 0) {
-            OS_Error(OS_ERR_THREAD_FAIL);
-        }
-//printf("Started Timer %d\n",timer);
+/**@brief Start a timer that sets its event every msec until stopped.
+ *
+ * @param[in]   timer index from OS_TimerCreate
+ * @param[in]   period in msec
+ *
+ * @details Expiries are scheduled from the previous expiry rather
+ *     than from when the event was handled, so the period does
+ *     not drift.
+ */
+void OS_TimerSetPeriodicInterval(uint16_t timer, uint32_t msec)
+{
+    if (msec < OS_TIMER_RESOLUTION_MSEC) {
+        msec = OS_TIMER_RESOLUTION_MSEC;
+    }
+    timer_arm(timer, msec, msec);
+}
+
+/**@brief Move the timers in one slot of an upper level down the wheel.
+ *     TimerMutex must be held.
+ */
+static void timer_cascade(uint8_t level, uint8_t slot)
+{
+    TIMER_STRUCT_PTR p_tmr = TimerWheel.slot[level][slot];
 
-        OS_TimerThreadId = id;
+    TimerWheel.slot[level][slot] = NULL;
+    TimerWheel.occupied[level] &= ~(1ULL << slot);
+    while (p_tmr != NULL) {
+        TIMER_STRUCT_PTR p_next = p_tmr->p_next;
+        timer_link(p_tmr);
+        p_tmr = p_next;
     }
+}
 
-    TimerParam[timer].enabled = true;
-    TimerParam[timer].count_down = msec/OS_TIMER_RESOLUTION_MSEC;
-    pthread_mutex_unlock(&OS_MsgMutex);
+/**@brief Advance the wheel to the given tick, firing expired timers.
+ *
+ * @param[in]   current tick
+ *
+ * @details Jumps straight from one tick of interest to the next, so
+ *     catching up after a long idle period is cheap.  TimerMutex must
+ *     be held.
+ */
+static void timer_advance(uint64_t now)
+{
+    uint64_t tick;
+
+    while (((tick = timer_next_tick()) != 0) && (tick <= now)) {
+        uint8_t level;
+        TIMER_STRUCT_PTR p_tmr;
+
+        TimerWheel.now = tick;
+        for (level = OS_WHEEL_LEVELS - 1; level > 0; --level) {
+            uint32_t shift = OS_WHEEL_BITS * level;
+            if ((tick & ((1ULL << shift) - 1)) == 0) {
+                timer_cascade(level, (tick >> shift) & OS_WHEEL_MASK);
+            }
+        }
+        p_tmr = TimerWheel.slot[0][tick & OS_WHEEL_MASK];
+        TimerWheel.slot[0][tick & OS_WHEEL_MASK] = NULL;
+        TimerWheel.occupied[0] &= ~(1ULL << (tick & OS_WHEEL_MASK));
+        while (p_tmr != NULL) {
+            TIMER_STRUCT_PTR p_next = p_tmr->p_next;
+            p_tmr->p_next = NULL;
+            p_tmr->p_prev = NULL;
+            if (p_tmr->interval != 0) {
+                p_tmr->expires += p_tmr->interval / OS_TIMER_RESOLUTION_MSEC;
+                if (p_tmr->expires <= tick) {
+                    //fell more than a period behind, don't fire a burst
+                    p_tmr->expires = tick + 1;
+                }
+                timer_link(p_tmr);
+            }
+            else {
+                p_tmr->enabled = false;
+            }
+//printf("BOOM\n");
+            OS_EventSet(p_tmr->event_handle, p_tmr->event_bit);
+            p_tmr = p_next;
+        }
+    }
+    if (TimerWheel.now < now) {
+        TimerWheel.now = now;
+    }
 }
 
 static void *timer_thread(void *temp)
 {
-    uint16_t idx;
+    uint64_t expirations;
 
+    task_info_bind(task_info_alloc("OS_timer"));
 
     while(1) {
-        OS_TaskSleep(OS_TIMER_RESOLUTION_MSEC);
-//printf(".");
-        for (idx = 0; idx < NumTimers; ++idx) {
-//printf("-");
-            if (TimerParam[idx].enabled == true) {
-//printf("+");
-                TimerParam[idx].count_down--;
-                if (TimerParam[idx].count_down == 0) {
-                    TimerParam[idx].enabled = false;
-//printf("BOOM\n");
-                    OS_EventSet(TimerParam[idx].event_handle, TimerParam[idx].event_bit);
-                }
+        if (read(TimerFd, &expirations, sizeof(expirations)) < 0) {
+            if (errno != EINTR) {
+                OS_Error(OS_ERR_TIMER_FAIL);
             }
+            continue;
         }
+        pthread_mutex_lock(&TimerMutex);
+        timer_advance(timer_ticks_now(false));
+        timer_program();
+        pthread_mutex_unlock(&TimerMutex);
     }
     return 0;
 }
 
 
+/**@brief Microsecond timestamp for statistics.
+ *
+ * @returned  CLOCK_MONOTONIC in usec, truncated to 32 bits.  Only
+ *    differences are used so the wrap every 71 minutes is harmless.
+ */
+static uint32_t stats_usec_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * MILLION + now.tv_nsec / THOUSAND);
+}
+
+/**@brief Add a sample to a log2 histogram.
+ *
+ * @details Bucket n counts samples from 2^(n-1) up to 2^n - 1 usec,
+ *     bucket 0 counts zero and the last bucket takes everything above.
+ */
+static void stats_hist_add(uint32_t *p_hist, uint32_t usec)
+{
+    uint32_t bucket = (usec == 0) ? 0 : 32 - __builtin_clz(usec);
+    if (bucket >= OS_STATS_HIST_BUCKETS) {
+        bucket = OS_STATS_HIST_BUCKETS - 1;
+    }
+    p_hist[bucket]++;
+}
+
+/**@brief Claim a statistics entry for a new thread.
+ *
+ * @param[in]   name to report the thread under
+ *
+ * @returned  The entry, or NULL when the table is full.
+ */
+static OS_TASK_INFO_STRUCT_PTR task_info_alloc(const char *name)
+{
+    OS_TASK_INFO_STRUCT_PTR p_task;
+    pthread_mutex_lock(&OS_MsgMutex);
+    if (OS_NumTasks >= MAX_THREADS) {
+        pthread_mutex_unlock(&OS_MsgMutex);
+        OS_Error(OS_ERR_THREAD_FAIL);
+    }
+    p_task = &OS_TaskInfo[OS_NumTasks];
+    memset(p_task, 0, sizeof(OS_TASK_INFO_STRUCT));
+    p_task->name = name;
+    OS_NumTasks++;
+    pthread_mutex_unlock(&OS_MsgMutex);
+    return p_task;
+}
+
+/**@brief Associate the calling thread with its statistics entry.
+ */
+static void task_info_bind(OS_TASK_INFO_STRUCT_PTR p_task)
+{
+    pthread_getcpuclockid(pthread_self(), &p_task->cpu_clock);
+    OS_CurrentTask = p_task;
+    __atomic_store_n(&p_task->started, true, __ATOMIC_RELEASE);
+}
+
+/**@brief Note that a task is about to block on its event.
+ *     The event mutex must be held.
+ */
+static void stats_wait_begin(EVENT_STRUCT * p_ev, uint16_t mask)
+{
+    OS_EVENT_INFO_STRUCT_PTR p_info = &OS_EventInfo[p_ev - OS_Event];
+    p_info->waits++;
+    p_info->waiting = ((p_ev->spec_event & mask) == 0);
+    p_info->wait_mask = mask;
+    p_info->wake_usec = 0;
+}
+
+/**@brief Record how long the task took to run after being woken.
+ *     The event mutex must be held.
+ *
+ * @details Only waits that actually blocked and were ended by
+ *     OS_EventSet are measured; a bit that was already set when
+ *     the task came to wait is backlog, not scheduling latency.
+ */
+static void stats_wait_end(EVENT_STRUCT * p_ev, uint16_t mask)
+{
+    OS_EVENT_INFO_STRUCT_PTR p_info = &OS_EventInfo[p_ev - OS_Event];
+    OS_TASK_INFO_STRUCT_PTR p_task = OS_CurrentTask;
+
+    if (p_info->waiting == false) {
+        return;
+    }
+    p_info->waiting = false;
+    if ((p_ev->spec_event & mask) == 0) {
+        p_info->timeouts++;
+    }
+    else if ((p_info->wake_usec != 0) && (p_task != NULL)) {
+        uint32_t latency = stats_usec_now() - p_info->wake_usec;
+        p_task->wakeups++;
+        if (latency > p_task->max_latency_usec) {
+            p_task->max_latency_usec = latency;
+        }
+        stats_hist_add(p_task->latency_hist, latency);
+    }
+}
+
+/**@brief Read a task's cpu time in usec.
+ */
+static uint64_t task_run_usec(OS_TASK_INFO_STRUCT_PTR p_task)
+{
+    struct timespec run;
+    if (__atomic_load_n(&p_task->started, __ATOMIC_ACQUIRE) == false) {
+        return 0;
+    }
+    if (clock_gettime(p_task->cpu_clock, &run) != 0) {
+        return 0;
+    }
+    return (uint64_t)run.tv_sec * MILLION + run.tv_nsec / THOUSAND;
+}
+
+/**@brief Get the number of tasks with statistics.
+ */
+uint16_t OS_GetTaskCount(void)
+{
+    return OS_NumTasks;
+}
+
+/**@brief Get a snapshot of a task's statistics.
+ *
+ * @param[in]   task index, 0 to OS_GetTaskCount()-1
+ * @param[out]  statistics for the task
+ *
+ * @returned  false if the index is out of range.
+ *
+ * @details Run time is cpu time consumed since start or the last
+ *     OS_ResetStats.  Latency is from the OS_EventSet that released
+ *     a blocked wait to the task returning from OS_TaskWaitEvents.
+ */
+bool OS_GetTaskStats(uint16_t task, OS_TASK_STATS *p_stats)
+{
+    OS_TASK_INFO_STRUCT_PTR p_task;
+    if (task >= OS_NumTasks) {
+        return false;
+    }
+    p_task = &OS_TaskInfo[task];
+    p_stats->name = p_task->name;
+    p_stats->run_usec = task_run_usec(p_task) - p_task->run_base_usec;
+    p_stats->wakeups = p_task->wakeups;
+    p_stats->max_latency_usec = p_task->max_latency_usec;
+    memcpy(p_stats->latency_hist, p_task->latency_hist, sizeof(p_stats->latency_hist));
+    return true;
+}
+
+/**@brief Get the number of events created.
+ */
+uint16_t OS_GetEventCount(void)
+{
+    return OS_NextAvailEvent;
+}
+
+/**@brief Get a snapshot of an event's statistics.
+ *
+ * @param[in]   event index, 0 to OS_GetEventCount()-1
+ * @param[out]  statistics for the event
+ *
+ * @returned  false if the index is out of range.
+ */
+bool OS_GetEventStats(uint16_t event, OS_EVENT_STATS *p_stats)
+{
+    OS_EVENT_INFO_STRUCT_PTR p_info;
+    if (event >= OS_NextAvailEvent) {
+        return false;
+    }
+    p_info = &OS_EventInfo[event];
+    p_stats->owner = (p_info->p_owner != NULL) ? p_info->p_owner->name : "-";
+    p_stats->pending = OS_Event[event].spec_event;
+    p_stats->sets = p_info->sets;
+    p_stats->waits = p_info->waits;
+    p_stats->timeouts = p_info->timeouts;
+    return true;
+}
+
+/**@brief Get a snapshot of a mailbox's statistics.
+ *
+ * @param[in]   mailbox index, 0 to MAX_MAILBOXES-1
+ * @param[out]  statistics for the mailbox
+ *
+ * @returned  false if the mailbox has not been created.
+ */
+bool OS_GetMboxStats(uint16_t mbox, OS_MBOX_STATS *p_stats)
+{
+    MBOX_STRUCT_PTR p_mbox;
+    OS_EVENT_INFO_STRUCT_PTR p_info;
+    if ((mbox >= MAX_MAILBOXES) || (mbox < NumMailboxes)) {
+        return false;
+    }
+    p_mbox = &MboxParam[mbox];
+    p_info = &OS_EventInfo[(EVENT_STRUCT_PTR)p_mbox->event_handle - OS_Event];
+    p_stats->owner = (p_info->p_owner != NULL) ? p_info->p_owner->name : "-";
+    p_stats->event_bit = p_mbox->event_bit;
+    p_stats->depth = __atomic_load_n(&p_mbox->count, __ATOMIC_RELAXED);
+    p_stats->high_water = p_mbox->high_water;
+    p_stats->sent = p_mbox->sent;
+    p_stats->received = p_mbox->received;
+    p_stats->max_dwell_usec = p_mbox->max_dwell_usec;
+    p_stats->total_dwell_usec = p_mbox->total_dwell_usec;
+    return true;
+}
+
+/**@brief Start a new measurement period.
+ *
+ * @details Counters are cleared without locking, so a sample
+ *     taken at the same moment may survive the reset.
+ */
+void OS_ResetStats(void)
+{
+    uint16_t idx;
+    for (idx = 0; idx < OS_NumTasks; ++idx) {
+        OS_TASK_INFO_STRUCT_PTR p_task = &OS_TaskInfo[idx];
+        p_task->run_base_usec = task_run_usec(p_task);
+        p_task->wakeups = 0;
+        p_task->max_latency_usec = 0;
+        memset(p_task->latency_hist, 0, sizeof(p_task->latency_hist));
+    }
+    for (idx = 0; idx < OS_NextAvailEvent; ++idx) {
+        OS_EventInfo[idx].sets = 0;
+        OS_EventInfo[idx].waits = 0;
+        OS_EventInfo[idx].timeouts = 0;
+    }
+    for (idx = NumMailboxes; idx < MAX_MAILBOXES; ++idx) {
+        MboxParam[idx].high_water = __atomic_load_n(&MboxParam[idx].count, __ATOMIC_RELAXED);
+        MboxParam[idx].sent = 0;
+        MboxParam[idx].received = 0;
+        MboxParam[idx].max_dwell_usec = 0;
+        MboxParam[idx].total_dwell_usec = 0;
+    }
+}
+
 void OS_GetTimeLocal(time_t *p_time)
 {
     time(p_time);
@@ -421,6 +1678,19 @@ void OS_TaskSleep(uint32_t val_msec)
 //	nanosleep((const struct timespec[]){{val_msec/1000, (1000000L)*(val_msec%1000)}}, NULL);
 }
 
+/**@brief Millisecond tick for measuring intervals.
+ *
+ * @returned  CLOCK_MONOTONIC in msec, truncated to 32 bits.  Unaffected
+ *    by OS_SetTime; compare ticks by subtraction so the wrap after 49
+ *    days is harmless.
+ */
+uint32_t OS_GetMsecTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * THOUSAND + now.tv_nsec / MILLION);
+}
+
 void OS_Error(uint16_t err_code)
 {
     printf("OS Error = %d\n",err_code);
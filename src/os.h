@@ -14,8 +14,52 @@ typedef struct EVENT_STRUCT_TAG
     pthread_cond_t trigger;
     pthread_mutex_t mutex;
     uint16_t spec_event;
+    int wake_fd;            //eventfd, only once a descriptor is attached
+    int poll_fd;            //epoll set of wake_fd and attached descriptors
 } EVENT_STRUCT, *EVENT_STRUCT_PTR;
 
+typedef struct
+{
+    uint32_t block_size;
+    uint32_t num_blocks;
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t alloc_count;
+    uint32_t heap_fallbacks;
+} OS_MEM_POOL_STATS;
+
+#define OS_STATS_HIST_BUCKETS   20  //log2 usec buckets, last is >= 262 msec
+
+typedef struct
+{
+    const char *name;
+    uint64_t run_usec;
+    uint32_t wakeups;
+    uint32_t max_latency_usec;
+    uint32_t latency_hist[OS_STATS_HIST_BUCKETS];
+} OS_TASK_STATS;
+
+typedef struct
+{
+    const char *owner;
+    uint16_t pending;
+    uint32_t sets;
+    uint32_t waits;
+    uint32_t timeouts;
+} OS_EVENT_STATS;
+
+typedef struct
+{
+    const char *owner;
+    uint16_t event_bit;
+    uint32_t depth;
+    uint32_t high_water;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t max_dwell_usec;
+    uint64_t total_dwell_usec;
+} OS_MBOX_STATS;
+
 typedef void *(* THREAD_FUNCT)(void *);
 typedef pthread_t _task_id;
 typedef struct thread_template_struct
@@ -49,12 +93,16 @@ typedef struct thread_template_struct
 #define OS_ERR_TASK_CLOCK_FAIL  17
 #define OS_ERR_MSG_QUEUE_MSG_FAIL  18
 #define OS_ERR_SERIAL_PORT      19
+#define OS_ERR_MEM_DOUBLE_FREE  20
+#define OS_ERR_MEM_USE_AFTER_FREE  21
 
 void OS_Init(THREAD_TEMPLATE_STRUCT_PTR p_list);
 pthread_t OS_TaskCreate(uint32_t template_index, void * parameter);
 void * OS_EventCreate(uint16_t event_group, bool auto_clear);
 
 uint16_t OS_TaskWaitEvents(void* handle, uint16_t mask, int32_t delay);
+bool OS_EventAttachFd(void * handle, int fd, uint16_t event_bit);
+void OS_EventDetachFd(void * handle, int fd);
 
 void OS_EventClear(void * event_handle, uint16_t mask);
 void OS_EventSet(void * event_handle, uint16_t mask);
@@ -66,21 +114,36 @@ void OS_ReleaseMsgMemBlock(void *p_msg);
 
 void *OS_GetMemBlock(uint16_t size);
 void OS_ReleaseMemBlock(void *p_msg);
+uint16_t OS_MsgPoolCreate(uint16_t size, uint16_t num_blocks);
+void *OS_GetPoolMsgBlock(uint16_t pool);
+uint16_t OS_GetMemPoolCount(void);
+bool OS_GetMemPoolStats(uint16_t pool, OS_MEM_POOL_STATS *p_stats);
 
 uint16_t OS_TimerCreate(void *event_handle, uint16_t event_bit);
 void OS_TimerStop(uint16_t timer);
 void OS_TimerSetCyclicInterval(uint16_t timer, uint32_t interval);
+void OS_TimerSetPeriodicInterval(uint16_t timer, uint32_t interval);
 
 void OS_GetTimeLocal(time_t*);
 void OS_SetTime(time_t *time);
+uint32_t OS_GetMsecTick(void);
 
 void OS_Error(uint16_t err_code);
 
+uint16_t OS_GetTaskCount(void);
+bool OS_GetTaskStats(uint16_t task, OS_TASK_STATS *p_stats);
+uint16_t OS_GetEventCount(void);
+bool OS_GetEventStats(uint16_t event, OS_EVENT_STATS *p_stats);
+bool OS_GetMboxStats(uint16_t mbox, OS_MBOX_STATS *p_stats);
+void OS_ResetStats(void);
+
 #define MESSAGE_HEADER_SIZE sizeof(MESSAGE_HEADER_STRUCT)
 
 #define MAX_THREADS 20
 #define MAX_MAILBOXES   40
-#define MAX_TIMERS  10
+#define MAX_TIMERS  2048
+#define OS_EVENT_MAX_FDS    8   //descriptors reported per wake up
+#define OS_MEM_MAX_MSG_POOLS    4   //pools made with OS_MsgPoolCreate
 
 #define OS_TaskYield()     sched_yield();
 //#define OS_TaskSleep(val_msec)  nanosleep((const struct timespec[]){{val_msec/1000, (1000000L)*(val_msec%1000)}}, NULL);
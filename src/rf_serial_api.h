@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "config.h"
 
 /*
@@ -245,15 +246,14 @@ typedef enum
 
 #define NETWORK_HEADER_SIZE         14
 
-//RF Timer Expiration Values
-//tick timer for timeout following the sending of a message to shade
-#define SC_WAIT_RF_TICK                     200
-//number of ticks to wait after sending a message to shade
-//  before sending next
-#define SC_SHADE_RF_TICK_MAX                5
-#define SC_SHADE_BATT_REQ_RF_TICK_MAX       9
-#define RNC_TICK_INTERVAL                   200
-#define RNC_PROCESS_TICK_INTERVAL           200
+//RF Pacing, see rfp_pacing.c
+//time a shade message holds its place after the Nordic confirms it,
+//  giving the shade a chance to respond, adapted between the floor
+//  and ceiling (RFO_WAIT_NEXT_RF_OUTBOUND)
+#define RFP_GAP_MIN_MSEC                    200
+#define RFP_GAP_START_MSEC                  1000
+//a battery reading takes the shade longer to answer
+#define RFP_BATTERY_EXTRA_MSEC              800
 
 //Serial Message Retries
 #define RFO_MAX_RF_MSG_TRIES                1
@@ -267,7 +267,8 @@ typedef enum
 #define RFO_WAIT_RETRY_NORDIC_OUTBOUND      2
 #define RFO_WAIT_NORDIC_SER_RESPONSE        1000
 
-//pause between outbound RF messages to give shades a chance to respond
+//longest pause between outbound RF messages to give shades a chance to
+//  respond, the ceiling of the adaptive gap
 #define RFO_WAIT_NEXT_RF_OUTBOUND           3000
 //if NAK was received or timeout occurred when sending an rf outbound
 // message then wait 200 msec before retrying
@@ -276,6 +277,9 @@ typedef enum
 #define RFO_WAIT_RF_SER_RESPONSE            2000
 //set the interval of the timer to zero to stop it
 #define RFO_WAIT_MAX                        WAIT_TIME_INFINITE
+//number of messages that may be handed to the Nordic before the first
+// of them is confirmed; each one keeps its own timeout and retries
+#define RFO_WINDOW_DEPTH                    4
 
 #define MAX_GROUP_LIST_SIZE 8
 typedef enum
@@ -432,6 +436,15 @@ typedef enum
     SC_RSLT_BUSY = 0x29
 } SC_SER_RESP_CODE_T;
 
+//result of a shade confirmation (or of a serial timeout) passed from the
+// serial receive side to the shade config list
+typedef struct SC_CONF_RESULT_TAG
+{
+    uint8_t status;             //SC_SER_RESP_CODE_T
+    uint8_t conf_type;          //MSG_TYPE_xxx_CONF being answered
+    uint8_t handle;             //tx handle, shade data only
+} SC_CONF_RESULT, *SC_CONF_RESULT_PTR;
+
 typedef enum
 {
     WAITING_TO_SEND_STATE,
@@ -439,6 +452,15 @@ typedef enum
     WAITING_TO_SEND_NEXT
 }SC_STATE_T;
 
+//order in which waiting shade messages are sent
+typedef enum
+{
+    SC_PRIORITY_INTERACTIVE,        //moves, position reads, scene controller replies
+    SC_PRIORITY_SCENE,              //scene execution and setup, groups
+    SC_PRIORITY_MAINTENANCE,        //battery, firmware, discovery, resets
+    SC_PRIORITY_COUNT
+}SC_PRIORITY_T;
+
 typedef enum
 {
     SINGLE,
@@ -498,6 +520,8 @@ typedef struct SHADE_DATA_REQUEST_HEADER_TYPE
 }__attribute__((packed)) SHADE_DATA_REQUEST_HEADER_STRUCT, *SHADE_DATA_REQUEST_HEADER_STRUCT_PTR;
 
 #define SHADE_DATA_REQUEST_HDR_SIZE     (sizeof(SHADE_DATA_REQUEST_HEADER_STRUCT) - 1)
+//position of TX_HANDLE in the raw message, see RNC_GetTransportByte
+#define SHADE_DATA_REQUEST_HANDLE_INDEX offsetof(SHADE_DATA_REQUEST_HEADER_STRUCT, tx_handle)
 typedef struct SHADE_DATA_REQ_MSG_TYPE
 {
     void(*p_callback)(void*);
@@ -768,7 +792,12 @@ typedef struct RNC_CFG_REC_TAG
     SC_STATE_T state;
     uint8_t rf_retry_count;
     uint8_t rf_retry_max;
-    uint8_t rf_ack_tick_count;
+    uint32_t sent_tick;             //OS_GetMsecTick when handed to rfo_outbound
+    uint32_t send_next_tick;        //OS_GetMsecTick when the hold after confirmation ends
+    uint8_t priority;               //SC_PRIORITY_T
+    uint8_t coalesce_kinds;         //position kinds set by a waiting move, 0 if none
+    uint64_t coalesce_key;          //address of a waiting move
+    struct RNC_CFG_REC_TAG* p_coalesce_next;
     uint32_t serial_timeout;
     uint8_t serial_retry_max;
     uint8_t expected_msg_response;
@@ -786,13 +815,6 @@ typedef struct DISCOVERY_DATA_TYPE
     uint8_t shade_type;
 } __attribute__((packed)) DISCOVERY_DATA_STRUCT, *DISCOVERY_DATA_STRUCT_PTR;
 
-typedef struct SC_SHADE_DISCOVER_TAG
-{
-    DISCOVERY_DATA_STRUCT shade_rsp;
-    struct SC_SHADE_DISCOVER_TAG* p_prev_rec;
-    struct SC_SHADE_DISCOVER_TAG* p_next_rec;
-}SC_SHADE_DISC_REC, *SC_SHADE_DISC_REC_PTR;
-
 typedef struct
 {
     ID_TYPE_T device_id;
@@ -819,6 +841,8 @@ typedef struct
 } SHADE_POSITION, *SHADE_POSITION_PTR;
 
 #define MAX_BATTERY_MEASUREMENTS_PER_SHADE      5
+#define BATTERY_CHECK_RETRY_MAX                 7
+#define SECONDS_BETWEEN_BATTERY_CHECKS          4
 typedef struct BATTERY_CHECK_STRUCT_TAG
 {
     uint16_t replicate_counter;
@@ -852,9 +876,11 @@ void RC_RequestVersion(void);
 
 COARSE_BATTERY_LEVEL SC_GetCoarseBatteryLevel(uint8_t shade_type, uint8_t voltage);
 void SC_ScheduleBatteryCheck(void);
-uint8_t* SC_ProcessShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg);
-void SC_HandleShadeConfirmationResult(uint8_t* p_ser_rsp);
+SC_CONF_RESULT_PTR SC_ProcessShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg);
+void SC_HandleShadeConfirmationResult(SC_CONF_RESULT_PTR p_ser_rsp);
 void SC_LoadNewCommand(SHADE_COMMAND_INSTRUCTION_PTR p_cmd);
+uint32_t SC_GetCoalescedCount(void);
+uint16_t SC_GetQueuedCount(SC_PRIORITY_T priority);
 
 void SC_HandleShadeIndication(PARSE_KEY_STRUCT_PTR p_rf_response);
 void SC_HandleShadeIndicationFromSlave(PARSE_KEY_STRUCT_PTR p_rf_response, uint16_t size);
@@ -875,10 +901,24 @@ void RNC_SendShadeConfirmation(PARSE_KEY_STRUCT_PTR p_ser_msg);
 void RNC_SendShadeIndication(PARSE_KEY_STRUCT_PTR p_ser_msg);
 void RNC_SendSystemIndication(PARSE_KEY_STRUCT_PTR p_ser_msg);
 void RNC_BeginDiscoveryProcessing(void);
-void RNC_StartTickTimer(void);
+void RNC_StartTickTimer(uint32_t msec);
 void RNC_StopTickTimer(void);
-void RNC_NotifySerialTimeout(DESTINATION_DEVICE_TYPE type);
+void RNC_NotifySerialTimeout(DESTINATION_DEVICE_TYPE type, uint8_t conf_type, uint8_t handle);
 void RNC_AddTransportLayer(uint8_t * p_msg_send, uint8_t * p_msg_raw);
+uint8_t RNC_GetTransportByte(uint8_t * p_msg_send, uint8_t index);
+
+typedef struct
+{
+    uint32_t frames;            //good frames passed to a handler
+    uint32_t checksum_failures;
+    uint32_t timeout_resyncs;   //frames abandoned after INTER_CHARACTER_TIMEOUT
+    uint32_t header_resyncs;    //frames cut short by a new START_OF_HEADER
+    uint32_t unknown_frames;    //good checksum but no matching handler
+    uint32_t ring_exhausted;    //frame slots all in use, heap block used instead
+} RFI_STATS;
+
+void RFI_GetStats(RFI_STATS *p_stats);
+void RFI_ResetStats(void);
 bool SC_IsNetworkJoiningActive(void);
 
 
@@ -0,0 +1,176 @@
+/***************************************************************************//**
+ * @file rfd_dedup.c
+ * @brief Drops shade indications the hub has just heard.
+ *
+ *  Shades and repeaters send the same indication more than once.  Each
+ *  indication is remembered for RFD_WINDOW_MSEC by the id of the shade
+ *  that sent it and a 64 bit FNV-1a hash of its payload, so repeats from
+ *  several shades talking at once are all caught and two different
+ *  payloads are practically never mistaken for each other.
+ *
+ *  Only a shade's latest indication is kept.  One that goes A, B, A
+ *  (moved by a remote, say) has all three reported, as the last
+ *  checksum check used to.
+ *
+ *  The cache is a small open addressed table.  A lookup probes at most
+ *  RFD_PROBE_MAX slots from the one the hash picks; entries past their
+ *  window, or superseded by a newer indication from their shade, count
+ *  as free.  When every probed slot is live the oldest one is
+ *  overwritten.
+ *
+ *  Sending a request empties the cache, since whatever the shade answers
+ *  must be reported even if it matches what it said a moment ago.
+ *
+ *  Everything runs in the rnc task.  Other tasks only read the counters.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include "os.h"
+#include "rfd_dedup.h"
+
+/* Local Symbols
+*******************************************************************************/
+#define RFD_TABLE_SIZE      64      //power of two
+#define RFD_PROBE_MAX       8
+#define RFD_FNV_OFFSET      0xcbf29ce484222325ULL
+#define RFD_FNV_PRIME       0x100000001b3ULL
+
+typedef struct RFD_ENTRY_TAG
+{
+    uint64_t hash;
+    uint32_t heard_msec;
+    uint16_t id;
+    bool used;
+} RFD_ENTRY;
+
+/* Local variables
+*******************************************************************************/
+static RFD_ENTRY RFD_Table[RFD_TABLE_SIZE];
+static RFD_STATS RFD_Stats;
+
+/* Local Function Declarations
+*******************************************************************************/
+static uint64_t rfd_hash(uint16_t id, const uint8_t * p_payload, uint16_t len);
+
+/*******************************************************************************
+* Procedure:    RFD_IsDuplicate
+* Purpose:      Tell whether an indication was already heard within the
+*               window, and remember it if not.
+* Passed:       id of the shade that sent it, its payload and length
+*
+* Returned:     true if it is a repeat and should be dropped
+* Globals:      none
+*******************************************************************************/
+bool RFD_IsDuplicate(uint16_t id, const uint8_t * p_payload, uint16_t len)
+{
+    uint64_t hash = rfd_hash(id, p_payload, len);
+    uint32_t now = OS_GetMsecTick();
+    RFD_ENTRY * p_free = NULL;
+    RFD_ENTRY * p_oldest = NULL;
+    RFD_ENTRY * p_entry;
+    uint16_t slot;
+    uint8_t probe;
+
+    //anything else the shade said no longer stands, so only a repeat of
+    //its latest indication can match
+    for (slot = 0; slot < RFD_TABLE_SIZE; ++slot) {
+        p_entry = &RFD_Table[slot];
+        if ((p_entry->used == true) && (p_entry->id == id) && (p_entry->hash != hash)) {
+            p_entry->used = false;
+        }
+    }
+
+    slot = (uint16_t)hash & (RFD_TABLE_SIZE - 1);
+    for (probe = 0; probe < RFD_PROBE_MAX; ++probe) {
+        p_entry = &RFD_Table[(slot + probe) & (RFD_TABLE_SIZE - 1)];
+        if ((p_entry->used == false) || ((now - p_entry->heard_msec) >= RFD_WINDOW_MSEC)) {
+            if (p_free == NULL) {
+                p_free = p_entry;
+            }
+        }
+        else if ((p_entry->hash == hash) && (p_entry->id == id)) {
+            //keep the first time heard so a shade that repeats itself
+            //steadily is still reported once per window
+            ++RFD_Stats.hits;
+            return true;
+        }
+        else if ((p_oldest == NULL) || ((int32_t)(p_entry->heard_msec - p_oldest->heard_msec) < 0)) {
+            p_oldest = p_entry;
+        }
+    }
+    if (p_free == NULL) {
+        p_free = p_oldest;
+        ++RFD_Stats.evictions;
+    }
+    p_free->hash = hash;
+    p_free->id = id;
+    p_free->heard_msec = now;
+    p_free->used = true;
+    ++RFD_Stats.misses;
+    return false;
+}
+
+/*******************************************************************************
+* Procedure:    RFD_Flush
+* Purpose:      Forget every indication heard.
+* Passed:       none
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFD_Flush(void)
+{
+    memset(RFD_Table, 0, sizeof(RFD_Table));
+    ++RFD_Stats.flushes;
+}
+
+/*******************************************************************************
+* Procedure:    RFD_GetStats
+* Purpose:      Copy out the cache counters.
+* Passed:       where to put them
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFD_GetStats(RFD_STATS * p_stats)
+{
+    *p_stats = RFD_Stats;
+}
+
+/*******************************************************************************
+* Procedure:    RFD_ResetStats
+* Purpose:      Clear the cache counters.
+* Passed:       none
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFD_ResetStats(void)
+{
+    memset(&RFD_Stats, 0, sizeof(RFD_Stats));
+}
+
+/*******************************************************************************
+* Procedure:    rfd_hash
+* Purpose:      Hash a shade id and payload.
+* Passed:       id of the shade, the payload and its length
+*
+* Returned:     64 bit FNV-1a hash
+* Globals:      none
+*******************************************************************************/
+static uint64_t rfd_hash(uint16_t id, const uint8_t * p_payload, uint16_t len)
+{
+    uint64_t hash = RFD_FNV_OFFSET;
+    uint16_t i;
+
+    hash = (hash ^ (uint8_t)(id >> 8)) * RFD_FNV_PRIME;
+    hash = (hash ^ (uint8_t)(id & 0xff)) * RFD_FNV_PRIME;
+    for (i = 0; i < len; ++i) {
+        hash = (hash ^ p_payload[i]) * RFD_FNV_PRIME;
+    }
+    //fold the high bits down, the table slot comes from the low ones
+    return hash ^ (hash >> 32);
+}
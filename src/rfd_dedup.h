@@ -0,0 +1,29 @@
+/***************************************************************************//**
+ * @file rfd_dedup.h
+ * @brief Include file for rfd_dedup.c
+ *
+ ******************************************************************************/
+#ifndef __RFD_DEDUP_H
+#define __RFD_DEDUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//an indication repeated within this many msec is dropped
+#define RFD_WINDOW_MSEC     3000
+
+typedef struct RFD_STATS_TAG
+{
+    uint32_t hits;              //repeats dropped
+    uint32_t misses;            //indications let through
+    uint32_t evictions;         //live entries overwritten for lack of room
+    uint32_t flushes;           //cache emptied because a request went out
+} RFD_STATS;
+
+//public function prototypes:
+bool RFD_IsDuplicate(uint16_t id, const uint8_t * p_payload, uint16_t len);
+void RFD_Flush(void);
+void RFD_GetStats(RFD_STATS * p_stats);
+void RFD_ResetStats(void);
+
+#endif
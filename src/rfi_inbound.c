@@ -31,6 +31,7 @@
 *******************************************************************************/
 #define RF_SERIAL_RX_EVENT_BIT     BIT0
 #define INTER_CHARACTER_TIMEOUT     200
+#define RFI_FRAME_SLOT_SIZE         257     //length byte, up to 255 bytes, spare
 
 typedef struct S_INB_MSG_STRUCT
 {
@@ -77,6 +78,8 @@ static uint16_t RxIndex;
 static uint32_t WaitTime;
 static PARSE_KEY_STRUCT_PTR pRxBuffer;
 static uint8_t Checksum;
+static uint16_t FramePool;
+static RFI_STATS RfiStats;
 
 /*****************************************************************************//**
 * @brief This function initializes the rf inbound task and holds the 
@@ -98,6 +101,9 @@ void *rfi_inbound_task(void * temp)
     uint8_t c;
 
     event_handle = RFU_Register_Inbound_Event(0, RF_SERIAL_RX_EVENT_BIT);
+    //frames are unescaped straight into these slots and passed on by
+    //reference; whoever handles the frame releases it back to the pool
+    FramePool = OS_MsgPoolCreate(RFI_FRAME_SLOT_SIZE, RFI_FRAME_SLOTS);
     re_init();
 printf("rfi_inbound_task\n");
     while(1)
@@ -107,11 +113,15 @@ printf("rfi_inbound_task\n");
             if (pRxBuffer != NULL) {
                 OS_ReleaseMsgMemBlock((void*)pRxBuffer);
             }
+            if (State != RFI_LOOKING_FOR_HEADER) {
+                RfiStats.timeout_resyncs++;
+            }
             re_init();
 //printf("!");
         }
         else {
-            if (RFU_GetRxChar(&c) == true) {
+            //take everything rx_task has queued in one pass
+            while (RFU_GetRxChar(&c) == true) {
 //printf("`");
                 process_char(c);
             }
@@ -144,7 +154,12 @@ static void process_char(uint8_t new_char)
             break;
         case RFI_LOOKING_FOR_LEN:
             //Note: this memory may be freed from this task or the RNC_RFNetworkConfig task
-            pRxBuffer = (PARSE_KEY_STRUCT_PTR)OS_GetMsgMemBlock(new_char+2); //add 2 for length itself
+            pRxBuffer = (PARSE_KEY_STRUCT_PTR)OS_GetPoolMsgBlock(FramePool);
+            if (pRxBuffer == NULL) {
+                //every slot is still held by a consumer
+                RfiStats.ring_exhausted++;
+                pRxBuffer = (PARSE_KEY_STRUCT_PTR)OS_GetMsgMemBlock(new_char+2); //add 2 for length itself
+            }
             pRxBuffer->generic.length = new_char;
             RxIndex = 0;
             State = RFI_LOOKING_FOR_PAYLOAD;
@@ -152,6 +167,9 @@ static void process_char(uint8_t new_char)
         case RFI_LOOKING_FOR_PAYLOAD:
             Checksum += new_char;
             if (new_char == START_OF_HEADER) {
+                //frame cut short by the start of another one
+                OS_ReleaseMsgMemBlock((void*)pRxBuffer);
+                RfiStats.header_resyncs++;
                 re_init();
                 State = RFI_LOOKING_FOR_LEN;
             }
@@ -176,6 +194,7 @@ static void process_char(uint8_t new_char)
                 process_message();
             }
             else {
+                RfiStats.checksum_failures++;
                 OS_ReleaseMsgMemBlock((void*)pRxBuffer);
             }
             re_init();
@@ -211,6 +230,7 @@ static void process_message(void)
                 && (pRxBuffer->generic.length <= (uint16_t)InboundMessage[n].msg_len_max) )
             {
 //printf("Valid message\n");
+                RfiStats.frames++;
                 (*InboundMessage[n].funct)(pRxBuffer);
                 
                 //The called function should release memory
@@ -220,6 +240,7 @@ static void process_message(void)
         ++pMessages;
         ++n;
     }
+    RfiStats.unknown_frames++;
     OS_ReleaseMsgMemBlock((void*)pRxBuffer);
 }
 
@@ -242,3 +263,24 @@ static void re_init(void)
     Checksum = 0;
 }
 
+/*****************************************************************************//**
+* @brief Copy out the frame counters.
+*
+* @param p_stats is filled in with the counters.
+* @return nothing.
+*******************************************************************************/
+void RFI_GetStats(RFI_STATS *p_stats)
+{
+    *p_stats = RfiStats;
+}
+
+/*****************************************************************************//**
+* @brief Clear the frame counters.
+*
+* @param nothing
+* @return nothing.
+*******************************************************************************/
+void RFI_ResetStats(void)
+{
+    memset(&RfiStats, 0, sizeof(RfiStats));
+}
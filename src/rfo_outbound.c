@@ -9,6 +9,11 @@
  *  configurable set of timing parameters for managing timeouts when expecting a<br/>
  *  response from the shade and for pacing the rate that shade messages are sent.
  *
+ *  Up to RFO_WINDOW_DEPTH messages may be outstanding at the Nordic at once.
+ *  Each occupies a slot of the window holding its own copy of the message,
+ *  its retry count and the time its current wait ends.  Confirmations are
+ *  matched to a slot by confirmation type and, for shade data, by tx handle.
+ *
  * @author Neal Shurmantine
  * @copyright (c) 2014 Hunter Douglas. All rights reserved.
  *
@@ -22,6 +27,7 @@
 *******************************************************************************/
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include "rf_serial_api.h"
 #include "util.h"
@@ -37,6 +43,9 @@
 #define RFO_MSG_RCVD_EVENT              BIT0
 #define RFO_SER_RESP_EVENT              BIT1
 
+//slot handle when the confirmation carries none
+#define RFO_NO_HANDLE                   (-1)
+
 
 typedef enum
 {
@@ -47,12 +56,46 @@ typedef enum
     RFO_IDLE_STATE
 }RFO_STATE_T;
 
+/** A message waiting in RFO_ReqMsgMbox.  The message is copied when it is<br/>
+  queued so the caller's record may be released at any time. */
+typedef struct RFO_REQUEST_TAG
+{
+    DESTINATION_DEVICE_TYPE dest_type;
+    uint8_t ser_msg[MAX_SER_CONFIG_SIZE];
+} RFO_REQUEST, *RFO_REQUEST_PTR;
+
+/** A confirmation waiting in RFO_ResponseMbox. */
+typedef struct RFO_RESPONSE_TAG
+{
+    uint8_t conf_type;
+    uint8_t handle;
+    uint8_t status;
+} RFO_RESPONSE, *RFO_RESPONSE_PTR;
+
+/** One outstanding message. */
+typedef struct RFO_SLOT_TAG
+{
+    RFO_STATE_T state;                  //RFO_IDLE_STATE when the slot is free
+    DESTINATION_DEVICE_TYPE dest_type;
+    uint8_t conf_type;                  //confirmation that completes the message
+    int16_t handle;                     //tx handle or RFO_NO_HANDLE
+    uint16_t retry_counter;
+    uint16_t retry_limit;
+    uint32_t deadline;                  //OS_GetMsecTick when the current wait ends
+    uint32_t sent_tick;                 //OS_GetMsecTick of the last transmission
+    uint32_t order;                     //acceptance sequence, lower is older
+    uint8_t ser_msg[MAX_SER_CONFIG_SIZE];
+} RFO_SLOT;
+
 
 /* Local Functions
 *******************************************************************************/
 static void RFO_process_msg_request(void);
 static void RFO_process_ser_response(void);
 static void RFO_process_timeout_event(void);
+static void rfo_transmit(RFO_SLOT * p_slot, uint32_t now);
+static void rfo_release_slot(RFO_SLOT * p_slot);
+static void rfo_update_wait(void);
 //static void debug_print(const char * p_msg);
 
 
@@ -65,18 +108,17 @@ static uint16_t RFO_ResponseMbox;
 /** Mask containing the events to which a task may respond when it is<br/> 
  blocked waiting on events */
 static uint16_t RFO_ExpectedEvents;
-/** Local counter containing the number of retries that have occurred. */
-static uint16_t RFO_MsgRetryCounter;
-/** Maximum number of retry attempts that should be made for this message. */
-static uint16_t RFO_MsgRetryLimit;
-/** Holds that state of the message currently being transmitted. */
-static RFO_STATE_T RFO_State;
-/** A pointer to the byte array containing the current serial message. */
-static uint8_t *RFO_SerMsg; //holds the active serial message info
+/** The messages currently outstanding at the Nordic. */
+static RFO_SLOT RFO_Window[RFO_WINDOW_DEPTH];
+/** Number of slots of RFO_Window in use. */
+static uint16_t RFO_InFlight;
+/** Incremented for each message accepted, orders the slots. */
+static uint32_t RFO_Sequence;
 /** A variable containing a timeout for waiting for an event.  This value<br/>
-  is modified, based on the state of the message transmission. */
+  is the time until the earliest deadline in the window. */
 static uint32_t RFO_WaitTime;
-static DESTINATION_DEVICE_TYPE RFO_DestinationType;
+/** Window and retry counters, see RFO_GetStats. */
+static RFO_STATS RFO_Stats;
 
 //static void debug_print(const char * p_msg)
 //{
@@ -89,26 +131,27 @@ static DESTINATION_DEVICE_TYPE RFO_DestinationType;
 * @brief This function is called to indicate that a new serial command should<br/>
 *  be sent to the Nordic for deivery to a shade.
 *
-* <b>Note:</b>  This function runs in the context of the calling task.  Also, <br/>
-*   receiving task (rfo_outbound) is responsible for releasing the memory block<br/>
-*   after processing.
+* <b>Note:</b>  This function runs in the context of the calling task.  The<br/>
+*   message is copied so the caller keeps ownership of the config record.<br/>
+*   If the window is full the message waits in the mailbox.
 * @param p_cfg_rec is a pointer to a shade configuration structure.
-* @return nothing.
+* @return true.
 * @author Neal Shurmantine
 * @since 2014-11-13
 * @version Initial revision.
 *******************************************************************************/
 bool RFO_DeliverRequest(RNC_CONFIG_REC_PTR p_cfg_rec)
 {
-//FIX ME
-// --- NOTE: block more than one message at a time
-    if (RFO_DestinationType != DESTINATION_NONE) {
-printf("Uh Oh!\n\r");
-        return false;
+    uint16_t len = p_cfg_rec->ser_msg[1] + 3;
+    RFO_REQUEST_PTR p_req = (RFO_REQUEST_PTR)OS_GetMsgMemBlock(sizeof(RFO_REQUEST));
+
+    if (len > MAX_SER_CONFIG_SIZE) {
+        len = MAX_SER_CONFIG_SIZE;
     }
-//printf("Got to here\n");
-    RFO_DestinationType = p_cfg_rec->dest_dev_type;
-    OS_MessageSend(RFO_ReqMsgMbox,p_cfg_rec);
+    p_req->dest_type = p_cfg_rec->dest_dev_type;
+    memcpy(p_req->ser_msg, p_cfg_rec->ser_msg, len);
+    __atomic_add_fetch(&RFO_Stats.requests, 1, __ATOMIC_RELAXED);
+    OS_MessageSend(RFO_ReqMsgMbox,p_req);
     return true;
 }
 
@@ -116,32 +159,88 @@ printf("Uh Oh!\n\r");
 * @brief This function is called when a serial inbound status message has been<br/>
 *  received from the Nordic.
 *
-* <b>Note:</b>  This function runs in the context of the calling task.  Also, <br/>
-*   receiving task (rfo_outbound) is responsible for releasing the memory block<br/>
-*   after processing.
-* @param p_status is a pointer to a status byte containing the result of the<br/>
-*  last message send to the nordic.
+* <b>Note:</b>  This function runs in the context of the calling task.
+* @param conf_type is the confirmation message type.
+* @param handle is the tx handle of a shade data confirmation, otherwise unused.
+* @param status is the result of the message sent to the nordic.
 * @return nothing.
 * @author Neal Shurmantine
 * @since 2014-11-13
 * @version Initial revision.
 *******************************************************************************/
-void RFO_NotifySerialResponse(uint8_t status)
+void RFO_NotifySerialResponse(uint8_t conf_type, uint8_t handle, uint8_t status)
 {
-    uint8_t * p_status = 
-            (uint8_t *)OS_GetMsgMemBlock(sizeof(uint8_t));
-    *p_status = status;
+    RFO_RESPONSE_PTR p_rsp = 
+            (RFO_RESPONSE_PTR)OS_GetMsgMemBlock(sizeof(RFO_RESPONSE));
+    p_rsp->conf_type = conf_type;
+    p_rsp->handle = handle;
+    p_rsp->status = status;
+    OS_MessageSend(RFO_ResponseMbox,p_rsp);
+}
 
-    if ((RFO_State == RFO_SENDING_RF_MSG_STATE) 
-            || (RFO_State == RFO_SENDING_NORDIC_MSG_STATE) ){
-        OS_MessageSend(RFO_ResponseMbox,p_status);
-    }
-    else {
-//printf("RFO_NotifySerialResponse OS_ReleaseMemBlock\n\r");
-        OS_ReleaseMsgMemBlock((void *)p_status);
+/*****************************************************************************//**
+* @brief Give the confirmation type the Nordic sends in answer to a request.
+*
+* @param req_type is the request message type.
+* @return the confirmation message type, 0 if the request is unknown.
+*******************************************************************************/
+uint8_t RFO_ExpectedConfirmation(uint8_t req_type)
+{
+    switch (req_type) {
+        case MSG_TYPE_GET_ATTR_REQ:
+            return MSG_TYPE_GET_ATTR_CONF;
+        case MSG_TYPE_SET_ATTR_REQ:
+            return MSG_TYPE_SET_ATTR_CONF;
+        case MSG_TYPE_RESET_REQ:
+            return MSG_TYPE_RESET_CONF;
+        case MSG_TYPE_START_REQ:
+            return MSG_TYPE_START_CONF;
+        case MSG_TYPE_SEND_SHADE_DATA_REQ:
+            return MSG_TYPE_SEND_SHADE_DATA_CONF;
+        case MSG_TYPE_SEND_BEACON_REQ:
+            return MSG_TYPE_SEND_BEACON_CONF;
+        case MSG_TYPE_SEND_GROUP_SET_REQ:
+            return MSG_TYPE_SEND_GROUP_SET_CONF;
+        case MSG_TYPE_SYSTEM:
+            return MSG_TYPE_SYSTEM_INDICATION;
+        default:
+            return 0;
     }
 }
 
+/*****************************************************************************//**
+* @brief Copy out the window and retry counters.
+*
+* @param p_stats is where to put the counters.
+* @return nothing.
+*******************************************************************************/
+void RFO_GetStats(RFO_STATS * p_stats)
+{
+    *p_stats = RFO_Stats;
+    p_stats->requests = __atomic_load_n(&RFO_Stats.requests, __ATOMIC_RELAXED);
+    p_stats->depth = RFO_WINDOW_DEPTH;
+}
+
+/*****************************************************************************//**
+* @brief Clear the window and retry counters.
+*
+* @param none.
+* @return nothing.
+*******************************************************************************/
+void RFO_ResetStats(void)
+{
+    uint16_t in_flight = RFO_InFlight;
+    uint32_t waiting = __atomic_load_n(&RFO_Stats.requests, __ATOMIC_RELAXED)
+            - RFO_Stats.accepted;
+
+    memset(&RFO_Stats, 0, sizeof(RFO_Stats));
+    //keep the messages still waiting for the window so requests - accepted
+    //  stays the mailbox backlog
+    __atomic_store_n(&RFO_Stats.requests, waiting, __ATOMIC_RELAXED);
+    RFO_Stats.in_flight = in_flight;
+    RFO_Stats.high_water = in_flight;
+}
+
 /*****************************************************************************//**
 * @brief This function initializes the rfo_outbound task and holds the<br/>
 *  main loop of the task.
@@ -169,21 +268,20 @@ printf("rfo_outbound_task\n");
     while(1) {
         event_active = OS_TaskWaitEvents(event_handle, RFO_ExpectedEvents, RFO_WaitTime);
         event_active &= RFO_ExpectedEvents;
-        if (event_active == RFO_MSG_RCVD_EVENT) {
-            RFO_process_msg_request();
-        }
-        if (event_active == RFO_SER_RESP_EVENT) {
+        if (event_active & RFO_SER_RESP_EVENT) {
             RFO_process_ser_response();
         }
-        if (!event_active)
-        {
-            RFO_process_timeout_event();
+        if (event_active & RFO_MSG_RCVD_EVENT) {
+            RFO_process_msg_request();
         }
+        //each slot has its own deadline, check them on every wake up
+        //  so a steady stream of events can't hold off a timeout
+        RFO_process_timeout_event();
     }
 }
 
 /*****************************************************************************//**
-* @brief This function ...
+* @brief This function empties the window.
 *
 * <b>Note:</b>  This function runs in the context of the calling task.
 * @param none.
@@ -194,182 +292,304 @@ printf("rfo_outbound_task\n");
 *******************************************************************************/
 void RFO_Reset(void)
 {
-    RFO_WaitTime = WAIT_TIME_INFINITE;
-    RFO_State = RFO_IDLE_STATE;
-    RFO_ExpectedEvents = RFO_MSG_RCVD_EVENT;
-    RFO_DestinationType = DESTINATION_NONE;
+    uint16_t idx;
+
+    for (idx = 0; idx < RFO_WINDOW_DEPTH; ++idx) {
+        RFO_Window[idx].state = RFO_IDLE_STATE;
+    }
+    RFO_InFlight = 0;
+    RFO_Stats.in_flight = 0;
+    rfo_update_wait();
 }
 
 /*******************************************************************************
 * Procedure:    RFO_process_msg_request
-* Purpose:      xxxx
-* Passed:       xxxx
+* Purpose:      Take the next message from the mailbox into a free slot of
+*               the window and send it.
+* Passed:       nothing
 *   
 * Returned:     nothing
-* Globals:      none
+* Globals:      RFO_Window, RFO_InFlight, RFO_Stats
 *
 * Date:         Author:             Comments:
 *   2014-11-13  Neal Shurmantine    initial revision
 *******************************************************************************/
 static void RFO_process_msg_request(void)
 {
-    RNC_CONFIG_REC_PTR p_cfg_rec = (RNC_CONFIG_REC_PTR)OS_MessageGet(RFO_ReqMsgMbox);
-
-    if (RFO_DestinationType == DESTINATION_NORDIC) {
-        //setup for retries
-        RFO_MsgRetryCounter = 0;
-        RFO_MsgRetryLimit = RFO_MAX_NORDIC_MSG_TRIES;
-        //set next state and wait time
-        RFO_State = RFO_SENDING_NORDIC_MSG_STATE;
-        RFO_WaitTime = RFO_WAIT_NORDIC_SER_RESPONSE;
+    RFO_REQUEST_PTR p_req;
+    RFO_SLOT * p_slot = NULL;
+    uint16_t idx;
+
+    //the mailbox event is only expected while a slot is free
+    for (idx = 0; idx < RFO_WINDOW_DEPTH; ++idx) {
+        if (RFO_Window[idx].state == RFO_IDLE_STATE) {
+            p_slot = &RFO_Window[idx];
+            break;
+        }
+    }
+    if (p_slot == NULL) {
+        rfo_update_wait();
+        return;
+    }
+    p_req = (RFO_REQUEST_PTR)OS_MessageGet(RFO_ReqMsgMbox);
+
+    ++RFO_Stats.occupancy[RFO_InFlight];
+    ++RFO_Stats.accepted;
+
+    p_slot->dest_type = p_req->dest_type;
+    memcpy(p_slot->ser_msg, p_req->ser_msg, MAX_SER_CONFIG_SIZE);
+    OS_ReleaseMsgMemBlock((void *)p_req);
+
+    p_slot->conf_type = RFO_ExpectedConfirmation(RNC_GetTransportByte(p_slot->ser_msg, 1));
+    if (p_slot->conf_type == MSG_TYPE_SEND_SHADE_DATA_CONF) {
+        p_slot->handle = RNC_GetTransportByte(p_slot->ser_msg, SHADE_DATA_REQUEST_HANDLE_INDEX);
     }
     else {
-        //setup for retries
-        RFO_MsgRetryCounter = 0;
-        RFO_MsgRetryLimit = RFO_MAX_RF_MSG_TRIES;
-        //set next state and wait time
-        RFO_State = RFO_SENDING_RF_MSG_STATE;
-        RFO_WaitTime = RFO_WAIT_RF_SER_RESPONSE;
+        p_slot->handle = RFO_NO_HANDLE;
     }
+    p_slot->order = RFO_Sequence++;
 
-    RFO_SerMsg = p_cfg_rec->ser_msg;
-    RFO_ExpectedEvents = RFO_SER_RESP_EVENT;
-    //Send message to UART
-    RFU_SendMsg(RFO_SerMsg[1]+3,(char*)RFO_SerMsg);
+    //setup for retries and set next state
+    p_slot->retry_counter = 0;
+    if (p_slot->dest_type == DESTINATION_NORDIC) {
+        p_slot->retry_limit = RFO_MAX_NORDIC_MSG_TRIES;
+        p_slot->state = RFO_SENDING_NORDIC_MSG_STATE;
+    }
+    else {
+        p_slot->retry_limit = RFO_MAX_RF_MSG_TRIES;
+        p_slot->state = RFO_SENDING_RF_MSG_STATE;
+    }
+
+    ++RFO_InFlight;
+    RFO_Stats.in_flight = RFO_InFlight;
+    if (RFO_InFlight > RFO_Stats.high_water) {
+        RFO_Stats.high_water = RFO_InFlight;
+    }
+    rfo_transmit(p_slot, OS_GetMsecTick());
+    rfo_update_wait();
 }
 
 /*******************************************************************************
 * Procedure:    RFO_process_ser_response
-* Purpose:      xxxx
-* Passed:       xxxx
+* Purpose:      Match a confirmation from the Nordic to the slot it answers
+*               and either free the slot or schedule a retry.
+* Passed:       nothing
 *   
 * Returned:     nothing
-* Globals:      none
+* Globals:      RFO_Window, RFO_Stats
+* Notes:        Shade data is matched by tx handle.  Other confirmations
+*               carry no handle and go to the oldest slot waiting for that
+*               confirmation type.  A slot waiting to retry is not waiting
+*               for a response, as before.
 *
 * Date:         Author:             Comments:
 *   2014-11-13  Neal Shurmantine    initial revision
 *******************************************************************************/
 static void RFO_process_ser_response(void)
 {
-    uint8_t *p_stat;
+    RFO_RESPONSE_PTR p_rsp;
+    RFO_SLOT * p_slot = NULL;
+    RFO_SLOT * p_cand;
+    uint32_t now;
+    uint32_t rtt;
+    uint16_t idx;
 
-    //Remove pointer to serial message response from NCO_NWCResponseMbox
-    p_stat = (uint8_t*)OS_MessageGet(RFO_ResponseMbox);
+    //Remove pointer to serial message response from RFO_ResponseMbox
+    p_rsp = (RFO_RESPONSE_PTR)OS_MessageGet(RFO_ResponseMbox);
 
-    if (RFO_State == RFO_SENDING_RF_MSG_STATE) {
-        if (*p_stat == SC_RSLT_SUCCESS)
-        {
-            //set events to wait on a timeout only, wait a
-            //minimum time before receiving a new message request
-            RFO_Reset();
+    for (idx = 0; idx < RFO_WINDOW_DEPTH; ++idx) {
+        p_cand = &RFO_Window[idx];
+        if (((p_cand->state == RFO_SENDING_RF_MSG_STATE)
+                    || (p_cand->state == RFO_SENDING_NORDIC_MSG_STATE))
+                && (p_cand->conf_type == p_rsp->conf_type)
+                && ((p_cand->handle == RFO_NO_HANDLE) || (p_cand->handle == p_rsp->handle))
+                && ((p_slot == NULL) || ((int32_t)(p_cand->order - p_slot->order) < 0))) {
+            p_slot = p_cand;
         }
-        else
-        {
-            //else this serial attempt failed, see if more retries available
-            RFO_MsgRetryCounter++;
-            if (RFO_MsgRetryCounter < RFO_MsgRetryLimit)
-            {
-                RFO_WaitTime = RFO_WAIT_RETRY_RF_OUTBOUND;
-                RFO_ExpectedEvents = 0;
-                RFO_State = RFO_RETRY_RF_MSG_STATE;
-            }
-            else
-            {
-                RFO_Reset();
-            }
+    }
+
+    if (p_slot == NULL) {
+        ++RFO_Stats.unmatched;
+    }
+    else if (p_rsp->status == SC_RSLT_SUCCESS)
+    {
+        now = OS_GetMsecTick();
+        rtt = now - p_slot->sent_tick;
+        ++RFO_Stats.acks;
+        RFO_Stats.rtt_total_msec += rtt;
+        if (rtt > RFO_Stats.rtt_max_msec) {
+            RFO_Stats.rtt_max_msec = rtt;
         }
+        rfo_release_slot(p_slot);
     }
-    else if (RFO_State == RFO_SENDING_NORDIC_MSG_STATE) {
-        if (*p_stat == SC_RSLT_SUCCESS)
+    else
+    {
+        //else this serial attempt failed, see if more retries available
+        ++RFO_Stats.naks;
+        p_slot->retry_counter++;
+        if (p_slot->retry_counter < p_slot->retry_limit)
         {
-            RFO_Reset();
+            now = OS_GetMsecTick();
+            if (p_slot->state == RFO_SENDING_NORDIC_MSG_STATE) {
+                p_slot->deadline = now + RFO_WAIT_RETRY_NORDIC_OUTBOUND;
+                p_slot->state = RFO_RETRY_NORDIC_MSG_STATE;
+            }
+            else {
+                p_slot->deadline = now + RFO_WAIT_RETRY_RF_OUTBOUND;
+                p_slot->state = RFO_RETRY_RF_MSG_STATE;
+            }
         }
         else
         {
-            //else this serial attempt failed, see if more retries available
-            RFO_MsgRetryCounter++;
-            if (RFO_MsgRetryCounter < RFO_MsgRetryLimit)
-            {
-                RFO_WaitTime = RFO_WAIT_RETRY_NORDIC_OUTBOUND;
-                RFO_ExpectedEvents = 0;
-                RFO_State = RFO_RETRY_NORDIC_MSG_STATE;
-            }
-            else
-            {
-                RFO_Reset();
-            }
+            rfo_release_slot(p_slot);
         }
     }
     // free memory used to hold the serial response
-    OS_ReleaseMsgMemBlock((void *)p_stat);
+    OS_ReleaseMsgMemBlock((void *)p_rsp);
+    rfo_update_wait();
 }
 
 /*******************************************************************************
 * Procedure:    RFO_process_timeout_event
-* Purpose:      xxxx
-* Passed:       xxxx
+* Purpose:      Act on every slot whose deadline has passed: resend after a
+*               retry wait, resend or give up after a response wait.
+* Passed:       nothing
 *   
 * Returned:     nothing
-* Globals:      none
+* Globals:      RFO_Window, RFO_Stats
 *
 * Date:         Author:             Comments:
 *   2014-11-13  Neal Shurmantine    initial revision
 *******************************************************************************/
 static void RFO_process_timeout_event(void)
 {
-    switch (RFO_State)
-    {
-        case RFO_SENDING_RF_MSG_STATE:
-        case RFO_SENDING_NORDIC_MSG_STATE:
-            RFO_MsgRetryCounter++;
-            if (RFO_MsgRetryCounter < RFO_MsgRetryLimit)
-            {
-                if (RFO_DestinationType == DESTINATION_NORDIC) {
+    RFO_SLOT * p_slot;
+    uint32_t now = OS_GetMsecTick();
+    uint16_t idx;
+
+    for (idx = 0; idx < RFO_WINDOW_DEPTH; ++idx) {
+        p_slot = &RFO_Window[idx];
+        if ((p_slot->state == RFO_IDLE_STATE)
+                || ((int32_t)(now - p_slot->deadline) < 0)) {
+            continue;
+        }
+        switch (p_slot->state)
+        {
+            case RFO_SENDING_RF_MSG_STATE:
+            case RFO_SENDING_NORDIC_MSG_STATE:
+                p_slot->retry_counter++;
+                if (p_slot->retry_counter < p_slot->retry_limit)
+                {
                     //last attempt to send an outbound message failed,retry
-                    RFO_WaitTime = RFO_WAIT_NORDIC_SER_RESPONSE;
+                    ++RFO_Stats.retries;
+                    rfo_transmit(p_slot, now);
+                }
+                else
+                {
+                    //no response was received to an rf outbound message, artificially
+                    // create a NAK with error code = timeout
+                    ++RFO_Stats.timeouts;
+                    RNC_NotifySerialTimeout(p_slot->dest_type, p_slot->conf_type,
+                            (uint8_t)p_slot->handle);
+
+                    //timeout has expired, no response received
+                    //free the slot for a new outbound message
+                    rfo_release_slot(p_slot);
+                }
+                break;
+            case RFO_RETRY_NORDIC_MSG_STATE:
+            case RFO_RETRY_RF_MSG_STATE:
+                //last attempt to send an outbound message failed,
+                // it is time to retry
+                if (p_slot->state == RFO_RETRY_NORDIC_MSG_STATE) {
+                    p_slot->state = RFO_SENDING_NORDIC_MSG_STATE;
                 }
                 else {
-                    //last attempt to send an outbound message failed,retry
-                    RFO_WaitTime = RFO_WAIT_RF_SER_RESPONSE;
+                    p_slot->state = RFO_SENDING_RF_MSG_STATE;
                 }
-                //send message to UART
-                RFU_SendMsg(RFO_SerMsg[1]+3,(char*)RFO_SerMsg);
-            }
-            else
-            {
-                //no response was received to an rf outbound message, artificially
-                // create a NAK with error code = timeout
-                //get enough memory to hold a serial NAK header
-                //memory must be obtained here because there was no response from NWC
-                // which would have obtained memory and DC_NotifySerialComplete
-                // may be called, which frees the response mem
-                RNC_NotifySerialTimeout(RFO_DestinationType);
-
-                //timeout has expired, no response received
-                //enable task to receive a new outbound message
-                RFO_Reset();
-            }
-            break;
-        case RFO_RETRY_NORDIC_MSG_STATE:
-        case RFO_RETRY_RF_MSG_STATE:
-            //last attempt to send an outbound message failed,
-            // it is time to retry
-            if (RFO_DestinationType == DESTINATION_NORDIC) {
-                RFO_State = RFO_SENDING_NORDIC_MSG_STATE;
-                RFO_WaitTime = RFO_WAIT_NORDIC_SER_RESPONSE;
-            }
-            else {
-                RFO_State = RFO_SENDING_RF_MSG_STATE;
-                RFO_WaitTime = RFO_WAIT_RF_SER_RESPONSE;
-            }
+                ++RFO_Stats.retries;
+                rfo_transmit(p_slot, now);
+                break;
+            default:
+                break;
+        }
+    }
+    rfo_update_wait();
+}
 
-            RFO_ExpectedEvents = RFO_SER_RESP_EVENT;
-            //send message to UART
-            RFU_SendMsg(RFO_SerMsg[1]+3,(char*)RFO_SerMsg);
-            break;
-        default:
-            break;
+/*******************************************************************************
+* Procedure:    rfo_transmit
+* Purpose:      Send a slot's message to the UART and start its response wait.
+* Passed:       the slot, the current OS_GetMsecTick
+*   
+* Returned:     nothing
+* Globals:      RFO_Stats
+*******************************************************************************/
+static void rfo_transmit(RFO_SLOT * p_slot, uint32_t now)
+{
+    if (p_slot->dest_type == DESTINATION_NORDIC) {
+        p_slot->deadline = now + RFO_WAIT_NORDIC_SER_RESPONSE;
+    }
+    else {
+        p_slot->deadline = now + RFO_WAIT_RF_SER_RESPONSE;
     }
+    p_slot->sent_tick = now;
+    ++RFO_Stats.transmissions;
+    //send message to UART
+    RFU_SendMsg(p_slot->ser_msg[1]+3,(char*)p_slot->ser_msg);
 }
 
+/*******************************************************************************
+* Procedure:    rfo_release_slot
+* Purpose:      Return a slot to the window.
+* Passed:       the slot
+*   
+* Returned:     nothing
+* Globals:      RFO_InFlight, RFO_Stats
+*******************************************************************************/
+static void rfo_release_slot(RFO_SLOT * p_slot)
+{
+    p_slot->state = RFO_IDLE_STATE;
+    --RFO_InFlight;
+    RFO_Stats.in_flight = RFO_InFlight;
+}
 
+/*******************************************************************************
+* Procedure:    rfo_update_wait
+* Purpose:      Set the events and wait time for the next wait: new messages
+*               only while a slot is free, a timeout at the earliest deadline.
+* Passed:       nothing
+*   
+* Returned:     nothing
+* Globals:      RFO_ExpectedEvents, RFO_WaitTime
+*******************************************************************************/
+static void rfo_update_wait(void)
+{
+    uint32_t now = OS_GetMsecTick();
+    int32_t remaining;
+    int32_t wait = 0;
+    bool outstanding = false;
+    uint16_t idx;
+
+    for (idx = 0; idx < RFO_WINDOW_DEPTH; ++idx) {
+        if (RFO_Window[idx].state != RFO_IDLE_STATE) {
+            remaining = (int32_t)(RFO_Window[idx].deadline - now);
+            if ((outstanding == false) || (remaining < wait)) {
+                wait = remaining;
+            }
+            outstanding = true;
+        }
+    }
+    if (outstanding == false) {
+        RFO_WaitTime = WAIT_TIME_INFINITE;
+    }
+    else {
+        //a wait of 0 would mean forever
+        RFO_WaitTime = (wait > 0) ? (uint32_t)wait : 1;
+    }
+
+    RFO_ExpectedEvents = RFO_SER_RESP_EVENT;
+    if (RFO_InFlight < RFO_WINDOW_DEPTH) {
+        RFO_ExpectedEvents |= RFO_MSG_RCVD_EVENT;
+    }
+}
@@ -17,8 +17,29 @@
 #ifndef RFO_OUTBOUND_H_
 #define RFO_OUTBOUND_H_
 
+typedef struct RFO_STATS_TAG
+{
+    uint32_t requests;          //messages passed to RFO_DeliverRequest
+    uint32_t accepted;          //taken into the window, requests - accepted are queued
+    uint32_t transmissions;     //sent to the Nordic, retries included
+    uint32_t retries;
+    uint32_t acks;
+    uint32_t naks;              //failure status, one per attempt
+    uint32_t timeouts;          //no response after the last attempt
+    uint32_t unmatched;         //responses that answered no outstanding message
+    uint32_t rtt_max_msec;      //last transmission to ack
+    uint32_t rtt_total_msec;    //summed over acks
+    uint16_t depth;
+    uint16_t in_flight;
+    uint16_t high_water;
+    uint32_t occupancy[RFO_WINDOW_DEPTH + 1];   //accepts by number already in flight
+} RFO_STATS;
+
 bool RFO_DeliverRequest(RNC_CONFIG_REC_PTR p_ser_msg);
-void RFO_NotifySerialResponse(uint8_t status);
+void RFO_NotifySerialResponse(uint8_t conf_type, uint8_t handle, uint8_t status);
+uint8_t RFO_ExpectedConfirmation(uint8_t req_type);
+void RFO_GetStats(RFO_STATS * p_stats);
+void RFO_ResetStats(void);
 void RFO_Reset(void);
 
 #endif
@@ -0,0 +1,282 @@
+/***************************************************************************//**
+ * @file rfp_pacing.c
+ * @brief Sets how long a shade message holds its place after the Nordic
+ *  confirms it, before the next message may take its place.
+ *
+ *  The hold gives the shade time to answer and keeps the hub from
+ *  crowding the channel.  It used to be a fixed number of 200 msec ticks;
+ *  here it follows the channel:
+ *
+ *  - the base gap shrinks a step for each confirmation while few messages
+ *    fail, doubles when the Nordic reports the channel busy and grows by
+ *    half on any other NAK or timeout;
+ *  - it never goes below twice the smoothed confirmation latency, since
+ *    a shade needs about as long to answer as the message took to go out;
+ *  - the share of air time taken by shade indications is added on top;
+ *  - the result is kept between a floor and a ceiling.
+ *
+ *  All updates come from the rnc task.  Other tasks only read the
+ *  counters.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include "rf_serial_api.h"
+#include "os.h"
+#include "rfp_pacing.h"
+
+/* Local Symbols
+*******************************************************************************/
+//base gap shortened by this much per confirmation
+#define RFP_GAP_STEP_MSEC           50
+//the gap only shortens while the smoothed failure share is below this
+#define RFP_FAIL_PERMILLE_LOW       50
+//gap floor as a multiple of the confirmation latency
+#define RFP_LATENCY_FACTOR          2
+//rough air time of one shade message, for the occupancy estimate
+#define RFP_FRAME_AIR_MSEC          20
+//period over which indications are counted
+#define RFP_OCCUPANCY_PERIOD_MSEC   1000
+//smoothing, each new sample has weight 1/2^RFP_EWMA_SHIFT
+#define RFP_EWMA_SHIFT              3
+
+/* Local variables
+*******************************************************************************/
+static uint32_t RFP_GapMinMsec = RFP_GAP_MIN_MSEC;
+static uint32_t RFP_GapMaxMsec = RFO_WAIT_NEXT_RF_OUTBOUND;
+/** Gap adjusted by confirmations and failures. */
+static uint32_t RFP_BaseGapMsec = RFP_GAP_START_MSEC;
+/** Smoothed latency in msec and failure share in permille, both x 2^RFP_EWMA_SHIFT. */
+static uint32_t RFP_LatencyScaled;
+static uint32_t RFP_FailScaled;
+/** Indications heard in the current occupancy period and when it began. */
+static uint32_t RFP_PeriodIndications;
+static uint32_t RFP_PeriodStart;
+/** Smoothed indications per period x 2^RFP_EWMA_SHIFT. */
+static uint32_t RFP_IndicationRateScaled;
+static RFP_STATS RFP_Stats = {
+    .gap_msec = RFP_GAP_START_MSEC,
+    .gap_min_msec = RFP_GAP_MIN_MSEC,
+    .gap_max_msec = RFO_WAIT_NEXT_RF_OUTBOUND,
+    .base_gap_msec = RFP_GAP_START_MSEC
+};
+
+/* Local Function Declarations
+*******************************************************************************/
+static void rfp_update_occupancy(uint32_t now);
+static uint32_t rfp_compute_gap(void);
+
+/*******************************************************************************
+* Procedure:    RFP_GetHoldMsec
+* Purpose:      Give the hold to apply to a message just confirmed.
+* Passed:       true if the message asked the shade for its battery level
+*
+* Returned:     msec to hold
+* Globals:      none
+*******************************************************************************/
+uint32_t RFP_GetHoldMsec(bool battery_request)
+{
+    uint32_t gap;
+
+    rfp_update_occupancy(OS_GetMsecTick());
+    gap = rfp_compute_gap();
+    if (battery_request == true) {
+        gap += RFP_BATTERY_EXTRA_MSEC;
+    }
+    return gap;
+}
+
+/*******************************************************************************
+* Procedure:    RFP_NoteConfirmation
+* Purpose:      Adapt the gap to the result of a shade message.
+* Passed:       status from the Nordic (SC_RSLT_TIMEOUT if there was none),
+*               msec from hand off to rfo_outbound until the result
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFP_NoteConfirmation(uint8_t status, uint32_t latency_msec)
+{
+    uint32_t floor_msec;
+    bool failed = (status != SC_RSLT_SUCCESS);
+
+    //timeouts say nothing about how long the channel takes
+    if (status != SC_RSLT_TIMEOUT) {
+        RFP_LatencyScaled += latency_msec - (RFP_LatencyScaled >> RFP_EWMA_SHIFT);
+        if (latency_msec > RFP_Stats.latency_max_msec) {
+            RFP_Stats.latency_max_msec = latency_msec;
+        }
+    }
+    RFP_FailScaled += (failed ? 1000 : 0) - (RFP_FailScaled >> RFP_EWMA_SHIFT);
+
+    if (failed == false) {
+        ++RFP_Stats.confirmations;
+        floor_msec = RFP_LATENCY_FACTOR * (RFP_LatencyScaled >> RFP_EWMA_SHIFT);
+        if (floor_msec < RFP_GapMinMsec) {
+            floor_msec = RFP_GapMinMsec;
+        }
+        if (((RFP_FailScaled >> RFP_EWMA_SHIFT) < RFP_FAIL_PERMILLE_LOW)
+                && (RFP_BaseGapMsec > floor_msec)) {
+            RFP_BaseGapMsec -= RFP_GAP_STEP_MSEC;
+            if (RFP_BaseGapMsec < floor_msec) {
+                RFP_BaseGapMsec = floor_msec;
+            }
+            ++RFP_Stats.decreases;
+        }
+    }
+    else {
+        ++RFP_Stats.failures;
+        if ((status == SC_RSLT_CHAN_ACCESS_FAIL) || (status == SC_RSLT_BUSY)) {
+            ++RFP_Stats.channel_busy;
+            RFP_BaseGapMsec *= 2;
+        }
+        else {
+            RFP_BaseGapMsec += RFP_BaseGapMsec / 2;
+        }
+        if (RFP_BaseGapMsec > RFP_GapMaxMsec) {
+            RFP_BaseGapMsec = RFP_GapMaxMsec;
+        }
+        ++RFP_Stats.increases;
+    }
+    rfp_compute_gap();
+}
+
+/*******************************************************************************
+* Procedure:    RFP_NoteIndication
+* Purpose:      Count a message heard from a shade toward channel occupancy.
+* Passed:       nothing
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFP_NoteIndication(void)
+{
+    rfp_update_occupancy(OS_GetMsecTick());
+    ++RFP_PeriodIndications;
+    ++RFP_Stats.indications;
+}
+
+/*******************************************************************************
+* Procedure:    RFP_SetLimits
+* Purpose:      Change the floor and ceiling of the gap.
+* Passed:       floor and ceiling in msec
+*
+* Returned:     false if the floor is above the ceiling
+* Globals:      none
+*******************************************************************************/
+bool RFP_SetLimits(uint32_t min_msec, uint32_t max_msec)
+{
+    if (min_msec > max_msec) {
+        return false;
+    }
+    RFP_GapMinMsec = min_msec;
+    RFP_GapMaxMsec = max_msec;
+    if (RFP_BaseGapMsec < min_msec) {
+        RFP_BaseGapMsec = min_msec;
+    }
+    if (RFP_BaseGapMsec > max_msec) {
+        RFP_BaseGapMsec = max_msec;
+    }
+    rfp_compute_gap();
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    RFP_GetStats
+* Purpose:      Copy out the pacing state and counters.
+* Passed:       where to put them
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFP_GetStats(RFP_STATS * p_stats)
+{
+    *p_stats = RFP_Stats;
+}
+
+/*******************************************************************************
+* Procedure:    RFP_ResetStats
+* Purpose:      Clear the counters; the pacing state is kept.
+* Passed:       nothing
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFP_ResetStats(void)
+{
+    RFP_Stats.latency_max_msec = 0;
+    RFP_Stats.confirmations = 0;
+    RFP_Stats.failures = 0;
+    RFP_Stats.channel_busy = 0;
+    RFP_Stats.indications = 0;
+    RFP_Stats.decreases = 0;
+    RFP_Stats.increases = 0;
+}
+
+/*******************************************************************************
+* Procedure:    rfp_update_occupancy
+* Purpose:      Close any occupancy periods that have ended, folding their
+*               indication counts into the smoothed rate.
+* Passed:       OS_GetMsecTick
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+static void rfp_update_occupancy(uint32_t now)
+{
+    uint32_t periods = (now - RFP_PeriodStart) / RFP_OCCUPANCY_PERIOD_MSEC;
+
+    if (periods == 0) {
+        return;
+    }
+    //the first period holds the count, any after it were quiet
+    RFP_IndicationRateScaled += RFP_PeriodIndications - (RFP_IndicationRateScaled >> RFP_EWMA_SHIFT);
+    RFP_PeriodIndications = 0;
+    while ((--periods > 0) && (RFP_IndicationRateScaled != 0)) {
+        RFP_IndicationRateScaled -= RFP_IndicationRateScaled >> RFP_EWMA_SHIFT;
+        if (RFP_IndicationRateScaled < (1 << RFP_EWMA_SHIFT)) {
+            RFP_IndicationRateScaled = 0;
+        }
+    }
+    RFP_PeriodStart = now - ((now - RFP_PeriodStart) % RFP_OCCUPANCY_PERIOD_MSEC);
+}
+
+/*******************************************************************************
+* Procedure:    rfp_compute_gap
+* Purpose:      Combine the base gap and channel occupancy into the gap.
+* Passed:       nothing
+*
+* Returned:     the gap in msec, also kept in the stats
+* Globals:      none
+*******************************************************************************/
+static uint32_t rfp_compute_gap(void)
+{
+    uint32_t busy;
+    uint32_t gap;
+
+    //indications per second times air time per indication is msec of
+    //  air per second, i.e. permille
+    busy = ((RFP_IndicationRateScaled * RFP_FRAME_AIR_MSEC) >> RFP_EWMA_SHIFT)
+            * 1000 / RFP_OCCUPANCY_PERIOD_MSEC;
+    if (busy > 1000) {
+        busy = 1000;
+    }
+    gap = RFP_BaseGapMsec + (RFP_BaseGapMsec * busy) / 1000;
+    if (gap < RFP_GapMinMsec) {
+        gap = RFP_GapMinMsec;
+    }
+    if (gap > RFP_GapMaxMsec) {
+        gap = RFP_GapMaxMsec;
+    }
+
+    RFP_Stats.gap_msec = gap;
+    RFP_Stats.gap_min_msec = RFP_GapMinMsec;
+    RFP_Stats.gap_max_msec = RFP_GapMaxMsec;
+    RFP_Stats.base_gap_msec = RFP_BaseGapMsec;
+    RFP_Stats.latency_msec = RFP_LatencyScaled >> RFP_EWMA_SHIFT;
+    RFP_Stats.fail_permille = RFP_FailScaled >> RFP_EWMA_SHIFT;
+    RFP_Stats.busy_permille = busy;
+    return gap;
+}
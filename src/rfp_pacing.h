@@ -0,0 +1,38 @@
+/***************************************************************************//**
+ * @file rfp_pacing.h
+ * @brief Include file for rfp_pacing.c
+ *
+ ******************************************************************************/
+#ifndef __RFP_PACING_H
+#define __RFP_PACING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct RFP_STATS_TAG
+{
+    uint32_t gap_msec;              //hold currently applied after a confirmation
+    uint32_t gap_min_msec;          //floor
+    uint32_t gap_max_msec;          //ceiling
+    uint32_t base_gap_msec;         //gap before the channel occupancy share
+    uint32_t latency_msec;          //smoothed time from hand off to confirmation
+    uint32_t latency_max_msec;
+    uint16_t fail_permille;         //smoothed share of NAKs and timeouts
+    uint16_t busy_permille;         //estimated share of air time used by shades
+    uint32_t confirmations;         //successful
+    uint32_t failures;              //NAK or timeout, channel busy included
+    uint32_t channel_busy;          //channel access failures and busy NAKs
+    uint32_t indications;           //shade messages heard
+    uint32_t decreases;             //gap shortened
+    uint32_t increases;             //gap lengthened
+} RFP_STATS;
+
+//public function prototypes:
+uint32_t RFP_GetHoldMsec(bool battery_request);
+void RFP_NoteConfirmation(uint8_t status, uint32_t latency_msec);
+void RFP_NoteIndication(void);
+bool RFP_SetLimits(uint32_t min_msec, uint32_t max_msec);
+void RFP_GetStats(RFP_STATS * p_stats);
+void RFP_ResetStats(void);
+
+#endif
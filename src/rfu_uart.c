@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "rf_serial_api.h"
 #include "util.h"
@@ -32,7 +33,7 @@
 #include "config.h"
 #include "os.h"
 #include "rfu_uart.h"
-#include "que.h"
+#include "ring.h"
 
 /* Local Constants and Definitions
 *******************************************************************************/
@@ -41,15 +42,18 @@
 //imx6 board: /dev/ttymxc1
 
 #define SERIAL_PORT_NAME  "/dev/ttymxc6"
+//set to use another device, e.g. the pty of tools/nordic_sim
+#define SERIAL_PORT_ENV   "HUB_NORDIC_PORT"
 #define RF_SERIAL_TX_EVENT_BIT     BIT0
-#define RECEIVE_SIZE              511
-#define NORMAL_RECEIVE_WAIT_TIME        20
-#define BOOTLOAD_RECEIVE_WAIT_TIME       5
+#define RF_SERIAL_RX_EVENT_BIT     BIT0
+#define RECEIVE_SIZE              512   //must be a power of two
 #define BAUDRATE B115200
 
 /* Local Function Declarations
 *******************************************************************************/
 static void tx_msg_to_uart(void);
+static uint32_t rx_store(uint8_t *p_chunk, uint32_t len);
+static void rx_wake_parser(uint32_t count);
 
 /* Local variables
 *******************************************************************************/
@@ -62,9 +66,15 @@ static uint16_t ActiveEventBit;
 
 static uint16_t TxMailbox;
 static int nordic_fp = 0;
-static uint8_t RxData[RECEIVE_SIZE+1];
-static S_QUEUE    RxQueue;
-static uint32_t URX_WaitTime;
+static uint8_t RxData[RECEIVE_SIZE];
+static BYTE_RING  RxRing;
+static pthread_mutex_t RxMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint16_t RxBatchBytes = RFU_RX_BATCH_BYTES;
+static uint16_t RxBatchIdleMsec = RFU_RX_BATCH_IDLE_MSEC;
+static bool RxBootloadActive = false;
+static bool RxFlushPending = false;
+static uint32_t RxFlushMark;
+static RFU_RX_STATS RxStats;
 
 static int set_interface_attribs(void)
 {
@@ -86,7 +96,10 @@ static int set_interface_attribs(void)
 static bool setup_serial_port(void)
 {
     bool rtn = false;
-    char *portname = SERIAL_PORT_NAME;
+    char *portname = getenv(SERIAL_PORT_ENV);
+    if ((portname == NULL) || (*portname == 0)) {
+        portname = SERIAL_PORT_NAME;
+    }
     nordic_fp = open(portname, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (nordic_fp != -1) {
         return set_interface_attribs();
@@ -175,37 +188,94 @@ printf("\n");
 *******************************************************************************/
 void *rx_task(void * param)
 {
+    void *event_handle;
+    uint16_t event_active;
+    uint32_t wait_time = WAIT_TIME_INFINITE;
+    uint32_t pending = 0;
     int numbytes;
-    bool process;
-    char ser_rx_buff[1];
-    QInit(RECEIVE_SIZE,&RxQueue, RxData);
-    URX_WaitTime = NORMAL_RECEIVE_WAIT_TIME;
+    uint8_t chunk[RFU_RX_CHUNK_SIZE];
+    RING_Init(&RxRing, RxData, RECEIVE_SIZE, RING_SINGLE_PRODUCER);
+
+    //block on the port itself rather than polling it on a timer
+    event_handle = OS_EventCreate(0,false);
+    if (OS_EventAttachFd(event_handle, nordic_fp, RF_SERIAL_RX_EVENT_BIT) == false) {
+        OS_Error(OS_ERR_SERIAL_PORT);
+    }
 
-uint16_t tick_count = 0;
 printf("rx_task\n");
     while(1)
     {    
-        OS_TaskSleep(URX_WaitTime);
-++tick_count;
-
-#ifdef USE_ME
-if ((tick_count % 100) == 1) printf(".");
-if ((tick_count % 500) == 1) printf("\n");
-#endif
-
-        process = false;
-        do {
-            numbytes = read(nordic_fp, ser_rx_buff, 1);
-            if (numbytes != 0) {
-printf("%02x ",(uint8_t)ser_rx_buff[0]);
-                process = true;
-                QInsert(ser_rx_buff[0], &RxQueue);
-            }
-        } while (numbytes != 0);
-        if (process == true) {
-            OS_EventSet(ActiveEventHandle,ActiveEventBit);
+        event_active = OS_TaskWaitEvents(event_handle, RF_SERIAL_RX_EVENT_BIT, wait_time);
+        if (event_active & RF_SERIAL_RX_EVENT_BIT) {
+            OS_EventClear(event_handle, RF_SERIAL_RX_EVENT_BIT);
+            //a short read means the driver had nothing more buffered
+            do {
+                numbytes = read(nordic_fp, chunk, sizeof(chunk));
+                if (numbytes > 0) {
+                    pending += rx_store(chunk, numbytes);
+                }
+            } while (numbytes == sizeof(chunk));
+        }
+
+        //hold the parser off until a batch has built up or the line goes quiet
+        if ((pending > 0)
+                && ((pending >= RxBatchBytes) || (RxBatchIdleMsec == 0)
+                    || RxBootloadActive || ((event_active & RF_SERIAL_RX_EVENT_BIT) == 0))) {
+            rx_wake_parser(pending);
+            pending = 0;
         }
+        wait_time = (pending > 0) ? RxBatchIdleMsec : WAIT_TIME_INFINITE;
+    }
+}
+
+/*******************************************************************************
+* Procedure:    rx_store
+* Purpose:      Copy a chunk read from the port into the receive ring.
+* Passed:       the bytes and how many there are
+*   
+* Returned:     number of bytes queued; the rest are dropped and counted
+*               as overflows
+* Globals:      RxRing, RxStats
+*******************************************************************************/
+static uint32_t rx_store(uint8_t *p_chunk, uint32_t len)
+{
+    uint32_t stored;
+
+    pthread_mutex_lock(&RxMutex);
+    stored = RING_Write(&RxRing, p_chunk, len);
+    pthread_mutex_unlock(&RxMutex);
+
+    RxStats.reads++;
+    RxStats.bytes += stored;
+    RxStats.overflows += len - stored;
+    return stored;
+}
+
+/*******************************************************************************
+* Procedure:    rx_wake_parser
+* Purpose:      Signal whichever task currently consumes the receive ring.
+* Passed:       number of bytes queued since the last wakeup
+*   
+* Returned:     nothing
+* Globals:      ActiveEventHandle, RxStats
+*******************************************************************************/
+static void rx_wake_parser(uint32_t count)
+{
+    uint16_t bucket = 0;
+
+    //the mode switch changes the target event under the same lock
+    pthread_mutex_lock(&RxMutex);
+    OS_EventSet(ActiveEventHandle,ActiveEventBit);
+    pthread_mutex_unlock(&RxMutex);
+
+    RxStats.wakeups++;
+    if (count > RxStats.max_per_wakeup) {
+        RxStats.max_per_wakeup = count;
+    }
+    while (((count >> bucket) > 1) && (bucket < (RFU_RX_HIST_BUCKETS - 1))) {
+        ++bucket;
     }
+    RxStats.per_wakeup_hist[bucket]++;
 }
 
 /*******************************************************************************
@@ -221,28 +291,24 @@ printf("%02x ",(uint8_t)ser_rx_buff[0]);
 *******************************************************************************/
 void RFU_SetBootloadActive(bool isBootloadActive)
 {
-    int numbytes;
-    char ser_rx_buff[1];
-
-//    OS_SchedLock();<<
+    //rx_task must not queue or signal halfway through the switch
+    pthread_mutex_lock(&RxMutex);
     OS_EventClear(ActiveEventHandle,ActiveEventBit);
-    QFlush(&RxQueue);
+    //only the reader may move the ring's head, so leave it a mark to
+    //flush up to on its next read
+    RxFlushMark = RING_Mark(&RxRing);
+    __atomic_store_n(&RxFlushPending, true, __ATOMIC_RELEASE);
+    RxBootloadActive = isBootloadActive;
     if (isBootloadActive == true) {
-        URX_WaitTime = BOOTLOAD_RECEIVE_WAIT_TIME;
         ActiveEventHandle = BootloadEventHandle;
         ActiveEventBit = BootloadEventBit;
     }
     else {
-        URX_WaitTime = NORMAL_RECEIVE_WAIT_TIME;
         ActiveEventHandle = InboundEventHandle;
         ActiveEventBit = InboundEventBit;
     }
-
-    do {
-        numbytes = read(nordic_fp, ser_rx_buff, 1);
-    } while (numbytes != 0);
-//    OS_SchedUnlock();<<
-
+    tcflush(nordic_fp, TCIFLUSH);
+    pthread_mutex_unlock(&RxMutex);
 }
 
 /*******************************************************************************
@@ -316,13 +382,67 @@ void RFU_SendMsg(unsigned char len, char *msg)
 *******************************************************************************/
 bool RFU_GetRxChar(unsigned char *rslt)
 {
-    if (QEmpty(&RxQueue) == false ) {
-        QRemove(rslt,&RxQueue);
-        if (QEmpty(&RxQueue) == true) {
+    if (__atomic_load_n(&RxFlushPending, __ATOMIC_ACQUIRE) == true) {
+        pthread_mutex_lock(&RxMutex);
+        RING_FlushTo(&RxRing, RxFlushMark);
+        RxFlushPending = false;
+        pthread_mutex_unlock(&RxMutex);
+    }
+    if (RING_Read(&RxRing, rslt, 1) == 1) {
+        if (RING_Count(&RxRing) == 0) {
             OS_EventClear(ActiveEventHandle,ActiveEventBit);
+            //rx_task may have queued more between the check and the clear
+            if (RING_Count(&RxRing) != 0) {
+                OS_EventSet(ActiveEventHandle,ActiveEventBit);
+            }
         }
         return true;
     }
     return false;
 }
 
+/*******************************************************************************
+* Procedure:    RFU_SetRxBatching
+* Purpose:      Set how many received bytes are collected before the parser
+*               is woken.
+* Passed:       batch size in bytes, 1 wakes on every read; msec of line
+*               idle time after which a partial batch is delivered anyway
+*   
+* Returned:     nothing
+* Globals:      none
+* Notes:        Batching is bypassed while the bootloader is active.
+*******************************************************************************/
+void RFU_SetRxBatching(uint16_t batch_bytes, uint16_t idle_msec)
+{
+    RxBatchBytes = (batch_bytes == 0) ? 1 : batch_bytes;
+    RxBatchIdleMsec = idle_msec;
+}
+
+/*******************************************************************************
+* Procedure:    RFU_GetRxStats
+* Purpose:      Copy out the receive counters.
+* Passed:       pointer to the structure to fill
+*   
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFU_GetRxStats(RFU_RX_STATS *p_stats)
+{
+    *p_stats = RxStats;
+    p_stats->batch_bytes = RxBatchBytes;
+    p_stats->batch_idle_msec = RxBatchIdleMsec;
+}
+
+/*******************************************************************************
+* Procedure:    RFU_ResetRxStats
+* Purpose:      Clear the receive counters.
+* Passed:       nothing
+*   
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RFU_ResetRxStats(void)
+{
+    memset(&RxStats, 0, sizeof(RxStats));
+}
+
@@ -17,10 +17,27 @@
 #ifndef RFU_UART_H_
 #define RFU_UART_H_
 
+#define RFU_RX_HIST_BUCKETS     8   //bytes per wakeup: 1, 2-3, 4-7 ... 128+
+
+typedef struct
+{
+    uint32_t reads;
+    uint32_t bytes;
+    uint32_t overflows;         //bytes dropped with the receive queue full
+    uint32_t wakeups;
+    uint32_t max_per_wakeup;
+    uint32_t per_wakeup_hist[RFU_RX_HIST_BUCKETS];
+    uint16_t batch_bytes;
+    uint16_t batch_idle_msec;
+} RFU_RX_STATS;
+
 void RFU_SendMsg(unsigned char len, char *msg);
 bool RFU_GetRxChar(unsigned char *rslt);
 void RFU_SetBootloadActive(bool isBootloadActive);
 void *RFU_Register_Inbound_Event(uint16_t event_group, uint16_t event_mask);
 void *RFU_Register_Bootload_Event(uint16_t event_group, uint16_t event_mask);
+void RFU_SetRxBatching(uint16_t batch_bytes, uint16_t idle_msec);
+void RFU_GetRxStats(RFU_RX_STATS *p_stats);
+void RFU_ResetRxStats(void);
 
 #endif
@@ -0,0 +1,330 @@
+/***************************************************************************//**
+ * @file ring.c
+ * @brief Provides a thread safe circular buffer of bytes.
+ *
+ *  A replacement for the S_QUEUE of que.c for buffers shared between
+ *  tasks.  Bytes are moved in blocks of any length instead of one per
+ *  call.
+ *
+ *  The caller supplies the storage, which must be a power of two in
+ *  size.  All of it is usable; head and tail are free running counts
+ *  so a full ring is told apart from an empty one without a spare cell.
+ *
+ *  One task reads.  Writers are either a single task, in which case no
+ *  lock is taken anywhere, or several tasks (RING_MULTI_PRODUCER), in
+ *  which case writers are serialized by a mutex while the reader stays
+ *  lock free.  Bytes that don't fit are dropped and counted.
+ *
+ *  An OS event can be attached with RING_SetEvent.  It is set when the
+ *  ring goes from empty to holding data and lets the reader block in
+ *  RING_ReadWait.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include "os.h"
+#include "ring.h"
+
+/* Local Function Declarations
+*******************************************************************************/
+static void ring_clear_event(BYTE_RING * p_ring);
+
+//counters have a single writer (writers are serialized) so a plain
+//load and store is enough; atomic only so readers see whole values
+#define RING_STAT_ADD(field, n) \
+    __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+/*******************************************************************************
+* Procedure:    RING_Init
+* Purpose:      Initialize the ring.
+* Passed:       pointer to the ring structure, the storage area, its size
+*               in bytes and whether more than one task will write
+*
+* Returned:     false if the size is not a power of two
+* Globals:      none
+*******************************************************************************/
+bool RING_Init(BYTE_RING * p_ring, uint8_t * p_data, uint32_t size, bool multi_producer)
+{
+    if ((size == 0) || ((size & (size - 1)) != 0)) {
+        return false;
+    }
+    memset(p_ring, 0, sizeof(BYTE_RING));
+    p_ring->mask = size - 1;
+    p_ring->p_data = p_data;
+    p_ring->multi_producer = multi_producer;
+    if (multi_producer == true) {
+        pthread_mutex_init(&p_ring->write_mutex, NULL);
+    }
+    return true;
+}
+
+/*******************************************************************************
+* Procedure:    RING_SetEvent
+* Purpose:      Attach an OS event that is set when data arrives.
+* Passed:       pointer to the ring structure, event handle and bit, or
+*               NULL to detach
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        Call before the ring is in use.
+*******************************************************************************/
+void RING_SetEvent(BYTE_RING * p_ring, void * event_handle, uint16_t event_bit)
+{
+    p_ring->event_handle = event_handle;
+    p_ring->event_bit = event_bit;
+}
+
+/*******************************************************************************
+* Procedure:    RING_Write
+* Purpose:      Add bytes at the tail of the ring.
+* Passed:       pointer to the ring structure, the bytes, how many
+*
+* Returned:     number of bytes added; the rest did not fit and were
+*               counted as dropped
+* Globals:      none
+*******************************************************************************/
+uint32_t RING_Write(BYTE_RING * p_ring, const uint8_t * p_src, uint32_t count)
+{
+    uint32_t size = p_ring->mask + 1;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+    uint32_t offset;
+    uint32_t run;
+    uint32_t high;
+
+    if (p_ring->multi_producer == true) {
+        pthread_mutex_lock(&p_ring->write_mutex);
+    }
+    tail = p_ring->tail;
+    head = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+    used = tail - head;
+    if (count > (size - used)) {
+        RING_STAT_ADD(p_ring->stats.dropped, count - (size - used));
+        count = size - used;
+    }
+    offset = tail & p_ring->mask;
+    run = size - offset;            //bytes before the wrap
+    if (run > count) {
+        run = count;
+    }
+    memcpy(&p_ring->p_data[offset], p_src, run);
+    memcpy(p_ring->p_data, p_src + run, count - run);
+    __atomic_store_n(&p_ring->tail, tail + count, __ATOMIC_RELEASE);
+
+    RING_STAT_ADD(p_ring->stats.written, count);
+    used += count;
+    high = __atomic_load_n(&p_ring->stats.high_water, __ATOMIC_RELAXED);
+    if (used > high) {
+        __atomic_store_n(&p_ring->stats.high_water, used, __ATOMIC_RELAXED);
+    }
+    if (p_ring->multi_producer == true) {
+        pthread_mutex_unlock(&p_ring->write_mutex);
+    }
+
+    //only the write that finds the ring drained needs to wake the reader;
+    //the fence pairs with the one in ring_clear_event
+    if ((count > 0) && (p_ring->event_handle != NULL)) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&p_ring->head, __ATOMIC_RELAXED) == tail) {
+            OS_EventSet(p_ring->event_handle, p_ring->event_bit);
+        }
+    }
+    return count;
+}
+
+/*******************************************************************************
+* Procedure:    RING_Read
+* Purpose:      Remove bytes from the head of the ring.
+* Passed:       pointer to the ring structure, where to put the bytes,
+*               the most to take
+*
+* Returned:     number of bytes removed, 0 if the ring is empty
+* Globals:      none
+*******************************************************************************/
+uint32_t RING_Read(BYTE_RING * p_ring, uint8_t * p_dest, uint32_t max)
+{
+    uint32_t size = p_ring->mask + 1;
+    uint32_t head = p_ring->head;
+    uint32_t tail = __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t count = tail - head;
+    uint32_t offset;
+    uint32_t run;
+
+    if (count > max) {
+        count = max;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    offset = head & p_ring->mask;
+    run = size - offset;
+    if (run > count) {
+        run = count;
+    }
+    memcpy(p_dest, &p_ring->p_data[offset], run);
+    memcpy(p_dest + run, p_ring->p_data, count - run);
+    __atomic_store_n(&p_ring->head, head + count, __ATOMIC_RELEASE);
+    RING_STAT_ADD(p_ring->stats.read, count);
+    return count;
+}
+
+/*******************************************************************************
+* Procedure:    RING_ReadWait
+* Purpose:      Remove bytes from the ring, waiting for some if it is empty.
+* Passed:       pointer to the ring structure, where to put the bytes,
+*               the most to take, msec to wait (WAIT_TIME_INFINITE to
+*               wait forever)
+*
+* Returned:     number of bytes removed, 0 on timeout
+* Globals:      none
+* Notes:        Needs an event from RING_SetEvent, without one this is
+*               the same as RING_Read.  The event must not be shared
+*               with anything else the reader waits for.
+*******************************************************************************/
+uint32_t RING_ReadWait(BYTE_RING * p_ring, uint8_t * p_dest, uint32_t max, uint32_t msec)
+{
+    uint32_t count;
+
+    while (1) {
+        count = RING_Read(p_ring, p_dest, max);
+        if ((count > 0) || (p_ring->event_handle == NULL)) {
+            break;
+        }
+        if ((OS_TaskWaitEvents(p_ring->event_handle, p_ring->event_bit, msec) & p_ring->event_bit) == 0) {
+            break;
+        }
+    }
+    ring_clear_event(p_ring);
+    return count;
+}
+
+/*******************************************************************************
+* Procedure:    ring_clear_event
+* Purpose:      Clear the ring's event once the reader has emptied it.
+* Passed:       pointer to the ring structure
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        A writer sets the event only when it sees the ring empty
+*               after publishing its bytes.  Both sides fence between
+*               their store and the load of the other side's index, so
+*               either the writer sees the reader's final head, or the
+*               re-check here sees the writer's tail; the event is never
+*               left clear with data in the ring.
+*******************************************************************************/
+static void ring_clear_event(BYTE_RING * p_ring)
+{
+    if ((p_ring->event_handle != NULL) && (RING_Count(p_ring) == 0)) {
+        OS_EventClear(p_ring->event_handle, p_ring->event_bit);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (RING_Count(p_ring) != 0) {
+            OS_EventSet(p_ring->event_handle, p_ring->event_bit);
+        }
+    }
+}
+
+/*******************************************************************************
+* Procedure:    RING_Count
+* Purpose:      Determine the number of bytes in the ring.
+* Passed:       pointer to the ring structure
+*
+* Returned:     number of bytes; exact for the reader, a snapshot for
+*               anyone else
+* Globals:      none
+*******************************************************************************/
+uint32_t RING_Count(BYTE_RING * p_ring)
+{
+    return __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE)
+            - __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+* Procedure:    RING_Space
+* Purpose:      Determine how many bytes could be added.
+* Passed:       pointer to the ring structure
+*
+* Returned:     free space in bytes
+* Globals:      none
+*******************************************************************************/
+uint32_t RING_Space(BYTE_RING * p_ring)
+{
+    return p_ring->mask + 1 - RING_Count(p_ring);
+}
+
+/*******************************************************************************
+* Procedure:    RING_Flush
+* Purpose:      Discard everything in the ring.
+* Passed:       pointer to the ring structure
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        This is a read, so it belongs to the reader.  Anyone
+*               else must first make sure the reader is not running.
+*******************************************************************************/
+void RING_Flush(BYTE_RING * p_ring)
+{
+    __atomic_store_n(&p_ring->head, __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+* Procedure:    RING_Mark
+* Purpose:      Note how far the ring has been written.
+* Passed:       pointer to the ring structure
+*
+* Returned:     mark to hand to RING_FlushTo
+* Globals:      none
+* Notes:        Lets another task ask for a flush that the reader then
+*               does itself, without losing what arrives in between.
+*******************************************************************************/
+uint32_t RING_Mark(BYTE_RING * p_ring)
+{
+    return __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+* Procedure:    RING_FlushTo
+* Purpose:      Discard everything written before a mark.
+* Passed:       pointer to the ring structure, mark from RING_Mark
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        Reader only, like RING_Flush.
+*******************************************************************************/
+void RING_FlushTo(BYTE_RING * p_ring, uint32_t mark)
+{
+    if ((int32_t)(mark - p_ring->head) > 0) {
+        __atomic_store_n(&p_ring->head, mark, __ATOMIC_RELEASE);
+    }
+}
+
+/*******************************************************************************
+* Procedure:    RING_GetStats
+* Purpose:      Copy out the ring's counters.
+* Passed:       pointer to the ring structure, where to put the counters
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RING_GetStats(BYTE_RING * p_ring, RING_STATS * p_stats)
+{
+    *p_stats = p_ring->stats;
+}
+
+/*******************************************************************************
+* Procedure:    RING_ResetStats
+* Purpose:      Clear the ring's counters.
+* Passed:       pointer to the ring structure
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void RING_ResetStats(BYTE_RING * p_ring)
+{
+    __atomic_store_n(&p_ring->stats.written, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_ring->stats.dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_ring->stats.read, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_ring->stats.high_water, RING_Count(p_ring), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,51 @@
+/***************************************************************************//**
+ * @file ring.h
+ * @brief Include file for ring.c
+ *
+ ******************************************************************************/
+#ifndef __RING_H
+#define __RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define RING_SINGLE_PRODUCER    false
+#define RING_MULTI_PRODUCER     true
+
+typedef struct RING_STATS_TAG
+{
+    uint32_t written;           //bytes accepted
+    uint32_t dropped;           //bytes refused because the ring was full
+    uint32_t read;              //bytes taken out
+    uint32_t high_water;        //most bytes ever held at once
+} RING_STATS;
+
+typedef struct BYTE_RING_TAG
+{
+    uint32_t head;              //free running read count, owned by the consumer
+    uint32_t tail;              //free running write count, owned by the producer(s)
+    uint32_t mask;              //size - 1
+    uint8_t * p_data;
+    bool multi_producer;
+    pthread_mutex_t write_mutex;    //serializes producers when multi_producer
+    void * event_handle;        //optional, set whenever the ring goes non-empty
+    uint16_t event_bit;
+    RING_STATS stats;
+} BYTE_RING;
+
+//public function prototypes:
+bool RING_Init(BYTE_RING * p_ring, uint8_t * p_data, uint32_t size, bool multi_producer);
+void RING_SetEvent(BYTE_RING * p_ring, void * event_handle, uint16_t event_bit);
+uint32_t RING_Write(BYTE_RING * p_ring, const uint8_t * p_src, uint32_t count);  //returns bytes written
+uint32_t RING_Read(BYTE_RING * p_ring, uint8_t * p_dest, uint32_t max);          //returns bytes read
+uint32_t RING_ReadWait(BYTE_RING * p_ring, uint8_t * p_dest, uint32_t max, uint32_t msec);
+uint32_t RING_Count(BYTE_RING * p_ring);
+uint32_t RING_Space(BYTE_RING * p_ring);
+void RING_Flush(BYTE_RING * p_ring);
+uint32_t RING_Mark(BYTE_RING * p_ring);
+void RING_FlushTo(BYTE_RING * p_ring, uint32_t mark);
+void RING_GetStats(BYTE_RING * p_ring, RING_STATS * p_stats);
+void RING_ResetStats(BYTE_RING * p_ring);
+
+#endif
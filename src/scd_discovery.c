@@ -0,0 +1,233 @@
+/***************************************************************************//**
+ * @file scd_discovery.c
+ * @brief Keeps the shades that answered a discovery beacon.
+ *
+ *  A discovery round can bring a response from every shade in the house,
+ *  most of them more than once.  Each response used to be checked against
+ *  a linked list of those already heard, so a round cost time in the
+ *  square of the number of shades.  Here they go in an open addressed
+ *  table keyed by the shade's unique id, with linear probing, and a
+ *  lookup costs about the same however many shades have answered.
+ *
+ *  Each entry keeps when the shade was first heard, its signal strength
+ *  and how often it repeated itself, and whether it has been processed.
+ *  A second array holds the slots in the order the shades were first
+ *  heard, so they are processed in that order as the linked list did.
+ *
+ *  Slots carry the round they were filled in; starting a new round only
+ *  bumps the round number instead of clearing the table.  Round 0 is
+ *  never used, so a zeroed registry needs no other initialization.
+ *
+ *  A registry belongs to one task.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include "os.h"
+#include "scd_discovery.h"
+
+/* Local Symbols
+*******************************************************************************/
+//Fibonacci hashing, 2^64 / golden ratio
+#define SCD_HASH_MULTIPLIER     0x9e3779b97f4a7c15ULL
+
+/* Local Function Declarations
+*******************************************************************************/
+static uint16_t scd_home_slot(uint64_t uuid);
+
+/*******************************************************************************
+* Procedure:    SCD_Reset
+* Purpose:      Forget every shade, ready for a new discovery round.
+* Passed:       pointer to the registry
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void SCD_Reset(SCD_REGISTRY * p_reg)
+{
+    uint16_t slot;
+
+    ++p_reg->round;
+    if (p_reg->round == 0) {
+        //the round number wrapped, old slots could look current
+        for (slot = 0; slot < SCD_TABLE_SIZE; ++slot) {
+            p_reg->table[slot].round = 0;
+        }
+        p_reg->round = 1;
+    }
+    p_reg->count = 0;
+    p_reg->next = 0;
+    p_reg->heard = 0;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_Record
+* Purpose:      Note a beacon response.
+* Passed:       pointer to the registry, the beacon indication, where to
+*               say whether the shade is new this round
+*
+* Returned:     the shade's entry, NULL if it is new and the registry is
+*               full.  A new entry is SCD_STATE_HEARD until passed to
+*               SCD_Ignore or handed out by SCD_NextHeard.
+* Globals:      none
+*******************************************************************************/
+SCD_ENTRY_PTR SCD_Record(SCD_REGISTRY * p_reg, BEACON_INDICATION_STRUCT_PTR p_beacon, bool * p_is_new)
+{
+    uint64_t uuid = p_beacon->source_adr.Unique_Id;
+    uint16_t slot = scd_home_slot(uuid);
+    uint32_t probes = 1;
+    SCD_ENTRY_PTR p_entry = &p_reg->table[slot];
+
+    ++p_reg->stats.responses;
+    *p_is_new = false;
+    if (p_reg->round == 0) {
+        SCD_Reset(p_reg);
+    }
+    //the table is never more than half full so an empty slot is always found
+    while (p_entry->round == p_reg->round) {
+        if (p_entry->shade_rsp.uuid == uuid) {
+            break;
+        }
+        slot = (slot + 1) & (SCD_TABLE_SIZE - 1);
+        p_entry = &p_reg->table[slot];
+        ++probes;
+    }
+    p_reg->stats.probes += probes;
+    if (probes > p_reg->stats.probe_max) {
+        p_reg->stats.probe_max = probes;
+    }
+
+    if (p_entry->round == p_reg->round) {
+        ++p_reg->stats.repeats;
+        if (p_entry->repeats != 0xff) {
+            ++p_entry->repeats;
+        }
+    }
+    else if (p_reg->count == ItsMaxShadeCount_) {
+        ++p_reg->stats.full;
+        return NULL;
+    }
+    else {
+        memset(p_entry, 0, sizeof(SCD_ENTRY));
+        p_entry->round = p_reg->round;
+        p_entry->shade_rsp.uuid = uuid;
+        p_entry->shade_rsp.device_id = p_beacon->source_device_id;
+        p_entry->shade_rsp.network_id = p_beacon->source_network_id;
+        p_entry->shade_rsp.shade_type = p_beacon->msg_payload[0];
+        p_entry->first_msec = OS_GetMsecTick();
+        p_entry->state = SCD_STATE_HEARD;
+        p_reg->order[p_reg->count++] = slot;
+        ++p_reg->heard;
+        *p_is_new = true;
+    }
+    p_entry->rssi = p_beacon->rssi;
+    return p_entry;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_Ignore
+* Purpose:      Keep a shade from being processed.  Its entry stays so its
+*               repeats are still recognized.
+* Passed:       pointer to the registry, the shade's entry
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void SCD_Ignore(SCD_REGISTRY * p_reg, SCD_ENTRY_PTR p_entry)
+{
+    if (p_entry->state == SCD_STATE_HEARD) {
+        --p_reg->heard;
+    }
+    p_entry->state = SCD_STATE_IGNORED;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_NextHeard
+* Purpose:      Take the next shade waiting to be processed.
+* Passed:       pointer to the registry
+*
+* Returned:     the entry, now SCD_STATE_PROCESSED, or NULL if none wait.
+*               Shades come out in the order first heard.
+* Globals:      none
+*******************************************************************************/
+SCD_ENTRY_PTR SCD_NextHeard(SCD_REGISTRY * p_reg)
+{
+    SCD_ENTRY_PTR p_entry;
+
+    while (p_reg->next < p_reg->count) {
+        p_entry = &p_reg->table[p_reg->order[p_reg->next++]];
+        if (p_entry->state == SCD_STATE_HEARD) {
+            p_entry->state = SCD_STATE_PROCESSED;
+            --p_reg->heard;
+            return p_entry;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_HeardCount
+* Purpose:      Determine how many shades wait to be processed.
+* Passed:       pointer to the registry
+*
+* Returned:     count of entries in SCD_STATE_HEARD
+* Globals:      none
+*******************************************************************************/
+uint16_t SCD_HeardCount(SCD_REGISTRY * p_reg)
+{
+    return p_reg->heard;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_Count
+* Purpose:      Determine how many shades answered this round.
+* Passed:       pointer to the registry
+*
+* Returned:     count of entries, whatever their state
+* Globals:      none
+*******************************************************************************/
+uint16_t SCD_Count(SCD_REGISTRY * p_reg)
+{
+    return p_reg->count;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_GetStats
+* Purpose:      Copy out the registry counters.
+* Passed:       pointer to the registry, where to put the counters
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void SCD_GetStats(SCD_REGISTRY * p_reg, SCD_STATS * p_stats)
+{
+    *p_stats = p_reg->stats;
+}
+
+/*******************************************************************************
+* Procedure:    SCD_ResetStats
+* Purpose:      Clear the registry counters.
+* Passed:       pointer to the registry
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void SCD_ResetStats(SCD_REGISTRY * p_reg)
+{
+    memset(&p_reg->stats, 0, sizeof(SCD_STATS));
+}
+
+/*******************************************************************************
+* Procedure:    scd_home_slot
+* Purpose:      Pick the slot a unique id hashes to.
+* Passed:       the unique id
+*
+* Returned:     slot index
+* Globals:      none
+*******************************************************************************/
+static uint16_t scd_home_slot(uint64_t uuid)
+{
+    return (uint16_t)((uuid * SCD_HASH_MULTIPLIER) >> (64 - SCD_TABLE_BITS));
+}
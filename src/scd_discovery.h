@@ -0,0 +1,64 @@
+/***************************************************************************//**
+ * @file scd_discovery.h
+ * @brief Include file for scd_discovery.c
+ *
+ ******************************************************************************/
+#ifndef __SCD_DISCOVERY_H
+#define __SCD_DISCOVERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rf_serial_api.h"
+
+//twice the most shades a hub handles, so probes stay short
+#define SCD_TABLE_BITS      9
+#define SCD_TABLE_SIZE      (1 << SCD_TABLE_BITS)
+
+typedef enum {
+    SCD_STATE_EMPTY,            //slot free in this round
+    SCD_STATE_HEARD,            //waiting for SCD_NextHeard
+    SCD_STATE_IGNORED,          //set by SCD_Ignore, kept only to spot repeats
+    SCD_STATE_PROCESSED         //handed out by SCD_NextHeard
+} SCD_STATE_T;
+
+typedef struct SCD_ENTRY_TAG
+{
+    DISCOVERY_DATA_STRUCT shade_rsp;
+    uint32_t first_msec;        //OS_GetMsecTick when first heard
+    uint16_t round;             //generation the slot belongs to
+    uint8_t rssi;               //from the last response
+    uint8_t repeats;            //responses after the first, saturates
+    uint8_t state;              //SCD_STATE_T
+} SCD_ENTRY, *SCD_ENTRY_PTR;
+
+typedef struct SCD_STATS_TAG
+{
+    uint32_t responses;         //beacon responses offered
+    uint32_t repeats;           //of shades already in the registry
+    uint32_t full;              //refused because ItsMaxShadeCount_ were held
+    uint32_t probes;            //slots examined, over all lookups
+    uint32_t probe_max;         //most slots examined by one lookup
+} SCD_STATS;
+
+typedef struct SCD_REGISTRY_TAG
+{
+    uint16_t round;             //current generation, slots of older ones are free
+    uint16_t count;             //entries this round
+    uint16_t next;              //position in order[] of SCD_NextHeard
+    uint16_t heard;             //entries in SCD_STATE_HEARD
+    uint16_t order[ItsMaxShadeCount_];  //slots in the order first heard
+    SCD_ENTRY table[SCD_TABLE_SIZE];
+    SCD_STATS stats;
+} SCD_REGISTRY;
+
+//public function prototypes:
+void SCD_Reset(SCD_REGISTRY * p_reg);
+SCD_ENTRY_PTR SCD_Record(SCD_REGISTRY * p_reg, BEACON_INDICATION_STRUCT_PTR p_beacon, bool * p_is_new);
+void SCD_Ignore(SCD_REGISTRY * p_reg, SCD_ENTRY_PTR p_entry);
+SCD_ENTRY_PTR SCD_NextHeard(SCD_REGISTRY * p_reg);
+uint16_t SCD_HeardCount(SCD_REGISTRY * p_reg);
+uint16_t SCD_Count(SCD_REGISTRY * p_reg);
+void SCD_GetStats(SCD_REGISTRY * p_reg, SCD_STATS * p_stats);
+void SCD_ResetStats(SCD_REGISTRY * p_reg);
+
+#endif
@@ -37,6 +37,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <shell.h>
 
 #include "sh_io.h"
@@ -48,6 +55,20 @@
 #include "stub.h"
 #include "ipc_client_cmd_to_db.h"
 #include "os.h"
+#include "rfu_uart.h"
+#include "que.h"
+#include "ring.h"
+#include "rfo_outbound.h"
+#include "rfp_pacing.h"
+#include "rfd_dedup.h"
+#include "scd_discovery.h"
+#include "bsw_battery_sweep.h"
+#include "ipc_client_report.h"
+#include "sst_shade_state.h"
+#include "eph_ephemeris.h"
+#include "ipc_server.h"
+#include "ipc_frame.h"
+#include "JSONReader.h"
 
 #define SHELL_MAX_ARGS       4
 
@@ -406,5 +427,1202 @@ int32_t Shell_get_shade_position(int32_t argc, char * argv[] )
     return return_code;
 }
 
+int32_t Shell_mem(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint16_t pool;
+    OS_MEM_POOL_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        switch (argc) {
+            case 1:
+                printf(" Block  Blocks   InUse    High      Allocs   Fallback\n");
+                for (pool = 0; pool < OS_GetMemPoolCount(); ++pool) {
+                    OS_GetMemPoolStats(pool, &stats);
+                    if (stats.block_size == 0) {
+                        printf("  heap");
+                    }
+                    else {
+                        printf("%6u", stats.block_size);
+                    }
+                    printf("  %6u  %6u  %6u  %10u  %8u\n", stats.num_blocks, stats.in_use,
+                            stats.high_water, stats.alloc_count, stats.heap_fallbacks);
+                }
+                break;
+            default:
+                printf("Error, %s invoked with incorrect number of arguments\n", argv[0]);
+                return_code = SHELL_EXIT_ERROR;
+                print_usage = TRUE;
+                break;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s No Parameters\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s No Parameters\n", argv[0]);
+        }
+    }
+    return return_code;
+}
+
+
+int32_t Shell_os_stats(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint16_t idx;
+    uint16_t bucket;
+    OS_TASK_STATS task;
+    OS_EVENT_STATS event;
+    OS_MBOX_STATS mbox;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        switch (argc) {
+            case 1:
+                printf("Task                   RunMsec   Wakeups  MaxLatUs  Latency histogram (log2 usec)\n");
+                for (idx = 0; OS_GetTaskStats(idx, &task) == true; ++idx) {
+                    printf("%-20s  %8llu  %8u  %8u ", task.name,
+                            (unsigned long long)(task.run_usec / 1000), task.wakeups, task.max_latency_usec);
+                    for (bucket = 0; bucket < OS_STATS_HIST_BUCKETS; ++bucket) {
+                        printf(" %u", task.latency_hist[bucket]);
+                    }
+                    printf("\n");
+                }
+                printf("\nEvent  Owner                 Pending      Sets     Waits  Timeouts\n");
+                for (idx = 0; OS_GetEventStats(idx, &event) == true; ++idx) {
+                    printf("%5u  %-20s  0x%04x  %8u  %8u  %8u\n", idx, event.owner,
+                            event.pending, event.sets, event.waits, event.timeouts);
+                }
+                printf("\nMbox  Owner                  Bit  Depth   High      Sent  MaxDwellUs  AvgDwellUs\n");
+                for (idx = 0; idx < MAX_MAILBOXES; ++idx) {
+                    if (OS_GetMboxStats(idx, &mbox) == true) {
+                        printf("%4u  %-20s  %4x  %5u  %5u  %8u  %10u  %10llu\n", idx, mbox.owner,
+                                mbox.event_bit, mbox.depth, mbox.high_water, mbox.sent, mbox.max_dwell_usec,
+                                (mbox.received == 0) ? 0ULL : (unsigned long long)(mbox.total_dwell_usec / mbox.received));
+                    }
+                }
+                break;
+            case 2:
+                if (strcmp(argv[1], "reset") == 0) {
+                    OS_ResetStats();
+                    break;
+                }
+                /* fall through */
+            default:
+                printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+                return_code = SHELL_EXIT_ERROR;
+                print_usage = TRUE;
+                break;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset]\n", argv[0]);
+            printf("   Task, event and mailbox statistics; reset starts a new period\n");
+        }
+    }
+    return return_code;
+}
+
+
+int32_t Shell_uart(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint16_t bucket;
+    RFU_RX_STATS stats;
+    RFI_STATS frames;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            RFU_GetRxStats(&stats);
+            printf("Batch %u bytes / %u msec idle\n", stats.batch_bytes, stats.batch_idle_msec);
+            printf("Reads %u  Bytes %u  Overflows %u  Wakeups %u  Max/wakeup %u\n", stats.reads,
+                    stats.bytes, stats.overflows, stats.wakeups, stats.max_per_wakeup);
+            printf("Bytes per wakeup (1, 2-3, 4-7 ...):");
+            for (bucket = 0; bucket < RFU_RX_HIST_BUCKETS; ++bucket) {
+                printf(" %u", stats.per_wakeup_hist[bucket]);
+            }
+            printf("\n");
+            RFI_GetStats(&frames);
+            printf("Frames %u  Unknown %u  Checksum errors %u  Timeout resyncs %u  Header resyncs %u  Slots exhausted %u\n",
+                    frames.frames, frames.unknown_frames, frames.checksum_failures,
+                    frames.timeout_resyncs, frames.header_resyncs, frames.ring_exhausted);
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            RFU_ResetRxStats();
+            RFI_ResetStats();
+        }
+        else if ((argc == 4) && (strcmp(argv[1], "batch") == 0)) {
+            RFU_SetRxBatching(atoi(argv[2]), atoi(argv[3]));
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset | batch <bytes> <msec>]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset | batch <bytes> <msec>]\n", argv[0]);
+            printf("   Nordic receive and frame counters; batch sets bytes collected before\n");
+            printf("   waking the parser and the idle time that flushes a partial batch\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_rfo(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint16_t idx;
+    RFO_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            RFO_GetStats(&stats);
+            printf("Window %u  In flight %u  High water %u  Queued %u\n", stats.depth,
+                    stats.in_flight, stats.high_water, stats.requests - stats.accepted);
+            printf("Requests %u  Sent %u  Retries %u  Acks %u  Naks %u  Timeouts %u  Unmatched %u\n",
+                    stats.requests, stats.transmissions, stats.retries, stats.acks,
+                    stats.naks, stats.timeouts, stats.unmatched);
+            printf("Ack msec avg %u  max %u  Replaced moves %u\n",
+                    (stats.acks != 0) ? stats.rtt_total_msec / stats.acks : 0,
+                    stats.rtt_max_msec, SC_GetCoalescedCount());
+            printf("Sends finding 0, 1 ... in flight:");
+            for (idx = 0; idx <= RFO_WINDOW_DEPTH; ++idx) {
+                printf(" %u", stats.occupancy[idx]);
+            }
+            printf("\n");
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            RFO_ResetStats();
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset]\n", argv[0]);
+            printf("   Outbound window occupancy, retry and timeout counters\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_rfp(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    RFP_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            RFP_GetStats(&stats);
+            printf("Gap %u msec (base %u, limits %u-%u)\n", stats.gap_msec,
+                    stats.base_gap_msec, stats.gap_min_msec, stats.gap_max_msec);
+            printf("Latency %u msec (max %u)  Failures %u.%u%%  Channel busy %u.%u%%\n",
+                    stats.latency_msec, stats.latency_max_msec,
+                    stats.fail_permille / 10, stats.fail_permille % 10,
+                    stats.busy_permille / 10, stats.busy_permille % 10);
+            printf("Confirmations %u  Failures %u  Channel busy NAKs %u  Indications %u  Shorter %u  Longer %u\n",
+                    stats.confirmations, stats.failures, stats.channel_busy,
+                    stats.indications, stats.decreases, stats.increases);
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            RFP_ResetStats();
+        }
+        else if ((argc == 4) && (strcmp(argv[1], "limits") == 0)) {
+            if (RFP_SetLimits(atoi(argv[2]), atoi(argv[3])) == false) {
+                printf("Error, floor is above ceiling\n");
+                return_code = SHELL_EXIT_ERROR;
+            }
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset | limits <min> <max>]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset | limits <min> <max>]\n", argv[0]);
+            printf("   RF pacing: the hold after each shade message and what it is based on;\n");
+            printf("   limits sets the floor and ceiling of the hold in msec\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_bsw(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    BSW_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            BSW_GetStats(&stats);
+            printf("Battery sweep %s%s  Window %u  Shades %u  Done %u  Asking %u\n",
+                    (stats.active == true) ? "running" : "idle",
+                    (stats.resumed == true) ? " (resumed)" : "",
+                    stats.window, stats.shades, stats.done, stats.in_flight);
+            printf("Requests %u  Readings %u  Early stops %u  No level %u  Deferred ticks %u\n",
+                    stats.requests, stats.readings, stats.early_stops,
+                    stats.no_level, stats.deferred_ticks);
+        }
+        else if ((argc == 3) && (strcmp(argv[1], "window") == 0)) {
+            if (BSW_SetWindow(atoi(argv[2])) == false) {
+                printf("Error, window must be 1 to %u\n", BSW_WINDOW_MAX);
+                return_code = SHELL_EXIT_ERROR;
+            }
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [window <shades>]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [window <shades>]\n", argv[0]);
+            printf("   Battery sweep progress; window sets how many shades are asked at once\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_rfd(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    RFD_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            RFD_GetStats(&stats);
+            printf("Window %u msec  Repeats dropped %u  Passed %u  Evictions %u  Flushes %u\n",
+                    RFD_WINDOW_MSEC, stats.hits, stats.misses, stats.evictions, stats.flushes);
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            RFD_ResetStats();
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset]\n", argv[0]);
+            printf("   Shade indication filter: repeats dropped and indications passed on\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_sst(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    SST_STATS stats;
+    SST_SHADE shade;
+    uint8_t n;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            SST_GetStats(&stats);
+            printf("Shades %u  Version %u  Changes %u  Unchanged %u  Full %u  Reads %u\n",
+                    stats.shades, SST_Version(), stats.updates, stats.unchanged,
+                    stats.full, stats.reads);
+        }
+        else if (argc == 2) {
+            if (SST_Get((uint16_t)strtoul(argv[1], NULL, 16), &shade) == false) {
+                printf("Nothing known of %s\n", argv[1]);
+            }
+            else {
+                printf("ID = %04x  Version %u\n", shade.shade_id, shade.version);
+                if (shade.pos_msec != 0) {
+                    for (n = 0; n < shade.positions.posCount; ++n) {
+                        printf("  Kind = %d Value = %d\n", shade.positions.posKind[n], shade.positions.position[n]);
+                    }
+                    printf("  Positions %u sec old\n", SST_AgeSeconds(shade.pos_msec));
+                }
+                if (shade.batt_msec != 0) {
+                    printf("  Voltage %u, %u sec old\n", shade.batt_voltage, SST_AgeSeconds(shade.batt_msec));
+                }
+                if (shade.nordic_fw_msec != 0) {
+                    printf("  Nordic FW %02X %02X %02X %02X\n", shade.nordic_fw[0], shade.nordic_fw[1],
+                            shade.nordic_fw[2], shade.nordic_fw[3]);
+                }
+                if (shade.motor_fw_msec != 0) {
+                    printf("  Motor FW  %02X %02X %02X %02X\n", shade.motor_fw[0], shade.motor_fw[1],
+                            shade.motor_fw[2], shade.motor_fw[3]);
+                }
+            }
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [<shade id>]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [<shade id>]\n", argv[0]);
+            printf("   Shade state table, or what it holds for one shade (id in hex)\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_dbq(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    IPC_REPORT_STATS stats;
+    IPC_CLIENT_STATS link;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            IPC_Report_GetStats(&stats);
+            printf("Waiting %u of %u  High water %u  Backed up %u\n",
+                    stats.waiting, IPC_REPORT_QUEUE_DEPTH, stats.high_water, stats.backed_up);
+            printf("Queued %u  Replaced %u  Dropped %u  Too long %u\n",
+                    stats.queued, stats.coalesced, stats.dropped, stats.too_long);
+            printf("Sent %u in %u messages  Refused %u  Unanswered messages %u  Put back %u  %s\n",
+                    stats.sent, stats.messages, stats.rejected, stats.failures, stats.retried,
+                    stats.batched ? "Batched" : "One per message");
+            getConnectionStats(DATABASE_CLIENT_PATH, &link);
+            printf("Connection: %s  Connects %u  Failed %u  Held off %u\n",
+                    link.persistent ? "kept open" : "one per request",
+                    link.connects, link.connect_failures, link.held_off);
+            printf("Requests %u  Answered %u  Failed %u  Resent %u  Timed out %u  In flight %u  High water %u\n",
+                    link.requests, link.answered, link.failed, link.resent, link.timeouts,
+                    link.in_flight, link.in_flight_high_water);
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            IPC_Report_ResetStats();
+            resetConnectionStats(DATABASE_CLIENT_PATH);
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset]\n", argv[0]);
+            printf("   Reports to the databases: queued, replaced by newer ones and sent,\n");
+            printf("   and the connection they go over\n");
+        }
+    }
+    return return_code;
+}
+
+int32_t Shell_ipcs(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    IPC_SERVER_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc == 1) {
+            IPC_Server_GetStats(&stats);
+            printf("Connections %u of %u  High water %u  Accepted %u  Full %u  Idle closed %u\n",
+                    stats.active, IPC_SERVER_MAX_CLIENTS, stats.active_high_water,
+                    stats.accepted, stats.full, stats.idle_closed);
+            printf("Requests %u  Pipelined %u  Too large %u  Queue high water %u of %u workers\n",
+                    stats.requests, stats.pipelined, stats.oversize,
+                    stats.queue_high_water, IPC_SERVER_WORKERS);
+            printf("Bytes in %u  out %u  Slow readers %u\n",
+                    stats.bytes_in, stats.bytes_out, stats.throttled);
+            printf("Latency average %llu usec  max %u usec\n",
+                    (stats.requests == 0) ? 0ULL :
+                        (unsigned long long)(stats.latency_total_usec / stats.requests),
+                    stats.latency_max_usec);
+        }
+        else if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+            IPC_Server_ResetStats();
+        }
+        else {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [reset]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [reset]\n", argv[0]);
+            printf("   Requests from other processes: connections, throughput and latency\n");
+        }
+    }
+    return return_code;
+}
+
+#define RING_BENCH_SIZE         512
+#define RING_BENCH_CHUNK        64
+#define RING_BENCH_DEFAULT_KB   1024
+
+static BYTE_RING BenchRing;
+static uint8_t BenchRingData[RING_BENCH_SIZE];
+static uint32_t BenchRingBytes;
+
+static uint64_t ring_bench_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void ring_bench_report(char * p_name, uint32_t bytes, uint32_t calls, uint64_t usec)
+{
+    if (usec == 0) {
+        usec = 1;
+    }
+    printf("%-28s %8llu KB/s  %6llu ns/call\n", p_name,
+            (unsigned long long)bytes * 1000000 / 1024 / usec,
+            (unsigned long long)usec * 1000 / calls);
+}
+
+static void *ring_bench_producer(void * param)
+{
+    uint8_t chunk[RING_BENCH_CHUNK];
+    uint32_t sent = 0;
+    memset(chunk, 0x55, sizeof(chunk));
+    while (sent < BenchRingBytes) {
+        uint32_t n = RING_Write(&BenchRing, chunk, sizeof(chunk));
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return NULL;
+}
+
+int32_t Shell_ring_bench(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint32_t bytes = RING_BENCH_DEFAULT_KB * 1024;
+    uint32_t done;
+    uint32_t calls;
+    uint32_t idx;
+    uint64_t start;
+    uint8_t chunk[RING_BENCH_CHUNK];
+    uint8_t c = 0;
+    S_QUEUE queue;
+    pthread_t producer;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if ((argc == 2) && (atoi(argv[1]) > 0)) {
+            bytes = atoi(argv[1]) * 1024;
+        }
+        else if (argc != 1) {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (!print_usage) {
+        //fill a chunk and drain it again, one byte per call
+        QInit(RING_BENCH_SIZE - 1, &queue, BenchRingData);
+        start = ring_bench_usec();
+        for (done = 0; done < bytes; done += RING_BENCH_CHUNK) {
+            for (idx = 0; idx < RING_BENCH_CHUNK; ++idx) {
+                QInsert(c, &queue);
+            }
+            for (idx = 0; idx < RING_BENCH_CHUNK; ++idx) {
+                QRemove(&c, &queue);
+            }
+        }
+        ring_bench_report("QInsert/QRemove", done, done * 2, ring_bench_usec() - start);
+
+        RING_Init(&BenchRing, BenchRingData, RING_BENCH_SIZE, RING_SINGLE_PRODUCER);
+        start = ring_bench_usec();
+        for (done = 0; done < bytes; done += RING_BENCH_CHUNK) {
+            for (idx = 0; idx < RING_BENCH_CHUNK; ++idx) {
+                RING_Write(&BenchRing, &c, 1);
+            }
+            for (idx = 0; idx < RING_BENCH_CHUNK; ++idx) {
+                RING_Read(&BenchRing, &c, 1);
+            }
+        }
+        ring_bench_report("RING_Write/RING_Read x1", done, done * 2, ring_bench_usec() - start);
+
+        start = ring_bench_usec();
+        for (done = 0; done < bytes; done += RING_BENCH_CHUNK) {
+            RING_Write(&BenchRing, chunk, RING_BENCH_CHUNK);
+            RING_Read(&BenchRing, chunk, RING_BENCH_CHUNK);
+        }
+        ring_bench_report("RING_Write/RING_Read x64", done, (done / RING_BENCH_CHUNK) * 2, ring_bench_usec() - start);
+
+        //a second task writes while this one reads
+        BenchRingBytes = bytes;
+        RING_Init(&BenchRing, BenchRingData, RING_BENCH_SIZE, RING_SINGLE_PRODUCER);
+        calls = 0;
+        start = ring_bench_usec();
+        pthread_create(&producer, NULL, ring_bench_producer, NULL);
+        for (done = 0; done < bytes; ) {
+            uint32_t n = RING_Read(&BenchRing, chunk, RING_BENCH_CHUNK);
+            if (n == 0) {
+                sched_yield();
+            }
+            else {
+                done += n;
+                ++calls;
+            }
+        }
+        pthread_join(producer, NULL);
+        ring_bench_report("RING two tasks x64 (reads)", done, calls, ring_bench_usec() - start);
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [kbytes]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [kbytes]\n", argv[0]);
+            printf("   Compare S_QUEUE and BYTE_RING throughput, default %u KB\n", RING_BENCH_DEFAULT_KB);
+        }
+    }
+    return return_code;
+}
+
+#define DISC_BENCH_REPEATS          4       //answers per shade per storm
+#define DISC_BENCH_DEFAULT_ROUNDS   20
+
+typedef struct DISC_BENCH_NODE_TAG
+{
+    DISCOVERY_DATA_STRUCT shade_rsp;
+    struct DISC_BENCH_NODE_TAG * p_next_rec;
+} DISC_BENCH_NODE;
+
+static SCD_REGISTRY BenchRegistry;
+
+static void disc_bench_report(char * p_name, uint32_t answers, uint32_t rounds, uint32_t kept, uint64_t usec)
+{
+    printf("%-12s %8llu ns/answer  %6llu usec/storm  %u shades kept per storm\n", p_name,
+            (unsigned long long)usec * 1000 / answers,
+            (unsigned long long)usec / rounds, kept / rounds);
+}
+
+//one storm: every shade answers DISC_BENCH_REPEATS times, in an order that
+//mixes them up the way overlapping retries do
+static uint64_t disc_bench_uuid(uint32_t n, uint32_t round)
+{
+    uint32_t shade = (n * 97 + round) % ItsMaxShadeCount_;
+    return 0x0013a20040000000ULL + shade * 0x1f3ULL;
+}
+
+int32_t Shell_disc_bench(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint32_t rounds = DISC_BENCH_DEFAULT_ROUNDS;
+    uint32_t responses = ItsMaxShadeCount_ * DISC_BENCH_REPEATS;
+    uint32_t round;
+    uint32_t n;
+    uint32_t kept;
+    uint64_t uuid;
+    uint64_t start;
+    bool is_new;
+    uint8_t beacon_data[BEACON_INDICATION_HEADER_SIZE + 1];
+    BEACON_INDICATION_STRUCT_PTR p_beacon = (BEACON_INDICATION_STRUCT_PTR)beacon_data;
+    DISC_BENCH_NODE * p_head;
+    DISC_BENCH_NODE * p_tail;
+    DISC_BENCH_NODE * p_node;
+    SCD_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if ((argc == 2) && (atoi(argv[1]) > 0)) {
+            rounds = atoi(argv[1]);
+        }
+        else if (argc != 1) {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (!print_usage) {
+        memset(beacon_data, 0, sizeof(beacon_data));
+
+        //the linked list walked for every answer, as discovery used to do
+        kept = 0;
+        start = ring_bench_usec();
+        for (round = 0; round < rounds; ++round) {
+            p_head = NULL;
+            p_tail = NULL;
+            for (n = 0; n < responses; ++n) {
+                uuid = disc_bench_uuid(n, round);
+                for (p_node = p_head; p_node != NULL; p_node = p_node->p_next_rec) {
+                    if (p_node->shade_rsp.uuid == uuid) {
+                        break;
+                    }
+                }
+                if (p_node == NULL) {
+                    p_node = (DISC_BENCH_NODE *)malloc(sizeof(DISC_BENCH_NODE));
+                    p_node->shade_rsp.uuid = uuid;
+                    p_node->p_next_rec = NULL;
+                    if (p_head == NULL) {
+                        p_head = p_node;
+                    }
+                    else {
+                        p_tail->p_next_rec = p_node;
+                    }
+                    p_tail = p_node;
+                }
+            }
+            while (p_head != NULL) {
+                p_node = p_head;
+                p_head = p_head->p_next_rec;
+                free(p_node);
+                ++kept;
+            }
+        }
+        disc_bench_report("linked list", rounds * responses, rounds, kept, ring_bench_usec() - start);
+
+        kept = 0;
+        memset(&BenchRegistry, 0, sizeof(BenchRegistry));
+        start = ring_bench_usec();
+        for (round = 0; round < rounds; ++round) {
+            SCD_Reset(&BenchRegistry);
+            for (n = 0; n < responses; ++n) {
+                p_beacon->source_adr.Unique_Id = disc_bench_uuid(n, round);
+                p_beacon->source_device_id = (uint16_t)n;
+                SCD_Record(&BenchRegistry, p_beacon, &is_new);
+            }
+            while (SCD_NextHeard(&BenchRegistry) != NULL) {
+                ++kept;
+            }
+        }
+        disc_bench_report("SCD registry", rounds * responses, rounds, kept, ring_bench_usec() - start);
+        SCD_GetStats(&BenchRegistry, &stats);
+        printf("%-12s %u.%02u slots probed per answer, at most %u\n", "",
+                stats.probes / stats.responses,
+                (stats.probes % stats.responses) * 100 / stats.responses, stats.probe_max);
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [rounds]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [rounds]\n", argv[0]);
+            printf("   Replay discovery storms of %u shades answering %u times each\n",
+                    ItsMaxShadeCount_, DISC_BENCH_REPEATS);
+            printf("   through a linked list and the SCD registry, default %u rounds\n",
+                    DISC_BENCH_DEFAULT_ROUNDS);
+        }
+    }
+    return return_code;
+}
+
+#define EPH_BENCH_DEFAULT_LOOKUPS   100000
+
+extern int32_t currentTimeOffset;
+extern float latitude;
+extern float longitude;
+extern uint16_t sunriseTimeInMinutes, sunsetTimeInMinutes;
+
+//local time_t (as OS_GetTimeLocal gives) for noon on a day of the year
+static time_t eph_bench_day(int16_t year, uint16_t yday)
+{
+    struct tm date;
+    memset(&date, 0, sizeof(date));
+    date.tm_year = year - 1900;
+    date.tm_mday = 1 + yday;
+    date.tm_hour = 12;
+    return timegm(&date);
+}
+
+//a zone with daylight saving, for checking the table across the changes
+#define EPH_BENCH_DST_ZONE          "MST7MDT,M3.2.0,M11.1.0"
+
+//UTC time and offset of 00:00:10 local on a day of the year in the
+//current TZ, when the scheduler's midnight refresh runs
+static time_t eph_bench_refresh(int16_t year, uint16_t yday, int32_t * p_offset)
+{
+    struct tm date;
+    time_t t;
+    memset(&date, 0, sizeof(date));
+    date.tm_year = year - 1900;
+    date.tm_mday = 1 + yday;
+    date.tm_sec = 10;
+    date.tm_isdst = -1;
+    t = mktime(&date);
+    *p_offset = date.tm_gmtoff;
+    return t;
+}
+
+//minutes after local midnight, in the current TZ, of an event given in
+//minutes from UTC midnight of a day of the year
+static uint16_t eph_bench_zone_minutes(int16_t year, uint16_t yday, int16_t utc_minutes)
+{
+    struct tm date;
+    time_t t = eph_bench_day(year, yday) - 12 * 3600 + utc_minutes * 60;
+    localtime_r(&t, &date);
+    return date.tm_hour * 60 + date.tm_min;
+}
+
+//minutes between two times of day, either way round midnight
+static int eph_bench_diff(uint16_t a, uint16_t b)
+{
+    int diff = abs((int)a - (int)b) % 1440;
+    return (diff > 720) ? 1440 - diff : diff;
+}
+
+static void eph_bench_print(char * p_name, uint16_t sunrise, uint16_t sunset)
+{
+    printf("%-12s sunrise %02d:%02d  sunset %02d:%02d\n", p_name,
+            sunrise / 60, sunrise % 60, sunset / 60, sunset % 60);
+}
+
+static EPH_TABLE EphBenchTable;
+
+int32_t Shell_eph(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint32_t lookups = EPH_BENCH_DEFAULT_LOOKUPS;
+    uint32_t n;
+    uint64_t start;
+    time_t now;
+    struct tm date;
+    int16_t year;
+    uint16_t yday;
+    uint16_t sunrise;
+    uint16_t sunset;
+    uint16_t expected_rise;
+    uint16_t expected_set;
+    int32_t offset;
+    int32_t offset_next;
+    char zone[64];
+    bool had_zone;
+    time_t refresh;
+    int lat;
+    int err;
+    int max_err;
+    uint16_t no_event;
+    EPH_DAY day;
+    EPH_STATS stats;
+
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if ((argc == 3) && (strcmp(argv[1], "bench") == 0) && (atoi(argv[2]) > 0)) {
+            lookups = atoi(argv[2]);
+        }
+        else if ((argc > 2) || ((argc == 2) && (strcmp(argv[1], "bench") != 0) && (strcmp(argv[1], "check") != 0))) {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (!print_usage) {
+        OS_GetTimeLocal(&now);
+        gmtime_r(&now, &date);
+        year = date.tm_year + 1900;
+    }
+    if (!print_usage && (argc == 1)) {
+        printf("Latitude %1.3f  Longitude %1.3f  UTC offset %d sec\n", latitude, longitude, currentTimeOffset);
+        if (EPH_GetSunMinutes(now, currentTimeOffset, &sunrise, &sunset) == true) {
+            eph_bench_print("Table", sunrise, sunset);
+        }
+        else {
+            printf("Table        no sunrise or sunset today, or no location\n");
+        }
+        eph_bench_print("Time server", sunriseTimeInMinutes, sunsetTimeInMinutes);
+        EPH_GetStats(&stats);
+        printf("Builds %u (last %u usec)  Lookups %u  Misses %u\n",
+                stats.builds, stats.build_usec, stats.lookups, stats.misses);
+    }
+    else if (!print_usage && (strcmp(argv[1], "bench") == 0)) {
+        start = ring_bench_usec();
+        EPH_BuildTable(&EphBenchTable, year, latitude, longitude);
+        printf("%-24s %8llu usec\n", "Build one year", (unsigned long long)(ring_bench_usec() - start));
+
+        start = ring_bench_usec();
+        for (n = 0; n < lookups; ++n) {
+            EPH_ComputeDay(year, n % 365, latitude, longitude, false, &day);
+        }
+        printf("%-24s %8llu ns/day\n", "Computed each time",
+                (unsigned long long)(ring_bench_usec() - start) * 1000 / lookups);
+
+        //days of this year only, so the table is built once, beforehand
+        EPH_GetSunMinutes(now, currentTimeOffset, &sunrise, &sunset);
+        now = eph_bench_day(year, 0);
+        start = ring_bench_usec();
+        for (n = 0; n < lookups; ++n) {
+            EPH_GetSunMinutes(now + (time_t)(n % 365) * DAY_IN_SEC, currentTimeOffset, &sunrise, &sunset);
+        }
+        printf("%-24s %8llu ns/day\n", "Table lookup",
+                (unsigned long long)(ring_bench_usec() - start) * 1000 / lookups);
+    }
+    else if (!print_usage) {
+        //table (sun's position at noon UTC) against the position worked
+        //out again at each sunrise and sunset
+        printf("Lat  max err (min)  days without both\n");
+        for (lat = -65; lat <= 65; lat += 10) {
+            EPH_BuildTable(&EphBenchTable, year, (float)lat, longitude);
+            max_err = 0;
+            no_event = 0;
+            for (yday = 0; yday < EphBenchTable.days; ++yday) {
+                EPH_ComputeDay(year, yday, (float)lat, longitude, true, &day);
+                if ((day.sunrise == EPH_NO_EVENT) || (day.sunset == EPH_NO_EVENT)
+                        || (EphBenchTable.day[yday].sunrise == EPH_NO_EVENT)
+                        || (EphBenchTable.day[yday].sunset == EPH_NO_EVENT)) {
+                    ++no_event;
+                    continue;
+                }
+                err = abs(day.sunrise - EphBenchTable.day[yday].sunrise);
+                if (err > max_err) max_err = err;
+                err = abs(day.sunset - EphBenchTable.day[yday].sunset);
+                if (err > max_err) max_err = err;
+            }
+            printf("%4d %8d %12u\n", lat, max_err, no_event);
+        }
+
+        //around the daylight saving changes of EPH_BENCH_DST_ZONE: what
+        //the scheduler sets at its midnight refresh, with the offset then
+        //in effect, against the zone's own local time of each event
+        had_zone = (getenv("TZ") != NULL);
+        if (had_zone) {
+            snprintf(zone, sizeof(zone), "%s", getenv("TZ"));
+        }
+        setenv("TZ", EPH_BENCH_DST_ZONE, 1);
+        tzset();
+        printf("%s at latitude %1.3f longitude %1.3f\n", EPH_BENCH_DST_ZONE, latitude, longitude);
+        printf("Day  Offset  Scheduled       Local time      Err (min)\n");
+        max_err = 0;
+        eph_bench_refresh(year, 0, &offset_next);
+        for (yday = 0; yday + 1 < EphBenchTable.days; ++yday) {
+            offset = offset_next;
+            eph_bench_refresh(year, yday + 1, &offset_next);
+            if (offset == offset_next) {
+                continue;
+            }
+            //the clocks change on yday
+            for (n = yday - 1; n <= yday + 1U; ++n) {
+                refresh = eph_bench_refresh(year, n, &offset);
+                EPH_ComputeDay(year, n, latitude, longitude, true, &day);
+                if ((EPH_GetSunMinutes(refresh + offset, offset, &sunrise, &sunset) == false)
+                        || (day.sunrise == EPH_NO_EVENT) || (day.sunset == EPH_NO_EVENT)) {
+                    printf("%3u  no sunrise or sunset, or no location\n", n);
+                    continue;
+                }
+                expected_rise = eph_bench_zone_minutes(year, n, day.sunrise);
+                expected_set = eph_bench_zone_minutes(year, n, day.sunset);
+                err = eph_bench_diff(sunrise, expected_rise);
+                if (eph_bench_diff(sunset, expected_set) > err) {
+                    err = eph_bench_diff(sunset, expected_set);
+                }
+                if (err > max_err) max_err = err;
+                printf("%3u %+6d  %02d:%02d-%02d:%02d     %02d:%02d-%02d:%02d     %d\n", n, offset / 60,
+                        sunrise / 60, sunrise % 60, sunset / 60, sunset % 60,
+                        expected_rise / 60, expected_rise % 60, expected_set / 60, expected_set % 60, err);
+            }
+        }
+        if (had_zone) {
+            setenv("TZ", zone, 1);
+        }
+        else {
+            unsetenv("TZ");
+        }
+        tzset();
+        printf("Daylight saving changes, max err %d min\n", max_err);
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [bench [lookups] | check]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [bench [lookups] | check]\n", argv[0]);
+            printf("   Today's sunrise and sunset from the table and the time server,\n");
+            printf("   time lookups against computing each day (default %u),\n", EPH_BENCH_DEFAULT_LOOKUPS);
+            printf("   or check the table's accuracy across latitudes and DST changes\n");
+        }
+    }
+    return return_code;
+}
+
+#define IPC_STRESS_PATH             "/tmp/app.stress"
+#define IPC_STRESS_DEFAULT_SENDERS  16
+#define IPC_STRESS_DEFAULT_REQUESTS 500
+#define IPC_STRESS_MAX_SENDERS      64
+#define IPC_STRESS_REQUEST          "{\"type\":\"databases\",\"data\":{\"action\":\"stress\",\"seq\":%u}}"
+#define IPC_STRESS_RESPONSE         "{\"request_id\":%u,\"type\":\"databases\",\"data\":{\"action\":\"stress\",\"seq\":%u}}\f"
+
+static int IpcStressListenFd = -1;
+static volatile bool IpcStressStop;
+static uint32_t IpcStressConnections;
+static uint32_t IpcStressRequests;
+static uint32_t IpcStressWrong;
+static uint32_t IpcStressFailed;
+
+//stands in for the databases on one connection: answers each request
+//with its request_id and seq
+static void *ipc_stress_db_connection(void * param)
+{
+    int fd = (int)(intptr_t)param;
+    char in[4096];
+    uint32_t len = 0;
+    IPC_FRAME frame;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    IPC_FrameReset(&frame);
+    while (IpcStressStop == false) {
+        ssize_t got;
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        got = read(fd, in + len, sizeof(in) - 1 - len);
+        if (got <= 0) {
+            break;
+        }
+        len += got;
+        while (1) {
+            char resp[160];
+            char save;
+            uint32_t space;
+            uint32_t skip;
+            uint32_t end;
+            uint32_t id = 0;
+            uint32_t seq = 0;
+
+            if (frame.scan == 0) {
+                space = IPC_FrameSkipSpace(in, len);
+                memmove(in, in + space, len - space);
+                len -= space;
+            }
+            end = IPC_FrameEnd(&frame, in, len, &skip);
+            if (end == 0) {
+                break;
+            }
+            save = in[end];
+            in[end] = '\0';
+            findJSONuint32(in, "request_id", &id);
+            findJSONuint32(in, "data\\seq", &seq);
+            in[end] = save;
+            snprintf(resp, sizeof(resp), IPC_STRESS_RESPONSE, id, seq);
+            if (write(fd, resp, strlen(resp)) < 0) {
+                break;
+            }
+            len -= end + skip;
+            memmove(in, in + end + skip, len);
+        }
+        if (len == sizeof(in) - 1) {
+            break;
+        }
+    }
+    close(fd);
+    __atomic_sub_fetch(&IpcStressConnections, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *ipc_stress_db(void * param)
+{
+    pthread_t connection;
+    int fd;
+
+    while ((fd = accept(IpcStressListenFd, NULL, NULL)) != -1) {
+        __atomic_add_fetch(&IpcStressConnections, 1, __ATOMIC_RELAXED);
+        pthread_create(&connection, NULL, ipc_stress_db_connection, (void *)(intptr_t)fd);
+        pthread_detach(connection);
+    }
+    return NULL;
+}
+
+//one sender: its own context, checks every answer is its own
+static void *ipc_stress_sender(void * param)
+{
+    uint32_t base = (uint32_t)(uintptr_t)param * 1000000;
+    uint32_t count = IpcStressRequests;
+    IPC_CLIENT_CONTEXT * p_ctx = IPC_Client_Begin(IPC_STRESS_PATH);
+    IPC_RECEIVE_MSG_PTR p_msg;
+    uint32_t seq;
+    uint32_t idx;
+
+    p_ctx->print = false;
+    for (idx = 0; idx < count; ++idx) {
+        IPC_Client_Format(p_ctx, IPC_STRESS_REQUEST, base + idx);
+        p_msg = IPC_Client_Send(p_ctx);
+        if (p_msg == NULL) {
+            __atomic_add_fetch(&IpcStressFailed, 1, __ATOMIC_RELAXED);
+        }
+        else if ((findJSONuint32(p_msg->p_buff, "data\\seq", &seq) == false) || (seq != base + idx)) {
+            __atomic_add_fetch(&IpcStressWrong, 1, __ATOMIC_RELAXED);
+        }
+    }
+    IPC_Client_End(p_ctx);
+    return NULL;
+}
+
+int32_t Shell_ipc_stress(int32_t argc, char * argv[] )
+{
+    bool print_usage;
+    bool shorthelp = FALSE;
+    int32_t return_code = SHELL_EXIT_SUCCESS;
+    uint32_t senders = IPC_STRESS_DEFAULT_SENDERS;
+    pthread_t threads[IPC_STRESS_MAX_SENDERS];
+    pthread_t db;
+    struct sockaddr_un addr;
+    IPC_CLIENT_STATS link;
+    uint64_t usec;
+    uint32_t idx;
+
+    IpcStressRequests = IPC_STRESS_DEFAULT_REQUESTS;
+    print_usage = Shell_check_help_request(argc, argv, &shorthelp );
+
+    if (!print_usage) {
+        if (argc >= 2) {
+            senders = atoi(argv[1]);
+        }
+        if (argc >= 3) {
+            IpcStressRequests = atoi(argv[2]);
+        }
+        if ((argc > 3) || (senders == 0) || (senders > IPC_STRESS_MAX_SENDERS) || (IpcStressRequests == 0)) {
+            printf("Error, %s invoked with incorrect arguments\n", argv[0]);
+            return_code = SHELL_EXIT_ERROR;
+            print_usage = TRUE;
+        }
+    }
+    if (!print_usage) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, IPC_STRESS_PATH, sizeof(addr.sun_path) - 1);
+        unlink(IPC_STRESS_PATH);
+        IpcStressListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((IpcStressListenFd == -1) ||
+            (bind(IpcStressListenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+            (listen(IpcStressListenFd, IPC_STRESS_MAX_SENDERS) == -1)) {
+            printf("Error, can't listen on %s\n", IPC_STRESS_PATH);
+            if (IpcStressListenFd != -1) {
+                close(IpcStressListenFd);
+            }
+            return SHELL_EXIT_ERROR;
+        }
+        IpcStressStop = false;
+        IpcStressWrong = 0;
+        IpcStressFailed = 0;
+        resetConnectionStats(IPC_STRESS_PATH);
+        pthread_create(&db, NULL, ipc_stress_db, NULL);
+
+        usec = ring_bench_usec();
+        for (idx = 0; idx < senders; ++idx) {
+            pthread_create(&threads[idx], NULL, ipc_stress_sender, (void *)(uintptr_t)idx);
+        }
+        for (idx = 0; idx < senders; ++idx) {
+            pthread_join(threads[idx], NULL);
+        }
+        usec = ring_bench_usec() - usec;
+
+        IpcStressStop = true;
+        shutdown(IpcStressListenFd, SHUT_RDWR);
+        pthread_join(db, NULL);
+        while (__atomic_load_n(&IpcStressConnections, __ATOMIC_ACQUIRE) != 0) {
+            OS_TaskSleep(10);
+        }
+        close(IpcStressListenFd);
+        unlink(IPC_STRESS_PATH);
+
+        getConnectionStats(IPC_STRESS_PATH, &link);
+        if (usec == 0) {
+            usec = 1;
+        }
+        printf("%u senders x %u requests in %llu ms, %llu requests/s\n",
+                senders, IpcStressRequests, (unsigned long long)(usec / 1000),
+                (unsigned long long)senders * IpcStressRequests * 1000000 / usec);
+        printf("Wrong answers %u  Failed %u  Resent %u  Connects %u  In flight high water %u\n",
+                IpcStressWrong, IpcStressFailed, link.resent, link.connects, link.in_flight_high_water);
+        if ((IpcStressWrong != 0) || (IpcStressFailed != 0)) {
+            return_code = SHELL_EXIT_ERROR;
+        }
+    }
+    if (print_usage) {
+        if (shorthelp) {
+            printf("%s [senders [requests]]\n", argv[0]);
+        }
+        else {
+            printf("Usage: %s [senders [requests]]\n", argv[0]);
+            printf("   Many tasks at once send requests to a stand-in databases process\n");
+            printf("   on %s and check each gets its own answer\n", IPC_STRESS_PATH);
+            printf("   senders  = tasks sending, at most %u (default %u)\n", IPC_STRESS_MAX_SENDERS, IPC_STRESS_DEFAULT_SENDERS);
+            printf("   requests = each one sends (default %u)\n", IPC_STRESS_DEFAULT_REQUESTS);
+        }
+    }
+    return return_code;
+}
 
 /* EOF */
@@ -46,6 +46,20 @@ int32_t Shell_set_nid(int32_t argc, char * argv[] );
 int32_t Shell_position_single_shade(int32_t argc, char * argv[] );
 int32_t Shell_jog(int32_t argc, char * argv[] );
 int32_t Shell_get_shade_position(int32_t argc, char * argv[] );
+int32_t Shell_mem(int32_t argc, char * argv[] );
+int32_t Shell_os_stats(int32_t argc, char * argv[] );
+int32_t Shell_uart(int32_t argc, char * argv[] );
+int32_t Shell_ring_bench(int32_t argc, char * argv[] );
+int32_t Shell_disc_bench(int32_t argc, char * argv[] );
+int32_t Shell_rfo(int32_t argc, char * argv[] );
+int32_t Shell_rfp(int32_t argc, char * argv[] );
+int32_t Shell_rfd(int32_t argc, char * argv[] );
+int32_t Shell_bsw(int32_t argc, char * argv[] );
+int32_t Shell_dbq(int32_t argc, char * argv[] );
+int32_t Shell_sst(int32_t argc, char * argv[] );
+int32_t Shell_eph(int32_t argc, char * argv[] );
+int32_t Shell_ipcs(int32_t argc, char * argv[] );
+int32_t Shell_ipc_stress(int32_t argc, char * argv[] );
 
 #endif
 
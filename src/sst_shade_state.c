@@ -0,0 +1,398 @@
+/***************************************************************************//**
+ * @file sst_shade_state.c
+ * @brief Keeps the last known state of every shade.
+ *
+ *  Positions, battery levels and firmware revisions reported by the
+ *  shades used to be passed to the databases and forgotten, so a user
+ *  interface wanting a shade's state had to ask the databases, or the
+ *  shade itself over the radio.  Here the rnc task records each
+ *  indication as it arrives and the ipc server answers reads from the
+ *  table.
+ *
+ *  Shades are kept in an open addressed table keyed by device id, with
+ *  linear probing, holding at most ItsMaxShadeCount_.  Each field carries
+ *  the OS_GetMsecTick it was last heard at so a reader can tell how fresh
+ *  it is.
+ *
+ *  A version counter goes up whenever a field changes, and the shade is
+ *  stamped with the new value, so a reader that remembers the version of
+ *  its last snapshot can ask only for what changed since.  Removing a
+ *  shade also bumps the counter and is remembered in SST_RemovedVersion;
+ *  a reader whose snapshot is older than that must start over.
+ *
+ *  The table is shared between tasks under SST_Mutex.
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#include <string.h>
+#include <pthread.h>
+#include "os.h"
+#include "sst_shade_state.h"
+
+/* Local Symbols
+*******************************************************************************/
+//Fibonacci hashing, 2^32 / golden ratio
+#define SST_HASH_MULTIPLIER     0x9e3779b9UL
+
+/* Local Function Declarations
+*******************************************************************************/
+static uint16_t sst_home_slot(uint16_t shade_id);
+static SST_SHADE_PTR sst_find(uint16_t shade_id, bool create);
+static uint32_t sst_now(void);
+static void sst_changed(SST_SHADE_PTR p_shade, bool changed);
+
+/* Local variables
+*******************************************************************************/
+static pthread_mutex_t SST_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static SST_SHADE SST_Table[SST_TABLE_SIZE];
+static uint32_t SST_VersionCount;
+static uint32_t SST_RemovedAt;
+static SST_STATS SST_Stats;
+
+/*******************************************************************************
+* Procedure:    SST_UpdatePositions
+* Purpose:      Record the positions a shade reported.
+* Passed:       device id, its positions
+*
+* Returned:     nothing
+* Globals:      SST_Table
+*******************************************************************************/
+void SST_UpdatePositions(uint16_t shade_id, const strPositions * p_pos)
+{
+    SST_SHADE_PTR p_shade;
+    bool changed;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, true);
+    if (p_shade != NULL) {
+        changed = (p_shade->pos_msec == 0)
+                || (p_shade->positions.posCount != p_pos->posCount)
+                || (memcmp(p_shade->positions.position, p_pos->position, p_pos->posCount * sizeof(p_pos->position[0])) != 0)
+                || (memcmp(p_shade->positions.posKind, p_pos->posKind, p_pos->posCount * sizeof(p_pos->posKind[0])) != 0);
+        p_shade->positions = *p_pos;
+        p_shade->pos_msec = sst_now();
+        sst_changed(p_shade, changed);
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    SST_UpdateBattery
+* Purpose:      Record the battery voltage a shade reported.
+* Passed:       device id, voltage in 100 millivolt units
+*
+* Returned:     nothing
+* Globals:      SST_Table
+*******************************************************************************/
+void SST_UpdateBattery(uint16_t shade_id, uint8_t voltage)
+{
+    SST_SHADE_PTR p_shade;
+    bool changed;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, true);
+    if (p_shade != NULL) {
+        changed = (p_shade->batt_msec == 0) || (p_shade->batt_voltage != voltage);
+        p_shade->batt_voltage = voltage;
+        p_shade->batt_msec = sst_now();
+        sst_changed(p_shade, changed);
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    SST_UpdateNordicFw
+* Purpose:      Record the radio firmware revision a shade reported.
+* Passed:       device id, SST_FW_LEN bytes of revision
+*
+* Returned:     nothing
+* Globals:      SST_Table
+*******************************************************************************/
+void SST_UpdateNordicFw(uint16_t shade_id, const uint8_t * p_fw)
+{
+    SST_SHADE_PTR p_shade;
+    bool changed;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, true);
+    if (p_shade != NULL) {
+        changed = (p_shade->nordic_fw_msec == 0) || (memcmp(p_shade->nordic_fw, p_fw, SST_FW_LEN) != 0);
+        memcpy(p_shade->nordic_fw, p_fw, SST_FW_LEN);
+        p_shade->nordic_fw_msec = sst_now();
+        sst_changed(p_shade, changed);
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    SST_UpdateMotorFw
+* Purpose:      Record the motor firmware revision a shade reported.
+* Passed:       device id, SST_FW_LEN bytes of revision
+*
+* Returned:     nothing
+* Globals:      SST_Table
+*******************************************************************************/
+void SST_UpdateMotorFw(uint16_t shade_id, const uint8_t * p_fw)
+{
+    SST_SHADE_PTR p_shade;
+    bool changed;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, true);
+    if (p_shade != NULL) {
+        changed = (p_shade->motor_fw_msec == 0) || (memcmp(p_shade->motor_fw, p_fw, SST_FW_LEN) != 0);
+        memcpy(p_shade->motor_fw, p_fw, SST_FW_LEN);
+        p_shade->motor_fw_msec = sst_now();
+        sst_changed(p_shade, changed);
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    SST_Remove
+* Purpose:      Forget a shade.
+* Passed:       device id
+*
+* Returned:     nothing
+* Globals:      SST_Table
+* Notes:        The entries after it in its probe run are moved back so
+*               no lookup stops short at the hole.
+*******************************************************************************/
+void SST_Remove(uint16_t shade_id)
+{
+    SST_SHADE_PTR p_shade;
+    uint16_t hole;
+    uint16_t slot;
+    uint16_t home;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, false);
+    if (p_shade != NULL) {
+        hole = p_shade - SST_Table;
+        slot = hole;
+        while (1) {
+            slot = (slot + 1) & (SST_TABLE_SIZE - 1);
+            if (SST_Table[slot].used == false) {
+                break;
+            }
+            home = sst_home_slot(SST_Table[slot].shade_id);
+            //move it back unless its home lies after the hole, up to slot
+            if (((slot - home) & (SST_TABLE_SIZE - 1)) >= ((slot - hole) & (SST_TABLE_SIZE - 1))) {
+                SST_Table[hole] = SST_Table[slot];
+                hole = slot;
+            }
+        }
+        memset(&SST_Table[hole], 0, sizeof(SST_SHADE));
+        --SST_Stats.shades;
+        SST_RemovedAt = ++SST_VersionCount;
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    SST_Get
+* Purpose:      Copy out one shade's state.
+* Passed:       device id, where to put it
+*
+* Returned:     false if nothing is known of the shade
+* Globals:      SST_Table
+*******************************************************************************/
+bool SST_Get(uint16_t shade_id, SST_SHADE_PTR p_copy)
+{
+    SST_SHADE_PTR p_shade;
+
+    pthread_mutex_lock(&SST_Mutex);
+    p_shade = sst_find(shade_id, false);
+    if (p_shade != NULL) {
+        *p_copy = *p_shade;
+        ++SST_Stats.reads;
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+    return (p_shade != NULL);
+}
+
+/*******************************************************************************
+* Procedure:    SST_Next
+* Purpose:      Walk the table, copying out the shades changed since a
+*               version.
+* Passed:       cursor, 0 to start, which is advanced past the shade
+*               returned; the version of the caller's last snapshot, 0 for
+*               every shade; where to put the shade
+*
+* Returned:     false when there are no more
+* Globals:      SST_Table
+* Notes:        The lock is only held for one call, so a walk sees each
+*               shade as it was when it got to it.  A shade moved back by
+*               SST_Remove during a walk may be missed; SST_RemovedVersion
+*               tells the caller to start over.
+*******************************************************************************/
+bool SST_Next(uint16_t * p_cursor, uint32_t since, SST_SHADE_PTR p_copy)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&SST_Mutex);
+    while (*p_cursor < SST_TABLE_SIZE) {
+        SST_SHADE_PTR p_shade = &SST_Table[(*p_cursor)++];
+        if ((p_shade->used == true) && (p_shade->version > since)) {
+            *p_copy = *p_shade;
+            ++SST_Stats.reads;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&SST_Mutex);
+    return found;
+}
+
+/*******************************************************************************
+* Procedure:    SST_Version
+* Purpose:      Get the version of the table's latest change.
+* Passed:       nothing
+*
+* Returned:     version, 0 if nothing has been recorded
+* Globals:      none
+*******************************************************************************/
+uint32_t SST_Version(void)
+{
+    uint32_t version;
+
+    pthread_mutex_lock(&SST_Mutex);
+    version = SST_VersionCount;
+    pthread_mutex_unlock(&SST_Mutex);
+    return version;
+}
+
+/*******************************************************************************
+* Procedure:    SST_RemovedVersion
+* Purpose:      Get the version at which a shade was last removed.
+* Passed:       nothing
+*
+* Returned:     version, 0 if no shade has been removed
+* Globals:      none
+*******************************************************************************/
+uint32_t SST_RemovedVersion(void)
+{
+    uint32_t version;
+
+    pthread_mutex_lock(&SST_Mutex);
+    version = SST_RemovedAt;
+    pthread_mutex_unlock(&SST_Mutex);
+    return version;
+}
+
+/*******************************************************************************
+* Procedure:    SST_AgeSeconds
+* Purpose:      Determine how long ago a field was heard.
+* Passed:       the field's timestamp
+*
+* Returned:     seconds, 0 for a field never heard
+* Globals:      none
+*******************************************************************************/
+uint32_t SST_AgeSeconds(uint32_t msec)
+{
+    if (msec == 0) {
+        return 0;
+    }
+    return (OS_GetMsecTick() - msec) / 1000;
+}
+
+/*******************************************************************************
+* Procedure:    SST_GetStats
+* Purpose:      Copy out the table's counters.
+* Passed:       where to put them
+*
+* Returned:     nothing
+* Globals:      none
+*******************************************************************************/
+void SST_GetStats(SST_STATS * p_stats)
+{
+    pthread_mutex_lock(&SST_Mutex);
+    *p_stats = SST_Stats;
+    pthread_mutex_unlock(&SST_Mutex);
+}
+
+/*******************************************************************************
+* Procedure:    sst_home_slot
+* Purpose:      Find the slot a shade's probe starts at.
+* Passed:       device id
+*
+* Returned:     slot
+* Globals:      none
+*******************************************************************************/
+static uint16_t sst_home_slot(uint16_t shade_id)
+{
+    return (uint16_t)((uint32_t)(shade_id * SST_HASH_MULTIPLIER) >> (32 - SST_TABLE_BITS));
+}
+
+/*******************************************************************************
+* Procedure:    sst_find
+* Purpose:      Look up a shade, optionally adding it.
+* Passed:       device id, whether to add it when it is not there
+*
+* Returned:     the shade's entry, NULL if not there or the table is full
+* Globals:      SST_Table
+* Notes:        Called with SST_Mutex held.
+*******************************************************************************/
+static SST_SHADE_PTR sst_find(uint16_t shade_id, bool create)
+{
+    uint16_t slot = sst_home_slot(shade_id);
+    SST_SHADE_PTR p_shade = &SST_Table[slot];
+
+    //the table is never more than half full so an empty slot is always found
+    while (p_shade->used == true) {
+        if (p_shade->shade_id == shade_id) {
+            return p_shade;
+        }
+        slot = (slot + 1) & (SST_TABLE_SIZE - 1);
+        p_shade = &SST_Table[slot];
+    }
+    if (create == false) {
+        return NULL;
+    }
+    if (SST_Stats.shades == ItsMaxShadeCount_) {
+        ++SST_Stats.full;
+        return NULL;
+    }
+    memset(p_shade, 0, sizeof(SST_SHADE));
+    p_shade->used = true;
+    p_shade->shade_id = shade_id;
+    ++SST_Stats.shades;
+    return p_shade;
+}
+
+/*******************************************************************************
+* Procedure:    sst_now
+* Purpose:      Get a timestamp for a field.
+* Passed:       nothing
+*
+* Returned:     OS_GetMsecTick, never 0 since that means never heard
+* Globals:      none
+*******************************************************************************/
+static uint32_t sst_now(void)
+{
+    uint32_t now = OS_GetMsecTick();
+
+    return (now == 0) ? 1 : now;
+}
+
+/*******************************************************************************
+* Procedure:    sst_changed
+* Purpose:      Count an update and stamp the shade if it changed anything.
+* Passed:       the shade's entry, whether a field changed
+*
+* Returned:     nothing
+* Globals:      none
+* Notes:        Called with SST_Mutex held.
+*******************************************************************************/
+static void sst_changed(SST_SHADE_PTR p_shade, bool changed)
+{
+    if (changed == true) {
+        p_shade->version = ++SST_VersionCount;
+        ++SST_Stats.updates;
+    }
+    else {
+        ++SST_Stats.unchanged;
+    }
+}
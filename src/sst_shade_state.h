@@ -0,0 +1,56 @@
+/***************************************************************************//**
+ * @file sst_shade_state.h
+ * @brief Include file for sst_shade_state.c
+ *
+ ******************************************************************************/
+#ifndef __SST_SHADE_STATE_H
+#define __SST_SHADE_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rf_serial_api.h"
+
+//twice the most shades a hub handles, so probes stay short
+#define SST_TABLE_BITS      9
+#define SST_TABLE_SIZE      (1 << SST_TABLE_BITS)
+#define SST_FW_LEN          4
+
+typedef struct SST_SHADE_TAG
+{
+    uint16_t shade_id;
+    bool used;
+    uint8_t batt_voltage;       //100 millivolt units
+    uint32_t version;           //SST_Version when last changed
+    //OS_GetMsecTick when each field was last heard, 0 if never
+    uint32_t pos_msec;
+    uint32_t batt_msec;
+    uint32_t nordic_fw_msec;
+    uint32_t motor_fw_msec;
+    strPositions positions;
+    uint8_t nordic_fw[SST_FW_LEN];
+    uint8_t motor_fw[SST_FW_LEN];
+} SST_SHADE, *SST_SHADE_PTR;
+
+typedef struct SST_STATS_TAG
+{
+    uint16_t shades;            //in the table now
+    uint32_t updates;           //indications that changed a field
+    uint32_t unchanged;         //indications that only refreshed a timestamp
+    uint32_t full;              //refused because ItsMaxShadeCount_ were held
+    uint32_t reads;             //shades copied out
+} SST_STATS;
+
+//public function prototypes:
+void SST_UpdatePositions(uint16_t shade_id, const strPositions * p_pos);
+void SST_UpdateBattery(uint16_t shade_id, uint8_t voltage);
+void SST_UpdateNordicFw(uint16_t shade_id, const uint8_t * p_fw);
+void SST_UpdateMotorFw(uint16_t shade_id, const uint8_t * p_fw);
+void SST_Remove(uint16_t shade_id);
+bool SST_Get(uint16_t shade_id, SST_SHADE_PTR p_copy);
+bool SST_Next(uint16_t * p_cursor, uint32_t since, SST_SHADE_PTR p_copy);
+uint32_t SST_Version(void);
+uint32_t SST_RemovedVersion(void);
+uint32_t SST_AgeSeconds(uint32_t msec);
+void SST_GetStats(SST_STATS * p_stats);
+
+#endif
@@ -13,7 +13,7 @@ float longitude = -105;
 //float latitude = 31.228611;
 //float longitude = 121.474722;
 
-MUTEX_STRUCT flashDeviceMutex = {0};
+MUTEX_STRUCT flashDeviceMutex = {PTHREAD_MUTEX_INITIALIZER};
 uint16_t RMT_TimeServerTokenSeconds = NULL_TOKEN;
 bool flashDataNeedsWritten = false;
 bool flashVectorNeedsWritten = false;
@@ -262,7 +262,21 @@ void RDS_TriggerRemoteSync(uint16_t token)
 
 uint8_t _mutex_try_lock(MUTEX_STRUCT * mutex)
 {
-    return MQX_EOK;
+    return (pthread_mutex_trylock(&mutex->mutex) == 0) ? MQX_EOK : 1;
+}
+
+//wait up to msec for the mutex, MQX_EOK once it is held
+uint8_t _mutex_lock_timed(MUTEX_STRUCT * mutex, uint32_t msec)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += msec / 1000;
+    deadline.tv_nsec += (msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return (pthread_mutex_timedlock(&mutex->mutex, &deadline) == 0) ? MQX_EOK : 1;
 }
 
 void RMT_SetPin(char * p_pin)
@@ -335,6 +349,7 @@ void setLocalTimeOffset(int32_t time_offset)
 
 void _mutex_unlock(MUTEX_STRUCT * mutex)
 {
+    pthread_mutex_unlock(&mutex->mutex);
 }
 
 uint32_t RFS_ReportFaults(uint16_t total)
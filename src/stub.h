@@ -144,10 +144,11 @@ main (void)
   return 0;
 }
 */
+#include <pthread.h>
 #include "rf_serial_api.h"
 
 typedef struct {
-    uint8_t unused;
+    pthread_mutex_t mutex;
 } MUTEX_STRUCT;
 
 typedef enum httpsrv_req_method
@@ -216,6 +217,7 @@ bool maintainFlash(uint8_t);
 //void OS_GetTimeLocal(TIME_STRUCT_PTR);
 bool _time_to_date(TIME_STRUCT_PTR t, DATE_STRUCT_PTR d);
 uint8_t _mutex_try_lock(MUTEX_STRUCT * mutex);
+uint8_t _mutex_lock_timed(MUTEX_STRUCT * mutex, uint32_t msec);
 void _mutex_unlock(MUTEX_STRUCT * mutex);
 
 void sendTextMessageToSlaveHubs(char * p_msg);
@@ -0,0 +1,1151 @@
+/***************************************************************************//**
+ * @file nordic_sim.c
+ * @brief Nordic radio simulator for running the hub without RF hardware.
+ *
+ *  Opens a pseudo-terminal and plays the part of the Nordic on the other
+ *  end of it: the 0x7E/0x7D framed serial protocol of rfu_uart.c and
+ *  rfi_inbound.c, the radio start-up sequence of RC_RadioConfig.c and a
+ *  population of shades that answer the requests built by
+ *  SC_LoadNewCommand.  Start it first, then point the hub at the device
+ *  it prints:
+ *
+ *      ./nordic_sim -n 256 -l 50:400 -p 2 &
+ *      HUB_NORDIC_PORT=/dev/pts/3 ./hub
+ *
+ *  Shades answer position ('?Z' with '?P' '?M' '?T' '?B' '?S' '@' 'S'
+ *  sub-commands), move ('R'), scene ('S'), discovery ('C' and the beacon
+ *  request), shade type, firmware, group and debug status queries.  Each
+ *  addressed shade replies after its own random delay; replies share one
+ *  simulated channel so they come out no closer than the air time of a
+ *  packet.  Requests and replies can be dropped at random and the Nordic
+ *  can refuse a transmit with a channel access failure, which exercises
+ *  the retry paths of rfo_outbound.c.  A remote can be made to beacon a
+ *  network ID periodically for testing network join.
+ *
+ *  Counters are printed every few seconds and on exit.
+ *
+ *  Not part of the hub image (excluded from the Eclipse build), build
+ *  on the development host with:
+ *
+ *      gcc -std=gnu99 -O2 -Wall -I../../src -o nordic_sim nordic_sim.c -lpthread
+ *
+ ******************************************************************************/
+
+/* Includes
+*******************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rf_serial_api.h"
+
+/* Local Constants and Definitions
+*******************************************************************************/
+#define SIM_MAX_SHADES          1024
+#define SIM_MAX_SCENES          256
+#define SIM_FRAME_SIZE          ((2 * 255) + 3)     //every byte escaped, plus header, length, checksum
+#define SIM_RAW_SIZE            256
+#define SIM_SHADE_TYPE          6                   //duette
+#define SIM_NORDIC_VERSION      0x01020304
+#define SIM_HUB_UUID            0x00000000484E5553ULL
+#define SIM_REMOTE_DEVICE_ID    0x7E57
+
+#define SIM_STATE_HEADER        0
+#define SIM_STATE_LENGTH        1
+#define SIM_STATE_PAYLOAD       2
+#define SIM_STATE_CHECKSUM      3
+
+typedef struct SIM_SHADE_TAG
+{
+    uint16_t device_id;
+    uint64_t uuid;
+    uint8_t type;
+    uint8_t battery;                        //100 millivolt units
+    int8_t rssi;
+    bool discovered;
+    uint16_t pos[MAX_POSITION_KINDS];       //primary, secondary, tilt
+    uint8_t groups[32];                     //bit per group
+    uint8_t scene_set[SIM_MAX_SCENES / 8];
+    uint16_t scene_pos[SIM_MAX_SCENES][MAX_POSITION_KINDS];
+} SIM_SHADE;
+
+typedef struct SIM_FRAME_TAG
+{
+    uint64_t due_usec;
+    uint32_t order;                         //keeps equal due times in FIFO order
+    uint16_t len;
+    uint8_t data[SIM_FRAME_SIZE];
+} SIM_FRAME;
+
+typedef struct SIM_STATS_TAG
+{
+    uint32_t rx_frames;
+    uint32_t rx_bad_checksum;
+    uint32_t rx_unknown;
+    uint32_t config_requests;
+    uint32_t data_requests;
+    uint32_t beacon_requests;
+    uint32_t group_requests;
+    uint32_t tx_confirmations;
+    uint32_t tx_naks;
+    uint32_t tx_indications;
+    uint32_t tx_beacons;
+    uint32_t lost_requests;
+    uint32_t lost_replies;
+} SIM_STATS;
+
+/* Local variables
+*******************************************************************************/
+static int MasterFd = -1;
+static bool Verbose = false;
+static volatile sig_atomic_t Running = true;
+
+//simulation parameters, set from the command line
+static uint16_t ShadeCount = 200;
+static uint16_t FirstDeviceId = 0x1000;
+static uint32_t ConfirmMsec = 20;
+static uint32_t LatencyMinMsec = 40;
+static uint32_t LatencyMaxMsec = 400;
+static uint32_t AirMsec = 8;
+static uint32_t WindowMsec = 2000;
+static uint32_t LossPercent = 0;
+static uint32_t NakPercent = 0;
+static uint16_t JoinNetworkId = 0;
+static uint32_t BeaconSeconds = 0;
+static uint32_t StatsSeconds = 10;
+
+//radio state as configured by the hub
+static uint16_t NetworkId = FACTORY_DEFAULT_NETWORK_ID;
+static uint16_t HubDeviceId = 0;
+static uint8_t SeqNum;
+
+static SIM_SHADE *Shades;
+static SIM_STATS Stats;
+
+//frames waiting to be written, a min-heap on due time
+static SIM_FRAME *Pending;
+static uint32_t PendingCount;
+static uint32_t PendingSize;
+static uint32_t PendingOrder;
+static uint64_t AirFreeUsec;                //when the simulated channel is next idle
+static pthread_mutex_t PendingMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PendingCond;
+
+/* Local Function Declarations
+*******************************************************************************/
+static uint64_t now_usec(void);
+static uint32_t random_range(uint32_t lo, uint32_t hi);
+static bool roll(uint32_t percent);
+static void queue_raw(const uint8_t *p_raw, uint64_t due_usec);
+static uint64_t reserve_air(uint64_t earliest_usec);
+static void *writer_task(void *param);
+static void process_frame(uint8_t *p_raw);
+static void handle_get_attr(uint8_t *p_raw);
+static void handle_set_attr(uint8_t *p_raw);
+static void handle_shade_data(SHADE_DATA_REQUEST_HEADER_STRUCT_PTR p_req);
+static void handle_beacon(BEACON_REQUEST_HEADER_STRUCT_PTR p_req);
+static void handle_group_set(GROUP_SET_REQUEST_HEADER_STRUCT_PTR p_req);
+static bool shade_is_addressed(SIM_SHADE *p_shade, uint8_t mode, P3_Address_Internal_Type *p_adr);
+static int kind_index(uint8_t kind);
+static uint8_t shade_respond(SIM_SHADE *p_shade, uint8_t *p_msg, uint8_t len, uint8_t *p_reply);
+static void send_confirmation(uint8_t type, uint8_t status, int16_t handle, uint64_t due_usec);
+static void send_shade_indication(SIM_SHADE *p_shade, uint8_t *p_payload, uint8_t len, uint64_t due_usec);
+static void send_beacon_indication(uint16_t network_id, uint16_t device_id, uint64_t uuid,
+                                   int16_t dev_type, int8_t rssi, uint64_t due_usec);
+static void print_stats(void);
+
+/*****************************************************************************//**
+* @brief Current time on the monotonic clock.
+*
+* @return microseconds.
+*******************************************************************************/
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*****************************************************************************//**
+* @brief Pick a number in the range lo to hi inclusive.
+*
+* @return the number.
+*******************************************************************************/
+static uint32_t random_range(uint32_t lo, uint32_t hi)
+{
+    if (hi <= lo) {
+        return lo;
+    }
+    return lo + (uint32_t)(random() % (hi - lo + 1));
+}
+
+/*****************************************************************************//**
+* @brief Decide whether something with the given chance happens.
+*
+* @param percent is the chance, 0 to 100.
+* @return true if it happens.
+*******************************************************************************/
+static bool roll(uint32_t percent)
+{
+    return (percent != 0) && ((uint32_t)(random() % 100) < percent);
+}
+
+/*****************************************************************************//**
+* @brief Add the transport layer to a raw message and queue it for writing.
+*   Mirrors RNC_AddTransportLayer: 0x7E and 0x7D are sent as 0x7D followed
+*   by the byte with bit 6 cleared, the length counts the escape bytes and
+*   the checksum is the sum of the bytes as sent.
+*
+* @param p_raw is the message starting with its length byte.
+* @param due_usec is when the frame should be written.
+* @return nothing.
+*******************************************************************************/
+static void queue_raw(const uint8_t *p_raw, uint64_t due_usec)
+{
+    SIM_FRAME frame;
+    uint16_t n;
+    uint16_t i;
+    uint16_t parent;
+    uint8_t chksum = 0;
+
+    frame.len = 2;
+    for (n = 1; n <= p_raw[0]; ++n) {
+        if ((p_raw[n] == START_OF_HEADER) || (p_raw[n] == ESCAPE_TOKEN)) {
+            frame.data[frame.len++] = ESCAPE_TOKEN;
+            chksum += ESCAPE_TOKEN;
+            frame.data[frame.len++] = p_raw[n] & 0xbf;
+            chksum += p_raw[n] & 0xbf;
+        }
+        else {
+            frame.data[frame.len++] = p_raw[n];
+            chksum += p_raw[n];
+        }
+    }
+    frame.data[0] = START_OF_HEADER;
+    frame.data[1] = (uint8_t)(frame.len - 2);
+    frame.data[frame.len++] = chksum;
+    frame.due_usec = due_usec;
+
+    pthread_mutex_lock(&PendingMutex);
+    frame.order = PendingOrder++;
+    if (PendingCount == PendingSize) {
+        PendingSize = (PendingSize == 0) ? 64 : (PendingSize * 2);
+        Pending = realloc(Pending, PendingSize * sizeof(SIM_FRAME));
+        if (Pending == NULL) {
+            fprintf(stderr, "nordic_sim: out of memory\n");
+            exit(1);
+        }
+    }
+    i = PendingCount++;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if ((Pending[parent].due_usec < frame.due_usec)
+                || ((Pending[parent].due_usec == frame.due_usec) && (Pending[parent].order < frame.order))) {
+            break;
+        }
+        Pending[i] = Pending[parent];
+        i = parent;
+    }
+    Pending[i] = frame;
+    pthread_cond_signal(&PendingCond);
+    pthread_mutex_unlock(&PendingMutex);
+}
+
+/*****************************************************************************//**
+* @brief Claim the simulated RF channel for one packet.
+*
+* @param earliest_usec is the soonest the packet could go out.
+* @return when it actually goes out, after any packet already on the air.
+*******************************************************************************/
+static uint64_t reserve_air(uint64_t earliest_usec)
+{
+    uint64_t start;
+
+    pthread_mutex_lock(&PendingMutex);
+    start = (earliest_usec > AirFreeUsec) ? earliest_usec : AirFreeUsec;
+    AirFreeUsec = start + ((uint64_t)AirMsec * 1000);
+    pthread_mutex_unlock(&PendingMutex);
+    return start;
+}
+
+/*****************************************************************************//**
+* @brief Task that writes queued frames to the pty once they are due.
+*
+* @param param is unused.
+* @return nothing.
+*******************************************************************************/
+static void *writer_task(void *param)
+{
+    SIM_FRAME frame;
+    SIM_FRAME last;
+    struct timespec ts;
+    uint64_t now;
+    uint32_t i;
+    uint32_t child;
+    ssize_t done;
+    ssize_t sent;
+
+    while (1) {
+        pthread_mutex_lock(&PendingMutex);
+        while (1) {
+            now = now_usec();
+            if ((PendingCount != 0) && (Pending[0].due_usec <= now)) {
+                break;
+            }
+            if (PendingCount == 0) {
+                pthread_cond_wait(&PendingCond, &PendingMutex);
+            }
+            else {
+                ts.tv_sec = Pending[0].due_usec / 1000000;
+                ts.tv_nsec = (Pending[0].due_usec % 1000000) * 1000;
+                pthread_cond_timedwait(&PendingCond, &PendingMutex, &ts);
+            }
+        }
+        frame = Pending[0];
+        last = Pending[--PendingCount];
+        i = 0;
+        while ((child = (2 * i) + 1) < PendingCount) {
+            if ((child + 1 < PendingCount)
+                    && ((Pending[child + 1].due_usec < Pending[child].due_usec)
+                    || ((Pending[child + 1].due_usec == Pending[child].due_usec)
+                        && (Pending[child + 1].order < Pending[child].order)))) {
+                ++child;
+            }
+            if ((last.due_usec < Pending[child].due_usec)
+                    || ((last.due_usec == Pending[child].due_usec) && (last.order < Pending[child].order))) {
+                break;
+            }
+            Pending[i] = Pending[child];
+            i = child;
+        }
+        Pending[i] = last;
+        pthread_mutex_unlock(&PendingMutex);
+
+        if (Verbose == true) {
+            printf("TX:");
+            for (i = 0; i < frame.len; ++i) {
+                printf(" %02X", frame.data[i]);
+            }
+            printf("\n");
+        }
+        for (done = 0; done < frame.len; done += sent) {
+            sent = write(MasterFd, &frame.data[done], frame.len - done);
+            if (sent < 0) {
+                if (errno != EINTR) {
+                    break;
+                }
+                sent = 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************//**
+* @brief Send a Nordic confirmation.
+*
+* @param type is the confirmation message type.
+* @param status is the result code.
+* @param handle is the transmit handle to echo, or -1 if the message has none.
+* @param due_usec is when to send it.
+* @return nothing.
+*******************************************************************************/
+static void send_confirmation(uint8_t type, uint8_t status, int16_t handle, uint64_t due_usec)
+{
+    uint8_t raw[4];
+
+    raw[0] = 2;
+    raw[1] = type;
+    raw[2] = status;
+    if (handle >= 0) {
+        raw[0] = 3;
+        raw[3] = (uint8_t)handle;
+    }
+    queue_raw(raw, due_usec);
+    Stats.tx_confirmations++;
+    if (status != SC_RSLT_SUCCESS) {
+        Stats.tx_naks++;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Send a shade data indication carrying a shade's reply.
+*
+* @param p_shade is the shade replying.
+* @param p_payload and len are the reply.
+* @param due_usec is when to send it.
+* @return nothing.
+*******************************************************************************/
+static void send_shade_indication(SIM_SHADE *p_shade, uint8_t *p_payload, uint8_t len, uint64_t due_usec)
+{
+    uint8_t raw[SIM_RAW_SIZE];
+    SHADE_DATA_INDICATION_STRUCT_PTR p_ind = (SHADE_DATA_INDICATION_STRUCT_PTR)raw;
+
+    memset(raw, 0, sizeof(raw));
+    p_ind->payload_len = SHADE_INDICATION_HEADER_SIZE + len;
+    p_ind->indication_type = MSG_TYPE_SHADE_DATA_INDICATION;
+    p_ind->source_mode = P3_Address_Mode_Device_Id;
+    p_ind->source_adr.Device_Id = p_shade->device_id;
+    p_ind->dest_mode = P3_Address_Mode_Device_Id;
+    p_ind->dest_adr.Device_Id = HubDeviceId;
+    p_ind->seq_num = SeqNum++;
+    p_ind->rssi = (uint8_t)p_shade->rssi;
+    memcpy(p_ind->msg_payload, p_payload, len);
+    queue_raw(raw, due_usec);
+    Stats.tx_indications++;
+}
+
+/*****************************************************************************//**
+* @brief Send a beacon indication.
+*
+* @param network_id, device_id and uuid identify the sender.
+* @param dev_type is the device type reported in the payload, or -1 for none.
+* @param rssi is the received signal strength to report.
+* @param due_usec is when to send it.
+* @return nothing.
+*******************************************************************************/
+static void send_beacon_indication(uint16_t network_id, uint16_t device_id, uint64_t uuid,
+                                   int16_t dev_type, int8_t rssi, uint64_t due_usec)
+{
+    uint8_t raw[SIM_RAW_SIZE];
+    BEACON_INDICATION_STRUCT_PTR p_ind = (BEACON_INDICATION_STRUCT_PTR)raw;
+
+    memset(raw, 0, sizeof(raw));
+    p_ind->payload_len = BEACON_INDICATION_HEADER_SIZE;
+    p_ind->indication_type = MSG_TYPE_BEACON_INDICATION;
+    p_ind->dest_mode = P3_Address_Mode_Device_Id;
+    p_ind->dest_adr.Device_Id = ALL_DEVICES_ADDRESS;
+    p_ind->source_adr.Unique_Id = uuid;
+    p_ind->source_network_id = network_id;
+    p_ind->source_device_id = device_id;
+    p_ind->seq_num = SeqNum++;
+    p_ind->rssi = (uint8_t)rssi;
+    if (dev_type >= 0) {
+        p_ind->msg_payload[0] = (uint8_t)dev_type;
+        p_ind->payload_len++;
+    }
+    queue_raw(raw, due_usec);
+    Stats.tx_beacons++;
+}
+
+/*****************************************************************************//**
+* @brief Check whether a shade is one of the destinations of a request.
+*
+* @param p_shade is the shade.
+* @param mode and p_adr are the destination of the request.
+* @return true if the shade should act on it.
+*******************************************************************************/
+static bool shade_is_addressed(SIM_SHADE *p_shade, uint8_t mode, P3_Address_Internal_Type *p_adr)
+{
+    uint8_t i;
+    uint8_t g;
+
+    switch (mode) {
+        case P3_Address_Mode_None:
+            return true;
+        case P3_Address_Mode_Device_Id:
+            return (p_adr->Device_Id == ALL_DEVICES_ADDRESS) || (p_adr->Device_Id == p_shade->device_id);
+        case P3_Address_Mode_Unique_Id:
+            return p_adr->Unique_Id == p_shade->uuid;
+        case P3_Address_Mode_Group_Id:
+            //a leading zero is the "all" group, otherwise up to 8 groups ending at a zero
+            if (p_adr->Group_Id[0] == 0) {
+                return true;
+            }
+            for (i = 0; (i < MAX_GROUP_LIST_SIZE) && (p_adr->Group_Id[i] != 0); ++i) {
+                g = p_adr->Group_Id[i];
+                if (p_shade->groups[g / 8] & (1 << (g % 8))) {
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Map a position kind letter to an index into the position arrays.
+*
+* @param kind is 'P', 'M' or 'T'.
+* @return the index, or -1 if the letter is not a position kind.
+*******************************************************************************/
+static int kind_index(uint8_t kind)
+{
+    switch (kind) {
+        case 'P':
+            return 0;
+        case 'M':
+            return 1;
+        case 'T':
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Let a shade act on a shade data payload and build its reply.
+*   '?Z' requests carry length-prefixed sub-commands and are answered with
+*   a '!Z' multi-packet, one length-prefixed '!' packet per sub-command,
+*   which is what sc_indication_multi_packet takes apart.
+*
+* @param p_shade is the shade.
+* @param p_msg and len are the payload as sent by SC_LoadNewCommand.
+* @param p_reply is filled in with the reply payload.
+* @return the length of the reply, 0 if the shade stays quiet.
+*******************************************************************************/
+static uint8_t shade_respond(SIM_SHADE *p_shade, uint8_t *p_msg, uint8_t len, uint8_t *p_reply)
+{
+    uint8_t out = 0;
+    uint8_t i;
+    uint8_t sub_len;
+    uint8_t *p_sub;
+    uint8_t scene;
+    int k;
+
+    if (len < 2) {
+        return 0;
+    }
+    switch (p_msg[0]) {
+        case '?':
+            if (p_msg[1] == 'Z') {
+                p_reply[out++] = '!';
+                p_reply[out++] = 'Z';
+                for (i = 2; (i < len) && (p_msg[i] != 0) && ((i + p_msg[i]) < len); i += p_msg[i] + 1) {
+                    sub_len = p_msg[i];
+                    p_sub = &p_msg[i + 1];
+                    if (out + 7 > MAX_INDICATION_PAYLOAD_SIZE) {
+                        break;
+                    }
+                    if ((p_sub[0] == '?') && (p_sub[1] == 'B')) {
+                        p_reply[out++] = 3;
+                        p_reply[out++] = '!';
+                        p_reply[out++] = 'B';
+                        p_reply[out++] = p_shade->battery;
+                    }
+                    else if ((p_sub[0] == '?') && (p_sub[1] == 'S') && (sub_len >= 4)
+                                && ((k = kind_index(p_sub[2])) >= 0)) {
+                        scene = p_sub[3];
+                        p_reply[out++] = 6;
+                        p_reply[out++] = '!';
+                        p_reply[out++] = 'S';
+                        if (p_shade->scene_set[scene / 8] & (1 << (scene % 8))) {
+                            p_reply[out++] = p_sub[2];
+                            p_reply[out++] = scene;
+                            p_reply[out++] = (uint8_t)(p_shade->scene_pos[scene][k] & 0xff);
+                            p_reply[out++] = (uint8_t)(p_shade->scene_pos[scene][k] >> 8);
+                        }
+                        else {
+                            p_reply[out++] = 'E';
+                            p_reply[out++] = scene;
+                            p_reply[out++] = 0;
+                            p_reply[out++] = 0;
+                        }
+                    }
+                    else if ((p_sub[0] == '?') && ((k = kind_index(p_sub[1])) >= 0)) {
+                        p_reply[out++] = 4;
+                        p_reply[out++] = '!';
+                        p_reply[out++] = p_sub[1];
+                        p_reply[out++] = (uint8_t)(p_shade->pos[k] & 0xff);
+                        p_reply[out++] = (uint8_t)(p_shade->pos[k] >> 8);
+                    }
+                    else if ((p_sub[0] == '@') && (sub_len >= 4) && ((k = kind_index(p_sub[1])) >= 0)) {
+                        p_shade->pos[k] = (uint16_t)p_sub[2] + (256 * (uint16_t)p_sub[3]);
+                        p_reply[out++] = 4;
+                        p_reply[out++] = '!';
+                        p_reply[out++] = p_sub[1];
+                        p_reply[out++] = p_sub[2];
+                        p_reply[out++] = p_sub[3];
+                    }
+                    else if ((p_sub[0] == 'S') && (sub_len >= 5) && ((k = kind_index(p_sub[1])) >= 0)) {
+                        scene = p_sub[2];
+                        p_shade->scene_pos[scene][k] = (uint16_t)p_sub[3] + (256 * (uint16_t)p_sub[4]);
+                        p_shade->scene_set[scene / 8] |= (1 << (scene % 8));
+                        p_reply[out++] = 6;
+                        p_reply[out++] = '!';
+                        p_reply[out++] = 'S';
+                        p_reply[out++] = p_sub[1];
+                        p_reply[out++] = scene;
+                        p_reply[out++] = p_sub[3];
+                        p_reply[out++] = p_sub[4];
+                    }
+                }
+                return (out > 2) ? out : 0;
+            }
+            else if ((p_msg[1] == 'D') && (len >= 3) && (p_msg[2] == 'S')) {
+                p_reply[out++] = '!';
+                p_reply[out++] = 'D';
+                p_reply[out++] = 'S';
+                p_reply[out++] = p_shade->type;
+            }
+            else if ((p_msg[1] == 'F') && (len >= 3) && ((p_msg[2] == 'N') || (p_msg[2] == 'C'))) {
+                p_reply[out++] = '!';
+                p_reply[out++] = 'F';
+                p_reply[out++] = p_msg[2];
+                p_reply[out++] = 1;
+                p_reply[out++] = 2;
+                p_reply[out++] = 3;
+                p_reply[out++] = (p_msg[2] == 'N') ? 4 : 5;
+            }
+            else if (p_msg[1] == 'g') {
+                p_reply[out++] = '!';
+                p_reply[out++] = 'g';
+                memcpy(&p_reply[out], p_shade->groups, sizeof(p_shade->groups));
+                out += sizeof(p_shade->groups);
+            }
+            else if (p_msg[1] == 'X') {
+                p_reply[out++] = '!';
+                p_reply[out++] = 'X';
+                memset(&p_reply[out], 0, 10);
+                out += 10;
+            }
+            break;
+        case 'R':
+            if (p_msg[1] == 'U') {
+                p_shade->pos[0] = 0xffff;
+            }
+            else if (p_msg[1] == 'D') {
+                p_shade->pos[0] = 0;
+            }
+            break;
+        case 'S':
+            scene = (len >= 3) ? p_msg[2] : 0;
+            if (p_msg[1] == 'C') {
+                memcpy(p_shade->scene_pos[scene], p_shade->pos, sizeof(p_shade->pos));
+                p_shade->scene_set[scene / 8] |= (1 << (scene % 8));
+            }
+            else if (p_msg[1] == 'D') {
+                p_shade->scene_set[scene / 8] &= ~(1 << (scene % 8));
+            }
+            else if (p_msg[1] == 'G') {
+                for (i = 2; i < len; ++i) {
+                    scene = p_msg[i];
+                    if (p_shade->scene_set[scene / 8] & (1 << (scene % 8))) {
+                        memcpy(p_shade->pos, p_shade->scene_pos[scene], sizeof(p_shade->pos));
+                    }
+                }
+            }
+            break;
+        case 'C':
+            if (p_msg[1] == 'D') {
+                p_shade->discovered = true;
+            }
+            break;
+        case '@':
+            if ((p_msg[1] == 'r') && (len >= 4)) {
+                if (p_msg[2] & SR_CLEAR_DISCOVERED_FLAG) {
+                    p_shade->discovered = false;
+                }
+                if (p_msg[3] & (SR_DELETE_SCENES >> 8)) {
+                    memset(p_shade->scene_set, 0, sizeof(p_shade->scene_set));
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return out;
+}
+
+/*****************************************************************************//**
+* @brief Handle a shade data request: confirm it, then have every shade that
+*   hears it act on it and reply after its own delay.  Discovery requests
+*   are answered with beacon indications.
+*
+* @param p_req is the request.
+* @return nothing.
+*******************************************************************************/
+static void handle_shade_data(SHADE_DATA_REQUEST_HEADER_STRUCT_PTR p_req)
+{
+    uint8_t *p_msg = (uint8_t *)p_req + sizeof(SHADE_DATA_REQUEST_HEADER_STRUCT);
+    uint8_t len = p_req->length - SHADE_DATA_REQUEST_HDR_SIZE;
+    uint8_t reply[SIM_RAW_SIZE];
+    uint8_t reply_len;
+    uint64_t sent_usec = now_usec() + ((uint64_t)ConfirmMsec * 1000);
+    bool discover;
+    uint16_t n;
+
+    Stats.data_requests++;
+    if (roll(NakPercent) == true) {
+        send_confirmation(MSG_TYPE_SEND_SHADE_DATA_CONF, SC_RSLT_CHAN_ACCESS_FAIL, p_req->tx_handle, sent_usec);
+        return;
+    }
+    send_confirmation(MSG_TYPE_SEND_SHADE_DATA_CONF, SC_RSLT_SUCCESS, p_req->tx_handle, sent_usec);
+
+    discover = (len >= 2) && (p_msg[0] == 'C') && ((p_msg[1] == 'A') || (p_msg[1] == 'F'));
+    for (n = 0; n < ShadeCount; ++n) {
+        if (shade_is_addressed(&Shades[n], p_req->dest_mode, &p_req->dest_adr) == false) {
+            continue;
+        }
+        if (roll(LossPercent) == true) {
+            Stats.lost_requests++;
+            continue;
+        }
+        if (discover == true) {
+            if ((p_msg[1] == 'A') || (Shades[n].discovered == false)) {
+                send_beacon_indication(NetworkId, Shades[n].device_id, Shades[n].uuid, Shades[n].type,
+                                       Shades[n].rssi, reserve_air(sent_usec + (random_range(0, WindowMsec) * 1000ULL)));
+            }
+            continue;
+        }
+        reply_len = shade_respond(&Shades[n], p_msg, len, reply);
+        if (reply_len == 0) {
+            continue;
+        }
+        if (roll(LossPercent) == true) {
+            Stats.lost_replies++;
+            continue;
+        }
+        send_shade_indication(&Shades[n], reply, reply_len,
+                reserve_air(sent_usec + (random_range(LatencyMinMsec, LatencyMaxMsec) * 1000ULL)));
+    }
+}
+
+/*****************************************************************************//**
+* @brief Handle a beacon request.  Shades that have not been discovered
+*   answer within the discovery window.
+*
+* @param p_req is the request.
+* @return nothing.
+*******************************************************************************/
+static void handle_beacon(BEACON_REQUEST_HEADER_STRUCT_PTR p_req)
+{
+    uint64_t sent_usec = now_usec() + ((uint64_t)ConfirmMsec * 1000);
+    uint16_t n;
+
+    Stats.beacon_requests++;
+    send_confirmation(MSG_TYPE_SEND_BEACON_CONF, SC_RSLT_SUCCESS, -1, sent_usec);
+    for (n = 0; n < ShadeCount; ++n) {
+        if (Shades[n].discovered == true) {
+            continue;
+        }
+        if (roll(LossPercent) == true) {
+            Stats.lost_requests++;
+            continue;
+        }
+        send_beacon_indication(NetworkId, Shades[n].device_id, Shades[n].uuid, Shades[n].type,
+                               Shades[n].rssi, reserve_air(sent_usec + (random_range(0, WindowMsec) * 1000ULL)));
+    }
+}
+
+/*****************************************************************************//**
+* @brief Handle a group set request.
+*
+* @param p_req is the request.
+* @return nothing.
+*******************************************************************************/
+static void handle_group_set(GROUP_SET_REQUEST_HEADER_STRUCT_PTR p_req)
+{
+    uint8_t g = p_req->group_id;
+    uint16_t n;
+
+    Stats.group_requests++;
+    for (n = 0; n < ShadeCount; ++n) {
+        if ((shade_is_addressed(&Shades[n], p_req->dest_mode, &p_req->dest_adr) == true)
+                && (roll(LossPercent) == false)) {
+            if (p_req->is_assigned != 0) {
+                Shades[n].groups[g / 8] |= (1 << (g % 8));
+            }
+            else {
+                Shades[n].groups[g / 8] &= ~(1 << (g % 8));
+            }
+        }
+    }
+    send_confirmation(MSG_TYPE_SEND_GROUP_SET_CONF, SC_RSLT_SUCCESS, -1,
+                      now_usec() + ((uint64_t)ConfirmMsec * 1000));
+}
+
+/*****************************************************************************//**
+* @brief Answer a get attribute request.
+*
+* @param p_raw is the request, starting with its length byte.
+* @return nothing.
+*******************************************************************************/
+static void handle_get_attr(uint8_t *p_raw)
+{
+    uint8_t raw[SIM_RAW_SIZE];
+    GET_ATTR_CONFIRMATION_STRUCT_PTR p_conf = (GET_ATTR_CONFIRMATION_STRUCT_PTR)raw;
+    uint8_t size;
+
+    memset(raw, 0, sizeof(raw));
+    p_conf->indication_type = MSG_TYPE_GET_ATTR_CONF;
+    p_conf->status = SC_RSLT_SUCCESS;
+    p_conf->attr_id = p_raw[2];
+    switch (p_raw[2]) {
+        case Attribute_DLL_Unique_Id:
+            p_conf->value.Unique_Id = SIM_HUB_UUID;
+            size = sizeof(p_conf->value.Unique_Id);
+            break;
+        case Attribute_DLL_Network_Id:
+            p_conf->value.Network_Id = NetworkId;
+            size = sizeof(p_conf->value.Network_Id);
+            break;
+        case Attribute_DLL_Device_Id:
+            p_conf->value.Device_Id = HubDeviceId;
+            size = sizeof(p_conf->value.Device_Id);
+            break;
+        default:
+            size = 1;
+            break;
+    }
+    p_conf->payload_len = 3 + size;
+    queue_raw(raw, now_usec() + ((uint64_t)ConfirmMsec * 1000));
+    Stats.tx_confirmations++;
+}
+
+/*****************************************************************************//**
+* @brief Apply a set attribute request and confirm it.
+*
+* @param p_raw is the request, starting with its length byte.
+* @return nothing.
+*******************************************************************************/
+static void handle_set_attr(uint8_t *p_raw)
+{
+    uint8_t raw[4];
+
+    if (p_raw[2] == Attribute_DLL_Network_Id) {
+        NetworkId = (uint16_t)p_raw[3] + (256 * (uint16_t)p_raw[4]);
+        printf("network ID %04X\n", NetworkId);
+    }
+    else if (p_raw[2] == Attribute_DLL_Device_Id) {
+        HubDeviceId = (uint16_t)p_raw[3] + (256 * (uint16_t)p_raw[4]);
+    }
+    raw[0] = 3;
+    raw[1] = MSG_TYPE_SET_ATTR_CONF;
+    raw[2] = SC_RSLT_SUCCESS;
+    raw[3] = p_raw[2];
+    queue_raw(raw, now_usec() + ((uint64_t)ConfirmMsec * 1000));
+    Stats.tx_confirmations++;
+}
+
+/*****************************************************************************//**
+* @brief Act on a frame received from the hub.
+*
+* @param p_raw is the unescaped message, starting with its length byte.
+* @return nothing.
+*******************************************************************************/
+static void process_frame(uint8_t *p_raw)
+{
+    uint8_t raw[8];
+    uint32_t version = SIM_NORDIC_VERSION;
+    uint64_t due_usec = now_usec() + ((uint64_t)ConfirmMsec * 1000);
+
+    Stats.rx_frames++;
+    switch (p_raw[1]) {
+        case MSG_TYPE_RESET_REQ:
+            Stats.config_requests++;
+            send_confirmation(MSG_TYPE_RESET_CONF, SC_RSLT_SUCCESS, -1, due_usec);
+            break;
+        case MSG_TYPE_START_REQ:
+            Stats.config_requests++;
+            send_confirmation(MSG_TYPE_START_CONF, SC_RSLT_SUCCESS, -1, due_usec);
+            printf("radio started\n");
+            break;
+        case MSG_TYPE_GET_ATTR_REQ:
+            Stats.config_requests++;
+            handle_get_attr(p_raw);
+            break;
+        case MSG_TYPE_SET_ATTR_REQ:
+            Stats.config_requests++;
+            handle_set_attr(p_raw);
+            break;
+        case MSG_TYPE_SYSTEM:
+            Stats.config_requests++;
+            if ((p_raw[0] >= 2) && (p_raw[2] == MSG_TYPE_SYSTEM_VERSION)) {
+                raw[0] = 6;
+                raw[1] = MSG_TYPE_SYSTEM_INDICATION;
+                raw[2] = 0x03;          //version indication
+                memcpy(&raw[3], &version, sizeof(version));
+                queue_raw(raw, due_usec);
+            }
+            break;
+        case MSG_TYPE_SEND_SHADE_DATA_REQ:
+            if (p_raw[0] >= SHADE_DATA_REQUEST_HDR_SIZE) {
+                handle_shade_data((SHADE_DATA_REQUEST_HEADER_STRUCT_PTR)p_raw);
+            }
+            break;
+        case MSG_TYPE_SEND_BEACON_REQ:
+            handle_beacon((BEACON_REQUEST_HEADER_STRUCT_PTR)p_raw);
+            break;
+        case MSG_TYPE_SEND_GROUP_SET_REQ:
+            if (p_raw[0] >= GROUP_SET_REQUEST_HDR_SIZE) {
+                handle_group_set((GROUP_SET_REQUEST_HEADER_STRUCT_PTR)p_raw);
+            }
+            break;
+        default:
+            Stats.rx_unknown++;
+            break;
+    }
+}
+
+/*****************************************************************************//**
+* @brief Print the counters.
+*
+* @return nothing.
+*******************************************************************************/
+static void print_stats(void)
+{
+    printf("rx %u frames (%u data, %u beacon, %u group, %u config, %u bad, %u unknown)"
+           "  tx %u conf (%u nak), %u replies, %u beacons  lost %u req, %u reply  queued %u\n",
+           Stats.rx_frames, Stats.data_requests, Stats.beacon_requests, Stats.group_requests,
+           Stats.config_requests, Stats.rx_bad_checksum, Stats.rx_unknown,
+           Stats.tx_confirmations, Stats.tx_naks, Stats.tx_indications, Stats.tx_beacons,
+           Stats.lost_requests, Stats.lost_replies, PendingCount);
+    fflush(stdout);
+}
+
+static void on_signal(int sig)
+{
+    Running = false;
+}
+
+static void usage(void)
+{
+    printf("usage: nordic_sim [options]\n");
+    printf("  -n count     number of shades (default 200, max %d)\n", SIM_MAX_SHADES);
+    printf("  -i id        device ID of the first shade, hex (default 1000)\n");
+    printf("  -c msec      Nordic confirmation delay (default 20)\n");
+    printf("  -l min:max   shade reply delay range in msec (default 40:400)\n");
+    printf("  -a msec      air time of one packet, replies never overlap (default 8)\n");
+    printf("  -w msec      window over which shades answer discovery (default 2000)\n");
+    printf("  -p percent   chance of losing each request and each reply (default 0)\n");
+    printf("  -f percent   chance of a channel access failure on transmit (default 0)\n");
+    printf("  -j netid     have a remote beacon this network ID, hex\n");
+    printf("  -b seconds   interval of the remote beacon (default 5 with -j)\n");
+    printf("  -s seconds   interval between counter printouts, 0 for none (default 10)\n");
+    printf("  -L path      also make path a symlink to the pty\n");
+    printf("  -r seed      random seed\n");
+    printf("  -v           print every frame\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t buf[256];
+    uint8_t raw[SIM_RAW_SIZE];
+    uint8_t state = SIM_STATE_HEADER;
+    uint8_t chksum = 0;
+    uint16_t length = 0;
+    uint16_t index = 0;
+    bool escape = false;
+    char *link_path = NULL;
+    char *slave_name;
+    int slave_fd;
+    int opt;
+    ssize_t got;
+    ssize_t i;
+    uint16_t n;
+    uint64_t now;
+    uint64_t next_beacon = 0;
+    uint64_t next_stats = 0;
+    struct termios tty;
+    pthread_condattr_t cond_attr;
+    pthread_t writer;
+    unsigned int seed = (unsigned int)time(NULL);
+
+    while ((opt = getopt(argc, argv, "n:i:c:l:a:w:p:f:j:b:s:L:r:vh")) != -1) {
+        switch (opt) {
+            case 'n':
+                ShadeCount = (uint16_t)atoi(optarg);
+                if (ShadeCount > SIM_MAX_SHADES) {
+                    ShadeCount = SIM_MAX_SHADES;
+                }
+                break;
+            case 'i':
+                FirstDeviceId = (uint16_t)strtoul(optarg, NULL, 16);
+                break;
+            case 'c':
+                ConfirmMsec = (uint32_t)atoi(optarg);
+                break;
+            case 'l':
+                if (sscanf(optarg, "%u:%u", &LatencyMinMsec, &LatencyMaxMsec) == 1) {
+                    LatencyMaxMsec = LatencyMinMsec;
+                }
+                break;
+            case 'a':
+                AirMsec = (uint32_t)atoi(optarg);
+                break;
+            case 'w':
+                WindowMsec = (uint32_t)atoi(optarg);
+                break;
+            case 'p':
+                LossPercent = (uint32_t)atoi(optarg);
+                break;
+            case 'f':
+                NakPercent = (uint32_t)atoi(optarg);
+                break;
+            case 'j':
+                JoinNetworkId = (uint16_t)strtoul(optarg, NULL, 16);
+                if (BeaconSeconds == 0) {
+                    BeaconSeconds = 5;
+                }
+                break;
+            case 'b':
+                BeaconSeconds = (uint32_t)atoi(optarg);
+                break;
+            case 's':
+                StatsSeconds = (uint32_t)atoi(optarg);
+                break;
+            case 'L':
+                link_path = optarg;
+                break;
+            case 'r':
+                seed = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                Verbose = true;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    srandom(seed);
+
+    Shades = calloc(SIM_MAX_SHADES, sizeof(SIM_SHADE));
+    if (Shades == NULL) {
+        fprintf(stderr, "nordic_sim: out of memory\n");
+        return 1;
+    }
+    for (n = 0; n < ShadeCount; ++n) {
+        Shades[n].device_id = FirstDeviceId + n;
+        Shades[n].uuid = 0x0001000000000000ULL | ((uint64_t)random() << 16) | Shades[n].device_id;
+        Shades[n].type = SIM_SHADE_TYPE;
+        Shades[n].battery = (uint8_t)random_range(140, 170);
+        Shades[n].rssi = -(int8_t)random_range(40, 90);
+        Shades[n].pos[0] = (uint16_t)random();
+    }
+
+    MasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((MasterFd < 0) || (grantpt(MasterFd) != 0) || (unlockpt(MasterFd) != 0)
+            || ((slave_name = ptsname(MasterFd)) == NULL)) {
+        perror("nordic_sim: pty");
+        return 1;
+    }
+    //raw, so nothing the hub sends is echoed back or translated
+    tcgetattr(MasterFd, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(MasterFd, TCSANOW, &tty);
+    //hold the slave open so reads don't fail while the hub is not attached
+    slave_fd = open(slave_name, O_RDWR | O_NOCTTY);
+    if (link_path != NULL) {
+        unlink(link_path);
+        if (symlink(slave_name, link_path) != 0) {
+            perror("nordic_sim: symlink");
+        }
+    }
+    printf("nordic_sim: %u shades %04X-%04X on %s\n", ShadeCount, FirstDeviceId,
+           (uint16_t)(FirstDeviceId + ShadeCount - 1), slave_name);
+    printf("start the hub with HUB_NORDIC_PORT=%s\n", (link_path != NULL) ? link_path : slave_name);
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&PendingCond, &cond_attr);
+    pthread_create(&writer, NULL, writer_task, NULL);
+
+    while (Running) {
+        struct timeval tv = { 0, 100000 };
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(MasterFd, &rd);
+        got = 0;
+        if (select(MasterFd + 1, &rd, NULL, NULL, &tv) > 0) {
+            got = read(MasterFd, buf, sizeof(buf));
+            if ((got < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EIO)) {
+                perror("nordic_sim: read");
+                break;
+            }
+        }
+        //same state machine as rfi_inbound.c
+        for (i = 0; i < got; ++i) {
+            switch (state) {
+                case SIM_STATE_HEADER:
+                    if (buf[i] == START_OF_HEADER) {
+                        state = SIM_STATE_LENGTH;
+                    }
+                    break;
+                case SIM_STATE_LENGTH:
+                    length = buf[i];
+                    raw[0] = 0;
+                    index = 0;
+                    chksum = 0;
+                    escape = false;
+                    state = (length == 0) ? SIM_STATE_CHECKSUM : SIM_STATE_PAYLOAD;
+                    break;
+                case SIM_STATE_PAYLOAD:
+                    chksum += buf[i];
+                    if (buf[i] == START_OF_HEADER) {
+                        state = SIM_STATE_LENGTH;
+                    }
+                    else if (buf[i] == ESCAPE_TOKEN) {
+                        escape = true;
+                        --length;
+                    }
+                    else {
+                        raw[1 + index++] = (escape == true) ? (buf[i] | 0x40) : buf[i];
+                        escape = false;
+                        if (index >= length) {
+                            state = SIM_STATE_CHECKSUM;
+                        }
+                    }
+                    break;
+                case SIM_STATE_CHECKSUM:
+                    if (buf[i] == chksum) {
+                        raw[0] = (uint8_t)index;
+                        if (Verbose == true) {
+                            printf("RX:");
+                            for (n = 0; n <= index; ++n) {
+                                printf(" %02X", raw[n]);
+                            }
+                            printf("\n");
+                        }
+                        if (index >= 1) {
+                            process_frame(raw);
+                        }
+                    }
+                    else {
+                        Stats.rx_bad_checksum++;
+                    }
+                    state = SIM_STATE_HEADER;
+                    break;
+                default:
+                    state = SIM_STATE_HEADER;
+                    break;
+            }
+        }
+
+        now = now_usec();
+        if ((JoinNetworkId != 0) && (BeaconSeconds != 0) && (now >= next_beacon)) {
+            //header only, so a discovery in progress does not take the remote for a shade
+            send_beacon_indication(JoinNetworkId, SIM_REMOTE_DEVICE_ID, 0x0002000000000000ULL | SIM_REMOTE_DEVICE_ID,
+                                   -1, -50, reserve_air(now));
+            next_beacon = now + ((uint64_t)BeaconSeconds * 1000000);
+        }
+        if ((StatsSeconds != 0) && (now >= next_stats)) {
+            if (next_stats != 0) {
+                print_stats();
+            }
+            next_stats = now + ((uint64_t)StatsSeconds * 1000000);
+        }
+    }
+    print_stats();
+    if (link_path != NULL) {
+        unlink(link_path);
+    }
+    close(slave_fd);
+    return 0;
+}